@@ -0,0 +1,232 @@
+#ifndef ODBXUV_AGGREGATE_H
+#define ODBXUV_AGGREGATE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+    /**
+     * \file odbxuv/aggregate.h
+     * Aggregates the rows of a query on the worker as they are fetched.
+     * Only the aggregate rows reach the loop, once the query finished.
+     *
+     * A grouping aggregate keeps one entry per distinct combination of its group columns
+     * and delivers rows of the group values followed by one value per aggregate function.
+     * A top aggregate keeps the \p limit rows with the highest or lowest value of a column
+     * and delivers them best first, with the columns of the result.
+     * Values are read as numbers with strtod, values that are not numbers count as NULL.
+     * Sums and averages are doubles, the aggregates of a group without values are NULL.
+     */
+
+    #include <limits.h>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include "odbxuv/db.h"
+
+    typedef struct odbxuv_aggregate_s odbxuv_aggregate_t;
+
+    /**
+     * \defgroup aggregate Odbxuv worker side aggregation
+     * \{
+     */
+
+    /**
+     * The column of ::ODBXUV_AGGREGATE_COUNT that counts every row
+     */
+    #define ODBXUV_AGGREGATE_ALL UINT_MAX
+
+    /**
+     * An aggregate function of a grouping aggregate
+     */
+    typedef enum odbxuv_aggregate_function_enum
+    {
+        /**
+         * The amount of values that are not NULL, or of rows for ::ODBXUV_AGGREGATE_ALL
+         */
+        ODBXUV_AGGREGATE_COUNT = 0,
+
+        /**
+         * Exact while all values are integers and the sum fits 64 bits, a double otherwise.
+         * The same holds for the integer part of ::ODBXUV_AGGREGATE_AVG.
+         */
+        ODBXUV_AGGREGATE_SUM,
+        ODBXUV_AGGREGATE_MIN,
+        ODBXUV_AGGREGATE_MAX,
+        ODBXUV_AGGREGATE_AVG
+    } odbxuv_aggregate_function_e;
+
+    /**
+     * What an aggregate keeps
+     */
+    typedef enum odbxuv_aggregate_mode_enum
+    {
+        ODBXUV_AGGREGATE_GROUP = 0,
+        ODBXUV_AGGREGATE_TOP
+    } odbxuv_aggregate_mode_e;
+
+    /**
+     * An output column of a grouping aggregate
+     */
+    typedef struct odbxuv_aggregate_column_s
+    {
+        odbxuv_aggregate_function_e function;
+
+        /**
+         * The index of the column in the result
+         */
+        unsigned int column;
+    } odbxuv_aggregate_column_t;
+
+    /**
+     * A group of a grouping aggregate or a row of a top aggregate
+     * \private
+     */
+    typedef struct odbxuv_aggregate_entry_s odbxuv_aggregate_entry_t;
+
+    /**
+     * Set \p aggregate of the ::odbxuv_query_config_t of one query at a time.
+     * The fetch callback receives the aggregate rows as if they were the result,
+     * the \p columns of a grouping query are NULL.
+     * The entries are not counted in the memory of the query, see \p size.
+     */
+    struct odbxuv_aggregate_s
+    {
+        /**
+         * Userdata
+         * \public
+         */
+        void *data;
+
+        /**
+         * \note Read only, set by ::odbxuv_aggregate_group_init or ::odbxuv_aggregate_top_init
+         */
+        odbxuv_aggregate_mode_e mode;
+
+        /**
+         * The columns the rows are grouped by, may be empty to aggregate all rows into one
+         * \note Read only
+         */
+        unsigned int *groupColumns;
+        unsigned int groupCount;
+
+        /**
+         * The aggregate functions
+         * \note Read only
+         */
+        odbxuv_aggregate_column_t *functions;
+        unsigned int functionCount;
+
+        /**
+         * The column a top aggregate orders by, the amount of rows it keeps
+         * and whether it keeps the highest values
+         * \note Read only
+         */
+        unsigned int orderColumn;
+        unsigned int limit;
+        unsigned char descending;
+
+        /**
+         * The amount of columns of an aggregate row, \p groupCount + \p functionCount when grouping
+         * and the amount of columns of the result for a top aggregate
+         * \note Read only
+         */
+        unsigned int columnCount;
+
+        /**
+         * The amount of groups or kept rows
+         * \note Read only
+         */
+        unsigned int resultCount;
+
+        /**
+         * The bytes taken by the entries
+         * \note Read only
+         */
+        size_t size;
+
+        /**
+         * Hash table of the groups, \p bucketCount is a power of two
+         * \private
+         */
+        odbxuv_aggregate_entry_t **buckets;
+        unsigned int bucketCount;
+
+        /**
+         * The groups in the order they were found, the heap of the kept rows of a top aggregate
+         * \private
+         */
+        odbxuv_aggregate_entry_t **entries;
+        unsigned int entryCount;
+        unsigned int entryCapacity;
+
+        /**
+         * The group values of the row being added
+         * \private
+         */
+        unsigned char *key;
+        size_t keyCapacity;
+
+        /**
+         * Values of the row being added by the worker
+         * \private
+         */
+        const char **values;
+        unsigned long *lengths;
+        unsigned int valueCapacity;
+    };
+
+    /**
+     * Prepares an aggregate grouping by \p groupCount columns, computing \p count functions per group.
+     * \public
+     */
+    int odbxuv_aggregate_group_init(odbxuv_aggregate_t *aggregate, const unsigned int *groupColumns, unsigned int groupCount, const odbxuv_aggregate_column_t *functions, unsigned int count);
+
+    /**
+     * Prepares an aggregate keeping the \p limit rows with the lowest, or with \p descending the highest, value of \p column.
+     * Rows whose value is NULL are skipped.
+     * \public
+     */
+    int odbxuv_aggregate_top_init(odbxuv_aggregate_t *aggregate, unsigned int column, unsigned int limit, unsigned char descending);
+
+    /**
+     * Frees the entries of an aggregate whose query finished.
+     * \public
+     */
+    void odbxuv_aggregate_free(odbxuv_aggregate_t *aggregate);
+
+    /**
+     * Drops the entries so the aggregate can be used again, called by ::odbxuv_query_ex.
+     * \public
+     */
+    void odbxuv_aggregate_reset(odbxuv_aggregate_t *aggregate);
+
+    /**
+     * Adds a row of \p columnCount zero terminated values, a \p NULL value is NULL.
+     * \p lengths may be \p NULL, the values are measured then.
+     * Returns -1 when the aggregate uses a column the row does not have.
+     * \public
+     */
+    int odbxuv_aggregate_add(odbxuv_aggregate_t *aggregate, unsigned int columnCount, const char **values, const unsigned long *lengths);
+
+    /**
+     * Orders the kept rows after the last row was added and sets \p resultCount.
+     * \public
+     */
+    void odbxuv_aggregate_finish(odbxuv_aggregate_t *aggregate);
+
+    /**
+     * Moves the values of result \p index into \p values, which has room for the columns of a result row.
+     * The values are allocated with malloc and belong to the caller, a result is emitted once.
+     * \public
+     */
+    void odbxuv_aggregate_emit(odbxuv_aggregate_t *aggregate, unsigned int index, char **values);
+
+    /**
+     * \}
+     */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,713 @@
+#ifndef ODBXUV_CORO_HPP
+#define ODBXUV_CORO_HPP
+
+/**
+ * \file odbxuv/coro.hpp
+ * C++20 coroutine layer over the odbxuv API.
+ * Operations live inside the awaiting coroutine frame and query operations are taken from
+ * the free list of the connection, so awaiting does not allocate once the free list is warm.
+ */
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "odbxuv/db.h"
+
+namespace odbxuv
+{
+    /**
+     * \defgroup coro Odbxuv C++ coroutines
+     * \{
+     */
+
+    /**
+     * An error reported by an operation
+     */
+    class Error : public std::runtime_error
+    {
+    public:
+        Error(int code, int type, const char *message)
+            : std::runtime_error(message ? message : "odbxuv operation failed"), code_(code), type_(type)
+        {
+        }
+
+        /**
+         * The status the operation failed with
+         */
+        int code() const noexcept { return code_; }
+
+        /**
+         * The odbx error type, negative when the connection is unusable
+         */
+        int type() const noexcept { return type_; }
+
+    private:
+        int code_;
+        int type_;
+    };
+
+    template<typename T = void>
+    class Task;
+
+    namespace detail
+    {
+        /**
+         * Frees the error of an operation and throws it as an ::odbxuv::Error
+         */
+        [[noreturn]] inline void throwError(odbxuv_handle_t *handle, int status)
+        {
+            Error error(status, handle->error ? handle->error->errorType : 0, handle->error ? handle->error->errorString : nullptr);
+            odbxuv_free_error(handle);
+            throw error;
+        }
+
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept { return false; }
+
+            template<typename Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+            {
+                std::coroutine_handle<> continuation = handle.promise().continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        struct PromiseBase
+        {
+            std::coroutine_handle<> continuation;
+            std::exception_ptr exception;
+
+            std::suspend_always initial_suspend() const noexcept { return {}; }
+            FinalAwaiter final_suspend() const noexcept { return {}; }
+            void unhandled_exception() noexcept { exception = std::current_exception(); }
+        };
+
+        template<typename T>
+        struct Promise : PromiseBase
+        {
+            std::optional<T> value;
+
+            Task<T> get_return_object() noexcept;
+
+            template<typename U>
+            void return_value(U &&result) { value.emplace(std::forward<U>(result)); }
+
+            T result()
+            {
+                if(exception) std::rethrow_exception(exception);
+                return std::move(*value);
+            }
+        };
+
+        template<>
+        struct Promise<void> : PromiseBase
+        {
+            Task<void> get_return_object() noexcept;
+
+            void return_void() const noexcept {}
+
+            void result()
+            {
+                if(exception) std::rethrow_exception(exception);
+            }
+        };
+
+        /**
+         * Awaits an operation whose callback has the signature of ::odbxuv_op_cb
+         */
+        template<typename Op>
+        struct OpAwaiter
+        {
+            Op op {};
+            std::coroutine_handle<> waiter;
+            int status = 0;
+
+            bool await_ready() const noexcept { return false; }
+
+            static void onDone(Op *op, int status)
+            {
+                OpAwaiter *self = static_cast<OpAwaiter *>(op->data);
+                self->status = status;
+                self->waiter.resume();
+            }
+
+            void prepare(std::coroutine_handle<> handle) noexcept
+            {
+                op.data = this;
+                waiter = handle;
+            }
+        };
+
+        struct Detached
+        {
+            struct promise_type
+            {
+                Detached get_return_object() const noexcept { return {}; }
+                std::suspend_never initial_suspend() const noexcept { return {}; }
+                std::suspend_never final_suspend() const noexcept { return {}; }
+                void return_void() const noexcept {}
+                void unhandled_exception() const noexcept { std::terminate(); }
+            };
+        };
+    }
+
+    /**
+     * A lazily started coroutine, runs when awaited
+     */
+    template<typename T>
+    class Task
+    {
+    public:
+        using promise_type = detail::Promise<T>;
+
+        explicit Task(std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+        Task(Task &&other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+
+        Task &operator=(Task &&other) noexcept
+        {
+            if(this != &other)
+            {
+                if(handle_) handle_.destroy();
+                handle_ = std::exchange(other.handle_, {});
+            }
+            return *this;
+        }
+
+        ~Task()
+        {
+            if(handle_) handle_.destroy();
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            handle_.promise().continuation = awaiting;
+            return handle_;
+        }
+
+        T await_resume() { return handle_.promise().result(); }
+
+    private:
+        std::coroutine_handle<promise_type> handle_;
+    };
+
+    namespace detail
+    {
+        template<typename T>
+        inline Task<T> Promise<T>::get_return_object() noexcept
+        {
+            return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+        }
+
+        inline Task<void> Promise<void>::get_return_object() noexcept
+        {
+            return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+        }
+
+        inline Detached runDetached(Task<void> task)
+        {
+            co_await task;
+        }
+    }
+
+    /**
+     * Starts a task nobody awaits, an exception escaping it terminates the program
+     */
+    inline void spawn(Task<void> task)
+    {
+        detail::runDetached(std::move(task));
+    }
+
+    /**
+     * The rows of one batch, valid until the next batch is requested
+     */
+    class Result
+    {
+    public:
+        class iterator
+        {
+        public:
+            explicit iterator(odbxuv_row_t *row = nullptr) noexcept : row_(row) {}
+
+            odbxuv_row_t *operator*() const noexcept { return row_; }
+            iterator &operator++() noexcept { row_ = row_->next; return *this; }
+            bool operator==(const iterator &other) const noexcept { return row_ == other.row_; }
+            bool operator!=(const iterator &other) const noexcept { return row_ != other.row_; }
+
+        private:
+            odbxuv_row_t *row_;
+        };
+
+        Result() noexcept = default;
+        Result(odbxuv_row_t *first, unsigned int count) noexcept : first_(first), count_(count) {}
+
+        iterator begin() const noexcept { return iterator(first_); }
+        iterator end() const noexcept { return iterator(); }
+
+        /**
+         * The amount of rows in the batch
+         */
+        unsigned int size() const noexcept { return count_; }
+
+        /**
+         * False after the last batch
+         */
+        explicit operator bool() const noexcept { return first_ != nullptr; }
+
+    private:
+        odbxuv_row_t *first_ = nullptr;
+        unsigned int count_ = 0;
+    };
+
+    /**
+     * A query that executed, owns its operation and hands out its rows a batch at a time.
+     * Destroying it early drops the remaining rows and returns the operation to the connection.
+     */
+    class Query
+    {
+    public:
+        class NextAwaiter
+        {
+        public:
+            explicit NextAwaiter(Query &query) noexcept : query_(query) {}
+
+            bool await_ready() const noexcept { return false; }
+
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                query_.advance();
+
+                if(query_.pending_) return false;
+
+                query_.waiter_ = handle;
+                return true;
+            }
+
+            Result await_resume()
+            {
+                query_.pending_ = false;
+
+                if(query_.rows_ == nullptr)
+                {
+                    query_.done_ = true;
+                    if(query_.status_ < 0) detail::throwError((odbxuv_handle_t *)query_.op_, query_.status_);
+                    return Result();
+                }
+
+                query_.held_ = true;
+                return Result(query_.rows_, query_.count_);
+            }
+
+        private:
+            Query &query_;
+        };
+
+        explicit Query(odbxuv_op_query_t *op) noexcept : op_(op)
+        {
+            op_->data = this;
+        }
+
+        Query(Query &&other) noexcept
+            : op_(std::exchange(other.op_, nullptr)), waiter_(std::exchange(other.waiter_, {})), rows_(other.rows_), count_(other.count_),
+              status_(other.status_), started_(other.started_), pending_(other.pending_), held_(other.held_), delivering_(other.delivering_),
+              finished_(other.finished_), done_(other.done_)
+        {
+            if(op_) op_->data = this;
+        }
+
+        Query(const Query &) = delete;
+        Query &operator=(const Query &) = delete;
+        Query &operator=(Query &&) = delete;
+
+        ~Query()
+        {
+            if(op_ == nullptr) return;
+
+            //From here on the callbacks drop the rows and release the operation after the last one
+            op_->data = nullptr;
+
+            if(!started_)
+            {
+                odbxuv_query_process_batch(op_, onRows);
+            }
+            else if(finished_)
+            {
+                if(!delivering_) odbxuv_op_query_release(op_);
+            }
+            else if(held_ && !delivering_)
+            {
+                odbxuv_query_resume(op_);
+            }
+        }
+
+        odbxuv_op_query_t *get() const noexcept { return op_; }
+
+        unsigned int columnCount() const noexcept { return op_->columnCount; }
+        unsigned int affectedCount() const noexcept { return op_->affectedCount; }
+
+        /**
+         * The column info, \p nullptr unless the query fetched names or types
+         */
+        const odbxuv_column_info_t *columns() const noexcept { return op_->columns; }
+
+        /**
+         * Awaits the next batch of rows, an empty ::odbxuv::Result after the last row.
+         * The rows of the previous batch are handed back to the worker.
+         */
+        NextAwaiter next() noexcept { return NextAwaiter(*this); }
+
+    private:
+        void advance()
+        {
+            if(done_)
+            {
+                pending_ = true;
+                rows_ = nullptr;
+                status_ = 0;
+                return;
+            }
+
+            if(held_)
+            {
+                held_ = false;
+
+                //Inside the batch callback the rows are released once it returns
+                if(!delivering_) odbxuv_query_resume(op_);
+            }
+
+            if(!started_)
+            {
+                started_ = true;
+                odbxuv_query_process_batch(op_, onRows);
+            }
+        }
+
+        static odbxuv_batch_result_e onRows(odbxuv_op_query_t *op, odbxuv_row_t *rows, unsigned int count, int status)
+        {
+            Query *self = static_cast<Query *>(op->data);
+
+            if(self != nullptr)
+            {
+                self->rows_ = rows;
+                self->count_ = count;
+                self->status_ = status;
+                self->pending_ = true;
+                self->finished_ = rows == nullptr;
+                self->delivering_ = true;
+
+                if(self->waiter_) std::exchange(self->waiter_, {}).resume();
+
+                //The coroutine may have moved or destroyed the query
+                self = static_cast<Query *>(op->data);
+            }
+
+            if(self == nullptr)
+            {
+                if(rows == nullptr) odbxuv_op_query_release(op);
+                return ODBXUV_BATCH_DONE;
+            }
+
+            self->delivering_ = false;
+
+            return rows != nullptr && (self->pending_ || self->held_) ? ODBXUV_BATCH_HOLD : ODBXUV_BATCH_DONE;
+        }
+
+        odbxuv_op_query_t *op_;
+        std::coroutine_handle<> waiter_;
+        odbxuv_row_t *rows_ = nullptr;
+        unsigned int count_ = 0;
+        int status_ = 0;
+        bool started_ = false;
+        bool pending_ = false;
+        bool held_ = false;
+        bool delivering_ = false;
+        bool finished_ = false;
+        bool done_ = false;
+    };
+
+    /**
+     * Where and how to connect
+     */
+    struct ConnectOptions
+    {
+        const char *backend = nullptr;
+        const char *host = nullptr;
+        const char *port = nullptr;
+        const char *database = nullptr;
+        const char *user = nullptr;
+        const char *password = nullptr;
+        int method = ODBX_BIND_SIMPLE;
+    };
+
+    /**
+     * A connection, closed when destroyed
+     */
+    class Connection
+    {
+    public:
+        class ConnectAwaiter : public detail::OpAwaiter<odbxuv_op_connect_t>
+        {
+        public:
+            ConnectAwaiter(odbxuv_connection_t *connection, const ConnectOptions &options) noexcept : connection_(connection), options_(options) {}
+
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                prepare(handle);
+                op.backend = options_.backend;
+                op.host = options_.host;
+                op.port = options_.port;
+                op.database = options_.database;
+                op.user = options_.user;
+                op.password = options_.password;
+                op.method = options_.method;
+                odbxuv_connect(connection_, &op, onDone);
+            }
+
+            void await_resume()
+            {
+                if(status < ODBX_ERR_SUCCESS)
+                {
+                    odbxuv_free_handle((odbxuv_handle_t *)&op);
+                    detail::throwError((odbxuv_handle_t *)&op, status);
+                }
+
+                odbxuv_free_handle((odbxuv_handle_t *)&op);
+            }
+
+        private:
+            odbxuv_connection_t *connection_;
+            ConnectOptions options_;
+        };
+
+        class CapabilitiesAwaiter : public detail::OpAwaiter<odbxuv_op_capabilities_t>
+        {
+        public:
+            CapabilitiesAwaiter(odbxuv_connection_t *connection, int capabilities) noexcept : connection_(connection), capabilities_(capabilities) {}
+
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                prepare(handle);
+                odbxuv_capabilities(connection_, &op, capabilities_, onDone);
+            }
+
+            bool await_resume()
+            {
+                if(status < ODBX_ERR_SUCCESS) detail::throwError((odbxuv_handle_t *)&op, status);
+
+                return op.result == ODBX_ENABLE;
+            }
+
+        private:
+            odbxuv_connection_t *connection_;
+            int capabilities_;
+        };
+
+        class EscapeAwaiter : public detail::OpAwaiter<odbxuv_op_escape_t>
+        {
+        public:
+            EscapeAwaiter(odbxuv_connection_t *connection, const char *string) noexcept : connection_(connection), string_(string) {}
+
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                prepare(handle);
+                odbxuv_escape(connection_, &op, string_, onDone);
+            }
+
+            std::string await_resume()
+            {
+                if(status < ODBX_ERR_SUCCESS)
+                {
+                    odbxuv_free_handle((odbxuv_handle_t *)&op);
+                    detail::throwError((odbxuv_handle_t *)&op, status);
+                }
+
+                std::string escaped(op.string ? op.string : "");
+                odbxuv_free_handle((odbxuv_handle_t *)&op);
+                return escaped;
+            }
+
+        private:
+            odbxuv_connection_t *connection_;
+            const char *string_;
+        };
+
+        class QueryAwaiter
+        {
+        public:
+            QueryAwaiter(odbxuv_connection_t *connection, const char *query, odbxuv_query_fetch_e flags, const odbxuv_query_config_t *config) noexcept
+                : connection_(connection), query_(query), flags_(flags), config_(config)
+            {
+            }
+
+            bool await_ready() const noexcept { return false; }
+
+            bool await_suspend(std::coroutine_handle<> handle)
+            {
+                waiter_ = handle;
+                op_ = odbxuv_op_query_acquire(connection_);
+                op_->data = this;
+
+                //A query the connection did not queue never calls back, resume right away
+                int result = odbxuv_query_recycled(connection_, op_, query_, flags_, config_, onQuery);
+                if(result < ODBX_ERR_SUCCESS)
+                {
+                    status_ = result;
+                    return false;
+                }
+
+                return true;
+            }
+
+            Query await_resume()
+            {
+                if(status_ < ODBX_ERR_SUCCESS)
+                {
+                    try
+                    {
+                        detail::throwError((odbxuv_handle_t *)op_, status_);
+                    }
+                    catch(...)
+                    {
+                        odbxuv_op_query_release(op_);
+                        throw;
+                    }
+                }
+
+                return Query(op_);
+            }
+
+        private:
+            static void onQuery(odbxuv_op_query_t *op, int status)
+            {
+                QueryAwaiter *self = static_cast<QueryAwaiter *>(op->data);
+                self->status_ = status;
+                self->waiter_.resume();
+            }
+
+            odbxuv_connection_t *connection_;
+            const char *query_;
+            odbxuv_query_fetch_e flags_;
+            const odbxuv_query_config_t *config_;
+            odbxuv_op_query_t *op_ = nullptr;
+            std::coroutine_handle<> waiter_;
+            int status_ = 0;
+        };
+
+        class CloseAwaiter
+        {
+        public:
+            explicit CloseAwaiter(odbxuv_connection_t *&connection) noexcept : connection_(connection) {}
+
+            bool await_ready() const noexcept { return connection_ == nullptr; }
+
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                waiter_ = handle;
+                connection_->data = this;
+                odbxuv_close((odbxuv_handle_t *)connection_, onClose);
+            }
+
+            void await_resume() const noexcept {}
+
+        private:
+            static void onClose(odbxuv_handle_t *handle)
+            {
+                CloseAwaiter *self = static_cast<CloseAwaiter *>(handle->data);
+                odbxuv_free_error(handle);
+                delete (odbxuv_connection_t *)handle;
+                self->connection_ = nullptr;
+                self->waiter_.resume();
+            }
+
+            odbxuv_connection_t *&connection_;
+            std::coroutine_handle<> waiter_;
+        };
+
+        explicit Connection(uv_loop_t *loop) : connection_(new odbxuv_connection_t())
+        {
+            odbxuv_init_connection(connection_, loop);
+        }
+
+        Connection(Connection &&other) noexcept : connection_(std::exchange(other.connection_, nullptr)) {}
+        Connection(const Connection &) = delete;
+        Connection &operator=(const Connection &) = delete;
+
+        Connection &operator=(Connection &&other) noexcept
+        {
+            if(this != &other)
+            {
+                release();
+                connection_ = std::exchange(other.connection_, nullptr);
+            }
+            return *this;
+        }
+
+        ~Connection()
+        {
+            release();
+        }
+
+        odbxuv_connection_t *get() const noexcept { return connection_; }
+
+        ConnectAwaiter connect(const ConnectOptions &options) noexcept { return ConnectAwaiter(connection_, options); }
+
+        /**
+         * Resolves to true when the capabilities are enabled
+         */
+        CapabilitiesAwaiter capabilities(int capabilities) noexcept { return CapabilitiesAwaiter(connection_, capabilities); }
+
+        EscapeAwaiter escape(const char *string) noexcept { return EscapeAwaiter(connection_, string); }
+        EscapeAwaiter escape(const std::string &string) noexcept { return EscapeAwaiter(connection_, string.c_str()); }
+
+        /**
+         * Resolves to the ::odbxuv::Query once the database executed it
+         */
+        QueryAwaiter query(const char *query, int flags = ODBXUV_QUERY_FETCH_VALUE, const odbxuv_query_config_t *config = nullptr) noexcept
+        {
+            return QueryAwaiter(connection_, query, (odbxuv_query_fetch_e)flags, config);
+        }
+
+        QueryAwaiter query(const std::string &query, int flags = ODBXUV_QUERY_FETCH_VALUE, const odbxuv_query_config_t *config = nullptr) noexcept
+        {
+            return QueryAwaiter(connection_, query.c_str(), (odbxuv_query_fetch_e)flags, config);
+        }
+
+        /**
+         * Disconnects and closes the connection
+         * \warning Destroy the queries of the connection first
+         */
+        CloseAwaiter close() noexcept { return CloseAwaiter(connection_); }
+
+    private:
+        void release() noexcept
+        {
+            if(connection_ == nullptr) return;
+
+            odbxuv_close((odbxuv_handle_t *)connection_, [](odbxuv_handle_t *handle)
+            {
+                odbxuv_free_error(handle);
+                delete (odbxuv_connection_t *)handle;
+            });
+
+            connection_ = nullptr;
+        }
+
+        odbxuv_connection_t *connection_;
+    };
+
+    /**
+     * \}
+     */
+}
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef ODBXUV_CURSOR_H
+#define ODBXUV_CURSOR_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+    /**
+     * \file odbxuv/cursor.h
+     * Scans a table in pages ordered by a unique key.
+     * Every page is a short query of the form
+     * <tt>select WHERE (where) AND key > last ORDER BY key LIMIT pageSize</tt>,
+     * the next page is queried as soon as the last row of the current one reached the loop
+     * so the worker fetches it while the rows of the current page are processed.
+     */
+
+    #include "odbxuv/db.h"
+
+    typedef struct odbxuv_cursor_s odbxuv_cursor_t;
+
+    /**
+     * \defgroup cursor Odbxuv keyset cursor
+     * \{
+     */
+
+    /**
+     * Receives the rows of the cursor in order, linked through \p next.
+     * \p page is the query of the page the rows belong to, for its column info.
+     * Is called with NULL as rows after the last row, \p status is negative when a page failed.
+     * The rows are handed back when the callback returns.
+     */
+    typedef void (*odbxuv_cursor_cb) (odbxuv_cursor_t *cursor, odbxuv_op_query_t *page, odbxuv_row_t *rows, unsigned int count, int status);
+
+    struct odbxuv_cursor_s
+    {
+        /**
+         * Userdata
+         * \public
+         */
+        void *data;
+
+        /**
+         * The connection the pages are queried on
+         * \note Read only
+         */
+        odbxuv_connection_t *connection;
+
+        /**
+         * The amount of rows per page
+         * \public
+         */
+        unsigned int pageSize;
+
+        /**
+         * The index of the key column in the result
+         * \public
+         */
+        unsigned int keyColumn;
+
+        /**
+         * Fetch flags of the pages, ::ODBXUV_QUERY_FETCH_VALUE is always added
+         * \public
+         */
+        odbxuv_query_fetch_e flags;
+
+        /**
+         * Settings of the page queries, see ::odbxuv_query_ex
+         * \public
+         */
+        odbxuv_query_config_t config;
+
+        /**
+         * The amount of rows handed to the callback
+         * \note Read only
+         */
+        uint64_t rowCount;
+
+        /**
+         * The amount of pages queried
+         * \note Read only
+         */
+        unsigned int pageCount;
+
+        /**
+         * Copies of the query parts passed to ::odbxuv_cursor_init
+         * \private
+         */
+        char *select;
+        char *where;
+        char *key;
+
+        /**
+         * The key of the last row of the last complete page, escaped when it is not a number
+         * \private
+         */
+        char *last;
+
+        /**
+         * The page being delivered and the next one
+         * \private
+         */
+        odbxuv_op_query_t *page;
+        odbxuv_op_query_t *nextPage;
+
+        /**
+         * The rows delivered of \p page
+         * \private
+         */
+        unsigned int pageRows;
+
+        /**
+         * Status of \p nextPage once its query returned, 1 before
+         * \private
+         */
+        int nextStatus;
+
+        /**
+         * Escapes a key that is not a number
+         * \private
+         */
+        odbxuv_op_escape_t escape;
+
+        /**
+         * Set while \p escape is queued
+         * \private
+         */
+        unsigned char escaping;
+
+        /**
+         * Set once no more pages are queried and the rows of the pending ones are dropped,
+         * by ::odbxuv_cursor_stop or an error
+         * \private
+         */
+        unsigned char stopping;
+
+        /**
+         * Set from ::odbxuv_cursor_start until the last callback
+         * \note Read only
+         */
+        unsigned char running;
+
+        /**
+         * The first error of a page
+         * \private
+         */
+        int status;
+
+        /**
+         * \private
+         */
+        odbxuv_cursor_cb callback;
+    };
+
+    /**
+     * Prepares a cursor over the rows of \p select, without WHERE and ORDER BY clauses,
+     * ordered by the unique column \p key. \p where may be \p NULL.
+     * \public
+     */
+    int odbxuv_cursor_init(odbxuv_cursor_t *cursor, odbxuv_connection_t *connection, const char *select, const char *where, const char *key);
+
+    /**
+     * Queries the first page and hands every row to \p onRows.
+     * When the first page is not queued, for example because the connection is overloaded,
+     * the error is returned and \p onRows is not called.
+     * A later page that is not queued stops the cursor with its error.
+     * \public
+     */
+    int odbxuv_cursor_start(odbxuv_cursor_t *cursor, odbxuv_cursor_cb onRows);
+
+    /**
+     * Stops querying pages, the callback is called with NULL as rows once the pending ones finished.
+     * \public
+     */
+    void odbxuv_cursor_stop(odbxuv_cursor_t *cursor);
+
+    /**
+     * Frees a cursor that is not running.
+     * \public
+     */
+    void odbxuv_cursor_free(odbxuv_cursor_t *cursor);
+
+    /**
+     * \}
+     */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
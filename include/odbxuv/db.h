@@ -1,3 +1,6 @@
+#ifndef ODBXUV_DB_H
+#define ODBXUV_DB_H
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -8,9 +11,11 @@ extern "C"
      */
 
     #include <odbx.h>
+    #include <stdint.h>
     #include "uv.h"
 
     typedef struct odbxuv_op_s odbxuv_op_t;
+    typedef struct odbxuv_snapshot_s odbxuv_snapshot_t;
 
     /**
      * \defgroup odbxuv Odbxuv global functions
@@ -29,7 +34,8 @@ extern "C"
         ODBXUV_CON_STATUS_CONNECTED,
         ODBXUV_CON_STATUS_DISCONNECTING,
         ODBXUV_CON_STATUS_DISCONNECTED,
-        ODBXUV_CON_STATUS_FAILED
+        ODBXUV_CON_STATUS_FAILED,
+        ODBXUV_CON_STATUS_RECONNECTING
     } odbxuv_connection_status_e;
 
     /**
@@ -61,8 +67,76 @@ extern "C"
         ODBXUV_QUERY_FETCH_NAME         = 1 << 0,
         ODBXUV_QUERY_FETCH_TYPE         = 1 << 1,
         ODBXUV_QUERY_FETCH_VALUE       = 1 << 2,
+
+        /**
+         * Repeated values of a column share one copy kept by the result,
+         * equal values of a column then have equal pointers. See \p dictionaryMax of ::odbxuv_query_config_t.
+         */
+        ODBXUV_QUERY_FETCH_DICTIONARY  = 1 << 3,
     } odbxuv_query_fetch_e;
 
+    /**
+     * Options of a query
+     * \sa odbxuv_query_config_t
+     */
+    typedef enum odbxuv_query_option_enum
+    {
+        /**
+         * The query may run again when the connection was lost before it executed
+         */
+        ODBXUV_QUERY_IDEMPOTENT         = 1 << 0,
+
+        /**
+         * A router sends the query to its primary, even when it only reads
+         */
+        ODBXUV_QUERY_PRIMARY            = 1 << 1,
+
+        /**
+         * The worker only counts the rows into \p rowCount of the query, no rows are delivered
+         */
+        ODBXUV_QUERY_COUNT_ONLY         = 1 << 2,
+
+        /**
+         * The query may be shed from the queue when the connection is overloaded, see ::odbxuv_admission_policy_t
+         */
+        ODBXUV_QUERY_LOW_PRIORITY       = 1 << 3,
+
+        /**
+         * The query is attached to an identical query with this option queued or fetching on the connection
+         * instead of running again, see ::odbxuv_snapshot_t. Only for reads as told by ::odbxuv_query_classify,
+         * other statements are never shared.
+         * The rows are delivered once all of them are fetched. Can't be combined with a serializer, aggregate,
+         * row hook, spill threshold, selected columns, ::ODBXUV_QUERY_COUNT_ONLY or ::ODBXUV_QUERY_FETCH_DICTIONARY.
+         */
+        ODBXUV_QUERY_SHARED             = 1 << 4,
+    } odbxuv_query_option_e;
+
+    /**
+     * What a statement does, see ::odbxuv_query_classify
+     */
+    typedef enum odbxuv_statement_enum
+    {
+        /**
+         * Only reads, may run on a replica
+         */
+        ODBXUV_STATEMENT_READ = 0,
+
+        /**
+         * Writes or changes state, runs on the primary
+         */
+        ODBXUV_STATEMENT_WRITE,
+
+        /**
+         * Starts a transaction
+         */
+        ODBXUV_STATEMENT_BEGIN,
+
+        /**
+         * Commits or rolls back a transaction
+         */
+        ODBXUV_STATEMENT_END
+    } odbxuv_statement_e;
+
     /**
      * All the different types of operations
      * Use \p ODBXUV_OP_CUSTOM to add custom operation types
@@ -106,6 +180,57 @@ extern "C"
         ODBXUV_FETCH_STATUS_CANCELLED
     } odbxuv_fetch_status_e;
 
+    /**
+     * Error codes used by odbxuv itself.
+     * They are negative like the OpenDBX error codes and don't overlap with them.
+     */
+    typedef enum odbxuv_error_enum
+    {
+        ODBXUV_ERR_NOCONNECTION = -100,
+
+        /**
+         * A row does not fit in a buffer of the ::odbxuv_serializer_t of the query
+         */
+        ODBXUV_ERR_TOOLARGE = -101,
+
+        /**
+         * The spill file of a query could not be written or mapped
+         */
+        ODBXUV_ERR_SPILL = -102,
+
+        /**
+         * A query exceeded a memory limit and its \p memoryPolicy is ::ODBXUV_MEMORY_FAIL
+         */
+        ODBXUV_ERR_MEMORY = -103,
+
+        /**
+         * The ::odbxuv_aggregate_t of a query uses a column the result does not have
+         */
+        ODBXUV_ERR_AGGREGATE = -104,
+
+        /**
+         * The queue of the connection is full, the query was rejected or shed
+         */
+        ODBXUV_ERR_OVERLOAD = -105,
+    } odbxuv_error_e;
+
+    /**
+     * What the worker does when fetching a row would exceed a memory limit
+     * \sa odbxuv_query_config_t
+     */
+    typedef enum odbxuv_memory_policy_enum
+    {
+        /**
+         * Wait until the loop hands back rows and reuse those instead of allocating new ones
+         */
+        ODBXUV_MEMORY_PAUSE = 0,
+
+        /**
+         * Fail the query with ::ODBXUV_ERR_MEMORY
+         */
+        ODBXUV_MEMORY_FAIL
+    } odbxuv_memory_policy_e;
+
     typedef enum odbxuv_fetch_cb_status_enum
     {
         ODBXUV_FETCH_CB_STATUS_NONE = 0,
@@ -169,6 +294,141 @@ extern "C"
         ODBXUV_HANDLE_BASE_FIELDS
     } odbxuv_handle_t;
 
+    /**
+     * Counters kept per connection.
+     * \sa odbxuv_connection_counters
+     */
+    typedef struct odbxuv_connection_counters_s
+    {
+        /**
+         * Amount of rows the worker fetched
+         */
+        uint64_t rowsFetched;
+
+        /**
+         * Amount of those rows that were written to a spill file, see \p spillThreshold
+         */
+        uint64_t rowsSpilled;
+
+        /**
+         * Amount of times the worker woke up the loop to deliver rows
+         */
+        uint64_t rowWakeups;
+
+        /**
+         * Amount of times the worker woke up the loop to run operation callbacks
+         */
+        uint64_t queryWakeups;
+
+        /**
+         * Amount of times the loop stopped delivering rows because of \p deliverRows or \p deliverTime
+         */
+        uint64_t deliveryYields;
+
+        /**
+         * Amount of queries rejected and shed because the queue was full, see ::odbxuv_admission_policy_t
+         */
+        uint64_t queriesRejected;
+        uint64_t queriesShed;
+
+        /**
+         * Amount of queries attached to an identical query instead of running, see ::ODBXUV_QUERY_SHARED
+         */
+        uint64_t queriesShared;
+
+        /**
+         * Amount of times the connection connected to the database, every reconnect starts a new session
+         */
+        uint64_t sessions;
+
+        /**
+         * Moving average of the time the database took to answer a query, in nanoseconds
+         */
+        uint64_t queryLatency;
+
+        /**
+         * Bytes held by the rows, column info and query strings of the query operations of the connection,
+         * including the column info the connection keeps for reuse.
+         * Operations freed after the connection closed only count globally.
+         */
+        uint64_t memoryUsed;
+    } odbxuv_connection_counters_t;
+
+    /**
+     * When and how often a connection reconnects after losing the connection to the database.
+     * The delay before an attempt is picked at random between half and all of
+     * \p baseDelay doubled for every failed attempt, but no more than \p maxDelay.
+     */
+    typedef struct odbxuv_reconnect_policy_s
+    {
+        /**
+         * The amount of attempts before failing the queued operations, 0 disables reconnecting
+         */
+        unsigned int maxAttempts;
+
+        /**
+         * The delay before the first attempt in milliseconds
+         */
+        unsigned int baseDelay;
+
+        /**
+         * The maximum delay between attempts in milliseconds
+         */
+        unsigned int maxDelay;
+    } odbxuv_reconnect_policy_t;
+
+    /**
+     * What happens to a query that does not fit in the queue of a connection
+     */
+    typedef enum odbxuv_overload_policy_enum
+    {
+        /**
+         * ::odbxuv_query_ex returns ::ODBXUV_ERR_OVERLOAD, the query is not queued
+         */
+        ODBXUV_OVERLOAD_REJECT = 0,
+
+        /**
+         * The oldest queued query with ::ODBXUV_QUERY_LOW_PRIORITY fails with ::ODBXUV_ERR_OVERLOAD to make room,
+         * the new query is rejected when there is none
+         */
+        ODBXUV_OVERLOAD_SHED
+    } odbxuv_overload_policy_e;
+
+    /**
+     * Limits of the queue of a connection, queries beyond them fail right away instead of waiting.
+     * Only queries are limited, the other operations are always queued.
+     */
+    typedef struct odbxuv_admission_policy_s
+    {
+        /**
+         * The most operations waiting for the worker, 0 disables the limit
+         */
+        unsigned int maxQueued;
+
+        /**
+         * The most microseconds a new query may be expected to wait: the waiting operations,
+         * and the running one, times the moving average of the query latency. 0 disables the limit.
+         */
+        unsigned int maxWait;
+
+        odbxuv_overload_policy_e policy;
+    } odbxuv_admission_policy_t;
+
+    /**
+     * The parameters a connection was opened with
+     * \private
+     */
+    typedef struct odbxuv_credentials_s
+    {
+        char *host;
+        char *port;
+        char *backend;
+        char *database;
+        char *user;
+        char *password;
+        int method;
+    } odbxuv_credentials_t;
+
     /**
      * A connection object.
      * This represents the connection to the database and contains all the worker information.
@@ -179,7 +439,7 @@ extern "C"
 
         /**
          * The current status of the connection.
-         * \note Read only
+         * \note Read only, use ::odbxuv_connection_get_status to read it while the worker is running
          */
         odbxuv_connection_status_e status;
 
@@ -191,6 +451,7 @@ extern "C"
 
         /**
          * The queue of the worker.
+         * Changed by the loop with \p lock held, the worker claims the operations it runs with \p lock held.
          * \private
          */
         odbxuv_op_t *operationQueue;
@@ -217,6 +478,186 @@ extern "C"
          * \note Read only
          */
         odbxuv_worker_status_e workerStatus;
+
+        /**
+         * Protects the row lists and counters shared with the worker.
+         * \private
+         */
+        uv_mutex_t lock;
+
+        /**
+         * Signalled when the loop hands rows back while the worker waits for them
+         * \private
+         */
+        uv_cond_t rowsReturned;
+
+        /**
+         * The amount of fetched rows the worker collects before waking up the loop.
+         * Set to the default by ::odbxuv_init_connection, 1 wakes up the loop for every row.
+         * \public
+         */
+        unsigned int notifyRows;
+
+        /**
+         * The amount of microseconds the worker may hold back fetched rows before waking up the loop.
+         * Set to the default by ::odbxuv_init_connection, 0 disables the time limit.
+         * \public
+         */
+        unsigned int notifyInterval;
+
+        /**
+         * The most rows the loop hands to the fetch callback of a query at once, 0 disables the limit.
+         * Rows beyond it are delivered in the next iteration of the loop.
+         * \public
+         */
+        unsigned int deliverRows;
+
+        /**
+         * The most microseconds the loop spends in the fetch callback of a query at once, 0 disables the limit.
+         * The time is checked after every \p notifyRows rows.
+         * \public
+         */
+        unsigned int deliverTime;
+
+        /**
+         * What to do when the connection to the database is lost.
+         * An operation failing with an error of a negative \p errorType (see \p odbx_error_type)
+         * makes the connection reconnect with the parameters of ::odbxuv_connect.
+         * The queued operations stay queued and run after reconnecting, the failed operation is
+         * run again when it had not executed yet and is a capabilities request or a query with ::ODBXUV_QUERY_IDEMPOTENT.
+         * \public
+         */
+        odbxuv_reconnect_policy_t reconnect;
+
+        /**
+         * Limits of the queue, see ::odbxuv_admission_policy_t
+         * \public
+         */
+        odbxuv_admission_policy_t admission;
+
+        /**
+         * Operations outside of the queue whose callbacks did not run yet:
+         * shed queries and queries attached to a shared query that was already answered
+         * \private
+         */
+        odbxuv_op_t *readyQueue;
+
+        /**
+         * Snapshots of the shared queries that are still fetching, protected by \p lock
+         * \private
+         */
+        odbxuv_snapshot_t *snapshots;
+
+        /**
+         * The amount of failed reconnect attempts since the connection was lost
+         * \note Read only
+         */
+        unsigned int reconnectAttempts;
+
+        /**
+         * Timer delaying the next reconnect attempt
+         * \private
+         */
+        uv_timer_t reconnectTimer;
+
+        /**
+         * Seed of the reconnect jitter
+         * \private
+         */
+        unsigned int reconnectSeed;
+
+        /**
+         * Copy of the parameters of ::odbxuv_connect
+         * \private
+         */
+        odbxuv_credentials_t credentials;
+
+        /**
+         * Disconnect operation of a close that waits for the worker
+         * \private
+         */
+        struct odbxuv_op_disconnect_s *closeOp;
+
+        /**
+         * Released query operations whose handles are closing, the connection closes after them
+         * \private
+         */
+        unsigned int closingQueries;
+
+        /**
+         * The close waiting for \p closingQueries
+         * \private
+         */
+        void *closing;
+
+        /**
+         * Query operations handed to another loop with ::odbxuv_query_hand_over that were not freed or reset yet,
+         * protected by \p lock. They still use the connection, it closes after them.
+         * \private
+         */
+        unsigned int remoteQueries;
+
+        /**
+         * Released query operations kept for reuse
+         * \private
+         */
+        struct odbxuv_op_query_s *freeQuery;
+
+        /**
+         * The amount of operations in \p freeQuery
+         * \note Read only
+         */
+        unsigned int freeQueryCount;
+
+        /**
+         * The maximum amount of released query operations to keep for reuse.
+         * \public
+         */
+        unsigned int freeQueryMax;
+
+        /**
+         * The most bytes the query operations of the connection may hold, see \p memoryUsed of the counters.
+         * 0 disables the limit.
+         * \public
+         */
+        uint64_t memoryLimit;
+
+        /**
+         * Hash table of the column info of the results of the connection,
+         * shared with the query operations so they can outlive the connection
+         * \private
+         */
+        struct _odbxuv_metadata_table_s *metadata;
+
+        /**
+         * The amount of column info kept in \p metadata
+         * \note Read only
+         */
+        unsigned int metadataCount;
+
+        /**
+         * The most column info to keep, results with other columns get a copy of their own.
+         * \public
+         */
+        unsigned int metadataMax;
+
+        /**
+         * Wakeup and row counters
+         * \note Read only, use ::odbxuv_connection_counters to read them
+         */
+        odbxuv_connection_counters_t counters;
+
+        /**
+         * When set the worker records the time, rows and errors of every query in it, see odbxuv/stats.h
+         * \public
+         */
+        struct odbxuv_stats_s *stats;
+
+        /**
+         * When set the worker logs queries taking longer than its threshold in it, see odbxuv/slowlog.h
+         * \public
+         */
+        struct odbxuv_slowlog_s *slowlog;
     } odbxuv_connection_t;
 
 
@@ -228,26 +669,156 @@ extern "C"
     typedef struct odbxuv_op_query_s odbxuv_op_query_t;
     typedef struct odbxuv_row_s odbxuv_row_t;
     typedef struct odbxuv_column_info_s odbxuv_column_info_t;
+    typedef struct odbxuv_metadata_s odbxuv_metadata_t;
+
     /**
-     * \}
-     * \}
+     * What the worker does with a row after its row hook ran
      */
+    typedef enum odbxuv_row_hook_enum
+    {
+        /**
+         * The row is skipped, nothing of it is copied
+         */
+        ODBXUV_ROW_DROP = 0,
+
+        /**
+         * The values are copied into the row as usual
+         */
+        ODBXUV_ROW_COPY,
+
+        /**
+         * The row is delivered with \p user set by the hook and without values
+         */
+        ODBXUV_ROW_EMIT
+    } odbxuv_row_hook_e;
 
     /**
-     * The function that runs the actual odbxuv operation.
-     * This is invoked by the background worker.
+     * Called by the worker for every fetched row of a query before it is copied, so it has to be thread safe.
+     * \p values and \p lengths hold the \p columnCount values of the row.
+     * The hook may set values to NULL to leave them out or point them to zero terminated values of its own,
+     * which only need to stay valid until it returns. For ::ODBXUV_ROW_EMIT it stores its result in \p user.
      */
-    typedef odbxuv_operation_status_e (*odbxuv_op_fun)(odbxuv_op_t *);
+    typedef odbxuv_row_hook_e (*odbxuv_row_hook_cb) (odbxuv_op_query_t *op, unsigned int columnCount, const char **values, unsigned long *lengths, void **user);
 
     /**
-     * A general callback function.
-     * Status contains the value of \p op->error for easy error checking.
-     * \warning Don't forget to call ::odbxuv_free_error when necessary
+     * Frees the \p user of a row emitted by a row hook.
+     * Called by the worker when it reuses the row and by the loop when the rows of the query are freed.
      */
-    typedef void (*odbxuv_op_cb) (odbxuv_op_t *op, int status);
+    typedef void (*odbxuv_row_user_free_cb) (odbxuv_op_query_t *op, void *user);
 
     /**
-     * Operation callback invoked after a connection attempt.
+     * Additional settings of a query
+     * \sa odbxuv_query_ex
+     */
+    typedef struct odbxuv_query_config_s
+    {
+        /**
+         * Combination of ::odbxuv_query_option_e
+         */
+        int options;
+
+        /**
+         * When set the worker serialises the rows into its buffers, see odbxuv/serialize.h
+         */
+        struct odbxuv_serializer_s *serializer;
+
+        /**
+         * When the rows waiting for the loop take more than this many bytes the worker
+         * writes the rest of the result to a temporary file, which is replayed once the query finished.
+         * 0 keeps every row in memory.
+         */
+        size_t spillThreshold;
+
+        /**
+         * Where the temporary file is created, \p P_tmpdir when \p NULL
+         */
+        const char *spillDirectory;
+
+        /**
+         * The most bytes the operation may hold, 0 disables the limit
+         */
+        uint64_t memoryLimit;
+
+        /**
+         * What happens when this, the connection or the global limit is exceeded
+         */
+        odbxuv_memory_policy_e memoryPolicy;
+
+        /**
+         * With ::ODBXUV_QUERY_FETCH_DICTIONARY, the most distinct values kept per column.
+         * Columns with more distinct values are copied per row from then on.
+         * 0 uses the default.
+         */
+        unsigned int dictionaryMax;
+
+        /**
+         * The amount of rows the backend fetches at once, 0 uses the default of the backend.
+         * With \p chunkBytes it is the size of the first chunk.
+         */
+        unsigned int chunkSize;
+
+        /**
+         * Resizes the chunks after every one to take about this many bytes, shrinking them
+         * while the loop lags behind or a chunk takes longer than the notify interval of the connection.
+         * 0 keeps \p chunkSize.
+         */
+        size_t chunkBytes;
+
+        /**
+         * When set the worker aggregates the rows and only delivers the aggregate rows, see odbxuv/aggregate.h.
+         * Can't be combined with \p serializer.
+         */
+        struct odbxuv_aggregate_s *aggregate;
+
+        /**
+         * Filters or transforms the rows on the worker, see ::odbxuv_row_hook_cb.
+         * Can't be combined with \p serializer, \p aggregate or \p spillThreshold.
+         */
+        odbxuv_row_hook_cb rowHook;
+
+        /**
+         * Frees what \p rowHook stored in the \p user of a row, may be NULL.
+         * The emitted structs are not counted in the memory of the query.
+         */
+        odbxuv_row_user_free_cb rowUserFree;
+
+        /**
+         * When set only these columns are copied, by index and by name, the others are left NULL.
+         * Indexes and names the result does not have are ignored.
+         * The arrays are read by the worker and have to stay valid until the rows are fetched.
+         */
+        const unsigned int *selectColumns;
+        unsigned int selectColumnCount;
+        const char *const *selectNames;
+        unsigned int selectNameCount;
+
+        /**
+         * Only runs the query in this session of the connection, see \p sessions of ::odbxuv_connection_counters_t.
+         * Once a reconnect started another session the query fails with ::ODBXUV_ERR_NOCONNECTION,
+         * so the statements of a transaction don't run without it. 0 runs the query in any session.
+         */
+        uint64_t session;
+    } odbxuv_query_config_t;
+    /**
+     * \}
+     * \}
+     */
+
+    /**
+     * The function that runs the actual odbxuv operation.
+     * This is invoked by the background worker.
+     */
+    typedef odbxuv_operation_status_e (*odbxuv_op_fun)(odbxuv_op_t *);
+
+    /**
+     * A general callback function.
+     * Status contains the value of \p op->error for easy error checking.
+     * \warning Don't forget to call ::odbxuv_free_error when necessary
+     */
+    typedef void (*odbxuv_op_cb) (odbxuv_op_t *op, int status);
+
+    /**
+     * Operation callback invoked after a connection attempt.
      * \sa odbxuv_op_cb
      */
     typedef void (*odbxuv_op_connect_cb) (odbxuv_op_connect_t *op, int status);
@@ -286,6 +857,28 @@ extern "C"
      */
     typedef void (*odbxuv_fetch_cb) (odbxuv_op_query_t *result, odbxuv_row_t *row, int status);
 
+    /**
+     * What a batch fetch callback did with its rows
+     */
+    typedef enum odbxuv_batch_result_enum
+    {
+        /**
+         * The rows have been processed and may be reused
+         */
+        ODBXUV_BATCH_DONE = 0,
+
+        /**
+         * The rows stay valid and no more rows are delivered until ::odbxuv_query_resume
+         */
+        ODBXUV_BATCH_HOLD
+    } odbxuv_batch_result_e;
+
+    /**
+     * Callback invoked with all the rows the loop took at once, linked through \p next.
+     * Is called with NULL as rows after the last row, \p status is the fetch status then.
+     */
+    typedef odbxuv_batch_result_e (*odbxuv_fetch_batch_cb) (odbxuv_op_query_t *result, odbxuv_row_t *rows, unsigned int count, int status);
+
     /**
      * Closing callback called when the hande has been closed and it is safe to free
      */
@@ -437,13 +1030,37 @@ extern "C"
          */
         char *query;
 
+        /**
+         * The size of the buffer \p query points to
+         * \private
+         */
+        size_t queryCapacity;
+
+        /**
+         * Set when the operation has been reset and its buffers may be reused
+         * \private
+         */
+        unsigned int recycle;
+
+        /**
+         * Set when \p async stays initialised between queries, see ::odbxuv_op_query_acquire
+         * \private
+         */
+        unsigned char persistentAsync;
+
         /**
          * Query fetch flags
          */
         odbxuv_query_fetch_e flags;
 
+        /**
+         * Copy of the settings passed to ::odbxuv_query_ex
+         */
+        odbxuv_query_config_t config;
+
         /**
          * The amount of rows to fetch at once
+         * \note Read only, set from \p chunkSize of the config and resized with \p chunkBytes
          */
         int chunkSize;
 
@@ -462,41 +1079,271 @@ extern "C"
          */
         unsigned int affectedCount;
 
+        /**
+         * The amount of rows of the result, set once they are fetched
+         * \note Read only
+         */
+        uint64_t rowCount;
+
         /**
          * An array of column info
          * May be NULL when hasn't been set
+         * \note Read only, points into \p metadata
          */
         odbxuv_column_info_t *columns;
 
         /**
-         * The list of rows that have been fetched
+         * The column info shared by the results with the same columns
+         * May be NULL when hasn't been set
+         * \note Read only, equal pointers mean equal columns
+         */
+        const odbxuv_metadata_t *metadata;
+
+        /**
+         * The list of rows that have been fetched but not yet been processed
+         * \private
          */
         odbxuv_row_t *row;
 
+        /**
+         * The last row in \p row
+         * \private
+         */
+        odbxuv_row_t *rowTail;
+
+        /**
+         * Processed rows that the worker may reuse
+         * \private
+         */
+        odbxuv_row_t *freeRow;
+
+        /**
+         * Rows the worker fetched but did not hand to the loop yet
+         * \private
+         */
+        odbxuv_row_t *batch;
+
+        /**
+         * The last row in \p batch
+         * \private
+         */
+        odbxuv_row_t *batchTail;
+
+        /**
+         * The amount of rows in \p batch
+         * \private
+         */
+        unsigned int batchCount;
+
+        /**
+         * The time the first row of \p batch was fetched, in nanoseconds
+         * \private
+         */
+        uint64_t batchStart;
+
+        /**
+         * Processed rows the worker took over for reuse
+         * \private
+         */
+        odbxuv_row_t *workerFreeRow;
+
         /**
          * The callback to the fetch function
          */
         odbxuv_fetch_cb cb;
 
+        /**
+         * The loop the fetch callback runs on, the loop of the connection when \p NULL
+         * \private
+         */
+        uv_loop_t *loop;
+
+        /**
+         * Bookkeeping of the pool loop the operation was submitted from, see ::odbxuv_pool_loop_query
+         * \private
+         */
+        void *remote;
+
         /**
          * Async handle to call the fetch callback on the event loop
          * \private
          */
         uv_async_t async;
 
-        unsigned char asyncStatus : 2;
+        /**
+         * The state of \p async, protected by the connection lock
+         * \private
+         */
+        unsigned char asyncStatus;
 
         /**
-         * Werther the query fetching has been finished
+         * Werther the query fetching has been finished, protected by the connection lock
          * \private
          */
-        odbxuv_fetch_status_e fetchStatus : 4;
+        odbxuv_fetch_status_e fetchStatus;
 
         /**
          * Werther the fetch callback has been called with fetch_first status yet
          * \private
          */
-        odbxuv_fetch_cb_status_e fetchCallbackStatus : 2;
+        odbxuv_fetch_cb_status_e fetchCallbackStatus;
+
+        /**
+         * The callback of ::odbxuv_query_process_batch, replaces \p cb
+         * \private
+         */
+        odbxuv_fetch_batch_cb batchCallback;
+
+        /**
+         * Rows a batch callback holds on to
+         * \private
+         */
+        odbxuv_row_t *held;
+
+        /**
+         * The last row in \p held
+         * \private
+         */
+        odbxuv_row_t *heldTail;
+
+        /**
+         * Set while no rows are delivered, see ::ODBXUV_BATCH_HOLD
+         * \private
+         */
+        unsigned char paused;
+
+        /**
+         * Bytes taken by the fetched rows the loop did not hand back yet, protected by the connection lock
+         * \private
+         */
+        size_t bufferedBytes;
+
+        /**
+         * Bytes taken by the rows in \p batch
+         * \private
+         */
+        size_t batchBytes;
+
+        /**
+         * Set once the worker writes the rows to the spill file instead, see \p spillThreshold
+         * \private
+         */
+        unsigned char spilling;
+
+        /**
+         * The unlinked spill file, valid while \p spilling is set
+         * \private
+         */
+        int spillFile;
+
+        /**
+         * Rows the worker did not write to the spill file yet
+         * \private
+         */
+        char *spillBuffer;
+        size_t spillBuffered;
+
+        /**
+         * The amount of bytes in the spill file
+         * \private
+         */
+        uint64_t spillLength;
+
+        /**
+         * The spill file mapped by the loop and how far it has been replayed
+         * \private
+         */
+        char *spillMap;
+        uint64_t spillPos;
+
+        /**
+         * Rows pointing into \p spillMap, reused for every replayed batch
+         * \private
+         */
+        odbxuv_row_t *spillRows;
+        unsigned int spillRowCount;
+
+        /**
+         * The shared values of ::ODBXUV_QUERY_FETCH_DICTIONARY, created by the worker
+         * \private
+         */
+        struct _odbxuv_dictionary_s *dictionary;
+
+        /**
+         * Reference to the column info table of the connection the operation was submitted to,
+         * tells whether the connection closed once the operation outlives it
+         * \private
+         */
+        struct _odbxuv_metadata_table_s *metadataTable;
+
+        /**
+         * Values of the row being passed to the row hook by the worker
+         * \private
+         */
+        const char **hookValues;
+        unsigned long *hookLengths;
+        unsigned int hookCapacity;
+
+        /**
+         * The amount of rows the row hook dropped
+         * \note Read only
+         */
+        uint64_t droppedCount;
+
+        /**
+         * Bitmap of the columns selected by the config, NULL when all are copied
+         * \private
+         */
+        unsigned char *columnMask;
+
+        /**
+         * The rows shared with identical queries, see ::ODBXUV_QUERY_SHARED
+         * \note Read only
+         */
+        odbxuv_snapshot_t *snapshot;
+
+        /**
+         * The next query attached to \p snapshot
+         * \private
+         */
+        struct odbxuv_op_query_s *nextFollower;
+
+        /**
+         * The next row of \p snapshot to deliver, set once the snapshot is complete
+         * \private
+         */
+        odbxuv_row_t *snapshotRow;
+
+        /**
+         * Rows pointing to the values of \p snapshot, reused for every delivered batch
+         * \private
+         */
+        odbxuv_row_t *snapshotRows;
+        unsigned int snapshotRowCount;
+
+        /**
+         * Bytes held by the rows, column info, query string and error of the operation
+         * \note Read only
+         */
+        uint64_t memoryUsed;
+
+        /**
+         * Bytes the worker allocated that were not added to the connection and global totals yet
+         * \private
+         */
+        int64_t memoryPending;
+
+        /**
+         * Set by the worker while a memory limit is exceeded
+         * \private
+         */
+        unsigned char memoryExceeded;
+
+        /**
+         * Set while the worker waits for rows to reuse
+         * \private
+         */
+        unsigned char memoryWaiting;
     };
 
     /**
@@ -520,6 +1367,61 @@ extern "C"
         int type;
     };
 
+    /**
+     * Column info of a result, created once per connection for every combination of
+     * column names and types and shared by all results having it.
+     */
+    struct odbxuv_metadata_s
+    {
+        /**
+         * The amount of results using it
+         * \private
+         */
+        unsigned int refs;
+
+        /**
+         * Whether the connection keeps it or it belongs to a single result
+         * \note Read only
+         */
+        unsigned char interned;
+
+        /**
+         * Next entry in the same bucket
+         * \private
+         */
+        struct odbxuv_metadata_s *next;
+
+        /**
+         * Hash of the columns and the fetch flags
+         * \private
+         */
+        uint32_t hash;
+
+        /**
+         * ::ODBXUV_QUERY_FETCH_NAME and ::ODBXUV_QUERY_FETCH_TYPE of the query that created it
+         * \note Read only
+         */
+        int flags;
+
+        /**
+         * The bytes allocated for it
+         * \private
+         */
+        size_t size;
+
+        /**
+         * The amount of columns
+         * \note Read only
+         */
+        unsigned int columnCount;
+
+        /**
+         * The column info, the names are stored behind it
+         * \note Read only
+         */
+        odbxuv_column_info_t columns[];
+    };
+
     /**
      * A fetched row
      */
@@ -541,9 +1443,101 @@ extern "C"
 
         /**
          * Pointer to the next result
-         * \private
+         * The next row of the batch for a ::odbxuv_fetch_batch_cb
+         * \note Read only
          */
         odbxuv_row_t *next;
+
+        /**
+         * What the row hook of the query stored for ::ODBXUV_ROW_EMIT, NULL otherwise
+         * \note Read only
+         */
+        void *user;
+
+        /**
+         * Bytes taken by the row and its values
+         * \private
+         */
+        size_t size;
+    };
+
+    /**
+     * The result of a query with ::ODBXUV_QUERY_SHARED, shared by the identical queries attached to it.
+     * The worker fetches the whole result into it once, afterwards every query delivers all of its rows
+     * and it does not change anymore. The values belong to the snapshot and are read only.
+     * The rows count for the query fetching them until it is complete, then only in ::odbxuv_memory_used
+     * as it may outlive the connection.
+     */
+    struct odbxuv_snapshot_s
+    {
+        /**
+         * The amount of queries and callers holding it
+         * \private
+         */
+        unsigned int refs;
+
+        /**
+         * Set by the worker once all rows are fetched, protected by the connection lock
+         * \private
+         */
+        unsigned char complete;
+
+        /**
+         * Set once the query callback of \p leader ran, the followers attached afterwards are answered right away
+         * \private
+         */
+        unsigned char answered;
+
+        /**
+         * The query that runs, the others follow it
+         * \private
+         */
+        odbxuv_op_query_t *leader;
+
+        /**
+         * The queries attached to it, linked through \p nextFollower
+         * \private
+         */
+        odbxuv_op_query_t *followers;
+
+        /**
+         * The query with its whitespace normalised, its hash and fetch flags
+         * \private
+         */
+        char *query;
+        uint32_t hash;
+        odbxuv_query_fetch_e flags;
+
+        /**
+         * The next snapshot still fetching on the connection
+         * \private
+         */
+        odbxuv_snapshot_t *next;
+
+        /**
+         * The rows, linked through \p next
+         * \note Read only
+         */
+        odbxuv_row_t *rows;
+
+        /**
+         * The last row in \p rows
+         * \private
+         */
+        odbxuv_row_t *rowsTail;
+
+        /**
+         * The amount of rows and of columns
+         * \note Read only
+         */
+        uint64_t rowCount;
+        unsigned int columnCount;
+
+        /**
+         * Bytes taken by the rows
+         * \note Read only
+         */
+        size_t size;
     };
 
     /**
@@ -557,8 +1551,37 @@ extern "C"
      */
     int odbxuv_init_connection(odbxuv_connection_t *connection, uv_loop_t *loop);
 
+    /**
+     * The bytes held by the query operations of all connections.
+     * Errors are included here but not in the totals of the connections.
+     * \public
+     */
+    uint64_t odbxuv_memory_used(void);
+
+    /**
+     * Sets the most bytes the query operations of all connections may hold together, 0 disables the limit.
+     * \sa odbxuv_memory_policy_e
+     * \public
+     */
+    void odbxuv_memory_set_limit(uint64_t limit);
+
+    /**
+     * Copies the counters of a connection.
+     * Safe to call while the worker is running.
+     * \public
+     */
+    void odbxuv_connection_counters(odbxuv_connection_t *connection, odbxuv_connection_counters_t *counters);
+
+    /**
+     * Returns the status of a connection.
+     * Safe to call while the worker is running, it changes the status when the connection is lost.
+     * \public
+     */
+    odbxuv_connection_status_e odbxuv_connection_get_status(odbxuv_connection_t *connection);
+
     /**
      * Closes an odbx handle
+     * The query operations of a connection have to be freed before closing it.
      * \public
      */
     void odbxuv_close(odbxuv_handle_t *handle, odbxuv_close_cb callback);
@@ -609,6 +1632,23 @@ extern "C"
      */
     int odbxuv_query(odbxuv_connection_t *connection, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, odbxuv_op_query_cb callback);
 
+    /**
+     * Runs a query on the database with additional settings
+     * Returns ::ODBXUV_ERR_OVERLOAD without queueing the query when the queue of the connection is full,
+     * the callback is not called then.
+     * \note The query string and \p config are internally copied, \p config may be \p NULL
+     * \public
+     */
+    int odbxuv_query_ex(odbxuv_connection_t *connection, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, const odbxuv_query_config_t *config, odbxuv_op_query_cb callback);
+
+    /**
+     * Runs a query like ::odbxuv_query_ex on an operation reset with ::odbxuv_op_reset
+     * or acquired with ::odbxuv_op_query_acquire, reusing its buffers.
+     * \note ::odbxuv_query and ::odbxuv_query_ex always start from a clean operation
+     * \public
+     */
+    int odbxuv_query_recycled(odbxuv_connection_t *connection, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, const odbxuv_query_config_t *config, odbxuv_op_query_cb callback);
+
     /**
      * Starts processing the rows of a query
      * Should be called inside the ::odbxuv_op_query_cb callback
@@ -616,6 +1656,85 @@ extern "C"
      */
     int odbxuv_query_process(odbxuv_op_query_t *result, odbxuv_fetch_cb onQueryRow);
 
+    /**
+     * Starts processing the rows of a query a batch at a time.
+     * Every wakeup of the loop hands all rows fetched until then to \p onRows at once.
+     * \sa odbxuv_query_process
+     * \public
+     */
+    int odbxuv_query_process_batch(odbxuv_op_query_t *result, odbxuv_fetch_batch_cb onRows);
+
+    /**
+     * Hands back the rows a batch callback held on to and continues delivering rows.
+     * The next batch is delivered from the loop, never from inside this call.
+     * \public
+     */
+    int odbxuv_query_resume(odbxuv_op_query_t *result);
+
+
+    /**
+     * Resets an operation after it finished so it can be submitted again.
+     * Unlike ::odbxuv_free_handle the query buffer and the fetched rows of a query are kept for the next use,
+     * submit a reset query with ::odbxuv_query_recycled.
+     * Call ::odbxuv_free_handle before freeing a reset operation.
+     * \public
+     */
+    void odbxuv_op_reset(odbxuv_op_t *operation);
+
+    /**
+     * Makes the fetch callbacks of a queued query run on \p loop instead of the loop of its connection.
+     * The connection does not finish closing until the operation is freed or reset on \p loop.
+     * \note Call this from the loop of the connection, before the query callback ran
+     * \public
+     */
+    void odbxuv_query_hand_over(odbxuv_op_query_t *operation, uv_loop_t *loop);
+
+    /**
+     * Takes a query operation from the connection's free list or allocates a new one.
+     * The async handle of the operation stays initialised between uses,
+     * so ::odbxuv_query_process does not have to close it after the last row.
+     * Submit it with ::odbxuv_query_recycled.
+     * \note Can only be processed on the loop of the connection
+     * \warning Hand the operation back with ::odbxuv_op_query_release instead of freeing it,
+     * and release every acquired operation before closing the connection.
+     * \public
+     */
+    odbxuv_op_query_t *odbxuv_op_query_acquire(odbxuv_connection_t *connection);
+
+    /**
+     * Resets an operation from ::odbxuv_op_query_acquire and puts it back on the free list of its connection.
+     * Can be called in the fetch callback of the last row, even when the connection started closing in it.
+     * \public
+     */
+    void odbxuv_op_query_release(odbxuv_op_query_t *operation);
+
+    /**
+     * Finds out what a statement does from its leading keyword, skipping comments.
+     * Selects that lock rows, write into a table or call sequence functions count as writes,
+     * the words of those clauses naming columns or tables elsewhere don't.
+     * \public
+     */
+    odbxuv_statement_e odbxuv_query_classify(const char *query);
+
+    /**
+     * Whether a query with ::ODBXUV_QUERY_SHARED would be attached to an identical query of the connection.
+     * \public
+     */
+    int odbxuv_connection_shares(odbxuv_connection_t *connection, const char *query, odbxuv_query_fetch_e flags);
+
+    /**
+     * Takes a reference to the snapshot of a query with ::ODBXUV_QUERY_SHARED once its rows are fetched,
+     * returns \p NULL before and for other queries.
+     * \sa odbxuv_snapshot_release
+     * \public
+     */
+    odbxuv_snapshot_t *odbxuv_query_snapshot(odbxuv_op_query_t *operation);
+
+    /**
+     * Drops a reference taken by ::odbxuv_query_snapshot, the last one frees the rows.
+     * \public
+     */
+    void odbxuv_snapshot_release(odbxuv_snapshot_t *snapshot);
 
     /**
      * \}
@@ -623,4 +1742,6 @@ extern "C"
 
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
+
+#endif
@@ -0,0 +1,434 @@
+#ifndef ODBXUV_POOL_H
+#define ODBXUV_POOL_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+    /**
+     * \file odbxuv/pool.h
+     * A pool of connections to the same database
+     */
+
+    #include "odbxuv/db.h"
+
+    typedef struct odbxuv_pool_s odbxuv_pool_t;
+    typedef struct odbxuv_pool_loop_s odbxuv_pool_loop_t;
+
+    /**
+     * \defgroup pool Odbxuv connection pool
+     * \{
+     */
+
+    /**
+     * The states a connection slot of the pool can be in.
+     */
+    typedef enum odbxuv_pool_slot_status_enum
+    {
+        ODBXUV_POOL_SLOT_FREE = 0,
+        ODBXUV_POOL_SLOT_CONNECTING,
+        ODBXUV_POOL_SLOT_READY,
+        ODBXUV_POOL_SLOT_CLOSING
+    } odbxuv_pool_slot_status_e;
+
+    /**
+     * Callback invoked once the pool opened its first \p minConnections connections.
+     * Status is \p ODBX_ERR_SUCCESS when at least one connection could be opened.
+     */
+    typedef void (*odbxuv_pool_cb) (odbxuv_pool_t *pool, int status);
+
+    /**
+     * Callback invoked once all connections of the pool have been closed.
+     */
+    typedef void (*odbxuv_pool_close_cb) (odbxuv_pool_t *pool);
+
+    /**
+     * Callback invoked once a pool loop has been closed.
+     */
+    typedef void (*odbxuv_pool_loop_close_cb) (odbxuv_pool_loop_t *poolLoop);
+
+    /**
+     * A connection owned by the pool.
+     * \private
+     */
+    typedef struct odbxuv_pool_slot_s
+    {
+        /**
+         * The connection, its \p data points back to the slot
+         */
+        odbxuv_connection_t connection;
+
+        /**
+         * The pool the slot belongs to
+         */
+        odbxuv_pool_t *pool;
+
+        /**
+         * The state of the slot
+         */
+        odbxuv_pool_slot_status_e status;
+
+        /**
+         * The loop time the connection was last handed out or checked, in milliseconds
+         */
+        uint64_t lastUsed;
+
+        /**
+         * The keepalive query in flight or \p NULL
+         */
+        odbxuv_op_query_t *keepalive;
+
+        /**
+         * Set while the connection is taken out with ::odbxuv_pool_checkout
+         */
+        unsigned char checkedOut;
+    } odbxuv_pool_slot_t;
+
+    /**
+     * A pool of connections.
+     * Every connection has its own worker, so the pool opens and uses its connections in parallel
+     * on the libuv threadpool (see \p UV_THREADPOOL_SIZE).
+     */
+    struct odbxuv_pool_s
+    {
+        /**
+         * Userdata
+         * \public
+         */
+        void *data;
+
+        /**
+         * The loop the connections of the pool run their callbacks on
+         * \note Read only
+         */
+        uv_loop_t *loop;
+
+        /**
+         * The amount of connections to open when the pool starts and to keep open afterwards.
+         * \public
+         */
+        unsigned int minConnections;
+
+        /**
+         * The maximum amount of connections
+         * \note Read only, set by ::odbxuv_pool_init
+         */
+        unsigned int maxConnections;
+
+        /**
+         * The amount of connected connections without pending operations to keep around.
+         * Additional connections are opened up to \p maxConnections when there are less.
+         * \public
+         */
+        unsigned int minIdle;
+
+        /**
+         * Milliseconds a connection may be idle before the pool checks it with \p keepaliveQuery.
+         * 0 disables the keepalive.
+         * \public
+         */
+        unsigned int keepaliveInterval;
+
+        /**
+         * The query used to check idle connections, "SELECT 1" when \p NULL.
+         * \note Copied by ::odbxuv_pool_start
+         * \public
+         */
+        const char *keepaliveQuery;
+
+        /**
+         * Statistics table the connections of the pool record their queries in, see odbxuv/stats.h
+         * \public
+         */
+        struct odbxuv_stats_s *stats;
+
+        /**
+         * Slow query log the connections of the pool write to, see odbxuv/slowlog.h
+         * \public
+         */
+        struct odbxuv_slowlog_s *slowlog;
+
+        /**
+         * Queue limits of every connection of the pool, see ::odbxuv_admission_policy_t
+         * \public
+         */
+        odbxuv_admission_policy_t admission;
+
+        /**
+         * The connection slots, \p maxConnections long
+         * \private
+         */
+        odbxuv_pool_slot_t *slots;
+
+        /**
+         * Copy of the credentials used to open connections
+         * \private
+         */
+        odbxuv_op_connect_t credentials;
+
+        /**
+         * Copy of \p keepaliveQuery
+         * \private
+         */
+        char *keepaliveText;
+
+        /**
+         * The amount of slots that are not free
+         * \note Read only
+         */
+        unsigned int openCount;
+
+        /**
+         * The amount of slots that are connected
+         * \note Read only
+         */
+        unsigned int readyCount;
+
+        /**
+         * The amount of startup connections that did not report back yet
+         * \private
+         */
+        unsigned int startPending;
+
+        /**
+         * The loop time of the last failed connection attempt, in milliseconds
+         * \private
+         */
+        uint64_t failedAt;
+
+        /**
+         * The status reported to \p startCallback
+         * \private
+         */
+        int startStatus;
+
+        /**
+         * Timer checking the idle and keepalive limits
+         * \private
+         */
+        uv_timer_t timer;
+
+        /**
+         * Invoked when the startup connections are open
+         * \private
+         */
+        odbxuv_pool_cb startCallback;
+
+        /**
+         * Invoked when the pool closed
+         * \private
+         */
+        odbxuv_pool_close_cb closeCallback;
+
+        /**
+         * Set when the pool is closing
+         * \private
+         */
+        unsigned char closing;
+
+        /**
+         * The amount of handles of the pool that did not finish closing yet
+         * \private
+         */
+        unsigned int closingHandles;
+
+        /**
+         * Wakes up the loop of the pool when other loops submitted queries
+         * \private
+         */
+        uv_async_t remoteAsync;
+
+        /**
+         * Protects \p remoteQueue and \p loopCount
+         * \private
+         */
+        uv_mutex_t remoteLock;
+
+        /**
+         * Queries submitted by other loops that did not start yet
+         * \private
+         */
+        struct _odbxuv_pool_remote_s *remoteQueue;
+
+        /**
+         * The last query in \p remoteQueue
+         * \private
+         */
+        struct _odbxuv_pool_remote_s *remoteQueueTail;
+
+        /**
+         * The amount of pool loops that have not been closed
+         * \private
+         */
+        unsigned int loopCount;
+    };
+
+    /**
+     * Lets another event loop run queries on the connections of a pool.
+     * The connections stay on the loop of the pool, the query and fetch callbacks
+     * of operations submitted through a pool loop run on its own loop.
+     */
+    struct odbxuv_pool_loop_s
+    {
+        /**
+         * Userdata
+         * \public
+         */
+        void *data;
+
+        /**
+         * The pool queries are submitted to
+         * \note Read only
+         */
+        odbxuv_pool_t *pool;
+
+        /**
+         * The loop the callbacks run on
+         * \note Read only
+         */
+        uv_loop_t *loop;
+
+        /**
+         * The amount of submitted queries whose callback did not run yet
+         * \note Read only
+         */
+        unsigned int pending;
+
+        /**
+         * Wakes up \p loop when queries started
+         * \private
+         */
+        uv_async_t async;
+
+        /**
+         * Protects \p done
+         * \private
+         */
+        uv_mutex_t lock;
+
+        /**
+         * Started queries waiting for their callback
+         * \private
+         */
+        struct _odbxuv_pool_remote_s *done;
+
+        /**
+         * The last query in \p done
+         * \private
+         */
+        struct _odbxuv_pool_remote_s *doneTail;
+
+        /**
+         * Invoked when the pool loop closed
+         * \private
+         */
+        odbxuv_pool_loop_close_cb closeCallback;
+    };
+
+    /**
+     * Initializes the pool with room for \p maxConnections connections.
+     * Set the public configuration fields before calling ::odbxuv_pool_start.
+     * \public
+     */
+    int odbxuv_pool_init(odbxuv_pool_t *pool, uv_loop_t *loop, unsigned int maxConnections);
+
+    /**
+     * Opens \p minConnections connections at once using the credentials in \p credentials.
+     * \note The credentials are internally copied
+     * \public
+     */
+    int odbxuv_pool_start(odbxuv_pool_t *pool, odbxuv_op_connect_t *credentials, odbxuv_pool_cb callback);
+
+    /**
+     * Returns the connected connection with the least pending operations or \p NULL.
+     * The connection stays in the pool, queries of the pool may run on it in between.
+     * Use ::odbxuv_pool_checkout for operations that must share a session, like a transaction.
+     * \public
+     */
+    odbxuv_connection_t *odbxuv_pool_get(odbxuv_pool_t *pool);
+
+    /**
+     * Takes the connected connection with the least pending operations out of the pool until ::odbxuv_pool_return.
+     * Queries of the pool, scans and the keepalive don't use it meanwhile.
+     * Returns \p NULL when no connection that is not checked out is connected.
+     * \note The connection may still lose its session, see \p session of ::odbxuv_query_config_t
+     * \public
+     */
+    odbxuv_connection_t *odbxuv_pool_checkout(odbxuv_pool_t *pool);
+
+    /**
+     * Puts a connection taken by ::odbxuv_pool_checkout back into the pool.
+     * A connection that failed is closed and replaced.
+     * \public
+     */
+    void odbxuv_pool_return(odbxuv_pool_t *pool, odbxuv_connection_t *connection);
+
+    /**
+     * Returns the expected time until a query sent now is answered, in nanoseconds.
+     * This is the lowest query latency of the connected connections multiplied by their pending operations plus one.
+     * Returns 0 when a connection has not answered a query yet and \p UINT64_MAX when no connection is connected.
+     * \sa odbxuv_connection_counters_t
+     * \public
+     */
+    uint64_t odbxuv_pool_latency(odbxuv_pool_t *pool);
+
+    /**
+     * Runs a query on the least busy connection of the pool.
+     * Returns ::ODBXUV_ERR_NOCONNECTION when no connection is connected
+     * and ::ODBXUV_ERR_OVERLOAD when the queue of the least busy one is full.
+     * \sa odbxuv_query
+     * \public
+     */
+    int odbxuv_pool_query(odbxuv_pool_t *pool, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, odbxuv_op_query_cb callback);
+
+    /**
+     * Runs a query with additional settings on the least busy connection of the pool.
+     * A query with ::ODBXUV_QUERY_SHARED goes to the connection running an identical one instead.
+     * \sa odbxuv_query_ex
+     * \public
+     */
+    int odbxuv_pool_query_ex(odbxuv_pool_t *pool, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, const odbxuv_query_config_t *config, odbxuv_op_query_cb callback);
+
+    /**
+     * Lets \p loop submit queries to \p pool.
+     * \note Call this from the thread running \p loop
+     * \public
+     */
+    int odbxuv_pool_loop_init(odbxuv_pool_loop_t *poolLoop, odbxuv_pool_t *pool, uv_loop_t *loop);
+
+    /**
+     * Runs a query on the least busy connection of the pool from another loop.
+     * The query callback and the fetch callback of ::odbxuv_query_process run on the loop of \p poolLoop.
+     * When no connection is connected the callback gets ::ODBXUV_ERR_NOCONNECTION without setting \p operation->error.
+     * The connection running the query stays open until \p operation is freed or reset,
+     * closing the pool waits for that as well.
+     * \note Call this from the thread running the loop of \p poolLoop
+     * \warning Operations acquired with ::odbxuv_op_query_acquire can't be used
+     * \sa odbxuv_pool_query
+     * \public
+     */
+    int odbxuv_pool_loop_query(odbxuv_pool_loop_t *poolLoop, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, odbxuv_op_query_cb callback);
+
+    /**
+     * Detaches the loop from the pool once all its queries finished.
+     * \note Call this from the thread running the loop of \p poolLoop
+     * \public
+     */
+    void odbxuv_pool_loop_close(odbxuv_pool_loop_t *poolLoop, odbxuv_pool_loop_close_cb callback);
+
+    /**
+     * Closes all connections of the pool, checked out connections once they are returned.
+     * \warning Release all operations acquired from pool connections and close all pool loops before closing
+     * \public
+     */
+    void odbxuv_pool_close(odbxuv_pool_t *pool, odbxuv_pool_close_cb callback);
+
+    /**
+     * \}
+     */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef ODBXUV_ROUTER_H
+#define ODBXUV_ROUTER_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+    /**
+     * \file odbxuv/router.h
+     * Read/write splitting over a primary and replica pools
+     */
+
+    #include "odbxuv/pool.h"
+
+    typedef struct odbxuv_router_s odbxuv_router_t;
+
+    /**
+     * \defgroup router Odbxuv query router
+     * \{
+     */
+
+    /**
+     * How the router picks a replica
+     */
+    typedef enum odbxuv_router_balance_enum
+    {
+        /**
+         * Use the connected replicas in turn
+         */
+        ODBXUV_ROUTER_ROUND_ROBIN = 0,
+
+        /**
+         * Use the replica with the lowest ::odbxuv_pool_latency
+         */
+        ODBXUV_ROUTER_LEAST_LATENCY
+    } odbxuv_router_balance_e;
+
+    /**
+     * What a statement does, as far as the router is concerned
+     * \sa odbxuv_router_classify
+     */
+    typedef odbxuv_statement_e odbxuv_router_statement_e;
+
+    /**
+     * Sends statements that only read to replicas and everything else to the primary.
+     * All pools must run on the same loop.
+     */
+    struct odbxuv_router_s
+    {
+        /**
+         * Userdata
+         * \public
+         */
+        void *data;
+
+        /**
+         * The loop of the pools
+         * \note Read only
+         */
+        uv_loop_t *loop;
+
+        /**
+         * The pool writes and transactions run on
+         * \note Read only
+         */
+        odbxuv_pool_t *primary;
+
+        /**
+         * The pools reads run on, may be empty
+         * \note Read only
+         */
+        odbxuv_pool_t **replicas;
+
+        /**
+         * The amount of pools in \p replicas
+         * \note Read only
+         */
+        unsigned int replicaCount;
+
+        /**
+         * How to pick a replica
+         * \public
+         */
+        odbxuv_router_balance_e balance;
+
+        /**
+         * Milliseconds reads go to the primary after a write, so they see it
+         * even when the replicas lag behind. 0 disables this.
+         * \public
+         */
+        unsigned int pinInterval;
+
+        /**
+         * The connection of the open transaction or \p NULL, checked out of \p primary
+         * \note Read only
+         */
+        odbxuv_connection_t *transaction;
+
+        /**
+         * Set when the connection of the transaction reconnected, its statements fail until it ends
+         * \note Read only
+         */
+        unsigned char transactionLost;
+
+        /**
+         * The session of \p transaction the transaction started in
+         * \private
+         */
+        uint64_t transactionSession;
+
+        /**
+         * Loop time until reads go to the primary, in milliseconds
+         * \private
+         */
+        uint64_t pinnedUntil;
+
+        /**
+         * The replica to try first
+         * \private
+         */
+        unsigned int nextReplica;
+    };
+
+    /**
+     * Initializes the router, \p replicas is copied.
+     * \public
+     */
+    int odbxuv_router_init(odbxuv_router_t *router, odbxuv_pool_t *primary, odbxuv_pool_t **replicas, unsigned int replicaCount);
+
+    /**
+     * Same as ::odbxuv_query_classify
+     * \public
+     */
+    odbxuv_router_statement_e odbxuv_router_classify(const char *query);
+
+    /**
+     * Runs a query on a replica when it only reads, otherwise on the primary.
+     * A statement starting a transaction checks a connection out of the primary,
+     * every query runs on that connection until the transaction ends.
+     * Once the connection reconnected the statements fail with ::ODBXUV_ERR_NOCONNECTION until the transaction ends,
+     * statements that were queued already fail as well.
+     * A statement that is not queued, for example because the connection is overloaded, does not start or end a transaction.
+     * Reads fall back to the primary when no replica is connected.
+     * \note Use ::odbxuv_pool_checkout on the primary for transactions running alongside each other
+     * \sa odbxuv_pool_query
+     * \public
+     */
+    int odbxuv_router_query(odbxuv_router_t *router, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, odbxuv_op_query_cb callback);
+
+    /**
+     * Routes a query with additional settings, ::ODBXUV_QUERY_PRIMARY sends reads to the primary.
+     * \sa odbxuv_router_query
+     * \public
+     */
+    int odbxuv_router_query_ex(odbxuv_router_t *router, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, const odbxuv_query_config_t *config, odbxuv_op_query_cb callback);
+
+    /**
+     * Frees the memory of the router and returns the connection of an open transaction, the pools are not closed.
+     * \public
+     */
+    void odbxuv_router_free(odbxuv_router_t *router);
+
+    /**
+     * \}
+     */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
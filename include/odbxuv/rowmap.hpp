@@ -0,0 +1,378 @@
+#ifndef ODBXUV_ROWMAP_HPP
+#define ODBXUV_ROWMAP_HPP
+
+/**
+ * \file odbxuv/rowmap.hpp
+ * Maps the rows of a result to a struct.
+ * The columns of a struct are declared once by specialising ::odbxuv::RowDescriptor,
+ * a ::odbxuv::RowMapper resolves them against the columns of a result and then decodes
+ * every row straight into the struct by index.
+ */
+
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "odbxuv/db.h"
+
+namespace odbxuv
+{
+    /**
+     * \defgroup rowmap Odbxuv row mapping
+     * \{
+     */
+
+    /**
+     * The result does not match the struct or a value could not be decoded
+     */
+    class MappingError : public std::runtime_error
+    {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    /**
+     * A column bound to a member of \p S
+     */
+    template<typename S, typename T>
+    struct Field
+    {
+        using type = T;
+
+        const char *name;
+        T S::*member;
+    };
+
+    template<typename S, typename T>
+    constexpr Field<S, T> field(const char *name, T S::*member) noexcept
+    {
+        return Field<S, T>{name, member};
+    }
+
+    /**
+     * Specialise with a static constexpr tuple \p fields of ::odbxuv::field for every struct to map:
+     * \code
+     * template<> struct odbxuv::RowDescriptor<User>
+     * {
+     *     static constexpr auto fields = std::make_tuple(odbxuv::field("id", &User::id), odbxuv::field("name", &User::name));
+     * };
+     * \endcode
+     */
+    template<typename S>
+    struct RowDescriptor;
+
+    /**
+     * Decodes the text of a value into \p T and tells which odbx column types may hold a \p T.
+     * Specialise it to map additional member types.
+     */
+    template<typename T, typename = void>
+    struct ColumnTraits;
+
+    template<typename T>
+    struct ColumnTraits<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>>
+    {
+        static constexpr bool accepts(int type) noexcept
+        {
+            return type == ODBX_TYPE_SMALLINT || type == ODBX_TYPE_INTEGER || type == ODBX_TYPE_BIGINT
+                || type == ODBX_TYPE_DECIMAL || type == ODBX_TYPE_BOOLEAN;
+        }
+
+        static bool decode(const char *value, T &out) noexcept
+        {
+            const char *end = value + std::strlen(value);
+            std::from_chars_result result = std::from_chars(value, end, out);
+            return result.ec == std::errc() && result.ptr == end;
+        }
+    };
+
+    template<typename T>
+    struct ColumnTraits<T, std::enable_if_t<std::is_floating_point_v<T>>>
+    {
+        static constexpr bool accepts(int type) noexcept
+        {
+            return type == ODBX_TYPE_REAL || type == ODBX_TYPE_DOUBLE || type == ODBX_TYPE_FLOAT || type == ODBX_TYPE_DECIMAL
+                || ColumnTraits<long long>::accepts(type);
+        }
+
+        static bool decode(const char *value, T &out) noexcept
+        {
+            const char *end = value + std::strlen(value);
+            std::from_chars_result result = std::from_chars(value, end, out);
+            return result.ec == std::errc() && result.ptr == end;
+        }
+    };
+
+    template<>
+    struct ColumnTraits<bool>
+    {
+        static constexpr bool accepts(int type) noexcept
+        {
+            return ColumnTraits<long long>::accepts(type) || type == ODBX_TYPE_CHAR || type == ODBX_TYPE_VARCHAR;
+        }
+
+        static bool decode(const char *value, bool &out) noexcept
+        {
+            switch(value[0])
+            {
+                case '1': case 't': case 'T': case 'y': case 'Y':
+                    out = true;
+                    return true;
+
+                case '0': case 'f': case 'F': case 'n': case 'N':
+                    out = false;
+                    return true;
+            }
+
+            return false;
+        }
+    };
+
+    template<>
+    struct ColumnTraits<std::string>
+    {
+        static constexpr bool accepts(int) noexcept { return true; }
+
+        static bool decode(const char *value, std::string &out)
+        {
+            out.assign(value);
+            return true;
+        }
+    };
+
+    /**
+     * Points into the row, only valid until the row is handed back
+     */
+    template<>
+    struct ColumnTraits<std::string_view>
+    {
+        static constexpr bool accepts(int) noexcept { return true; }
+
+        static bool decode(const char *value, std::string_view &out) noexcept
+        {
+            out = value;
+            return true;
+        }
+    };
+
+    /**
+     * Points into the row like std::string_view, \p nullptr for NULL
+     */
+    template<>
+    struct ColumnTraits<const char *>
+    {
+        static constexpr bool accepts(int) noexcept { return true; }
+
+        static bool decode(const char *value, const char *&out) noexcept
+        {
+            out = value;
+            return true;
+        }
+    };
+
+    namespace detail
+    {
+        template<typename T>
+        struct Nullable
+        {
+            static constexpr bool value = false;
+        };
+
+        template<>
+        struct Nullable<const char *>
+        {
+            static constexpr bool value = true;
+        };
+
+        template<typename T>
+        struct Decoder
+        {
+            static constexpr bool accepts(int type) noexcept { return ColumnTraits<T>::accepts(type); }
+
+            static bool decode(const char *value, T &out)
+            {
+                if(value == nullptr)
+                {
+                    if constexpr (Nullable<T>::value)
+                    {
+                        out = nullptr;
+                        return true;
+                    }
+                    else
+                    {
+                        return false;
+                    }
+                }
+
+                return ColumnTraits<T>::decode(value, out);
+            }
+        };
+
+        template<typename T>
+        struct Decoder<std::optional<T>>
+        {
+            static constexpr bool accepts(int type) noexcept { return ColumnTraits<T>::accepts(type); }
+
+            static bool decode(const char *value, std::optional<T> &out)
+            {
+                if(value == nullptr)
+                {
+                    out.reset();
+                    return true;
+                }
+
+                return ColumnTraits<T>::decode(value, out.emplace());
+            }
+        };
+    }
+
+    /**
+     * Resolves the fields of \p S against the columns of a result once,
+     * afterwards every row is decoded by column index without looking at names.
+     */
+    template<typename S>
+    class RowMapper
+    {
+    public:
+        static constexpr auto &fields = RowDescriptor<S>::fields;
+        static constexpr std::size_t size = std::tuple_size_v<std::remove_cv_t<std::remove_reference_t<decltype(RowDescriptor<S>::fields)>>>;
+
+        static_assert(size > 0, "A row descriptor needs at least one field");
+
+        RowMapper() noexcept = default;
+
+        /**
+         * Binds to the result of \p query, call it once per result before decoding rows.
+         * The columns are known once the first rows arrived, so bind when handling the first batch.
+         * Fields are matched by name when the query fetched names (::ODBXUV_QUERY_FETCH_NAME),
+         * otherwise by position, and their types are checked when it fetched types.
+         * Binding again to a result sharing the interned column info of the last one is free.
+         * \throws MappingError when the query does not fetch values or a field has no or an incompatible column
+         */
+        void bind(const odbxuv_op_query_t *query)
+        {
+            if(!(query->flags & ODBXUV_QUERY_FETCH_VALUE) || (query->config.options & ODBXUV_QUERY_COUNT_ONLY))
+            {
+                bound_ = false;
+                metadata_ = nullptr;
+                throw MappingError("The query does not fetch values");
+            }
+
+            //Column info owned by a single result is freed with it and its address reused by the next one
+            if(bound_ && query->metadata != nullptr && query->metadata == metadata_ && query->metadata->interned)
+            {
+                return;
+            }
+
+            bound_ = false;
+            metadata_ = nullptr;
+
+            bool byName = (query->flags & ODBXUV_QUERY_FETCH_NAME) && query->columns != nullptr;
+            bool byType = (query->flags & ODBXUV_QUERY_FETCH_TYPE) && query->columns != nullptr;
+
+            if(!byName && query->columnCount < size)
+            {
+                throw MappingError("The result has less columns than the struct has fields");
+            }
+
+            bindFields(query, byName, byType, std::make_index_sequence<size>());
+            bound_ = true;
+            metadata_ = query->metadata;
+        }
+
+        /**
+         * Whether ::bind succeeded
+         */
+        bool bound() const noexcept { return bound_; }
+
+        /**
+         * Decodes \p row into \p out.
+         * \throws MappingError when the row has no values, like rows emitted by a row hook,
+         * or a value is NULL for a field that isn't nullable or can't be decoded
+         */
+        void decode(const odbxuv_row_t *row, S &out) const
+        {
+            if(row->value == nullptr)
+            {
+                throw MappingError("The row has no values");
+            }
+
+            decodeFields(row, out, std::make_index_sequence<size>());
+        }
+
+        S decode(const odbxuv_row_t *row) const
+        {
+            S out{};
+            decode(row, out);
+            return out;
+        }
+
+    private:
+        template<std::size_t... I>
+        void bindFields(const odbxuv_op_query_t *query, bool byName, bool byType, std::index_sequence<I...>)
+        {
+            (bindField<I>(query, byName, byType), ...);
+        }
+
+        template<std::size_t I>
+        void bindField(const odbxuv_op_query_t *query, bool byName, bool byType)
+        {
+            using T = typename std::remove_cv_t<std::remove_reference_t<decltype(std::get<I>(fields))>>::type;
+            const char *name = std::get<I>(fields).name;
+            unsigned int column = I;
+
+            if(byName)
+            {
+                for(column = 0; column < query->columnCount; column++)
+                {
+                    if(query->columns[column].name != nullptr && std::strcmp(query->columns[column].name, name) == 0) break;
+                }
+
+                if(column == query->columnCount)
+                {
+                    throw MappingError(std::string("The result has no column ") + name);
+                }
+            }
+
+            if(byType && !detail::Decoder<T>::accepts(query->columns[column].type) && query->columns[column].type != ODBX_TYPE_UNKNOWN)
+            {
+                throw MappingError(std::string("The type of column ") + name + " does not match its field");
+            }
+
+            index_[I] = column;
+        }
+
+        template<std::size_t... I>
+        void decodeFields(const odbxuv_row_t *row, S &out, std::index_sequence<I...>) const
+        {
+            (decodeField<I>(row, out), ...);
+        }
+
+        template<std::size_t I>
+        void decodeField(const odbxuv_row_t *row, S &out) const
+        {
+            using T = typename std::remove_cv_t<std::remove_reference_t<decltype(std::get<I>(fields))>>::type;
+
+            if(!detail::Decoder<T>::decode(row->value[index_[I]], out.*(std::get<I>(fields).member)))
+            {
+                throw MappingError(std::string("Can't decode the value of column ") + std::get<I>(fields).name);
+            }
+        }
+
+        std::array<unsigned int, size> index_ {};
+        const odbxuv_metadata_t *metadata_ = nullptr;
+        bool bound_ = false;
+    };
+
+    /**
+     * \}
+     */
+}
+
+#endif
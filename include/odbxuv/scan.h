@@ -0,0 +1,254 @@
+#ifndef ODBXUV_SCAN_H
+#define ODBXUV_SCAN_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+    /**
+     * \file odbxuv/scan.h
+     * Splits a query into partitions of a numeric key and runs them at once on the connections of a pool.
+     * The rows of the partitions are delivered as they arrive or merged in key order.
+     */
+
+    #include "odbxuv/pool.h"
+
+    typedef struct odbxuv_scan_s odbxuv_scan_t;
+
+    /**
+     * \defgroup scan Odbxuv partitioned scan
+     * \{
+     */
+
+    /**
+     * How a scan splits its query
+     */
+    typedef enum odbxuv_scan_partition_enum
+    {
+        /**
+         * Equal ranges of the key between \p min and \p max:
+         * <tt>select WHERE (where) AND key >= low AND key < high</tt>
+         */
+        ODBXUV_SCAN_RANGE = 0,
+
+        /**
+         * The remainder of the key: <tt>select WHERE (where) AND MOD(key, partitions) = partition</tt>,
+         * the key may not be negative
+         */
+        ODBXUV_SCAN_MODULO
+    } odbxuv_scan_partition_e;
+
+    /**
+     * In which order a scan delivers the rows of its partitions
+     */
+    typedef enum odbxuv_scan_order_enum
+    {
+        /**
+         * A batch of a partition is delivered as soon as it arrives
+         */
+        ODBXUV_SCAN_UNORDERED = 0,
+
+        /**
+         * The partitions are ordered by key and merged, every partition holds
+         * its last batch until the rows of the other partitions passed it
+         */
+        ODBXUV_SCAN_MERGED
+    } odbxuv_scan_order_e;
+
+    /**
+     * Receives the rows of a scan, linked through \p next.
+     * \p partition is the query the rows belong to.
+     * Is called with NULL as rows after the last row, \p status is negative when a partition failed.
+     * The rows are handed back when the callback returns.
+     */
+    typedef void (*odbxuv_scan_cb) (odbxuv_scan_t *scan, odbxuv_op_query_t *partition, odbxuv_row_t *rows, unsigned int count, int status);
+
+    /**
+     * A partition of a scan
+     * \private
+     */
+    typedef struct odbxuv_scan_partition_s
+    {
+        odbxuv_scan_t *scan;
+
+        /**
+         * The query of the partition, NULL once it finished
+         */
+        odbxuv_op_query_t *op;
+
+        /**
+         * The next row to merge and its key
+         */
+        odbxuv_row_t *head;
+        int64_t headKey;
+
+        /**
+         * Whether the partition holds a batch
+         */
+        unsigned char held;
+
+        /**
+         * Set while its batch callback runs, the batch is held once it returns
+         */
+        unsigned char delivering;
+    } odbxuv_scan_partition_t;
+
+    struct odbxuv_scan_s
+    {
+        /**
+         * Userdata
+         * \public
+         */
+        void *data;
+
+        /**
+         * The pool the partitions run on
+         * \note Read only
+         */
+        odbxuv_pool_t *pool;
+
+        /**
+         * The amount of partitions
+         * \note Read only, set by ::odbxuv_scan_init
+         */
+        unsigned int partitionCount;
+
+        /**
+         * How the query is split
+         * \public
+         */
+        odbxuv_scan_partition_e partitionBy;
+
+        /**
+         * The range of the key split by ::ODBXUV_SCAN_RANGE, \p max is not included
+         * \public
+         */
+        int64_t min;
+        int64_t max;
+
+        /**
+         * The order the rows are delivered in
+         * \public
+         */
+        odbxuv_scan_order_e order;
+
+        /**
+         * The index of the key column in the result, read as integer to merge
+         * \public
+         */
+        unsigned int keyColumn;
+
+        /**
+         * Fetch flags of the partitions, ::ODBXUV_QUERY_FETCH_VALUE is always added
+         * \public
+         */
+        odbxuv_query_fetch_e flags;
+
+        /**
+         * Settings of the partition queries, see ::odbxuv_query_ex
+         * \public
+         */
+        odbxuv_query_config_t config;
+
+        /**
+         * The amount of rows handed to the callback
+         * \note Read only
+         */
+        uint64_t rowCount;
+
+        /**
+         * Copies of the query parts passed to ::odbxuv_scan_init
+         * \private
+         */
+        char *select;
+        char *where;
+        char *key;
+
+        /**
+         * The partitions, \p partitionCount long
+         * \private
+         */
+        odbxuv_scan_partition_t *partitions;
+
+        /**
+         * Heap of the partitions holding rows by their next key
+         * \private
+         */
+        odbxuv_scan_partition_t **heap;
+        unsigned int heapCount;
+
+        /**
+         * The amount of partitions that are running and don't hold rows, merging waits for them
+         * \private
+         */
+        unsigned int waiting;
+
+        /**
+         * The amount of partitions that did not finish
+         * \private
+         */
+        unsigned int running;
+
+        /**
+         * Set once the rows of the partitions are dropped, by ::odbxuv_scan_stop or an error
+         * \private
+         */
+        unsigned char stopping;
+
+        /**
+         * Set while merged rows are handed to the callback
+         * \private
+         */
+        unsigned char merging;
+
+        /**
+         * The first error of a partition
+         * \private
+         */
+        int status;
+
+        /**
+         * \private
+         */
+        odbxuv_scan_cb callback;
+    };
+
+    /**
+     * Prepares a scan of \p select, without WHERE and ORDER BY clauses, split in \p partitions by the integer column \p key.
+     * \p where may be \p NULL.
+     * \public
+     */
+    int odbxuv_scan_init(odbxuv_scan_t *scan, odbxuv_pool_t *pool, const char *select, const char *where, const char *key, unsigned int partitions);
+
+    /**
+     * Queries all partitions and hands their rows to \p onRows.
+     * Returns ::ODBXUV_ERR_NOCONNECTION when the pool has no connected connection,
+     * or, for ::ODBXUV_SCAN_MERGED, fewer connected connections than partitions:
+     * every merged partition runs on its own connection.
+     * When a partition is not queued, for example because its connection is overloaded,
+     * the scan stops with its error, or returns it when no partition was queued.
+     * \public
+     */
+    int odbxuv_scan_start(odbxuv_scan_t *scan, odbxuv_scan_cb onRows);
+
+    /**
+     * Drops the rows of the partitions, the callback is called with NULL as rows once they finished.
+     * \public
+     */
+    void odbxuv_scan_stop(odbxuv_scan_t *scan);
+
+    /**
+     * Frees a scan that is not running.
+     * \public
+     */
+    void odbxuv_scan_free(odbxuv_scan_t *scan);
+
+    /**
+     * \}
+     */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef ODBXUV_SERIALIZE_H
+#define ODBXUV_SERIALIZE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+    /**
+     * \file odbxuv/serialize.h
+     * Compact binary form of a result set.
+     *
+     * A result starts with a header: the bytes 'O' 'X' 'B' and the format version,
+     * the amount of columns as varint and per column its odbx type and the length
+     * of its name as varints followed by the name.
+     * Every row is a bitmap of one bit per column, set for NULL values, followed by
+     * the length as varint and the bytes of every value that is not NULL.
+     * Varints are little endian base 128, values are not terminated.
+     */
+
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <uv.h>
+    #include "odbxuv/db.h"
+
+    typedef struct odbxuv_serializer_s odbxuv_serializer_t;
+
+    /**
+     * \defgroup serialize Odbxuv result serialisation
+     * \{
+     */
+
+    /**
+     * The format version written in the header
+     */
+    #define ODBXUV_SERIAL_VERSION 1
+
+    /**
+     * Receives the buffers filled by the worker.
+     * \p buffer is handed back to the worker when the callback returns.
+     * Invoked a last time with \p buffer \p NULL once the query finished.
+     */
+    typedef void (*odbxuv_serialized_cb) (odbxuv_op_query_t *op, const char *buffer, size_t length, int status);
+
+    /**
+     * Serialises the rows of a query into caller provided buffers on the worker,
+     * the rows are never copied into ::odbxuv_row_t.
+     * Set \p serializer of the ::odbxuv_query_config_t of one query at a time
+     * and process it with ::odbxuv_query_process_serialized.
+     * The worker waits while the loop holds all buffers.
+     */
+    struct odbxuv_serializer_s
+    {
+        /**
+         * Userdata
+         * \public
+         */
+        void *data;
+
+        /**
+         * The buffers to fill, the first one starts with the header.
+         * A row never spans two buffers.
+         * \note Read only, set by ::odbxuv_serializer_init
+         */
+        uv_buf_t *buffers;
+
+        /**
+         * The amount of buffers
+         * \note Read only
+         */
+        unsigned int bufferCount;
+
+        /**
+         * The amount of bytes written in each buffer
+         * \private
+         */
+        size_t *lengths;
+
+        /**
+         * Stack of the buffers the worker may fill
+         * \private
+         */
+        unsigned int *free;
+        unsigned int freeCount;
+
+        /**
+         * Ring of the buffers waiting for the loop
+         * \private
+         */
+        unsigned int *filled;
+        unsigned int filledStart;
+        unsigned int filledCount;
+
+        /**
+         * The buffer the worker is filling, \p bufferCount when none
+         * \private
+         */
+        unsigned int current;
+
+        /**
+         * The amount of rows in the buffer being filled and when its first row was added
+         * \private
+         */
+        unsigned int rows;
+        uint64_t bufferStart;
+
+        /**
+         * Signalled when a buffer is handed back
+         * \private
+         */
+        uv_cond_t available;
+
+        /**
+         * Values of the row being serialised by the worker
+         * \private
+         */
+        const char **values;
+        unsigned long *valueLengths;
+        unsigned int valueCapacity;
+
+        /**
+         * \private
+         */
+        odbxuv_serialized_cb callback;
+    };
+
+    /**
+     * Iterates a serialised buffer in place
+     */
+    typedef struct odbxuv_serial_reader_s
+    {
+        /**
+         * The amount of columns per row
+         * \note Read only
+         */
+        unsigned int columnCount;
+
+        /**
+         * \private
+         */
+        const unsigned char *pos;
+        const unsigned char *end;
+        const unsigned char *nulls;
+        unsigned int column;
+        unsigned int headerColumns;
+    } odbxuv_serial_reader_t;
+
+    /**
+     * Prepares a serializer filling \p count buffers.
+     * \public
+     */
+    int odbxuv_serializer_init(odbxuv_serializer_t *serializer, uv_buf_t *buffers, unsigned int count);
+
+    /**
+     * Frees the serializer, its buffers are left to the caller.
+     * \public
+     */
+    void odbxuv_serializer_free(odbxuv_serializer_t *serializer);
+
+    /**
+     * Starts delivering the buffers of a query whose config has a \p serializer.
+     * Should be called inside the ::odbxuv_op_query_cb callback.
+     * \sa odbxuv_query_process
+     * \public
+     */
+    int odbxuv_query_process_serialized(odbxuv_op_query_t *result, odbxuv_serialized_cb onBuffer);
+
+    /**
+     * Writes the header of a result with \p columnCount columns, \p columns may be \p NULL.
+     * Returns the amount of bytes written or 0 when \p size is too small.
+     * \public
+     */
+    size_t odbxuv_serialize_header(unsigned int columnCount, const odbxuv_column_info_t *columns, char *buffer, size_t size);
+
+    /**
+     * Writes a row of \p columnCount values, a \p NULL value is NULL.
+     * \p lengths may be \p NULL for zero terminated values.
+     * Returns the amount of bytes written or 0 when \p size is too small.
+     * \public
+     */
+    size_t odbxuv_serialize_values(unsigned int columnCount, const char **values, const unsigned long *lengths, char *buffer, size_t size);
+
+    /**
+     * Writes a fetched row, see ::odbxuv_serialize_values.
+     * \public
+     */
+    size_t odbxuv_serialize_row(unsigned int columnCount, const odbxuv_row_t *row, char *buffer, size_t size);
+
+    /**
+     * Starts reading \p buffer.
+     * When \p columnCount is 0 the buffer starts with the header, see ::odbxuv_serial_read_column,
+     * otherwise it holds rows of \p columnCount columns only.
+     * Returns -1 when the header is malformed.
+     * \public
+     */
+    int odbxuv_serial_reader_init(odbxuv_serial_reader_t *reader, const char *buffer, size_t length, unsigned int columnCount);
+
+    /**
+     * Reads the next column of the header.
+     * Returns 1 for a column, 0 after the last one and -1 when the buffer is malformed.
+     * \p name points into the buffer and is not zero terminated.
+     * \public
+     */
+    int odbxuv_serial_read_column(odbxuv_serial_reader_t *reader, const char **name, size_t *nameLength, int *type);
+
+    /**
+     * Moves to the next row, skipping the rest of the header or the current row.
+     * Returns 1 for a row, 0 at the end of the buffer and -1 when the buffer is malformed.
+     * \public
+     */
+    int odbxuv_serial_read_row(odbxuv_serial_reader_t *reader);
+
+    /**
+     * Reads the next value of the current row.
+     * Returns 1 for a value, 0 for NULL and -1 after the last column or when the buffer is malformed.
+     * \p value points into the buffer and is not zero terminated.
+     * \public
+     */
+    int odbxuv_serial_read_value(odbxuv_serial_reader_t *reader, const char **value, size_t *length);
+
+    /**
+     * \}
+     */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,233 @@
+#ifndef ODBXUV_SLOWLOG_H
+#define ODBXUV_SLOWLOG_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+    /**
+     * \file odbxuv/slowlog.h
+     * Log of queries that took longer than a threshold
+     */
+
+    #include <stdint.h>
+    #include <uv.h>
+
+    typedef struct odbxuv_slowlog_s odbxuv_slowlog_t;
+
+    /**
+     * \defgroup slowlog Odbxuv slow query log
+     * \{
+     */
+
+    /**
+     * The longest query text kept per record, including the terminating zero
+     */
+    #define ODBXUV_SLOWLOG_TEXT_SIZE 1024
+
+    /**
+     * Callback invoked once the log file and the handles of the log have been closed
+     */
+    typedef void (*odbxuv_slowlog_close_cb) (odbxuv_slowlog_t *slowlog);
+
+    /**
+     * A slow query as recorded by the worker
+     */
+    typedef struct odbxuv_slowlog_entry_s
+    {
+        /**
+         * Wall clock time the query finished
+         */
+        uv_timeval64_t finished;
+
+        /**
+         * The connection that ran the query
+         */
+        const void *connection;
+
+        /**
+         * Time until the database answered, in nanoseconds
+         */
+        uint64_t executeTime;
+
+        /**
+         * Time spent fetching rows after that, in nanoseconds
+         */
+        uint64_t fetchTime;
+
+        /**
+         * Amount of rows fetched
+         */
+        uint64_t rows;
+
+        /**
+         * Set when the query failed
+         */
+        unsigned char failed;
+
+        /**
+         * The query, normalised by ::odbxuv_query_fingerprint when \p redact is set
+         */
+        char text[ODBXUV_SLOWLOG_TEXT_SIZE];
+    } odbxuv_slowlog_entry_t;
+
+    /**
+     * A slot of the ring
+     * \private
+     */
+    typedef struct odbxuv_slowlog_cell_s
+    {
+        uint64_t sequence;
+        odbxuv_slowlog_entry_t entry;
+    } odbxuv_slowlog_cell_t;
+
+    /**
+     * A slow query log.
+     * Workers put slow queries in a bounded lock free ring, the loop writes them
+     * to the file with ::uv_fs_write so neither waits for the disk.
+     * Set \p slowlog of a connection or a pool to log its queries.
+     */
+    struct odbxuv_slowlog_s
+    {
+        /**
+         * Userdata
+         * \public
+         */
+        void *data;
+
+        /**
+         * The loop writing the log
+         * \note Read only
+         */
+        uv_loop_t *loop;
+
+        /**
+         * Queries whose execution and fetch time together reach this are logged, in microseconds
+         * \public
+         */
+        uint64_t threshold;
+
+        /**
+         * Log the query with its literals replaced by '?'
+         * \public
+         */
+        unsigned char redact;
+
+        /**
+         * Amount of slow queries that were not logged because the ring was full
+         * \note Read only, updated atomically
+         */
+        uint64_t dropped;
+
+        /**
+         * Amount of slow queries that were not logged because writing the file failed
+         * \note Read only, updated atomically
+         */
+        uint64_t failed;
+
+        /**
+         * The ring, \p mask + 1 cells
+         * \private
+         */
+        odbxuv_slowlog_cell_t *cells;
+
+        /**
+         * The amount of cells minus one, the amount of cells is a power of two
+         * \private
+         */
+        uint64_t mask;
+
+        /**
+         * The next cell to fill
+         * \private
+         */
+        uint64_t enqueuePos;
+
+        /**
+         * The next cell to write
+         * \private
+         */
+        uint64_t dequeuePos;
+
+        /**
+         * The log file
+         * \private
+         */
+        uv_file file;
+
+        /**
+         * Wakes up the loop when a record was added
+         * \private
+         */
+        uv_async_t async;
+
+        /**
+         * The running write or close request
+         * \private
+         */
+        uv_fs_t req;
+
+        /**
+         * The formatted records being written
+         * \private
+         */
+        char *buffer;
+
+        /**
+         * The length of the records in \p buffer, the amount written so far and the amount of records
+         * \private
+         */
+        size_t bufferLength;
+        size_t bufferWritten;
+        unsigned int bufferRecords;
+
+        /**
+         * Set while \p req is running
+         * \private
+         */
+        unsigned char writing;
+
+        /**
+         * Set when the log is closing
+         * \private
+         */
+        unsigned char closing;
+
+        /**
+         * Invoked when the log closed
+         * \private
+         */
+        odbxuv_slowlog_close_cb closeCallback;
+    };
+
+    /**
+     * Opens \p path for appending and prepares a ring of at least \p capacity records.
+     * Returns a negative libuv error code when the file can't be opened.
+     * \public
+     */
+    int odbxuv_slowlog_open(odbxuv_slowlog_t *slowlog, uv_loop_t *loop, const char *path, unsigned int capacity);
+
+    /**
+     * Adds a query to the log when it reached the threshold.
+     * This is thread safe and never blocks, the workers call it for connections with \p slowlog set.
+     * Returns 0 when the query was not added.
+     * \public
+     */
+    int odbxuv_slowlog_record(odbxuv_slowlog_t *slowlog, const void *connection, const char *query, uint64_t executeTime, uint64_t fetchTime, uint64_t rows, unsigned char failed);
+
+    /**
+     * Writes the remaining records and closes the log.
+     * \warning No connection may record into the log anymore
+     * \public
+     */
+    void odbxuv_slowlog_close(odbxuv_slowlog_t *slowlog, odbxuv_slowlog_close_cb callback);
+
+    /**
+     * \}
+     */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef ODBXUV_STATS_H
+#define ODBXUV_STATS_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+    /**
+     * \file odbxuv/stats.h
+     * Per query fingerprint statistics
+     */
+
+    #include <stdio.h>
+    #include <stdint.h>
+    #include <uv.h>
+
+    /**
+     * \defgroup stats Odbxuv query statistics
+     * \{
+     */
+
+    /**
+     * The amount of latency histogram buckets.
+     * Bucket \p i counts queries that took less than 2^i microseconds, the last bucket counts the rest.
+     */
+    #define ODBXUV_STATS_BUCKETS 24
+
+    /**
+     * The longest normalised query text kept per fingerprint, including the terminating zero
+     */
+    #define ODBXUV_STATS_TEXT_SIZE 256
+
+    /**
+     * The aggregates of one query fingerprint
+     */
+    typedef struct odbxuv_stats_entry_s
+    {
+        /**
+         * Hash of the normalised query, 0 for the entry collecting the queries that did not fit in the table
+         */
+        uint64_t fingerprint;
+
+        /**
+         * The normalised query, cut off at ::ODBXUV_STATS_TEXT_SIZE
+         */
+        char text[ODBXUV_STATS_TEXT_SIZE];
+
+        /**
+         * Amount of times the query ran
+         */
+        uint64_t calls;
+
+        /**
+         * Amount of times the query failed
+         */
+        uint64_t errors;
+
+        /**
+         * Amount of rows fetched
+         */
+        uint64_t rows;
+
+        /**
+         * Total time from sending the query until the last row was fetched, in nanoseconds
+         */
+        uint64_t totalTime;
+
+        /**
+         * The longest time a single call took, in nanoseconds
+         */
+        uint64_t maxTime;
+
+        /**
+         * Latency histogram
+         */
+        uint64_t histogram[ODBXUV_STATS_BUCKETS];
+    } odbxuv_stats_entry_t;
+
+    /**
+     * A bounded table of query statistics shared by any amount of connections.
+     * Set \p stats of a connection or a pool to make its worker record every query.
+     */
+    typedef struct odbxuv_stats_s
+    {
+        /**
+         * Userdata
+         * \public
+         */
+        void *data;
+
+        /**
+         * The maximum amount of fingerprints
+         * \note Read only, set by ::odbxuv_stats_init
+         */
+        unsigned int capacity;
+
+        /**
+         * The amount of fingerprints in the table
+         * \note Read only
+         */
+        unsigned int count;
+
+        /**
+         * Open addressed table of \p capacity * 2 slots
+         * \private
+         */
+        odbxuv_stats_entry_t **slots;
+
+        /**
+         * Collects the queries that did not fit in the table
+         * \private
+         */
+        odbxuv_stats_entry_t overflow;
+
+        /**
+         * Protects the table, the workers of all connections record into it
+         * \private
+         */
+        uv_mutex_t lock;
+    } odbxuv_stats_t;
+
+    /**
+     * Initializes a statistics table for up to \p capacity fingerprints.
+     * \public
+     */
+    int odbxuv_stats_init(odbxuv_stats_t *stats, unsigned int capacity);
+
+    /**
+     * Normalises \p query into \p normalised and returns its fingerprint.
+     * Literals become '?', lists of literals like IN (1, 2, 3) become (...),
+     * whitespace and comments collapse into a single space and words are lowercased.
+     * \p normalised may be \p NULL, otherwise it is cut off at \p size.
+     * \public
+     */
+    uint64_t odbxuv_query_fingerprint(const char *query, char *normalised, size_t size);
+
+    /**
+     * Adds one call of \p query to its fingerprint.
+     * This is thread safe, the workers call it for connections with \p stats set.
+     * \public
+     */
+    void odbxuv_stats_record(odbxuv_stats_t *stats, const char *query, uint64_t time, uint64_t rows, unsigned char failed);
+
+    /**
+     * Copies up to \p max entries ordered by \p totalTime, highest first, and returns how many were copied.
+     * \public
+     */
+    unsigned int odbxuv_stats_snapshot(odbxuv_stats_t *stats, odbxuv_stats_entry_t *entries, unsigned int max);
+
+    /**
+     * Writes all entries as tab separated lines ordered by \p totalTime to \p out.
+     * \public
+     */
+    void odbxuv_stats_dump(odbxuv_stats_t *stats, FILE *out);
+
+    /**
+     * Removes all fingerprints.
+     * \public
+     */
+    void odbxuv_stats_reset(odbxuv_stats_t *stats);
+
+    /**
+     * Frees the table, no connection may record into it anymore.
+     * \public
+     */
+    void odbxuv_stats_free(odbxuv_stats_t *stats);
+
+    /**
+     * \}
+     */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,687 @@
+#include "odbxuv/aggregate.h"
+#include <assert.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+/**
+ * The buckets of a new hash table of groups
+ * \internal
+ */
+#define ODBXUV_AGGREGATE_BUCKETS 64
+
+/**
+ * Long enough for every number written by _aggregate_format
+ * \internal
+ */
+#define ODBXUV_AGGREGATE_NUMBER_SIZE 48
+
+/**
+ * The marker of a NULL group value in a key
+ * \internal
+ */
+#define ODBXUV_AGGREGATE_NULL UINT32_MAX
+
+/**
+ * The running value of an aggregate function in a group
+ * \internal
+ */
+typedef struct _odbxuv_aggregate_state_s
+{
+    uint64_t count;
+    double value;
+
+    /**
+     * The exact total of SUM and AVG while every value was an integer and it did not overflow,
+     * afterwards \p inexact is set and \p value holds the total
+     */
+    int64_t total;
+    unsigned char inexact;
+} _odbxuv_aggregate_state_t;
+
+struct odbxuv_aggregate_entry_s
+{
+    odbxuv_aggregate_entry_t *next;
+    uint32_t hash;
+
+    /**
+     * The value of the order column of a kept row
+     */
+    double order;
+
+    /**
+     * The values of a kept row and the bytes they hold
+     */
+    char **values;
+    size_t valuesSize;
+
+    /**
+     * The states of a group and its group values as key, the states are stored after the key
+     */
+    _odbxuv_aggregate_state_t *states;
+    size_t keyLength;
+    unsigned char key[];
+};
+
+static uint32_t _aggregate_hash(const unsigned char *data, size_t length)
+{
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for(i = 0; i < length; i++)
+    {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+/**
+ * Reads a zero terminated value as number, returns 0 when it is NULL or not a number.
+ */
+static int _aggregate_number(const char *value, double *number)
+{
+    char *end;
+
+    if(value == NULL) return 0;
+
+    *number = strtod(value, &end);
+    if(end == value) return 0;
+
+    while(*end == ' ') end++;
+
+    return *end == '\0';
+}
+
+/**
+ * Reads a zero terminated number as integer, returns 0 when it has a fraction, an exponent or does not fit.
+ */
+static int _aggregate_integer(const char *value, int64_t *integer)
+{
+    char *end;
+
+    errno = 0;
+    *integer = strtoll(value, &end, 10);
+    if(end == value || errno == ERANGE) return 0;
+
+    while(*end == ' ') end++;
+
+    return *end == '\0';
+}
+
+static char *_aggregate_copy(const char *value, size_t length)
+{
+    char *copy = malloc(length + 1);
+    memcpy(copy, value, length);
+    copy[length] = '\0';
+
+    return copy;
+}
+
+static char *_aggregate_format(const char *format, ...)
+{
+    char buffer[ODBXUV_AGGREGATE_NUMBER_SIZE];
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    return _aggregate_copy(buffer, (size_t)length);
+}
+
+static void _aggregate_reserve(odbxuv_aggregate_t *aggregate)
+{
+    if(aggregate->entryCount < aggregate->entryCapacity) return;
+
+    aggregate->size -= sizeof(odbxuv_aggregate_entry_t *) * aggregate->entryCapacity;
+    aggregate->entryCapacity = aggregate->entryCapacity ? aggregate->entryCapacity * 2 : ODBXUV_AGGREGATE_BUCKETS;
+    aggregate->entries = realloc(aggregate->entries, sizeof(odbxuv_aggregate_entry_t *) * aggregate->entryCapacity);
+    aggregate->size += sizeof(odbxuv_aggregate_entry_t *) * aggregate->entryCapacity;
+}
+
+static void _aggregate_free_entry(odbxuv_aggregate_t *aggregate, odbxuv_aggregate_entry_t *entry)
+{
+    if(entry->values != NULL)
+    {
+        unsigned int i;
+        for(i = 0; i < aggregate->columnCount; i++)
+        {
+            free(entry->values[i]);
+        }
+
+        free(entry->values);
+    }
+
+    free(entry);
+}
+
+/*
+ * Grouping:
+ */
+
+/**
+ * Writes the group values of a row into \p key, every value as its length followed by its bytes.
+ * Returns the length of the key.
+ */
+static size_t _aggregate_key(odbxuv_aggregate_t *aggregate, const char **values, const unsigned long *lengths)
+{
+    size_t needed = sizeof(uint32_t) * aggregate->groupCount;
+    unsigned int i;
+
+    for(i = 0; i < aggregate->groupCount; i++)
+    {
+        unsigned int column = aggregate->groupColumns[i];
+
+        if(values[column] != NULL) needed += lengths != NULL ? lengths[column] : strlen(values[column]);
+    }
+
+    //Grouping by no columns still has an empty key
+    if(aggregate->key == NULL || aggregate->keyCapacity < needed)
+    {
+        aggregate->key = realloc(aggregate->key, needed + 1);
+        aggregate->keyCapacity = needed + 1;
+    }
+
+    unsigned char *out = aggregate->key;
+
+    for(i = 0; i < aggregate->groupCount; i++)
+    {
+        unsigned int column = aggregate->groupColumns[i];
+        uint32_t length = ODBXUV_AGGREGATE_NULL;
+
+        if(values[column] != NULL) length = (uint32_t)(lengths != NULL ? lengths[column] : strlen(values[column]));
+
+        memcpy(out, &length, sizeof(uint32_t));
+        out += sizeof(uint32_t);
+
+        if(length != ODBXUV_AGGREGATE_NULL)
+        {
+            memcpy(out, values[column], length);
+            out += length;
+        }
+    }
+
+    return needed;
+}
+
+/**
+ * Doubles the hash table once it holds as many groups as buckets.
+ */
+static void _aggregate_grow(odbxuv_aggregate_t *aggregate)
+{
+    if(aggregate->buckets != NULL && aggregate->entryCount < aggregate->bucketCount) return;
+
+    aggregate->size -= sizeof(odbxuv_aggregate_entry_t *) * aggregate->bucketCount;
+    aggregate->bucketCount = aggregate->bucketCount ? aggregate->bucketCount * 2 : ODBXUV_AGGREGATE_BUCKETS;
+    aggregate->size += sizeof(odbxuv_aggregate_entry_t *) * aggregate->bucketCount;
+
+    free(aggregate->buckets);
+    aggregate->buckets = calloc(aggregate->bucketCount, sizeof(odbxuv_aggregate_entry_t *));
+
+    unsigned int i;
+    for(i = 0; i < aggregate->entryCount; i++)
+    {
+        odbxuv_aggregate_entry_t *entry = aggregate->entries[i];
+        unsigned int bucket = entry->hash & (aggregate->bucketCount - 1);
+
+        entry->next = aggregate->buckets[bucket];
+        aggregate->buckets[bucket] = entry;
+    }
+}
+
+static odbxuv_aggregate_entry_t *_aggregate_group(odbxuv_aggregate_t *aggregate, size_t keyLength)
+{
+    uint32_t hash = _aggregate_hash(aggregate->key, keyLength);
+
+    _aggregate_grow(aggregate);
+
+    unsigned int bucket = hash & (aggregate->bucketCount - 1);
+    odbxuv_aggregate_entry_t *entry;
+
+    for(entry = aggregate->buckets[bucket]; entry != NULL; entry = entry->next)
+    {
+        if(entry->hash == hash && entry->keyLength == keyLength && memcmp(entry->key, aggregate->key, keyLength) == 0) return entry;
+    }
+
+    size_t statesSize = sizeof(_odbxuv_aggregate_state_t) * aggregate->functionCount;
+    size_t size = sizeof(odbxuv_aggregate_entry_t) + keyLength + statesSize + sizeof(double);
+
+    //The states follow the key, aligned
+    entry = malloc(size);
+    memset(entry, 0, sizeof(odbxuv_aggregate_entry_t));
+    entry->hash = hash;
+    entry->keyLength = keyLength;
+    entry->states = (_odbxuv_aggregate_state_t *)(((uintptr_t)(entry->key + keyLength) + sizeof(double) - 1) & ~(uintptr_t)(sizeof(double) - 1));
+    memset(entry->states, 0, statesSize);
+    memcpy(entry->key, aggregate->key, keyLength);
+
+    entry->next = aggregate->buckets[bucket];
+    aggregate->buckets[bucket] = entry;
+
+    _aggregate_reserve(aggregate);
+    aggregate->entries[aggregate->entryCount++] = entry;
+    aggregate->size += size;
+
+    return entry;
+}
+
+static void _aggregate_update(odbxuv_aggregate_t *aggregate, odbxuv_aggregate_entry_t *entry, const char **values)
+{
+    unsigned int i;
+
+    for(i = 0; i < aggregate->functionCount; i++)
+    {
+        const odbxuv_aggregate_column_t *function = &aggregate->functions[i];
+        _odbxuv_aggregate_state_t *state = &entry->states[i];
+        double number;
+
+        if(function->function == ODBXUV_AGGREGATE_COUNT)
+        {
+            if(function->column == ODBXUV_AGGREGATE_ALL || values[function->column] != NULL) state->count++;
+            continue;
+        }
+
+        if(!_aggregate_number(values[function->column], &number)) continue;
+
+        switch(function->function)
+        {
+            case ODBXUV_AGGREGATE_MIN:
+                if(state->count == 0 || number < state->value) state->value = number;
+                break;
+
+            case ODBXUV_AGGREGATE_MAX:
+                if(state->count == 0 || number > state->value) state->value = number;
+                break;
+
+            default:
+            {
+                int64_t integer;
+
+                if(!state->inexact && _aggregate_integer(values[function->column], &integer)
+                    && !__builtin_add_overflow(state->total, integer, &integer))
+                {
+                    state->total = integer;
+                    break;
+                }
+
+                //Continue in floating point from the exact total
+                if(!state->inexact)
+                {
+                    state->value = (double)state->total;
+                    state->inexact = 1;
+                }
+
+                state->value += number;
+            }
+            break;
+        }
+
+        state->count++;
+    }
+}
+
+/**
+ * Formats the average of an exact total, the integer part stays exact.
+ */
+static char *_aggregate_format_average(int64_t total, uint64_t count)
+{
+    uint64_t magnitude = total < 0 ? 0 - (uint64_t)total : (uint64_t)total;
+    uint64_t whole = magnitude / count;
+    char fraction[ODBXUV_AGGREGATE_NUMBER_SIZE];
+    size_t length;
+
+    snprintf(fraction, sizeof(fraction), "%.17f", (double)(magnitude % count) / (double)count);
+
+    //A remainder close to the count rounds up to the next integer
+    if(fraction[0] == '1')
+    {
+        whole++;
+        fraction[1] = '\0';
+    }
+
+    for(length = strlen(fraction); fraction[length - 1] == '0'; length--)
+    {
+        fraction[length - 1] = '\0';
+    }
+
+    if(fraction[length - 1] == '.') fraction[length - 1] = '\0';
+
+    return _aggregate_format("%s%llu%s", total < 0 && (whole > 0 || fraction[1] != '\0') ? "-" : "", (unsigned long long)whole, fraction + 1);
+}
+
+static void _aggregate_emit_group(odbxuv_aggregate_t *aggregate, odbxuv_aggregate_entry_t *entry, char **values)
+{
+    const unsigned char *key = entry->key;
+    unsigned int i;
+
+    for(i = 0; i < aggregate->groupCount; i++)
+    {
+        uint32_t length;
+
+        memcpy(&length, key, sizeof(uint32_t));
+        key += sizeof(uint32_t);
+
+        if(length == ODBXUV_AGGREGATE_NULL)
+        {
+            values[i] = NULL;
+            continue;
+        }
+
+        values[i] = _aggregate_copy((const char *)key, length);
+        key += length;
+    }
+
+    for(i = 0; i < aggregate->functionCount; i++)
+    {
+        _odbxuv_aggregate_state_t *state = &entry->states[i];
+        char **value = &values[aggregate->groupCount + i];
+
+        if(aggregate->functions[i].function == ODBXUV_AGGREGATE_COUNT)
+        {
+            *value = _aggregate_format("%llu", (unsigned long long)state->count);
+        }
+        else if(state->count == 0)
+        {
+            *value = NULL;
+        }
+        else if(aggregate->functions[i].function == ODBXUV_AGGREGATE_AVG)
+        {
+            *value = state->inexact ? _aggregate_format("%.17g", state->value / (double)state->count) : _aggregate_format_average(state->total, state->count);
+        }
+        else if(aggregate->functions[i].function == ODBXUV_AGGREGATE_SUM)
+        {
+            *value = state->inexact ? _aggregate_format("%.17g", state->value) : _aggregate_format("%lld", (long long)state->total);
+        }
+        else
+        {
+            *value = _aggregate_format("%.17g", state->value);
+        }
+    }
+}
+
+/*
+ * Top:
+ */
+
+/**
+ * Whether kept row \p a goes after \p b, the worst row is the root of the heap
+ */
+static int _aggregate_worse(odbxuv_aggregate_t *aggregate, odbxuv_aggregate_entry_t *a, odbxuv_aggregate_entry_t *b)
+{
+    return aggregate->descending ? a->order < b->order : a->order > b->order;
+}
+
+static void _aggregate_heap_up(odbxuv_aggregate_t *aggregate, unsigned int index)
+{
+    odbxuv_aggregate_entry_t **heap = aggregate->entries;
+
+    while(index > 0)
+    {
+        unsigned int parent = (index - 1) / 2;
+
+        if(!_aggregate_worse(aggregate, heap[index], heap[parent])) break;
+
+        odbxuv_aggregate_entry_t *swap = heap[index];
+        heap[index] = heap[parent];
+        heap[parent] = swap;
+        index = parent;
+    }
+}
+
+static void _aggregate_heap_down(odbxuv_aggregate_t *aggregate, unsigned int index, unsigned int count)
+{
+    odbxuv_aggregate_entry_t **heap = aggregate->entries;
+
+    for(;;)
+    {
+        unsigned int worst = index;
+        unsigned int child = index * 2 + 1;
+
+        if(child < count && _aggregate_worse(aggregate, heap[child], heap[worst])) worst = child;
+        if(child + 1 < count && _aggregate_worse(aggregate, heap[child + 1], heap[worst])) worst = child + 1;
+
+        if(worst == index) break;
+
+        odbxuv_aggregate_entry_t *swap = heap[index];
+        heap[index] = heap[worst];
+        heap[worst] = swap;
+        index = worst;
+    }
+}
+
+/**
+ * Replaces the values of a kept row by copies of \p values.
+ */
+static void _aggregate_keep(odbxuv_aggregate_t *aggregate, odbxuv_aggregate_entry_t *entry, const char **values, const unsigned long *lengths)
+{
+    unsigned int i;
+
+    aggregate->size -= entry->valuesSize;
+    entry->valuesSize = 0;
+
+    for(i = 0; i < aggregate->columnCount; i++)
+    {
+        if(entry->values[i] != NULL)
+        {
+            free(entry->values[i]);
+            entry->values[i] = NULL;
+        }
+
+        if(values[i] != NULL)
+        {
+            size_t length = lengths != NULL ? lengths[i] : strlen(values[i]);
+
+            entry->values[i] = _aggregate_copy(values[i], length);
+            entry->valuesSize += length + 1;
+        }
+    }
+
+    aggregate->size += entry->valuesSize;
+}
+
+static void _aggregate_add_top(odbxuv_aggregate_t *aggregate, const char **values, const unsigned long *lengths)
+{
+    double order;
+
+    if(aggregate->limit == 0 || !_aggregate_number(values[aggregate->orderColumn], &order)) return;
+
+    if(aggregate->entryCount < aggregate->limit)
+    {
+        size_t size = sizeof(odbxuv_aggregate_entry_t) + sizeof(char *) * aggregate->columnCount;
+        odbxuv_aggregate_entry_t *entry = malloc(sizeof(odbxuv_aggregate_entry_t));
+
+        memset(entry, 0, sizeof(odbxuv_aggregate_entry_t));
+        entry->order = order;
+        entry->values = calloc(aggregate->columnCount, sizeof(char *));
+        aggregate->size += size;
+
+        _aggregate_keep(aggregate, entry, values, lengths);
+
+        _aggregate_reserve(aggregate);
+        aggregate->entries[aggregate->entryCount++] = entry;
+        _aggregate_heap_up(aggregate, aggregate->entryCount - 1);
+        return;
+    }
+
+    odbxuv_aggregate_entry_t *root = aggregate->entries[0];
+
+    if(aggregate->descending ? order <= root->order : order >= root->order) return;
+
+    root->order = order;
+    _aggregate_keep(aggregate, root, values, lengths);
+    _aggregate_heap_down(aggregate, 0, aggregate->entryCount);
+}
+
+/*
+ * API:
+ */
+
+int odbxuv_aggregate_group_init(odbxuv_aggregate_t *aggregate, const unsigned int *groupColumns, unsigned int groupCount, const odbxuv_aggregate_column_t *functions, unsigned int count)
+{
+    assert((groupCount == 0 || groupColumns != NULL) && (count == 0 || functions != NULL));
+
+    void *data = aggregate->data;
+    memset(aggregate, 0, sizeof(odbxuv_aggregate_t));
+    aggregate->data = data;
+
+    aggregate->mode = ODBXUV_AGGREGATE_GROUP;
+    aggregate->groupCount = groupCount;
+    aggregate->functionCount = count;
+    aggregate->columnCount = groupCount + count;
+
+    if(groupCount > 0)
+    {
+        aggregate->groupColumns = malloc(sizeof(unsigned int) * groupCount);
+        memcpy(aggregate->groupColumns, groupColumns, sizeof(unsigned int) * groupCount);
+    }
+
+    if(count > 0)
+    {
+        aggregate->functions = malloc(sizeof(odbxuv_aggregate_column_t) * count);
+        memcpy(aggregate->functions, functions, sizeof(odbxuv_aggregate_column_t) * count);
+    }
+
+    return 0;
+}
+
+int odbxuv_aggregate_top_init(odbxuv_aggregate_t *aggregate, unsigned int column, unsigned int limit, unsigned char descending)
+{
+    void *data = aggregate->data;
+    memset(aggregate, 0, sizeof(odbxuv_aggregate_t));
+    aggregate->data = data;
+
+    aggregate->mode = ODBXUV_AGGREGATE_TOP;
+    aggregate->orderColumn = column;
+    aggregate->limit = limit;
+    aggregate->descending = descending;
+
+    return 0;
+}
+
+void odbxuv_aggregate_reset(odbxuv_aggregate_t *aggregate)
+{
+    unsigned int i;
+
+    for(i = 0; i < aggregate->entryCount; i++)
+    {
+        _aggregate_free_entry(aggregate, aggregate->entries[i]);
+    }
+
+    if(aggregate->buckets != NULL)
+    {
+        memset(aggregate->buckets, 0, sizeof(odbxuv_aggregate_entry_t *) * aggregate->bucketCount);
+    }
+
+    aggregate->entryCount = 0;
+    aggregate->resultCount = 0;
+    aggregate->size = sizeof(odbxuv_aggregate_entry_t *) * (aggregate->bucketCount + aggregate->entryCapacity);
+
+    if(aggregate->mode == ODBXUV_AGGREGATE_TOP)
+    {
+        aggregate->columnCount = 0;
+    }
+}
+
+void odbxuv_aggregate_free(odbxuv_aggregate_t *aggregate)
+{
+    odbxuv_aggregate_reset(aggregate);
+
+    free(aggregate->groupColumns);
+    free(aggregate->functions);
+    free(aggregate->buckets);
+    free(aggregate->entries);
+    free(aggregate->key);
+    free(aggregate->values);
+    free(aggregate->lengths);
+
+    aggregate->groupColumns = NULL;
+    aggregate->functions = NULL;
+    aggregate->buckets = NULL;
+    aggregate->bucketCount = 0;
+    aggregate->entries = NULL;
+    aggregate->entryCapacity = 0;
+    aggregate->key = NULL;
+    aggregate->keyCapacity = 0;
+    aggregate->values = NULL;
+    aggregate->lengths = NULL;
+    aggregate->valueCapacity = 0;
+    aggregate->size = 0;
+}
+
+int odbxuv_aggregate_add(odbxuv_aggregate_t *aggregate, unsigned int columnCount, const char **values, const unsigned long *lengths)
+{
+    unsigned int i;
+
+    if(aggregate->mode == ODBXUV_AGGREGATE_TOP)
+    {
+        if(aggregate->orderColumn >= columnCount) return -1;
+
+        //Kept rows have the columns of the first row
+        if(aggregate->columnCount == 0) aggregate->columnCount = columnCount;
+        if(aggregate->columnCount != columnCount) return -1;
+
+        _aggregate_add_top(aggregate, values, lengths);
+        return 0;
+    }
+
+    for(i = 0; i < aggregate->groupCount; i++)
+    {
+        if(aggregate->groupColumns[i] >= columnCount) return -1;
+    }
+
+    for(i = 0; i < aggregate->functionCount; i++)
+    {
+        unsigned int column = aggregate->functions[i].column;
+
+        if(column >= columnCount && !(column == ODBXUV_AGGREGATE_ALL && aggregate->functions[i].function == ODBXUV_AGGREGATE_COUNT)) return -1;
+    }
+
+    size_t keyLength = _aggregate_key(aggregate, values, lengths);
+    _aggregate_update(aggregate, _aggregate_group(aggregate, keyLength), values);
+
+    return 0;
+}
+
+void odbxuv_aggregate_finish(odbxuv_aggregate_t *aggregate)
+{
+    if(aggregate->mode == ODBXUV_AGGREGATE_TOP)
+    {
+        //Sort the heap in place, moving the worst row to the end every time leaves the best first
+        unsigned int count;
+
+        for(count = aggregate->entryCount; count > 1; count--)
+        {
+            odbxuv_aggregate_entry_t *swap = aggregate->entries[0];
+            aggregate->entries[0] = aggregate->entries[count - 1];
+            aggregate->entries[count - 1] = swap;
+
+            _aggregate_heap_down(aggregate, 0, count - 1);
+        }
+    }
+
+    aggregate->resultCount = aggregate->entryCount;
+}
+
+void odbxuv_aggregate_emit(odbxuv_aggregate_t *aggregate, unsigned int index, char **values)
+{
+    assert(index < aggregate->resultCount);
+
+    odbxuv_aggregate_entry_t *entry = aggregate->entries[index];
+
+    if(aggregate->mode == ODBXUV_AGGREGATE_GROUP)
+    {
+        _aggregate_emit_group(aggregate, entry, values);
+        return;
+    }
+
+    unsigned int i;
+    for(i = 0; i < aggregate->columnCount; i++)
+    {
+        values[i] = entry->values[i];
+        entry->values[i] = NULL;
+    }
+}
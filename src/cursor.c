@@ -0,0 +1,326 @@
+#include "odbxuv/cursor.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <malloc.h>
+
+/**
+ * The default amount of rows per page
+ * \internal
+ */
+#define ODBXUV_CURSOR_DEFAULT_PAGE_SIZE 1000
+
+static int _cursor_query_page(odbxuv_cursor_t *cursor);
+
+static char *_cursor_copy_string(const char *string)
+{
+    if(string == NULL) return NULL;
+
+    char *copy = malloc(strlen(string) + 1);
+    strcpy(copy, string);
+    return copy;
+}
+
+/**
+ * Whether a key can be put in a query as is
+ */
+static int _cursor_is_number(const char *value)
+{
+    const char *c = value;
+    unsigned char dot = 0;
+
+    if(*c == '-' || *c == '+') c++;
+    if(*c == '\0') return 0;
+
+    for(; *c != '\0'; c++)
+    {
+        if(*c == '.' && !dot)
+        {
+            dot = 1;
+            continue;
+        }
+
+        if(*c < '0' || *c > '9') return 0;
+    }
+
+    return 1;
+}
+
+static void _cursor_fail(odbxuv_cursor_t *cursor, int status)
+{
+    if(cursor->status == 0)
+    {
+        cursor->status = status;
+    }
+
+    cursor->stopping = 1;
+}
+
+/**
+ * Calls the callback for the last time once nothing is pending anymore.
+ */
+static void _cursor_check_finished(odbxuv_cursor_t *cursor)
+{
+    if(!cursor->running || cursor->page != NULL || cursor->nextPage != NULL || cursor->escaping) return;
+
+    cursor->running = 0;
+    cursor->callback(cursor, NULL, NULL, 0, cursor->status);
+}
+
+static odbxuv_batch_result_e _cursor_page_rows(odbxuv_op_query_t *op, odbxuv_row_t *rows, unsigned int count, int status);
+
+/**
+ * Starts delivering the rows of the next page once its query returned.
+ */
+static void _cursor_next_page(odbxuv_cursor_t *cursor)
+{
+    odbxuv_op_query_t *page = cursor->nextPage;
+
+    cursor->nextPage = NULL;
+
+    if(cursor->nextStatus < 0)
+    {
+        _cursor_fail(cursor, cursor->nextStatus);
+        odbxuv_op_query_release(page);
+        _cursor_check_finished(cursor);
+        return;
+    }
+
+    //Process the rows even when stopping, the worker is fetching them anyway
+    cursor->page = page;
+    cursor->pageRows = 0;
+    odbxuv_query_process_batch(page, _cursor_page_rows);
+}
+
+static void _cursor_page_queried(odbxuv_op_query_t *op, int status)
+{
+    odbxuv_cursor_t *cursor = (odbxuv_cursor_t *)op->data;
+
+    cursor->nextStatus = status;
+
+    //Wait for the rows of the current page
+    if(cursor->page == NULL)
+    {
+        _cursor_next_page(cursor);
+    }
+}
+
+static void _cursor_escaped(odbxuv_op_escape_t *op, int status)
+{
+    odbxuv_cursor_t *cursor = (odbxuv_cursor_t *)op->data;
+
+    cursor->escaping = 0;
+
+    if(status < 0)
+    {
+        _cursor_fail(cursor, op->error ? op->error->error : status);
+        odbxuv_free_error((odbxuv_handle_t *)op);
+    }
+    else if(!cursor->stopping)
+    {
+        free(cursor->last);
+        cursor->last = malloc(strlen(op->string) + 3);
+        sprintf(cursor->last, "'%s'", op->string);
+
+        _cursor_query_page(cursor);
+    }
+
+    odbxuv_free_handle((odbxuv_handle_t *)op);
+    _cursor_check_finished(cursor);
+}
+
+/**
+ * Queries the page after \p key, escaping it first when it is not a number.
+ */
+static void _cursor_continue_after(odbxuv_cursor_t *cursor, const char *key)
+{
+    if(key == NULL)
+    {
+        _cursor_fail(cursor, -ODBX_ERR_PARAM);
+        return;
+    }
+
+    if(!_cursor_is_number(key))
+    {
+        cursor->escape.data = cursor;
+
+        int result = odbxuv_escape(cursor->connection, &cursor->escape, key, _cursor_escaped);
+        if(result < ODBX_ERR_SUCCESS)
+        {
+            _cursor_fail(cursor, result);
+            return;
+        }
+
+        cursor->escaping = 1;
+        return;
+    }
+
+    free(cursor->last);
+    cursor->last = _cursor_copy_string(key);
+
+    _cursor_query_page(cursor);
+}
+
+static odbxuv_batch_result_e _cursor_page_rows(odbxuv_op_query_t *op, odbxuv_row_t *rows, unsigned int count, int status)
+{
+    odbxuv_cursor_t *cursor = (odbxuv_cursor_t *)op->data;
+
+    if(rows != NULL)
+    {
+        cursor->pageRows += count;
+
+        //The last row of a full page arrived, let the worker fetch the next page meanwhile
+        if(cursor->pageRows >= cursor->pageSize && !cursor->stopping && cursor->nextPage == NULL && !cursor->escaping)
+        {
+            odbxuv_row_t *last = rows;
+            while(last->next != NULL) last = last->next;
+
+            _cursor_continue_after(cursor, last->value != NULL ? last->value[cursor->keyColumn] : NULL);
+        }
+
+        if(!cursor->stopping)
+        {
+            cursor->rowCount += count;
+            cursor->callback(cursor, op, rows, count, 0);
+        }
+
+        return ODBXUV_BATCH_DONE;
+    }
+
+    cursor->page = NULL;
+
+    if(status < 0)
+    {
+        _cursor_fail(cursor, status);
+    }
+
+    odbxuv_op_query_release(op);
+
+    if(cursor->nextPage != NULL && cursor->nextStatus != 1)
+    {
+        _cursor_next_page(cursor);
+    }
+    else
+    {
+        _cursor_check_finished(cursor);
+    }
+
+    return ODBXUV_BATCH_DONE;
+}
+
+/**
+ * Queries the page after the last key, a page that is not queued stops the cursor.
+ */
+static int _cursor_query_page(odbxuv_cursor_t *cursor)
+{
+    const char *select = cursor->select;
+    const char *where = cursor->where;
+    const char *key = cursor->key;
+    const char *last = cursor->last;
+    size_t length = strlen(select) + strlen(key) * 2 + (where ? strlen(where) : 0) + (last ? strlen(last) : 0) + 64;
+    char *query = malloc(length);
+
+    if(where != NULL && last != NULL)
+    {
+        snprintf(query, length, "%s WHERE (%s) AND %s > %s ORDER BY %s LIMIT %u", select, where, key, last, key, cursor->pageSize);
+    }
+    else if(where != NULL)
+    {
+        snprintf(query, length, "%s WHERE (%s) ORDER BY %s LIMIT %u", select, where, key, cursor->pageSize);
+    }
+    else if(last != NULL)
+    {
+        snprintf(query, length, "%s WHERE %s > %s ORDER BY %s LIMIT %u", select, key, last, key, cursor->pageSize);
+    }
+    else
+    {
+        snprintf(query, length, "%s ORDER BY %s LIMIT %u", select, key, cursor->pageSize);
+    }
+
+    odbxuv_op_query_t *page = odbxuv_op_query_acquire(cursor->connection);
+    page->data = cursor;
+
+    cursor->nextPage = page;
+    cursor->nextStatus = 1;
+    cursor->pageCount++;
+
+    int result = odbxuv_query_recycled(cursor->connection, page, query, cursor->flags | ODBXUV_QUERY_FETCH_VALUE, &cursor->config, _cursor_page_queried);
+
+    free(query);
+
+    if(result < ODBX_ERR_SUCCESS)
+    {
+        cursor->nextPage = NULL;
+        cursor->pageCount--;
+        odbxuv_op_query_release(page);
+        _cursor_fail(cursor, result);
+    }
+
+    return result;
+}
+
+/*
+ * API:
+ */
+
+int odbxuv_cursor_init(odbxuv_cursor_t *cursor, odbxuv_connection_t *connection, const char *select, const char *where, const char *key)
+{
+    void *data = cursor->data;
+    memset(cursor, 0, sizeof(odbxuv_cursor_t));
+    cursor->data = data;
+
+    cursor->connection = connection;
+    cursor->pageSize = ODBXUV_CURSOR_DEFAULT_PAGE_SIZE;
+    cursor->flags = ODBXUV_QUERY_FETCH_VALUE;
+    cursor->select = _cursor_copy_string(select);
+    cursor->where = _cursor_copy_string(where);
+    cursor->key = _cursor_copy_string(key);
+
+    return 0;
+}
+
+int odbxuv_cursor_start(odbxuv_cursor_t *cursor, odbxuv_cursor_cb onRows)
+{
+    assert(!cursor->running && "The cursor is already running");
+    assert(cursor->pageSize > 0 && "A page needs at least one row");
+
+    free(cursor->last);
+    cursor->last = NULL;
+    cursor->callback = onRows;
+    cursor->rowCount = 0;
+    cursor->pageCount = 0;
+    cursor->stopping = 0;
+    cursor->status = 0;
+    cursor->running = 1;
+
+    int result = _cursor_query_page(cursor);
+    if(result < ODBX_ERR_SUCCESS)
+    {
+        cursor->running = 0;
+        return result;
+    }
+
+    return 0;
+}
+
+void odbxuv_cursor_stop(odbxuv_cursor_t *cursor)
+{
+    if(!cursor->running) return;
+
+    cursor->stopping = 1;
+}
+
+void odbxuv_cursor_free(odbxuv_cursor_t *cursor)
+{
+    assert(!cursor->running && "Can't free a running cursor");
+
+    free(cursor->select);
+    free(cursor->where);
+    free(cursor->key);
+    free(cursor->last);
+
+    cursor->select = NULL;
+    cursor->where = NULL;
+    cursor->key = NULL;
+    cursor->last = NULL;
+}
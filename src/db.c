@@ -1,13 +1,51 @@
 #include "odbxuv/db.h"
+#include "odbxuv/stats.h"
+#include "odbxuv/slowlog.h"
+#include "odbxuv/serialize.h"
+#include "odbxuv/aggregate.h"
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <malloc.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static void _query_snapshot_answer(odbxuv_op_t *operation);
+
+/**
+ * The status passed to the callback of an operation, the error of a query may be set by the worker while it fetches.
+ */
+static int _op_callback_status(odbxuv_op_t *operation)
+{
+    odbxuv_error_t *error = __atomic_load_n(&operation->error, __ATOMIC_ACQUIRE);
+
+    return error ? error->error : ODBX_ERR_SUCCESS;
+}
 
 /**
  * Removes the finished tasks from the list and then runs callbacks for them.
  */
 static void _op_run_callbacks_real(odbxuv_connection_t *con)
 {
+    //Operations that are no longer part of the queue go first
+    while(con->readyQueue)
+    {
+        odbxuv_op_t *readyOperation = con->readyQueue;
+        con->readyQueue = readyOperation->next;
+        readyOperation->next = NULL;
+
+        _query_snapshot_answer(readyOperation);
+
+        if(readyOperation->callback)
+        {
+            readyOperation->callback(readyOperation, _op_callback_status(readyOperation));
+        }
+    }
+
     if(!con->operationQueue) return;
 
     odbxuv_op_t *oldQueue = con->operationQueue;
@@ -15,6 +53,8 @@ static void _op_run_callbacks_real(odbxuv_connection_t *con)
 
     // Build a new operation queue
     {
+        uv_mutex_lock(&con->lock);
+
         //Find the first operation that is pending
         while(firstPendingOperation)
         {
@@ -23,663 +63,3712 @@ static void _op_run_callbacks_real(odbxuv_connection_t *con)
         }
 
         con->operationQueue = firstPendingOperation;
+        uv_mutex_unlock(&con->lock);
     }
 
     // Run all the callbacks, assumes the operation is freed inside the callback
+    // Pending operations are never touched here, a callback may close the connection and complete them
     {
         odbxuv_op_t *firstOperation = oldQueue;
 
-        while(firstOperation && firstOperation->status == ODBXUV_OP_STATUS_COMPLETED && firstOperation != firstPendingOperation)
+        while(firstOperation && firstOperation != firstPendingOperation && firstOperation->status == ODBXUV_OP_STATUS_COMPLETED)
         {
             odbxuv_op_t *currentOperation = firstOperation;
             firstOperation = currentOperation->next;
 
+            _query_snapshot_answer(currentOperation);
+
             if(currentOperation->callback)
             {
-                currentOperation->callback(currentOperation, currentOperation->error ? currentOperation->error->error : ODBX_ERR_SUCCESS);
+                currentOperation->callback(currentOperation, _op_callback_status(currentOperation));
             }
         }
     }
 }
 
+static void _close_connection(odbxuv_op_disconnect_t *op, int status);
+
 static void _op_run_callbacks(uv_async_t *handle)
 {
-    _op_run_callbacks_real((odbxuv_connection_t *)handle->data);
+    odbxuv_connection_t *con = (odbxuv_connection_t *)handle->data;
+
+    _op_run_callbacks_real(con);
+
+    //A close waiting for the operations handed to other loops, see _query_remote_release
+    if(con->closeOp != NULL && con->workerStatus == ODBXUV_WORKER_IDLE)
+    {
+        odbxuv_op_disconnect_t *op = con->closeOp;
+        con->closeOp = NULL;
+        _close_connection(op, 0);
+    }
 }
 
 /**
  * Runs the pending operations on the connection
  */
-static void _op_run_operations(uv_work_t *req)
+static int _con_reconnect(odbxuv_connection_t *con);
+static unsigned char _con_check_lost(odbxuv_connection_t *con, odbxuv_op_t *operation);
+static unsigned char _op_prepare_replay(odbxuv_op_t *operation);
+
+/**
+ * Changes the status of the connection, the worker and the loop both read it.
+ */
+static void _con_set_status(odbxuv_connection_t *con, odbxuv_connection_status_e status)
 {
-    odbxuv_connection_t *con = (odbxuv_connection_t *)req->data;
-    odbxuv_op_t *operation = con->operationQueue;
+    uv_mutex_lock(&con->lock);
+    con->status = status;
+    uv_mutex_unlock(&con->lock);
+}
 
-    while(operation)
+/**
+ * Marks the connection connected in a new session.
+ * Runs on the worker.
+ */
+static void _con_set_connected(odbxuv_connection_t *con)
+{
+    uv_mutex_lock(&con->lock);
+    con->status = ODBXUV_CON_STATUS_CONNECTED;
+    con->counters.sessions++;
+    uv_mutex_unlock(&con->lock);
+}
+
+/**
+ * Whether operations can be queued on the connection.
+ */
+static unsigned char _con_is_open(odbxuv_connection_t *con)
+{
+    odbxuv_connection_status_e status = odbxuv_connection_get_status(con);
+
+    return status == ODBXUV_CON_STATUS_CONNECTED || status == ODBXUV_CON_STATUS_RECONNECTING;
+}
+
+/**
+ * Takes the first operation that did not start yet, the loop can't shed it afterwards.
+ * Runs on the worker.
+ */
+static odbxuv_op_t *_con_claim_op(odbxuv_connection_t *con)
+{
+    odbxuv_op_t *operation;
+
+    uv_mutex_lock(&con->lock);
+
+    for(operation = con->operationQueue; operation; operation = operation->next)
     {
-        int res = ODBXUV_OP_STATUS_COMPLETED;
-        odbxuv_op_t *next = operation->next;
         if(operation->status == ODBXUV_OP_STATUS_NOT_STARTED)
         {
             operation->status = ODBXUV_OP_STATUS_IN_PROGRESS;
-            res = operation->operationFunction(operation);
+            break;
+        }
+    }
 
-            if(res != ODBXUV_OP_STATUS_COMPLETED)
-            {
-                operation->status = ODBXUV_OP_STATUS_COMPLETED;
+    uv_mutex_unlock(&con->lock);
+
+    return operation;
+}
+
+static void _op_run_operations(uv_work_t *req)
+{
+    odbxuv_connection_t *con = (odbxuv_connection_t *)req->data;
+
+    if(odbxuv_connection_get_status(con) == ODBXUV_CON_STATUS_RECONNECTING && !_con_reconnect(con))
+    {
+        return;
+    }
+
+    odbxuv_op_t *operation;
+
+    //The operation is not touched after it ran, its callback may have freed it
+    while((operation = _con_claim_op(con)) != NULL)
+    {
+        unsigned char keepRunning = operation->type == ODBXUV_HANDLE_TYPE_OP_DISCONNECT;
+        int res = operation->operationFunction(operation);
 
-                uv_async_send(&con->async);
+        if(res != ODBXUV_OP_STATUS_COMPLETED)
+        {
+            if(_con_check_lost(con, operation) && _op_prepare_replay(operation))
+            {
+                //Keep it queued, it runs again after reconnecting
+                uv_mutex_lock(&con->lock);
+                operation->status = ODBXUV_OP_STATUS_NOT_STARTED;
+                uv_mutex_unlock(&con->lock);
+                break;
             }
+
+            // No need to wake up the loop, _op_after_run_operations runs the callback once we return
+            uv_mutex_lock(&con->lock);
+            operation->status = ODBXUV_OP_STATUS_COMPLETED;
+            uv_mutex_unlock(&con->lock);
         }
 
-        if(res != ODBXUV_OP_STATUS_COMPLETED && operation->type != ODBXUV_HANDLE_TYPE_OP_DISCONNECT)
+        if(odbxuv_connection_get_status(con) == ODBXUV_CON_STATUS_RECONNECTING)
         {
             break;
         }
 
-        operation = next;
+        if(res != ODBXUV_OP_STATUS_COMPLETED && !keepRunning)
+        {
+            break;
+        }
     }
 }
 
-static void _handle_make_error(odbxuv_handle_t *handle, int errorNum, int errorType, const char *errorString)
-{
-    odbxuv_error_t *error = malloc(sizeof(odbxuv_error_t));
-    memset(error, 0, sizeof(*error));
-    error->error = errorNum;
-    error->errorType = errorType;
-    char *msg = malloc(strlen(errorString)+1);
-    strcpy(msg, errorString);
-    error->errorString  = msg;
-    handle->error = error;
-    assert(errorNum != -ODBX_ERR_PARAM && "Internal error");
-}
+/**
+ * The default amount of column info a connection keeps for reuse
+ * \internal
+ */
+#define ODBXUV_DEFAULT_METADATA_MAX 1024
 
 /**
+ * The amount of buckets of the column info table of a connection
  * \internal
- * \private
  */
-#define MAKE_ODBX_ERR(operation, result, func) \
-    if(result < ODBX_ERR_SUCCESS) \
-    { \
-        _handle_make_error((odbxuv_handle_t *)operation, result, odbx_error_type( operation->connection->handle, result), odbx_error(operation->connection->handle, result )); \
-        func; \
-        return 0; \
-    }
+#define ODBXUV_METADATA_BUCKETS 256
 
-#define SET_0_COPY_DATA(obj)                        \
-    {                                               \
-        assert(obj && "Object is NULL");            \
-        void *data = obj->data;                     \
-        memset(obj, 0, sizeof(*obj));               \
-        obj->data = data;                           \
-    }
+/**
+ * Values of \p interned of ::odbxuv_metadata_t
+ * \internal
+ */
+#define ODBXUV_METADATA_OWNED 0
+#define ODBXUV_METADATA_INTERNED 1
+
+/**
+ * Column info of the results of a connection.
+ * The connection and every query operation submitted to it hold a reference,
+ * the last one frees it, the operations may be freed after the connection closed.
+ * \internal
+ */
+struct _odbxuv_metadata_table_s
+{
+    unsigned int refs;
 
+    /**
+     * Set by the loop when the connection closed, the operations no longer count in its totals then
+     */
+    unsigned char closed;
 
-static void con_worker_check(odbxuv_connection_t *connection);
+    /**
+     * The bytes of the buckets and the entries
+     */
+    size_t size;
 
+    /**
+     * ODBXUV_METADATA_BUCKETS long, allocated by the worker for the first interned entry
+     */
+    odbxuv_metadata_t **buckets;
+};
 
 /**
- * called after the worker thread finished.
- * checks if the worker should be restarted
+ * Bytes held by the query operations of all connections, updated atomically
+ * \internal
  */
-static void _op_after_run_operations(uv_work_t *req, int status)
-{
-    odbxuv_connection_t *con = (odbxuv_connection_t *)req->data;
+static uint64_t _odbxuv_memory_used = 0;
 
-    con->workerStatus = ODBXUV_WORKER_IDLE;
-    _op_run_callbacks_real(con); //Make sure we run, maybe uv_async is lazy
-    con_worker_check(con);
-}
+/**
+ * See ::odbxuv_memory_set_limit
+ * \internal
+ */
+static uint64_t _odbxuv_memory_limit = 0;
 
 /**
- * Start the worker function in another thread when there is work to do.
+ * Adds allocated or freed memory of a query operation to the totals.
+ * The worker uses ::_memory_worker instead while it fetches.
  */
-static void con_worker_check(odbxuv_connection_t *connection)
+static void _memory_add(odbxuv_op_query_t *op, int64_t bytes)
 {
-    if(connection->workerStatus == ODBXUV_WORKER_IDLE)
-    {
-        unsigned char havePendingRequests = 0;
-
-        {
-            odbxuv_op_t *operation = connection->operationQueue;
-            while(operation)
-            {
-                if(operation->status == ODBXUV_OP_STATUS_NOT_STARTED)
-                {
-                    havePendingRequests = 1;
-                    break;
-                }
-                operation = operation->next;
-            }
-        }
+    if(bytes == 0) return;
 
-        if(havePendingRequests > 0 && connection->workerStatus == ODBXUV_WORKER_IDLE)
-        {
-            connection->workerStatus = ODBXUV_WORKER_RUNNING;
-            memset(&connection->worker, 0, sizeof(connection->worker));
-            connection->worker.data = connection;
+    op->memoryUsed += bytes;
 
-            uv_queue_work(connection->loop, &connection->worker, _op_run_operations, _op_after_run_operations);
-            connection->workerStatus = ODBXUV_WORKER_RUNNING;
-        }
+    //The connection may be closed, reinitialised or freed, only its table tells
+    if(op->metadataTable == NULL || !op->metadataTable->closed)
+    {
+        __atomic_add_fetch(&op->connection->counters.memoryUsed, bytes, __ATOMIC_RELAXED);
     }
+
+    __atomic_add_fetch(&_odbxuv_memory_used, bytes, __ATOMIC_RELAXED);
 }
 
-/*
- * Up next, functions that implement certain types of operations.
+/**
+ * Adds memory allocated by the worker to the operation,
+ * the totals catch up when the rows are handed to the loop.
  */
+static void _memory_worker(odbxuv_op_query_t *op, int64_t bytes)
+{
+    op->memoryUsed += bytes;
+    op->memoryPending += bytes;
+}
 
-static odbxuv_operation_status_e _op_connect(odbxuv_op_t *req)
+/**
+ * Checks the limits of the operation, its connection and the global one.
+ * Call with the connection lock held.
+ */
+static unsigned char _memory_exceeded(odbxuv_op_query_t *op)
 {
-    int result;
-    odbxuv_op_connect_t *op = (odbxuv_op_connect_t *)req;
-    assert(op->type == ODBXUV_HANDLE_TYPE_OP_CONNECT);
+    uint64_t limit = __atomic_load_n(&_odbxuv_memory_limit, __ATOMIC_RELAXED);
 
-    result = odbx_init(&op->connection->handle, op->backend, op->host, op->port);
+    return (op->config.memoryLimit && op->memoryUsed > op->config.memoryLimit)
+        || (op->connection->memoryLimit && __atomic_load_n(&op->connection->counters.memoryUsed, __ATOMIC_RELAXED) > op->connection->memoryLimit)
+        || (limit && __atomic_load_n(&_odbxuv_memory_used, __ATOMIC_RELAXED) > limit);
+}
 
-    MAKE_ODBX_ERR(op, result, {
-        odbx_finish(op->connection->handle);
-        op->connection->handle = NULL;
-        op->connection->status = ODBXUV_CON_STATUS_FAILED;
-    });
+static uint32_t _hash_bytes(uint32_t hash, const void *data, size_t length)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
 
-    result = odbx_bind(op->connection->handle, op->database, op->user, op->password, op->method);
+    while(length-- > 0)
+    {
+        hash ^= *bytes++;
+        hash *= 16777619u;
+    }
 
-    MAKE_ODBX_ERR(op, result, {
-        odbx_unbind(op->connection->handle);
-        odbx_finish(op->connection->handle);
-        op->connection->handle = NULL;
-        op->connection->status = ODBXUV_CON_STATUS_FAILED;
-    });
+    return hash;
+}
+
+static int _metadata_equals(const odbxuv_metadata_t *metadata, odbxuv_op_query_t *op, int flags)
+{
+    unsigned int i;
 
-    op->connection->status = ODBXUV_CON_STATUS_CONNECTED;
+    if(metadata->flags != flags || metadata->columnCount != op->columnCount) return 0;
 
-    return 0;
+    for(i = 0; i < metadata->columnCount; i++)
+    {
+        if(flags & ODBXUV_QUERY_FETCH_NAME && strcmp(metadata->columns[i].name, odbx_column_name(op->resultHandle, i)) != 0) return 0;
+        if(flags & ODBXUV_QUERY_FETCH_TYPE && metadata->columns[i].type != odbx_column_type(op->resultHandle, i)) return 0;
+    }
+
+    return 1;
 }
 
-static odbxuv_operation_status_e _op_disconnect(odbxuv_op_t *req)
+/**
+ * Finds the column info of the current result of \p op or creates it, on the worker.
+ * Only the worker of the connection adds to the table and the operation holds a reference to it,
+ * so it is read without taking the lock.
+ */
+static odbxuv_metadata_t *_metadata_acquire(odbxuv_op_query_t *op)
 {
-    int result;
-    odbxuv_op_disconnect_t *op = (odbxuv_op_disconnect_t *)req;
-    assert(op->type == ODBXUV_HANDLE_TYPE_OP_DISCONNECT);
-
-    result = odbx_unbind(req->connection->handle);
+    odbxuv_connection_t *con = op->connection;
+    struct _odbxuv_metadata_table_s *table = op->metadataTable;
+    int flags = op->flags & (ODBXUV_QUERY_FETCH_NAME | ODBXUV_QUERY_FETCH_TYPE);
+    unsigned int count = op->columnCount;
+    uint32_t hash = 2166136261u;
+    size_t names = 0;
+    unsigned int i;
+
+    hash = _hash_bytes(hash, &flags, sizeof(flags));
+    hash = _hash_bytes(hash, &count, sizeof(count));
+
+    for(i = 0; i < count; i++)
+    {
+        if(flags & ODBXUV_QUERY_FETCH_NAME)
+        {
+            const char *name = odbx_column_name(op->resultHandle, i);
+            size_t length = strlen(name) + 1;
 
-    MAKE_ODBX_ERR(op, result, {
-        odbx_finish(op->connection->handle);
-        op->connection->handle = NULL;
-        op->connection->status = ODBXUV_CON_STATUS_IDLE;
-    });
+            hash = _hash_bytes(hash, name, length);
+            names += length;
+        }
+        if(flags & ODBXUV_QUERY_FETCH_TYPE)
+        {
+            int type = odbx_column_type(op->resultHandle, i);
+            hash = _hash_bytes(hash, &type, sizeof(type));
+        }
+    }
 
-    result = odbx_finish(op->connection->handle);
+    odbxuv_metadata_t *metadata;
 
-    MAKE_ODBX_ERR(op, result, {
-        op->connection->handle = NULL;
-        op->connection->status = ODBXUV_CON_STATUS_IDLE;
-    });
+    if(table->buckets != NULL)
+    {
+        for(metadata = table->buckets[hash % ODBXUV_METADATA_BUCKETS]; metadata != NULL; metadata = metadata->next)
+        {
+            if(metadata->hash == hash && _metadata_equals(metadata, op, flags))
+            {
+                __atomic_add_fetch(&metadata->refs, 1, __ATOMIC_RELAXED);
+                return metadata;
+            }
+        }
+    }
 
-    op->connection->status = ODBXUV_CON_STATUS_DISCONNECTED;
+    size_t size = sizeof(odbxuv_metadata_t) + sizeof(odbxuv_column_info_t) * count + names;
+    metadata = malloc(size);
+    memset(metadata, 0, sizeof(odbxuv_metadata_t) + sizeof(odbxuv_column_info_t) * count);
+    metadata->refs = 1;
+    metadata->hash = hash;
+    metadata->flags = flags;
+    metadata->size = size;
+    metadata->columnCount = count;
 
-    return 0;
-}
+    char *name = (char *)&metadata->columns[count];
 
-static odbxuv_operation_status_e _op_capabilities(odbxuv_op_t *req)
-{
-    int result;
-    odbxuv_op_capabilities_t *op = (odbxuv_op_capabilities_t *)req;
-    assert(op->type == ODBXUV_HANDLE_TYPE_OP_CAPABILITIES);
+    for(i = 0; i < count; i++)
+    {
+        if(flags & ODBXUV_QUERY_FETCH_NAME)
+        {
+            strcpy(name, odbx_column_name(op->resultHandle, i));
+            metadata->columns[i].name = name;
+            name += strlen(name) + 1;
+        }
+        if(flags & ODBXUV_QUERY_FETCH_TYPE)
+        {
+            metadata->columns[i].type = odbx_column_type(op->resultHandle, i);
+        }
+    }
 
-    result = odbx_capabilities(op->connection->handle, op->capabilities);
+    if(con->metadataCount >= con->metadataMax)
+    {
+        metadata->interned = ODBXUV_METADATA_OWNED;
+        _memory_worker(op, size);
+        return metadata;
+    }
 
-    MAKE_ODBX_ERR(op, result, {
+    if(table->buckets == NULL)
+    {
+        table->buckets = calloc(ODBXUV_METADATA_BUCKETS, sizeof(odbxuv_metadata_t *));
+        size += sizeof(odbxuv_metadata_t *) * ODBXUV_METADATA_BUCKETS;
+    }
 
-    });
+    metadata->interned = ODBXUV_METADATA_INTERNED;
+    metadata->next = table->buckets[hash % ODBXUV_METADATA_BUCKETS];
+    table->buckets[hash % ODBXUV_METADATA_BUCKETS] = metadata;
+    table->size += size;
+    con->metadataCount++;
 
-    op->result = result;
+    __atomic_add_fetch(&con->counters.memoryUsed, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&_odbxuv_memory_used, size, __ATOMIC_RELAXED);
 
-    return 0;
+    return metadata;
 }
 
-static odbxuv_operation_status_e _op_query(odbxuv_op_t *req)
+/**
+ * Takes a reference to the column info table of the connection, creating it for the first query.
+ * Runs on the loop.
+ */
+static void _metadata_table_acquire(odbxuv_op_query_t *op, odbxuv_connection_t *con)
 {
-    int result;
-    odbxuv_op_query_t *op = (odbxuv_op_query_t *)req;
-    assert(op->type == ODBXUV_HANDLE_TYPE_OP_QUERY);
-
+    if(con->metadata == NULL)
+    {
+        con->metadata = malloc(sizeof(struct _odbxuv_metadata_table_s));
+        memset(con->metadata, 0, sizeof(struct _odbxuv_metadata_table_s));
+        con->metadata->refs = 1;
+    }
 
-    result = odbx_query(op->connection->handle, op->query, 0);
+    __atomic_add_fetch(&con->metadata->refs, 1, __ATOMIC_RELAXED);
+    op->metadataTable = con->metadata;
+}
 
-    MAKE_ODBX_ERR(op, result, {
-        op->fetchStatus = ODBXUV_FETCH_STATUS_ERROR_BEFORE;
-    });
+/**
+ * Drops a reference to a column info table, the last one frees it with its entries.
+ * By then the connection closed, the entries only count globally.
+ */
+static void _metadata_table_release(struct _odbxuv_metadata_table_s *table)
+{
+    unsigned int i;
 
-    op->status = ODBXUV_OP_STATUS_COMPLETED;
-    op->fetchStatus = ODBXUV_FETCH_STATUS_RUNNING;
-    uv_async_send(&op->connection->async); //Note: the callback should not free the op!
+    if(__atomic_sub_fetch(&table->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
 
-    unsigned char didGetInfo = 0;
-    do
+    if(table->buckets != NULL)
     {
-        if(op->resultHandle != NULL)
+        for(i = 0; i < ODBXUV_METADATA_BUCKETS; i++)
         {
-            result = odbx_result_finish(op->resultHandle);
+            odbxuv_metadata_t *metadata = table->buckets[i];
 
-            MAKE_ODBX_ERR(op, result, {
-                op->error->error = -result;
-                op->fetchStatus = ODBXUV_FETCH_STATUS_ERROR_FINISH;
-            });
+            while(metadata != NULL)
+            {
+                odbxuv_metadata_t *next = metadata->next;
+                free(metadata);
+                metadata = next;
+            }
         }
 
-        result = odbx_result(
+        free(table->buckets);
+    }
+
+    __atomic_sub_fetch(&_odbxuv_memory_used, table->size, __ATOMIC_RELAXED);
+    free(table);
+}
+
+/**
+ * Lets go of the column info table of a closed connection.
+ * Query operations that were not freed yet keep it, the column info they use included.
+ */
+static void _metadata_free_all(odbxuv_connection_t *con)
+{
+    struct _odbxuv_metadata_table_s *table = con->metadata;
+
+    if(table == NULL) return;
+
+    table->closed = 1;
+    __atomic_sub_fetch(&con->counters.memoryUsed, table->size, __ATOMIC_RELAXED);
+
+    con->metadata = NULL;
+    con->metadataCount = 0;
+
+    _metadata_table_release(table);
+}
+
+static size_t _error_size(odbxuv_error_t *error)
+{
+    return sizeof(odbxuv_error_t) + strlen(error->errorString) + 1;
+}
+
+static void _handle_make_error(odbxuv_handle_t *handle, int errorNum, int errorType, const char *errorString)
+{
+    odbxuv_error_t *error = malloc(sizeof(odbxuv_error_t));
+    memset(error, 0, sizeof(*error));
+    error->error = errorNum;
+    error->errorType = errorType;
+    char *msg = malloc(strlen(errorString)+1);
+    strcpy(msg, errorString);
+    error->errorString  = msg;
+
+    //The loop may be about to run the query callback while the worker fails the fetch
+    __atomic_store_n(&handle->error, error, __ATOMIC_RELEASE);
+
+    //Errors may outlive their connection, they only count globally
+    size_t size = _error_size(error);
+    __atomic_add_fetch(&_odbxuv_memory_used, size, __ATOMIC_RELAXED);
+    if(handle->type == ODBXUV_HANDLE_TYPE_OP_QUERY)
+    {
+        ((odbxuv_op_query_t *)handle)->memoryUsed += size;
+    }
+    assert(errorNum != -ODBX_ERR_PARAM && "Internal error");
+}
+
+/**
+ * \internal
+ * \private
+ */
+#define MAKE_ODBX_ERR(operation, result, func) \
+    if(result < ODBX_ERR_SUCCESS) \
+    { \
+        _handle_make_error((odbxuv_handle_t *)operation, result, odbx_error_type( operation->connection->handle, result), odbx_error(operation->connection->handle, result )); \
+        func; \
+        return 0; \
+    }
+
+/**
+ * The default amount of rows the worker collects before waking up the loop
+ * \internal
+ */
+#define ODBXUV_DEFAULT_NOTIFY_ROWS 256
+
+/**
+ * The default time in microseconds the worker may hold back rows
+ * \internal
+ */
+#define ODBXUV_DEFAULT_NOTIFY_INTERVAL 2000
+
+/**
+ * A new latency sample weighs 1/ODBXUV_LATENCY_WEIGHT in the moving average
+ * \internal
+ */
+#define ODBXUV_LATENCY_WEIGHT 8
+
+/**
+ * Marks a query operation that has been reset and keeps its buffers
+ * \internal
+ */
+#define ODBXUV_OP_RECYCLE_MAGIC 0x6f647578
+
+/**
+ * The default amount of released query operations a connection keeps
+ * \internal
+ */
+#define ODBXUV_DEFAULT_FREE_QUERY_MAX 64
+
+/**
+ * The amount of bytes the worker collects before writing them to the spill file
+ * \internal
+ */
+#define ODBXUV_SPILL_BUFFER_SIZE 65536
+
+/**
+ * Length written to the spill file for NULL values
+ * \internal
+ */
+#define ODBXUV_SPILL_NULL UINT32_MAX
+
+/**
+ * The default \p dictionaryMax of a query
+ * \internal
+ */
+#define ODBXUV_DEFAULT_DICTIONARY_MAX 256
+
+/**
+ * Longer values are never shared
+ * \internal
+ */
+#define ODBXUV_DICTIONARY_VALUE_MAX 64
+
+/**
+ * The first chunk size of a query resizing its chunks without a \p chunkSize
+ * \internal
+ */
+#define ODBXUV_DEFAULT_CHUNK_SIZE 64
+
+/**
+ * The largest chunk a query resizing its chunks grows to
+ * \internal
+ */
+#define ODBXUV_CHUNK_SIZE_MAX 65536
+
+/**
+ * A value shared by the rows of a result
+ * \internal
+ */
+typedef struct _odbxuv_dictionary_entry_s
+{
+    struct _odbxuv_dictionary_entry_s *next;
+    uint32_t hash;
+    size_t length;
+    char value[];
+} _odbxuv_dictionary_entry_t;
+
+/**
+ * The shared values of a column
+ * \internal
+ */
+typedef struct _odbxuv_dictionary_column_s
+{
+    _odbxuv_dictionary_entry_t **buckets;
+    unsigned int count;
+    unsigned char full;
+} _odbxuv_dictionary_column_t;
+
+/**
+ * The shared values of a result, only the worker adds to it.
+ * Values stay until the operation is reset or freed.
+ * \internal
+ */
+struct _odbxuv_dictionary_s
+{
+    unsigned int columnCount;
+    unsigned int max;
+    unsigned int bucketCount;
+    size_t size;
+    _odbxuv_dictionary_column_t columns[];
+};
+
+#define ODBXUV_FREE_STRING(var) \
+    if(var != NULL)             \
+    {                           \
+        free((void *)var);      \
+        var = NULL;             \
+    }
+
+#define SET_0_COPY_DATA(obj)                        \
+    {                                               \
+        assert(obj && "Object is NULL");            \
+        void *data = obj->data;                     \
+        memset(obj, 0, sizeof(*obj));               \
+        obj->data = data;                           \
+    }
+
+
+/**
+ * The default delay before the first reconnect attempt in milliseconds
+ * \internal
+ */
+#define ODBXUV_DEFAULT_RECONNECT_DELAY 100
+
+/**
+ * The default maximum delay between reconnect attempts in milliseconds
+ * \internal
+ */
+#define ODBXUV_DEFAULT_RECONNECT_MAX_DELAY 10000
+
+/**
+ * The longest keyword the classifier compares
+ * \internal
+ */
+#define ODBXUV_STATEMENT_WORD_SIZE 16
+
+static void con_worker_check(odbxuv_connection_t *connection);
+static void _con_close(odbxuv_connection_t *con, odbxuv_op_disconnect_t *op);
+
+/**
+ * Fails all operations that did not start yet.
+ * Only call this when the worker is not running or from the worker itself.
+ */
+static void _con_fail_pending(odbxuv_connection_t *con, int errorNum, const char *errorString)
+{
+    uv_mutex_lock(&con->lock);
+    odbxuv_op_t *operation = con->operationQueue;
+
+    while(operation)
+    {
+        if(operation->status == ODBXUV_OP_STATUS_NOT_STARTED)
+        {
+            _handle_make_error((odbxuv_handle_t *)operation, errorNum, -1, errorString);
+            operation->status = ODBXUV_OP_STATUS_COMPLETED;
+        }
+
+        operation = operation->next;
+    }
+    uv_mutex_unlock(&con->lock);
+}
+
+/**
+ * Checks if the error of an operation means the connection to the database is lost.
+ * If so and the reconnect policy allows it the connection starts reconnecting.
+ * Runs on the worker.
+ */
+static unsigned char _con_check_lost(odbxuv_connection_t *con, odbxuv_op_t *operation)
+{
+    if(con->reconnect.maxAttempts == 0 || operation->error == NULL || operation->error->errorType >= 0)
+    {
+        return 0;
+    }
+
+    if(operation->type == ODBXUV_HANDLE_TYPE_OP_CONNECT || operation->type == ODBXUV_HANDLE_TYPE_OP_DISCONNECT)
+    {
+        return 0;
+    }
+
+    _con_set_status(con, ODBXUV_CON_STATUS_RECONNECTING);
+
+    return 1;
+}
+
+/**
+ * Prepares a failed operation to run again, returns 0 if it can't.
+ */
+static unsigned char _op_prepare_replay(odbxuv_op_t *operation)
+{
+    switch(operation->type)
+    {
+        case ODBXUV_HANDLE_TYPE_OP_QUERY:
+        {
+            odbxuv_op_query_t *query = (odbxuv_op_query_t *)operation;
+
+            //Once the query executed the server may have applied it
+            if(!(query->config.options & ODBXUV_QUERY_IDEMPOTENT) || query->fetchStatus != ODBXUV_FETCH_STATUS_ERROR_BEFORE)
+            {
+                return 0;
+            }
+
+            query->fetchStatus = ODBXUV_FETCH_STATUS_NONE;
+        }
+        break;
+
+        case ODBXUV_HANDLE_TYPE_OP_CAPABILITIES:
+            break;
+
+        default:
+            return 0;
+    }
+
+    odbxuv_free_error((odbxuv_handle_t *)operation);
+
+    return 1;
+}
+
+/**
+ * Opens the connection to the database again with the stored parameters.
+ * Fails all pending operations when the last attempt failed.
+ * Runs on the worker.
+ */
+static int _con_reconnect(odbxuv_connection_t *con)
+{
+    int result;
+    odbxuv_credentials_t *credentials = &con->credentials;
+
+    if(con->handle != NULL)
+    {
+        odbx_unbind(con->handle);
+        odbx_finish(con->handle);
+        con->handle = NULL;
+    }
+
+    result = odbx_init(&con->handle, credentials->backend, credentials->host, credentials->port);
+
+    if(result >= ODBX_ERR_SUCCESS)
+    {
+        result = odbx_bind(con->handle, credentials->database, credentials->user, credentials->password, credentials->method);
+
+        if(result < ODBX_ERR_SUCCESS)
+        {
+            odbx_unbind(con->handle);
+        }
+    }
+
+    if(result >= ODBX_ERR_SUCCESS)
+    {
+        con->reconnectAttempts = 0;
+        _con_set_connected(con);
+        return 1;
+    }
+
+    con->reconnectAttempts++;
+
+    if(con->reconnectAttempts >= con->reconnect.maxAttempts)
+    {
+        _con_fail_pending(con, result, odbx_error(con->handle, result));
+        _con_set_status(con, ODBXUV_CON_STATUS_FAILED);
+    }
+
+    if(con->handle != NULL)
+    {
+        odbx_finish(con->handle);
+        con->handle = NULL;
+    }
+
+    return 0;
+}
+
+static void _con_reconnect_timer(uv_timer_t *handle)
+{
+    odbxuv_connection_t *con = (odbxuv_connection_t *)handle->data;
+
+    con_worker_check(con);
+}
+
+/**
+ * Starts the timer for the next reconnect attempt
+ */
+static void _con_schedule_reconnect(odbxuv_connection_t *con)
+{
+    uint64_t delay = con->reconnect.baseDelay;
+    unsigned int i;
+
+    for(i = 0; i < con->reconnectAttempts && delay < con->reconnect.maxDelay; i++)
+    {
+        delay *= 2;
+    }
+
+    if(delay > con->reconnect.maxDelay)
+    {
+        delay = con->reconnect.maxDelay;
+    }
+
+    //Spread the attempts of connections that lost the database at the same time
+    con->reconnectSeed = con->reconnectSeed * 1103515245 + 12345;
+    delay = delay / 2 + (delay > 1 ? (con->reconnectSeed >> 8) % (delay / 2 + 1) : 0);
+
+    uv_timer_start(&con->reconnectTimer, _con_reconnect_timer, delay, 0);
+}
+
+/**
+ * called after the worker thread finished.
+ * checks if the worker should be restarted
+ */
+static void _op_after_run_operations(uv_work_t *req, int status)
+{
+    odbxuv_connection_t *con = (odbxuv_connection_t *)req->data;
+
+    con->workerStatus = ODBXUV_WORKER_IDLE;
+    _op_run_callbacks_real(con); //Make sure we run, maybe uv_async is lazy
+
+    if(con->closeOp != NULL)
+    {
+        //A close was waiting for us
+        odbxuv_op_disconnect_t *op = con->closeOp;
+        con->closeOp = NULL;
+        _con_close(con, op);
+        return;
+    }
+
+    if(odbxuv_connection_get_status(con) == ODBXUV_CON_STATUS_RECONNECTING)
+    {
+        _con_schedule_reconnect(con);
+        return;
+    }
+
+    con_worker_check(con);
+}
+
+/**
+ * Start the worker function in another thread when there is work to do.
+ */
+static void con_worker_check(odbxuv_connection_t *connection)
+{
+    //Wait for the reconnect delay
+    if(odbxuv_connection_get_status(connection) == ODBXUV_CON_STATUS_RECONNECTING && uv_is_active((uv_handle_t *)&connection->reconnectTimer))
+    {
+        return;
+    }
+
+    if(connection->workerStatus == ODBXUV_WORKER_IDLE)
+    {
+        unsigned char havePendingRequests = odbxuv_connection_get_status(connection) == ODBXUV_CON_STATUS_RECONNECTING;
+
+        {
+            odbxuv_op_t *operation = connection->operationQueue;
+            while(operation)
+            {
+                if(operation->status == ODBXUV_OP_STATUS_NOT_STARTED)
+                {
+                    havePendingRequests = 1;
+                    break;
+                }
+                operation = operation->next;
+            }
+        }
+
+        if(havePendingRequests > 0 && connection->workerStatus == ODBXUV_WORKER_IDLE)
+        {
+            connection->workerStatus = ODBXUV_WORKER_RUNNING;
+            memset(&connection->worker, 0, sizeof(connection->worker));
+            connection->worker.data = connection;
+
+            uv_queue_work(connection->loop, &connection->worker, _op_run_operations, _op_after_run_operations);
+            connection->workerStatus = ODBXUV_WORKER_RUNNING;
+        }
+    }
+}
+
+/*
+ * Up next, functions that implement certain types of operations.
+ */
+
+static odbxuv_operation_status_e _op_connect(odbxuv_op_t *req)
+{
+    int result;
+    odbxuv_op_connect_t *op = (odbxuv_op_connect_t *)req;
+    assert(op->type == ODBXUV_HANDLE_TYPE_OP_CONNECT);
+
+    result = odbx_init(&op->connection->handle, op->backend, op->host, op->port);
+
+    MAKE_ODBX_ERR(op, result, {
+        odbx_finish(op->connection->handle);
+        op->connection->handle = NULL;
+        _con_set_status(op->connection, ODBXUV_CON_STATUS_FAILED);
+    });
+
+    result = odbx_bind(op->connection->handle, op->database, op->user, op->password, op->method);
+
+    MAKE_ODBX_ERR(op, result, {
+        odbx_unbind(op->connection->handle);
+        odbx_finish(op->connection->handle);
+        op->connection->handle = NULL;
+        _con_set_status(op->connection, ODBXUV_CON_STATUS_FAILED);
+    });
+
+    _con_set_connected(op->connection);
+
+    return 0;
+}
+
+static odbxuv_operation_status_e _op_disconnect(odbxuv_op_t *req)
+{
+    int result;
+    odbxuv_op_disconnect_t *op = (odbxuv_op_disconnect_t *)req;
+    assert(op->type == ODBXUV_HANDLE_TYPE_OP_DISCONNECT);
+
+    result = odbx_unbind(req->connection->handle);
+
+    MAKE_ODBX_ERR(op, result, {
+        odbx_finish(op->connection->handle);
+        op->connection->handle = NULL;
+        _con_set_status(op->connection, ODBXUV_CON_STATUS_IDLE);
+    });
+
+    result = odbx_finish(op->connection->handle);
+
+    MAKE_ODBX_ERR(op, result, {
+        op->connection->handle = NULL;
+        _con_set_status(op->connection, ODBXUV_CON_STATUS_IDLE);
+    });
+
+    _con_set_status(op->connection, ODBXUV_CON_STATUS_DISCONNECTED);
+
+    return 0;
+}
+
+static odbxuv_operation_status_e _op_capabilities(odbxuv_op_t *req)
+{
+    int result;
+    odbxuv_op_capabilities_t *op = (odbxuv_op_capabilities_t *)req;
+    assert(op->type == ODBXUV_HANDLE_TYPE_OP_CAPABILITIES);
+
+    result = odbx_capabilities(op->connection->handle, op->capabilities);
+
+    MAKE_ODBX_ERR(op, result, {
+
+    });
+
+    op->result = result;
+
+    return 0;
+}
+
+/**
+ * Hands the rows fetched by the worker to the loop.
+ * The loop is only woken up when it has nothing left to process, when it is
+ * still busy it picks up the new rows together with the ones it was woken up for.
+ * When \p fetchStatus is not \p ODBXUV_FETCH_STATUS_RUNNING the fetch is finished and the loop is always woken up.
+ * \warning The worker may not touch the operation after finishing it.
+ */
+static void _query_flush_rows(odbxuv_op_query_t *op, odbxuv_fetch_status_e fetchStatus)
+{
+    odbxuv_connection_t *con = op->connection;
+    unsigned char notify = 0;
+
+    uv_mutex_lock(&con->lock);
+
+    if(op->memoryPending != 0)
+    {
+        __atomic_add_fetch(&con->counters.memoryUsed, op->memoryPending, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&_odbxuv_memory_used, op->memoryPending, __ATOMIC_RELAXED);
+        op->memoryPending = 0;
+    }
+
+    op->memoryExceeded = _memory_exceeded(op);
+
+    if(op->batch != NULL)
+    {
+        notify = op->row == NULL;
+
+        if(op->rowTail != NULL)
+        {
+            op->rowTail->next = op->batch;
+        }
+        else
+        {
+            op->row = op->batch;
+        }
+
+        op->rowTail = op->batchTail;
+        con->counters.rowsFetched += op->batchCount;
+        op->bufferedBytes += op->batchBytes;
+
+        if(op->config.spillThreshold && !op->spilling && op->bufferedBytes >= op->config.spillThreshold)
+        {
+            //Everything after this batch goes to the spill file to keep the order
+            op->spilling = 1;
+            op->spillFile = -1;
+        }
+
+        op->batch = NULL;
+        op->batchTail = NULL;
+        op->batchCount = 0;
+        op->batchBytes = 0;
+    }
+
+    if(fetchStatus != ODBXUV_FETCH_STATUS_RUNNING)
+    {
+        //Give back the rows we were going to reuse so they can be freed
+        if(op->workerFreeRow != NULL)
+        {
+            odbxuv_row_t *last = op->workerFreeRow;
+            while(last->next) last = last->next;
+            last->next = op->freeRow;
+            op->freeRow = op->workerFreeRow;
+        }
+
+        op->fetchStatus = fetchStatus;
+        notify = 1;
+    }
+    else if(op->workerFreeRow == NULL)
+    {
+        //Take over the rows the loop is done with
+        op->workerFreeRow = op->freeRow;
+        op->freeRow = NULL;
+    }
+
+    notify = notify && op->asyncStatus == 1;
+
+    if(notify)
+    {
+        con->counters.rowWakeups++;
+    }
+
+    //Once finished the loop may close the handle as soon as the lock is released
+    if(notify && fetchStatus != ODBXUV_FETCH_STATUS_RUNNING)
+    {
+        uv_async_send(&op->async);
+        notify = 0;
+    }
+
+    uv_mutex_unlock(&con->lock);
+
+    if(notify)
+    {
+        uv_async_send(&op->async);
+    }
+}
+
+/**
+ * Adds a fetched row to the current batch and flushes the batch when it is full or too old.
+ */
+static void _query_batch_row(odbxuv_op_query_t *op, odbxuv_row_t *row)
+{
+    odbxuv_connection_t *con = op->connection;
+
+    row->next = NULL;
+
+    if(op->batchTail != NULL)
+    {
+        op->batchTail->next = row;
+    }
+    else
+    {
+        op->batch = row;
+        op->batchStart = con->notifyInterval ? uv_hrtime() : 0;
+    }
+
+    op->batchTail = row;
+    op->batchCount++;
+    op->batchBytes += row->size;
+
+    if(op->batchCount >= con->notifyRows
+        || (con->notifyInterval && uv_hrtime() - op->batchStart >= (uint64_t)con->notifyInterval * 1000))
+    {
+        _query_flush_rows(op, ODBXUV_FETCH_STATUS_RUNNING);
+    }
+}
+
+/**
+ * Waits until the loop hands back rows the worker can reuse instead of allocating more.
+ * Returns right away when the loop holds no rows.
+ * Runs on the worker.
+ */
+static void _query_wait_rows(odbxuv_op_query_t *op)
+{
+    odbxuv_connection_t *con = op->connection;
+
+    //The loop can't hand back rows it never saw
+    if(op->batch != NULL)
+    {
+        _query_flush_rows(op, ODBXUV_FETCH_STATUS_RUNNING);
+        if(op->workerFreeRow != NULL || !op->memoryExceeded) return;
+    }
+
+    uv_mutex_lock(&con->lock);
+    while(op->freeRow == NULL && op->bufferedBytes > 0 && op->fetchStatus != ODBXUV_FETCH_STATUS_CANCELLED)
+    {
+        op->memoryWaiting = 1;
+        uv_cond_wait(&con->rowsReturned, &con->lock);
+    }
+    op->memoryWaiting = 0;
+    op->workerFreeRow = op->freeRow;
+    op->freeRow = NULL;
+    uv_mutex_unlock(&con->lock);
+}
+
+/**
+ * Takes a processed row for reuse or allocates a new one.
+ */
+static odbxuv_row_t *_query_get_row(odbxuv_op_query_t *op)
+{
+    if(op->workerFreeRow == NULL && op->memoryExceeded && op->config.memoryPolicy == ODBXUV_MEMORY_PAUSE)
+    {
+        _query_wait_rows(op);
+    }
+
+    odbxuv_row_t *row = op->workerFreeRow;
+
+    if(row != NULL)
+    {
+        op->workerFreeRow = row->next;
+        row->next = NULL;
+        return row;
+    }
+
+    row = malloc(sizeof(odbxuv_row_t));
+    memset(row, 0, sizeof(odbxuv_row_t));
+    row->status = ODBXUV_ROW_STATUS_NONE;
+
+    return row;
+}
+
+/**
+ * Builds the bitmap of the columns selected by the config once the columns of the result are known.
+ * Runs on the worker.
+ */
+static void _query_select_columns(odbxuv_op_query_t *op)
+{
+    unsigned int i;
+    unsigned int j;
+
+    if(op->config.selectColumnCount == 0 && op->config.selectNameCount == 0) return;
+
+    size_t size = (op->columnCount + 7) / 8;
+
+    free(op->columnMask);
+    op->columnMask = malloc(size ? size : 1);
+    memset(op->columnMask, 0, size ? size : 1);
+
+    for(i = 0; i < op->config.selectColumnCount; i++)
+    {
+        unsigned int column = op->config.selectColumns[i];
+
+        if(column < op->columnCount) op->columnMask[column / 8] |= 1 << (column % 8);
+    }
+
+    for(j = 0; j < op->columnCount; j++)
+    {
+        const char *name = odbx_column_name(op->resultHandle, j);
+
+        for(i = 0; name != NULL && i < op->config.selectNameCount; i++)
+        {
+            if(strcmp(op->config.selectNames[i], name) == 0)
+            {
+                op->columnMask[j / 8] |= 1 << (j % 8);
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Whether the values of \p column are copied
+ */
+static int _query_column_selected(odbxuv_op_query_t *op, unsigned int column)
+{
+    return op->columnMask == NULL || op->columnMask[column / 8] & (1 << (column % 8));
+}
+
+/**
+ * Hands the buffer the worker is filling to the loop.
+ * Runs on the worker.
+ */
+static void _query_serial_push(odbxuv_op_query_t *op)
+{
+    odbxuv_serializer_t *serializer = op->config.serializer;
+    odbxuv_connection_t *con = op->connection;
+    unsigned char notify;
+
+    if(serializer->current == serializer->bufferCount) return;
+
+    if(serializer->lengths[serializer->current] == 0)
+    {
+        //Nothing was written in it, keep it for later
+        uv_mutex_lock(&con->lock);
+        serializer->free[serializer->freeCount++] = serializer->current;
+        uv_mutex_unlock(&con->lock);
+
+        serializer->current = serializer->bufferCount;
+        return;
+    }
+
+    uv_mutex_lock(&con->lock);
+    notify = serializer->filledCount == 0 && op->asyncStatus == 1;
+    serializer->filled[(serializer->filledStart + serializer->filledCount) % serializer->bufferCount] = serializer->current;
+    serializer->filledCount++;
+    con->counters.rowsFetched += serializer->rows;
+    if(notify)
+    {
+        con->counters.rowWakeups++;
+    }
+    uv_mutex_unlock(&con->lock);
+
+    serializer->current = serializer->bufferCount;
+
+    if(notify)
+    {
+        uv_async_send(&op->async);
+    }
+}
+
+/**
+ * Takes a buffer to fill, waits until the loop hands one back when it holds all of them.
+ * Runs on the worker.
+ */
+static void _query_serial_take(odbxuv_op_query_t *op)
+{
+    odbxuv_serializer_t *serializer = op->config.serializer;
+
+    uv_mutex_lock(&op->connection->lock);
+    while(serializer->freeCount == 0)
+    {
+        uv_cond_wait(&serializer->available, &op->connection->lock);
+    }
+    serializer->current = serializer->free[--serializer->freeCount];
+    uv_mutex_unlock(&op->connection->lock);
+
+    serializer->lengths[serializer->current] = 0;
+    serializer->rows = 0;
+    serializer->bufferStart = op->connection->notifyInterval ? uv_hrtime() : 0;
+}
+
+/**
+ * Starts the first buffer with the header.
+ * Runs on the worker.
+ */
+static int _query_serial_header(odbxuv_op_query_t *op)
+{
+    odbxuv_serializer_t *serializer = op->config.serializer;
+
+    _query_serial_take(op);
+
+    uv_buf_t *buf = &serializer->buffers[serializer->current];
+    size_t written = odbxuv_serialize_header(op->columnCount, op->columns, buf->base, buf->len);
+
+    if(written == 0) return ODBXUV_ERR_TOOLARGE;
+
+    serializer->lengths[serializer->current] = written;
+
+    return ODBX_ERR_SUCCESS;
+}
+
+/**
+ * Writes the current row of the result straight into the buffers of the serializer.
+ * Runs on the worker.
+ */
+static int _query_serial_row(odbxuv_op_query_t *op)
+{
+    odbxuv_serializer_t *serializer = op->config.serializer;
+    odbxuv_connection_t *con = op->connection;
+    unsigned int i;
+
+    if(serializer->valueCapacity < op->columnCount)
+    {
+        serializer->values = realloc(serializer->values, sizeof(const char *) * op->columnCount);
+        serializer->valueLengths = realloc(serializer->valueLengths, sizeof(unsigned long) * op->columnCount);
+        serializer->valueCapacity = op->columnCount;
+    }
+
+    for(i = 0; i < op->columnCount; i++)
+    {
+        const char *value = op->flags & ODBXUV_QUERY_FETCH_VALUE && _query_column_selected(op, i) ? odbx_field_value(op->resultHandle, i) : NULL;
+
+        serializer->values[i] = value;
+        serializer->valueLengths[i] = value ? odbx_field_length(op->resultHandle, i) : 0;
+    }
+
+    for(;;)
+    {
+        if(serializer->current == serializer->bufferCount)
+        {
+            _query_serial_take(op);
+        }
+
+        uv_buf_t *buf = &serializer->buffers[serializer->current];
+        size_t used = serializer->lengths[serializer->current];
+        size_t written = odbxuv_serialize_values(op->columnCount, serializer->values, serializer->valueLengths, buf->base + used, buf->len - used);
+
+        if(written != 0)
+        {
+            serializer->lengths[serializer->current] += written;
+            serializer->rows++;
+            break;
+        }
+
+        //Not even an empty buffer can hold the row
+        if(serializer->rows == 0) return ODBXUV_ERR_TOOLARGE;
+
+        _query_serial_push(op);
+    }
+
+    if(con->notifyInterval && uv_hrtime() - serializer->bufferStart >= (uint64_t)con->notifyInterval * 1000)
+    {
+        _query_serial_push(op);
+    }
+
+    return ODBX_ERR_SUCCESS;
+}
+
+/**
+ * Hands the filled buffers to the callback and gives them back to the worker.
+ */
+static void _query_serial_deliver(odbxuv_op_query_t *op)
+{
+    odbxuv_serializer_t *serializer = op->config.serializer;
+    odbxuv_connection_t *con = op->connection;
+    unsigned int index;
+
+    for(;;)
+    {
+        uv_mutex_lock(&con->lock);
+        if(serializer->filledCount == 0)
+        {
+            uv_mutex_unlock(&con->lock);
+            return;
+        }
+        index = serializer->filled[serializer->filledStart];
+        serializer->filledStart = (serializer->filledStart + 1) % serializer->bufferCount;
+        serializer->filledCount--;
+        uv_mutex_unlock(&con->lock);
+
+        op->fetchCallbackStatus = ODBXUV_FETCH_CB_STATUS_CALLED;
+        serializer->callback(op, serializer->buffers[index].base, serializer->lengths[index], 0);
+
+        uv_mutex_lock(&con->lock);
+        serializer->free[serializer->freeCount++] = index;
+        uv_cond_signal(&serializer->available);
+        uv_mutex_unlock(&con->lock);
+    }
+}
+
+/**
+ * Writes the collected rows to the spill file.
+ * Runs on the worker.
+ */
+static int _query_spill_write(odbxuv_op_query_t *op)
+{
+    size_t written = 0;
+
+    while(written < op->spillBuffered)
+    {
+        ssize_t result = write(op->spillFile, op->spillBuffer + written, op->spillBuffered - written);
+
+        if(result < 0)
+        {
+            if(errno == EINTR) continue;
+            return -errno;
+        }
+
+        written += result;
+    }
+
+    op->spillLength += written;
+    op->spillBuffered = 0;
+
+    return 0;
+}
+
+static int _query_spill_put(odbxuv_op_query_t *op, const void *data, size_t length)
+{
+    const char *bytes = data;
+
+    while(length > 0)
+    {
+        size_t chunk = ODBXUV_SPILL_BUFFER_SIZE - op->spillBuffered;
+
+        if(chunk > length) chunk = length;
+
+        memcpy(op->spillBuffer + op->spillBuffered, bytes, chunk);
+        op->spillBuffered += chunk;
+        bytes += chunk;
+        length -= chunk;
+
+        if(op->spillBuffered == ODBXUV_SPILL_BUFFER_SIZE && _query_spill_write(op) < 0) return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Appends the current row of the result to the spill file, creating it for the first row.
+ * Every value is its length as 32 bit integer, ::ODBXUV_SPILL_NULL for NULL,
+ * followed by the value and a terminating zero so the loop can point into the mapping.
+ * Runs on the worker.
+ */
+static int _query_spill_row(odbxuv_op_query_t *op)
+{
+    unsigned int i;
+
+    if(op->spillBuffer == NULL)
+    {
+        const char *directory = op->config.spillDirectory ? op->config.spillDirectory : P_tmpdir;
+        size_t length = strlen(directory) + sizeof("/odbxuv-spill-XXXXXX");
+        char *path = malloc(length);
+
+        snprintf(path, length, "%s/odbxuv-spill-XXXXXX", directory);
+        op->spillFile = mkstemp(path);
+
+        if(op->spillFile < 0)
+        {
+            free(path);
+            return -1;
+        }
+
+        //Nobody else needs to see it, the space is released once the loop unmaps it
+        unlink(path);
+        free(path);
+
+        op->spillBuffer = malloc(ODBXUV_SPILL_BUFFER_SIZE);
+        op->spillBuffered = 0;
+        _memory_worker(op, ODBXUV_SPILL_BUFFER_SIZE);
+    }
+
+    for(i = 0; i < op->columnCount; i++)
+    {
+        const char *value = op->flags & ODBXUV_QUERY_FETCH_VALUE && _query_column_selected(op, i) ? odbx_field_value(op->resultHandle, i) : NULL;
+        uint32_t length = value ? (uint32_t)odbx_field_length(op->resultHandle, i) : ODBXUV_SPILL_NULL;
+
+        if(_query_spill_put(op, &length, sizeof(length)) < 0) return -1;
+
+        if(value != NULL && _query_spill_put(op, value, (size_t)length + 1) < 0) return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Closes the spill file and frees the rows replaying it.
+ */
+static void _query_spill_free(odbxuv_op_query_t *op)
+{
+    unsigned int i;
+
+    if(!op->spilling) return;
+
+    if(op->spillMap != NULL)
+    {
+        munmap(op->spillMap, op->spillLength);
+    }
+
+    if(op->spillFile >= 0)
+    {
+        close(op->spillFile);
+    }
+
+    for(i = 0; i < op->spillRowCount; i++)
+    {
+        free(op->spillRows[i].value);
+    }
+
+    free(op->spillRows);
+    free(op->spillBuffer);
+
+    op->spilling = 0;
+    op->spillFile = -1;
+    op->spillBuffer = NULL;
+    op->spillBuffered = 0;
+    op->spillLength = 0;
+    op->spillMap = NULL;
+    op->spillPos = 0;
+    op->spillRows = NULL;
+    op->spillRowCount = 0;
+}
+
+/**
+ * Returns the shared copy of \p value for \p column, adding it while the column has room.
+ * Returns NULL when the value has to be copied.
+ */
+static char *_query_dictionary_value(odbxuv_op_query_t *op, unsigned int column, const char *value, size_t length)
+{
+    struct _odbxuv_dictionary_s *dictionary = op->dictionary;
+
+    if(dictionary == NULL)
+    {
+        unsigned int max = op->config.dictionaryMax ? op->config.dictionaryMax : ODBXUV_DEFAULT_DICTIONARY_MAX;
+        size_t size = sizeof(struct _odbxuv_dictionary_s) + sizeof(_odbxuv_dictionary_column_t) * op->columnCount;
+
+        dictionary = malloc(size);
+        memset(dictionary, 0, size);
+        dictionary->columnCount = op->columnCount;
+        dictionary->max = max;
+        dictionary->bucketCount = 1;
+        while(dictionary->bucketCount < max) dictionary->bucketCount <<= 1;
+        dictionary->size = size;
+
+        op->dictionary = dictionary;
+        _memory_worker(op, size);
+    }
+
+    _odbxuv_dictionary_column_t *entries = &dictionary->columns[column];
+
+    if(length > ODBXUV_DICTIONARY_VALUE_MAX) return NULL;
+
+    uint32_t hash = _hash_bytes(2166136261u, value, length);
+    _odbxuv_dictionary_entry_t *entry;
+
+    if(entries->buckets == NULL)
+    {
+        size_t size = sizeof(_odbxuv_dictionary_entry_t *) * dictionary->bucketCount;
+
+        entries->buckets = malloc(size);
+        memset(entries->buckets, 0, size);
+        dictionary->size += size;
+        _memory_worker(op, size);
+    }
+
+    for(entry = entries->buckets[hash & (dictionary->bucketCount - 1)]; entry != NULL; entry = entry->next)
+    {
+        if(entry->hash == hash && entry->length == length && memcmp(entry->value, value, length) == 0)
+        {
+            return entry->value;
+        }
+    }
+
+    if(entries->full) return NULL;
+
+    if(entries->count >= dictionary->max)
+    {
+        //Too many distinct values, the column is copied from now on
+        entries->full = 1;
+        return NULL;
+    }
+
+    size_t size = sizeof(_odbxuv_dictionary_entry_t) + length + 1;
+
+    entry = malloc(size);
+    entry->hash = hash;
+    entry->length = length;
+    memcpy(entry->value, value, length + 1);
+    entry->next = entries->buckets[hash & (dictionary->bucketCount - 1)];
+    entries->buckets[hash & (dictionary->bucketCount - 1)] = entry;
+    entries->count++;
+
+    dictionary->size += size;
+    _memory_worker(op, size);
+
+    return entry->value;
+}
+
+/**
+ * Frees the shared values, after the rows pointing into them.
+ */
+static void _query_dictionary_free(odbxuv_op_query_t *op)
+{
+    struct _odbxuv_dictionary_s *dictionary = op->dictionary;
+    unsigned int i;
+    unsigned int j;
+
+    if(dictionary == NULL) return;
+
+    for(i = 0; i < dictionary->columnCount; i++)
+    {
+        _odbxuv_dictionary_column_t *entries = &dictionary->columns[i];
+
+        if(entries->buckets == NULL) continue;
+
+        for(j = 0; j < dictionary->bucketCount; j++)
+        {
+            _odbxuv_dictionary_entry_t *entry = entries->buckets[j];
+
+            while(entry != NULL)
+            {
+                _odbxuv_dictionary_entry_t *next = entry->next;
+                free(entry);
+                entry = next;
+            }
+        }
+
+        free(entries->buckets);
+    }
+
+    op->dictionary = NULL;
+    _memory_add(op, -(int64_t)dictionary->size);
+    free(dictionary);
+}
+
+/**
+ * The bitmap behind the values of a row, marking the values pointing into the dictionary.
+ * NULL when the query does not use one.
+ */
+static unsigned char *_row_shared(odbxuv_op_query_t *op, odbxuv_row_t *row)
+{
+    return op->flags & ODBXUV_QUERY_FETCH_DICTIONARY ? (unsigned char *)(row->value + op->columnCount) : NULL;
+}
+
+/**
+ * Frees a value of a row unless it is shared.
+ */
+static void _row_free_value(odbxuv_op_query_t *op, odbxuv_row_t *row, unsigned int column)
+{
+    unsigned char *shared = _row_shared(op, row);
+
+    if(shared != NULL && shared[column / 8] & (1 << (column % 8)))
+    {
+        shared[column / 8] &= ~(1 << (column % 8));
+    }
+    else
+    {
+        free(row->value[column]);
+    }
+
+    row->value[column] = NULL;
+}
+
+/**
+ * Frees what the row hook emitted in a row before the row is reused or freed.
+ */
+static void _row_free_user(odbxuv_op_query_t *op, odbxuv_row_t *row)
+{
+    if(op->config.rowUserFree != NULL)
+    {
+        op->config.rowUserFree(op, row->user);
+    }
+
+    row->user = NULL;
+}
+
+/**
+ * Passes the current row of the result to the row hook of the query.
+ * The values to copy are left in \p hookValues and \p hookLengths.
+ * Runs on the worker.
+ */
+static odbxuv_row_hook_e _query_hook_row(odbxuv_op_query_t *op, void **user)
+{
+    unsigned int i;
+
+    if(op->hookCapacity < op->columnCount)
+    {
+        op->hookValues = realloc(op->hookValues, sizeof(const char *) * op->columnCount);
+        op->hookLengths = realloc(op->hookLengths, sizeof(unsigned long) * op->columnCount);
+        op->hookCapacity = op->columnCount;
+    }
+
+    for(i = 0; i < op->columnCount; i++)
+    {
+        const char *value = odbx_field_value(op->resultHandle, i);
+        op->hookValues[i] = value;
+        op->hookLengths[i] = value ? odbx_field_length(op->resultHandle, i) : 0;
+    }
+
+    *user = NULL;
+
+    return op->config.rowHook(op, op->columnCount, op->hookValues, op->hookLengths, user);
+}
+
+/**
+ * Adds the current row of the result to the aggregate of the query.
+ * Runs on the worker.
+ */
+static int _query_aggregate_row(odbxuv_op_query_t *op)
+{
+    odbxuv_aggregate_t *aggregate = op->config.aggregate;
+    unsigned int columnCount = odbx_column_count(op->resultHandle);
+    unsigned int i;
+
+    if(aggregate->valueCapacity < columnCount)
+    {
+        aggregate->values = realloc(aggregate->values, sizeof(const char *) * columnCount);
+        aggregate->lengths = realloc(aggregate->lengths, sizeof(unsigned long) * columnCount);
+        aggregate->valueCapacity = columnCount;
+    }
+
+    for(i = 0; i < columnCount; i++)
+    {
+        const char *value = odbx_field_value(op->resultHandle, i);
+        aggregate->values[i] = value;
+        aggregate->lengths[i] = value ? odbx_field_length(op->resultHandle, i) : 0;
+    }
+
+    return odbxuv_aggregate_add(aggregate, columnCount, aggregate->values, aggregate->lengths);
+}
+
+/**
+ * Hands the aggregate rows to the loop like fetched rows once the result has been aggregated.
+ * Runs on the worker.
+ */
+static void _query_aggregate_emit(odbxuv_op_query_t *op)
+{
+    odbxuv_aggregate_t *aggregate = op->config.aggregate;
+    unsigned int i;
+
+    odbxuv_aggregate_finish(aggregate);
+
+    for(i = 0; i < aggregate->resultCount; i++)
+    {
+        odbxuv_row_t *row = _query_get_row(op);
+        size_t previousSize = row->size;
+
+        row->size = sizeof(odbxuv_row_t);
+
+        if(op->flags & ODBXUV_QUERY_FETCH_VALUE)
+        {
+            size_t len = sizeof(char *) * op->columnCount;
+            unsigned int column;
+
+            if(op->flags & ODBXUV_QUERY_FETCH_DICTIONARY) len += (op->columnCount + 7) / 8;
+
+            if(row->value == NULL)
+            {
+                row->value = malloc(len);
+            }
+            else
+            {
+                //Recycled rows held aggregate rows as well
+                for(column = 0; column < op->columnCount; column++)
+                {
+                    if(row->value[column] != NULL) _row_free_value(op, row, column);
+                }
+            }
+
+            memset(row->value, 0, len);
+            row->size += len;
+
+            odbxuv_aggregate_emit(aggregate, i, row->value);
+
+            for(column = 0; column < op->columnCount; column++)
+            {
+                if(row->value[column] != NULL) row->size += strlen(row->value[column]) + 1;
+            }
+        }
+
+        row->status = ODBXUV_ROW_STATUS_READ;
+
+        _memory_worker(op, (int64_t)row->size - (int64_t)previousSize);
+        _query_batch_row(op, row);
+    }
+}
+
+/**
+ * The bytes of the selected values of the current row as reported by the backend
+ */
+static uint64_t _query_row_width(odbxuv_op_query_t *op)
+{
+    uint64_t width = sizeof(odbxuv_row_t);
+    unsigned int columnCount = odbx_column_count(op->resultHandle);
+    unsigned int i;
+
+    for(i = 0; i < columnCount; i++)
+    {
+        if(_query_column_selected(op, i)) width += odbx_field_length(op->resultHandle, i) + 1;
+    }
+
+    return width;
+}
+
+/**
+ * Sizes the next chunk after fetching one of \p rows rows and \p bytes bytes in \p elapsed nanoseconds.
+ * The size aims at \p chunkBytes, is cut to what the observed row rate fetches within the notify interval
+ * and halved while the loop holds more than two chunks. It grows to at most twice the previous size.
+ */
+static void _query_resize_chunk(odbxuv_op_query_t *op, uint64_t rows, uint64_t bytes, uint64_t elapsed)
+{
+    if(rows == 0) return;
+
+    uint64_t width = bytes / rows;
+    uint64_t size = op->config.chunkBytes / (width ? width : 1);
+    uint64_t interval = (uint64_t)op->connection->notifyInterval * 1000;
+
+    if(interval && elapsed > interval)
+    {
+        uint64_t fits = rows * interval / elapsed;
+        if(fits < size) size = fits;
+    }
+
+    uv_mutex_lock(&op->connection->lock);
+    unsigned char lagging = op->bufferedBytes > op->config.chunkBytes * 2 || op->memoryExceeded;
+    uv_mutex_unlock(&op->connection->lock);
+
+    if(lagging) size /= 2;
+
+    if(size > (uint64_t)op->chunkSize * 2) size = (uint64_t)op->chunkSize * 2;
+    if(size > ODBXUV_CHUNK_SIZE_MAX) size = ODBXUV_CHUNK_SIZE_MAX;
+    if(size < 1) size = 1;
+
+    op->chunkSize = (int)size;
+}
+
+/**
+ * Adds the time the database took to answer a query to the moving average of the connection.
+ */
+static void _con_record_latency(odbxuv_connection_t *con, uint64_t latency)
+{
+    uv_mutex_lock(&con->lock);
+    if(con->counters.queryLatency == 0)
+    {
+        con->counters.queryLatency = latency;
+    }
+    else
+    {
+        con->counters.queryLatency = con->counters.queryLatency - con->counters.queryLatency / ODBXUV_LATENCY_WEIGHT + latency / ODBXUV_LATENCY_WEIGHT;
+    }
+    uv_mutex_unlock(&con->lock);
+}
+
+/**
+ * Adds a finished query to the statistics and the slow query log of its connection.
+ * \p answered is the time the database answered or 0 when it did not.
+ */
+static void _query_record(odbxuv_op_query_t *op, uint64_t start, uint64_t answered, uint64_t rows, unsigned char failed)
+{
+    odbxuv_connection_t *con = op->connection;
+
+    if(con->stats == NULL && con->slowlog == NULL) return;
+
+    uint64_t finished = uv_hrtime();
+
+    if(answered == 0) answered = finished;
+
+    if(con->stats != NULL)
+    {
+        odbxuv_stats_record(con->stats, op->query, finished - start, rows, failed);
+    }
+
+    if(con->slowlog != NULL)
+    {
+        odbxuv_slowlog_record(con->slowlog, con, op->query, answered - start, finished - answered, rows, failed);
+    }
+}
+
+/**
+ * Adds a fetched row to the snapshot of a shared query instead of handing it to the loop.
+ * Runs on the worker.
+ */
+static void _query_snapshot_row(odbxuv_op_query_t *op, odbxuv_row_t *row)
+{
+    odbxuv_snapshot_t *snapshot = op->snapshot;
+    unsigned int notifyRows = op->connection->notifyRows;
+
+    row->next = NULL;
+
+    if(snapshot->rowsTail != NULL)
+    {
+        snapshot->rowsTail->next = row;
+    }
+    else
+    {
+        snapshot->rows = row;
+    }
+
+    snapshot->rowsTail = row;
+    snapshot->rowCount++;
+    snapshot->size += row->size;
+
+    //Catch up with the totals now and then so the memory limits apply
+    if(notifyRows <= 1 || snapshot->rowCount % notifyRows == 0)
+    {
+        _query_flush_rows(op, ODBXUV_FETCH_STATUS_RUNNING);
+    }
+}
+
+/**
+ * Completes the snapshot of a shared query and hands it to the queries attached to it,
+ * from then on the rows only count globally.
+ * Runs on the worker, or on the loop when the query failed before fetching.
+ */
+static void _query_snapshot_finish(odbxuv_op_query_t *op, odbxuv_fetch_status_e fetchStatus)
+{
+    odbxuv_connection_t *con = op->connection;
+    odbxuv_snapshot_t *snapshot = op->snapshot;
+    odbxuv_snapshot_t **link;
+    odbxuv_op_query_t *follower;
+
+    uv_mutex_lock(&con->lock);
+
+    if(op->memoryPending != 0)
+    {
+        __atomic_add_fetch(&con->counters.memoryUsed, op->memoryPending, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&_odbxuv_memory_used, op->memoryPending, __ATOMIC_RELAXED);
+        op->memoryPending = 0;
+    }
+
+    __atomic_sub_fetch(&con->counters.memoryUsed, snapshot->size, __ATOMIC_RELAXED);
+    con->counters.rowsFetched += snapshot->rowCount;
+    op->memoryUsed -= snapshot->size;
+
+    snapshot->columnCount = op->columnCount;
+    snapshot->complete = 1;
+    op->snapshotRow = snapshot->rows;
+
+    //Identical queries submitted from now on run again
+    for(link = &con->snapshots; *link != NULL; link = &(*link)->next)
+    {
+        if(*link == snapshot)
+        {
+            *link = snapshot->next;
+            break;
+        }
+    }
+
+    snapshot->next = NULL;
+
+    for(follower = snapshot->followers; follower; follower = follower->nextFollower)
+    {
+        follower->columnCount = op->columnCount;
+        follower->affectedCount = op->affectedCount;
+        follower->rowCount = snapshot->rowCount;
+        follower->snapshotRow = snapshot->rows;
+
+        if(op->metadata != NULL)
+        {
+            __atomic_add_fetch(&((odbxuv_metadata_t *)op->metadata)->refs, 1, __ATOMIC_ACQ_REL);
+            follower->metadata = op->metadata;
+            follower->columns = op->columns;
+        }
+
+        if(op->error != NULL)
+        {
+            _handle_make_error((odbxuv_handle_t *)follower, op->error->error, op->error->errorType, op->error->errorString);
+        }
+
+        follower->fetchStatus = fetchStatus;
+
+        //The loop can't have seen the status and closed the handle while we hold the lock
+        if(follower->asyncStatus == 1)
+        {
+            uv_async_send(&follower->async);
+        }
+    }
+
+    uv_mutex_unlock(&con->lock);
+}
+
+static odbxuv_operation_status_e _op_query(odbxuv_op_t *req)
+{
+    int result;
+    odbxuv_op_query_t *op = (odbxuv_op_query_t *)req;
+    odbxuv_fetch_status_e fetchStatus = ODBXUV_FETCH_STATUS_FINISHED;
+    uint64_t start = uv_hrtime();
+    uint64_t queryStart = start;
+    uint64_t answered = 0;
+    uint64_t rowCount = 0;
+    uint64_t spillCount = 0;
+    uint64_t chunkStart = 0;
+    uint64_t chunkRows = 0;
+    uint64_t chunkBytes = 0;
+    assert(op->type == ODBXUV_HANDLE_TYPE_OP_QUERY);
+
+    //Only the worker starts sessions, so it reads the counter without the lock
+    if(op->config.session != 0 && op->config.session != op->connection->counters.sessions)
+    {
+        _handle_make_error((odbxuv_handle_t *)op, ODBXUV_ERR_NOCONNECTION, 0, "The session of the query was lost");
+        op->fetchStatus = ODBXUV_FETCH_STATUS_ERROR_BEFORE;
+        return 0;
+    }
+
+    result = odbx_query(op->connection->handle, op->query, 0);
+
+    MAKE_ODBX_ERR(op, result, {
+        op->fetchStatus = ODBXUV_FETCH_STATUS_ERROR_BEFORE;
+
+        _query_record(op, queryStart, 0, 0, 1);
+    });
+
+    uv_mutex_lock(&op->connection->lock);
+    op->fetchStatus = ODBXUV_FETCH_STATUS_RUNNING;
+    op->connection->counters.queryWakeups++;
+    op->status = ODBXUV_OP_STATUS_COMPLETED;
+    uv_mutex_unlock(&op->connection->lock);
+
+    uv_async_send(&op->connection->async); //Note: the callback should not free the op!
+
+    unsigned char didGetInfo = 0;
+    do
+    {
+        if(op->resultHandle != NULL)
+        {
+            result = odbx_result_finish(op->resultHandle);
+            op->resultHandle = NULL;
+
+            if(result < ODBX_ERR_SUCCESS)
+            {
+                fetchStatus = ODBXUV_FETCH_STATUS_ERROR_FINISH;
+                goto error;
+            }
+        }
+
+        if(op->config.chunkBytes)
+        {
+            chunkStart = uv_hrtime();
+            chunkRows = 0;
+            chunkBytes = 0;
+        }
+
+        result = odbx_result(
             op->connection->handle,
             &op->resultHandle,
             NULL,
             op->chunkSize);
 
+        if(start != 0)
+        {
+            //Most backends only wait for the server in the first odbx_result
+            answered = uv_hrtime();
+            _con_record_latency(op->connection, answered - start);
+            start = 0;
+        }
+
+        if(result < ODBX_ERR_SUCCESS)
+        {
+            fetchStatus = ODBXUV_FETCH_STATUS_ERROR_RESULT;
+            goto error;
+        }
+
+        if(didGetInfo == 0 && op->resultHandle != NULL)
+        {
+            didGetInfo = 1;
+            op->columnCount = odbx_column_count(op->resultHandle);
+            op->affectedCount = odbx_rows_affected(op->resultHandle);
+
+            _query_select_columns(op);
+
+            //Grouped rows have their own columns, without column info
+            if(op->config.aggregate != NULL && op->config.aggregate->mode == ODBXUV_AGGREGATE_GROUP)
+            {
+                op->columnCount = op->config.aggregate->columnCount;
+            }
+            else if(op->metadata == NULL && (op->flags & ODBXUV_QUERY_FETCH_NAME || op->flags & ODBXUV_QUERY_FETCH_TYPE))
+            {
+                op->metadata = _metadata_acquire(op);
+                op->columns = ((odbxuv_metadata_t *)op->metadata)->columns;
+            }
+
+            if(op->config.serializer != NULL && _query_serial_header(op) < ODBX_ERR_SUCCESS)
+            {
+                fetchStatus = ODBXUV_FETCH_STATUS_ERROR_FETCH;
+                _handle_make_error((odbxuv_handle_t *)op, ODBXUV_ERR_TOOLARGE, 0, "Header does not fit in a serializer buffer");
+                goto escape;
+            }
+        }
+
+        switch(result)
+        {
+            case ODBX_RES_ROWS:
+                //fetch & see if there is more
+                while(ODBX_ROW_NEXT == (result = odbx_row_fetch(op->resultHandle)))
+                {
+                    if(op->config.chunkBytes)
+                    {
+                        chunkRows++;
+                        chunkBytes += _query_row_width(op);
+                    }
+
+                    if(op->config.options & ODBXUV_QUERY_COUNT_ONLY)
+                    {
+                        rowCount++;
+
+                        if(op->fetchStatus == ODBXUV_FETCH_STATUS_CANCELLED) goto escape;
+                        continue;
+                    }
+
+                    if(op->config.aggregate != NULL)
+                    {
+                        if(_query_aggregate_row(op) < 0)
+                        {
+                            fetchStatus = ODBXUV_FETCH_STATUS_ERROR_FETCH;
+                            _handle_make_error((odbxuv_handle_t *)op, ODBXUV_ERR_AGGREGATE, 0, "The aggregate uses a column the result does not have");
+                            goto escape;
+                        }
+
+                        rowCount++;
+
+                        if(op->fetchStatus == ODBXUV_FETCH_STATUS_CANCELLED) goto escape;
+                        continue;
+                    }
+
+                    if(op->config.serializer != NULL)
+                    {
+                        if(_query_serial_row(op) < ODBX_ERR_SUCCESS)
+                        {
+                            fetchStatus = ODBXUV_FETCH_STATUS_ERROR_FETCH;
+                            _handle_make_error((odbxuv_handle_t *)op, ODBXUV_ERR_TOOLARGE, 0, "Row does not fit in a serializer buffer");
+                            goto escape;
+                        }
+
+                        rowCount++;
+
+                        if(op->fetchStatus == ODBXUV_FETCH_STATUS_CANCELLED) goto escape;
+                        continue;
+                    }
+
+                    if(op->spilling)
+                    {
+                        if(_query_spill_row(op) < 0)
+                        {
+                            fetchStatus = ODBXUV_FETCH_STATUS_ERROR_FETCH;
+                            _handle_make_error((odbxuv_handle_t *)op, ODBXUV_ERR_SPILL, 0, strerror(errno));
+                            goto escape;
+                        }
+
+                        rowCount++;
+                        spillCount++;
+
+                        if(op->fetchStatus == ODBXUV_FETCH_STATUS_CANCELLED) goto escape;
+                        continue;
+                    }
+
+                    odbxuv_row_hook_e hook = ODBXUV_ROW_COPY;
+                    void *user = NULL;
+
+                    if(op->config.rowHook != NULL && (hook = _query_hook_row(op, &user)) == ODBXUV_ROW_DROP)
+                    {
+                        rowCount++;
+                        op->droppedCount++;
+
+                        if(op->fetchStatus == ODBXUV_FETCH_STATUS_CANCELLED) goto escape;
+                        continue;
+                    }
+
+                    odbxuv_row_t *row = _query_get_row(op);
+                    size_t previousSize = row->size;
+                    unsigned char copy = op->flags & ODBXUV_QUERY_FETCH_VALUE && hook == ODBXUV_ROW_COPY;
+
+                    if(row->user != NULL)
+                    {
+                        _row_free_user(op, row);
+                    }
+
+                    row->status = ODBXUV_ROW_STATUS_READING;
+                    row->user = user;
+                    row->size = sizeof(odbxuv_row_t);
+
+                    int i;
+                    for(i = 0; i < op->columnCount; i++)
+                    {
+                        if(copy || row->value != NULL)
+                        {
+                            //Lazy init, followed by the bitmap of shared values
+                            if(row->value == NULL)
+                            {
+                                size_t len = sizeof(char *) * op->columnCount;
+                                if(op->flags & ODBXUV_QUERY_FETCH_DICTIONARY) len += (op->columnCount + 7) / 8;
+                                row->value = malloc(len);
+                                memset(row->value, 0, len);
+                            }
+
+                            if(row->value[i] != NULL)
+                            {
+                                _row_free_value(op, row, i);
+                            }
+
+                            if(!copy) continue;
+
+                            if(!_query_column_selected(op, i)) continue;
+
+                            const char *value = op->config.rowHook != NULL ? op->hookValues[i] : odbx_field_value(op->resultHandle, i);
+
+                            if(value)
+                            {
+                                size_t length = op->config.rowHook != NULL ? op->hookLengths[i] : strlen(value);
+
+                                if(op->flags & ODBXUV_QUERY_FETCH_DICTIONARY && (row->value[i] = _query_dictionary_value(op, i, value, length)) != NULL)
+                                {
+                                    _row_shared(op, row)[i / 8] |= 1 << (i % 8);
+                                }
+                                else
+                                {
+                                    row->value[i] = malloc(length + 1);
+                                    memcpy(row->value[i], value, length + 1);
+                                    row->size += length + 1;
+                                }
+                            }
+                        }
+
+                        //TODO fetch lengths
+                    }
+
+                    //Emitted rows keep the value array of a reused row, with all values NULL
+                    if(row->value != NULL)
+                    {
+                        row->size += sizeof(char *) * op->columnCount;
+                        if(op->flags & ODBXUV_QUERY_FETCH_DICTIONARY) row->size += (op->columnCount + 7) / 8;
+                    }
+
+                    row->status = ODBXUV_ROW_STATUS_READ;
+                    rowCount++;
+
+                    _memory_worker(op, (int64_t)row->size - (int64_t)previousSize);
+
+                    if(op->snapshot != NULL)
+                    {
+                        _query_snapshot_row(op, row);
+                    }
+                    else
+                    {
+                        _query_batch_row(op, row);
+                    }
+
+                    if(op->memoryExceeded && op->config.memoryPolicy == ODBXUV_MEMORY_FAIL)
+                    {
+                        fetchStatus = ODBXUV_FETCH_STATUS_ERROR_FETCH;
+                        _handle_make_error((odbxuv_handle_t *)op, ODBXUV_ERR_MEMORY, 0, "Memory limit exceeded");
+                        goto escape;
+                    }
+
+                    if(op->fetchStatus == ODBXUV_FETCH_STATUS_CANCELLED) goto escape;
+                }
+
+                if(result < ODBX_ERR_SUCCESS)
+                {
+                    fetchStatus = ODBXUV_FETCH_STATUS_ERROR_FETCH;
+                    goto error;
+                }
+
+                //Fetching the next chunk can block, the rows of this one should not wait for it
+                if(op->batch != NULL)
+                {
+                    _query_flush_rows(op, ODBXUV_FETCH_STATUS_RUNNING);
+                }
+
+                if(op->config.chunkBytes)
+                {
+                    _query_resize_chunk(op, chunkRows, chunkBytes, uv_hrtime() - chunkStart);
+                }
+
+                continue;
+                break;
+
+            default: //Assert on this?
+            case ODBX_RES_NOROWS:
+            case ODBX_RES_DONE:
+                goto escape;
+                break;
+        }
+    }
+    while(op->fetchStatus != ODBXUV_FETCH_STATUS_CANCELLED);
+
+    error:
+
+    if(fetchStatus != ODBXUV_FETCH_STATUS_FINISHED)
+    {
+        _handle_make_error((odbxuv_handle_t *)op, result, odbx_error_type(op->connection->handle, result), odbx_error(op->connection->handle, result));
+        _con_check_lost(op->connection, req);
+        op->error->error = -result;
+    }
+
+    escape:
+
+    if(op->resultHandle != NULL)
+    {
+        result = odbx_result_finish(op->resultHandle);
+        op->resultHandle = NULL;
+
+        if(result < ODBX_ERR_SUCCESS && op->error == NULL)
+        {
+            fetchStatus = ODBXUV_FETCH_STATUS_ERROR_FINISH;
+            _handle_make_error((odbxuv_handle_t *)op, result, odbx_error_type(op->connection->handle, result), odbx_error(op->connection->handle, result));
+            op->error->error = -result;
+        }
+    }
+
+    _query_record(op, queryStart, answered, rowCount, fetchStatus != ODBXUV_FETCH_STATUS_FINISHED);
+
+    if(op->config.aggregate != NULL && fetchStatus == ODBXUV_FETCH_STATUS_FINISHED && op->fetchStatus != ODBXUV_FETCH_STATUS_CANCELLED)
+    {
+        _query_aggregate_emit(op);
+    }
+
+    if(op->config.serializer != NULL)
+    {
+        _query_serial_push(op);
+    }
+
+    if(op->spillBuffer != NULL)
+    {
+        if(_query_spill_write(op) < 0 && op->error == NULL)
+        {
+            fetchStatus = ODBXUV_FETCH_STATUS_ERROR_FETCH;
+            _handle_make_error((odbxuv_handle_t *)op, ODBXUV_ERR_SPILL, 0, strerror(errno));
+        }
+
+        free(op->spillBuffer);
+        op->spillBuffer = NULL;
+        _memory_worker(op, -ODBXUV_SPILL_BUFFER_SIZE);
+
+        uv_mutex_lock(&op->connection->lock);
+        op->connection->counters.rowsFetched += spillCount;
+        op->connection->counters.rowsSpilled += spillCount;
+        uv_mutex_unlock(&op->connection->lock);
+    }
+
+    op->rowCount = rowCount;
+
+    if(op->snapshot != NULL)
+    {
+        _query_snapshot_finish(op, fetchStatus);
+    }
+
+    _query_flush_rows(op, fetchStatus);
+
+    return ODBXUV_OP_STATUS_COMPLETED;
+}
+
+static odbxuv_operation_status_e _op_escape(odbxuv_op_t *req)
+{
+    int result;
+    odbxuv_op_escape_t *op = (odbxuv_op_escape_t *)req;
+    assert(op->type == ODBXUV_HANDLE_TYPE_OP_ESCAPE);
+
+    unsigned long inlen = strlen(op->string);
+    unsigned long outlen = 2 * (inlen+1);
+
+    const char *in = op->string;
+    char *out = malloc(outlen + 1);
+    memset(out, 0, outlen + 1);
+
+    result = odbx_escape(op->connection->handle, in, inlen, out, &outlen);
+
+    op->string = out;
+
+    free((void *)in);
+
+    MAKE_ODBX_ERR(op, result, {
+
+    });
+
+    return 0;
+}
+
+/**
+ * Initialize an operation from the arguments and default values
+ */
+static void _init_op(int type, odbxuv_op_t *operation, odbxuv_connection_t *connection, odbxuv_op_fun fun, odbxuv_op_cb callback)
+{
+    operation->type = type;
+    operation->status = ODBXUV_OP_STATUS_NOT_STARTED;
+    operation->next = NULL;
+    operation->connection = connection;
+    operation->operationFunction = fun;
+    operation->callback = callback;
+    operation->error = NULL;
+}
+
+/**
+ * Push an operation to the connection's operation queue
+ */
+static void _con_add_op(odbxuv_connection_t *connection, odbxuv_op_t *operation)
+{
+    assert(odbxuv_connection_get_status(connection) != ODBXUV_CON_STATUS_DISCONNECTING && "Cannot add operations while disconnecting");
+
+    uv_mutex_lock(&connection->lock);
+
+    if(connection->operationQueue == NULL)
+    {
+        connection->operationQueue = operation;
+    }
+    else
+    {
+        odbxuv_op_t *currentOperation = connection->operationQueue;
+        while(currentOperation->next != NULL)
+        {
+            currentOperation = currentOperation->next;
+        }
+        currentOperation->next = operation;
+    }
+
+    uv_mutex_unlock(&connection->lock);
+}
+
+/**
+ * Checks the admission policy of the connection before queueing a query.
+ * Sheds the oldest low priority query when the policy allows it,
+ * returns ::ODBXUV_ERR_OVERLOAD when the query does not fit.
+ */
+static int _con_admit(odbxuv_connection_t *connection)
+{
+    odbxuv_admission_policy_t *admission = &connection->admission;
+    odbxuv_op_t *operation;
+    odbxuv_op_t *previous = NULL;
+    odbxuv_op_t *shed = NULL;
+    odbxuv_op_t *shedPrevious = NULL;
+    unsigned int queued = 0;
+
+    if(admission->maxQueued == 0 && admission->maxWait == 0) return ODBX_ERR_SUCCESS;
+
+    uv_mutex_lock(&connection->lock);
+
+    for(operation = connection->operationQueue; operation; previous = operation, operation = operation->next)
+    {
+        if(operation->status != ODBXUV_OP_STATUS_NOT_STARTED) continue;
+
+        queued++;
+
+        if(shed == NULL && operation->type == ODBXUV_HANDLE_TYPE_OP_QUERY && ((odbxuv_op_query_t *)operation)->config.options & ODBXUV_QUERY_LOW_PRIORITY)
+        {
+            shed = operation;
+            shedPrevious = previous;
+        }
+    }
+
+    uint64_t wait = (uint64_t)(queued + (connection->workerStatus == ODBXUV_WORKER_RUNNING ? 1 : 0)) * connection->counters.queryLatency / 1000;
+    unsigned char overloaded = (admission->maxQueued && queued >= admission->maxQueued) || (admission->maxWait && wait > admission->maxWait);
+
+    if(overloaded && admission->policy == ODBXUV_OVERLOAD_SHED && shed != NULL)
+    {
+        if(shedPrevious != NULL)
+        {
+            shedPrevious->next = shed->next;
+        }
+        else
+        {
+            connection->operationQueue = shed->next;
+        }
+
+        overloaded = 0;
+        connection->counters.queriesShed++;
+    }
+    else
+    {
+        shed = NULL;
+    }
+
+    if(overloaded)
+    {
+        connection->counters.queriesRejected++;
+    }
+
+    uv_mutex_unlock(&connection->lock);
+
+    if(shed != NULL)
+    {
+        //Fails like a query the database did not accept
+        _handle_make_error((odbxuv_handle_t *)shed, ODBXUV_ERR_OVERLOAD, 0, "Query shed from an overloaded queue");
+        shed->status = ODBXUV_OP_STATUS_COMPLETED;
+        ((odbxuv_op_query_t *)shed)->fetchStatus = ODBXUV_FETCH_STATUS_ERROR_BEFORE;
+
+        shed->next = connection->readyQueue;
+        connection->readyQueue = shed;
+        uv_async_send(&connection->async);
+    }
+
+    return overloaded ? ODBXUV_ERR_OVERLOAD : ODBX_ERR_SUCCESS;
+}
+
+/*
+ * API:
+ */
+
+/**
+ * Copies the next word of \p query uppercased into \p word, skipping comments and quoted strings.
+ * Returns 0 at the end of the query.
+ */
+static int _statement_next_word(const char **query, char *word)
+{
+    const char *cursor = *query;
+
+    while(*cursor)
+    {
+        if(cursor[0] == '-' && cursor[1] == '-')
+        {
+            while(*cursor && *cursor != '\n') cursor++;
+        }
+        else if(cursor[0] == '/' && cursor[1] == '*')
+        {
+            cursor += 2;
+            while(*cursor && !(cursor[0] == '*' && cursor[1] == '/')) cursor++;
+            if(*cursor) cursor += 2;
+        }
+        else if(*cursor == '\'' || *cursor == '"' || *cursor == '`')
+        {
+            char quote = *cursor++;
+            while(*cursor && *cursor != quote)
+            {
+                if(*cursor == '\\' && cursor[1]) cursor++;
+                cursor++;
+            }
+            if(*cursor) cursor++;
+        }
+        else if(isalpha((unsigned char)*cursor) || *cursor == '_')
+        {
+            size_t length = 0;
+
+            while(isalnum((unsigned char)*cursor) || *cursor == '_')
+            {
+                if(length < ODBXUV_STATEMENT_WORD_SIZE - 1)
+                {
+                    word[length++] = toupper((unsigned char)*cursor);
+                }
+                cursor++;
+            }
+
+            word[length] = '\0';
+            *query = cursor;
+            return 1;
+        }
+        else
+        {
+            cursor++;
+        }
+    }
+
+    *query = cursor;
+    return 0;
+}
+
+/**
+ * Checks the rest of a read statement for clauses that make it write.
+ * The words of those clauses are only keywords in their position, elsewhere they may name columns or tables.
+ */
+static odbxuv_statement_e _statement_classify_read(const char *query)
+{
+    static const char *writes[] = { "INSERT", "UPDATE", "DELETE", "MERGE", NULL };
+    char word[ODBXUV_STATEMENT_WORD_SIZE];
+    char previous[ODBXUV_STATEMENT_WORD_SIZE] = "";
+    char beforePrevious[ODBXUV_STATEMENT_WORD_SIZE] = "";
+
+    while(_statement_next_word(&query, word))
+    {
+        const char *start = query;
+        const char *next = query;
+        const char **write;
+
+        //Where the word starts and what follows it
+        while(isalnum((unsigned char)start[-1]) || start[-1] == '_') start--;
+        while(isspace((unsigned char)*next)) next++;
+
+        for(write = writes; *write; write++)
+        {
+            if(strcmp(word, *write) == 0) return ODBXUV_STATEMENT_WRITE;
+        }
+
+        //FOR SHARE, FOR KEY SHARE and LOCK IN SHARE MODE
+        if(strcmp(word, "SHARE") == 0 && (strcmp(previous, "FOR") == 0 || strcmp(previous, "KEY") == 0
+            || (strcmp(previous, "IN") == 0 && strcmp(beforePrevious, "LOCK") == 0)))
+        {
+            return ODBXUV_STATEMENT_WRITE;
+        }
+
+        //SELECT ... INTO, unless it is a qualified or aliased name
+        if(strcmp(word, "INTO") == 0 && start[-1] != '.' && strcmp(previous, "AS") != 0)
+        {
+            return ODBXUV_STATEMENT_WRITE;
+        }
+
+        //nextval('seq') and setval('seq', n), or seq.NEXTVAL
+        if((strcmp(word, "NEXTVAL") == 0 || strcmp(word, "SETVAL") == 0) && (*next == '(' || start[-1] == '.'))
+        {
+            return ODBXUV_STATEMENT_WRITE;
+        }
+
+        strcpy(beforePrevious, previous);
+        strcpy(previous, word);
+    }
+
+    return ODBXUV_STATEMENT_READ;
+}
+
+odbxuv_statement_e odbxuv_query_classify(const char *query)
+{
+    char word[ODBXUV_STATEMENT_WORD_SIZE];
+
+    if(!_statement_next_word(&query, word)) return ODBXUV_STATEMENT_WRITE;
+
+    if(strcmp(word, "SELECT") == 0 || strcmp(word, "WITH") == 0 || strcmp(word, "EXPLAIN") == 0)
+    {
+        return _statement_classify_read(query);
+    }
+
+    if(strcmp(word, "SHOW") == 0 || strcmp(word, "DESCRIBE") == 0 || strcmp(word, "DESC") == 0
+        || strcmp(word, "VALUES") == 0 || strcmp(word, "TABLE") == 0)
+    {
+        return ODBXUV_STATEMENT_READ;
+    }
+
+    if(strcmp(word, "BEGIN") == 0 || strcmp(word, "START") == 0)
+    {
+        return ODBXUV_STATEMENT_BEGIN;
+    }
+
+    if(strcmp(word, "COMMIT") == 0 || strcmp(word, "END") == 0 || strcmp(word, "ABORT") == 0)
+    {
+        return ODBXUV_STATEMENT_END;
+    }
+
+    if(strcmp(word, "ROLLBACK") == 0)
+    {
+        //ROLLBACK TO SAVEPOINT keeps the transaction open
+        if(_statement_next_word(&query, word) && strcmp(word, "TO") == 0) return ODBXUV_STATEMENT_WRITE;
+
+        return ODBXUV_STATEMENT_END;
+    }
+
+    return ODBXUV_STATEMENT_WRITE;
+}
+
+/**
+ * Copies a query with the whitespace outside of quotes collapsed to single spaces.
+ */
+static char *_query_normalize(const char *query)
+{
+    char *normalized = malloc(strlen(query) + 1);
+    char *out = normalized;
+    char quote = 0;
+    unsigned char space = 0;
+
+    for(; *query; query++)
+    {
+        if(quote == 0 && isspace((unsigned char)*query))
+        {
+            space = out != normalized;
+            continue;
+        }
+
+        if(space)
+        {
+            *out++ = ' ';
+            space = 0;
+        }
+
+        if(quote != 0 && *query == '\\' && query[1])
+        {
+            *out++ = *query++;
+        }
+        else if(quote == 0 && (*query == '\'' || *query == '"' || *query == '`'))
+        {
+            quote = *query;
+        }
+        else if(*query == quote)
+        {
+            //A doubled quote opens the string again right away
+            quote = 0;
+        }
+
+        *out++ = *query;
+    }
+
+    *out = '\0';
+
+    return normalized;
+}
+
+/**
+ * Finds the snapshot of a shared query that is still fetching.
+ * Call with the connection lock held.
+ */
+static odbxuv_snapshot_t *_con_find_snapshot(odbxuv_connection_t *con, const char *normalized, uint32_t hash, odbxuv_query_fetch_e flags)
+{
+    odbxuv_snapshot_t *snapshot;
+
+    for(snapshot = con->snapshots; snapshot; snapshot = snapshot->next)
+    {
+        if(snapshot->hash == hash && snapshot->flags == flags && strcmp(snapshot->query, normalized) == 0)
+        {
+            return snapshot;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Attaches a query with ::ODBXUV_QUERY_SHARED to the snapshot of an identical query and returns 1,
+ * or makes it lead a new snapshot and returns 0, it has to be queued then.
+ * Takes over \p normalized.
+ */
+static int _query_share(odbxuv_op_query_t *op, char *normalized, uint32_t hash)
+{
+    odbxuv_connection_t *con = op->connection;
+    odbxuv_snapshot_t *snapshot;
+
+    uv_mutex_lock(&con->lock);
+
+    //The snapshot may have completed since the admission check
+    snapshot = _con_find_snapshot(con, normalized, hash, op->flags);
+
+    if(snapshot == NULL)
+    {
+        snapshot = malloc(sizeof(odbxuv_snapshot_t));
+        memset(snapshot, 0, sizeof(odbxuv_snapshot_t));
+        snapshot->refs = 1;
+        snapshot->leader = op;
+        snapshot->query = normalized;
+        snapshot->hash = hash;
+        snapshot->flags = op->flags;
+        snapshot->next = con->snapshots;
+        con->snapshots = snapshot;
+        op->snapshot = snapshot;
+
+        uv_mutex_unlock(&con->lock);
+        return 0;
+    }
+
+    __atomic_add_fetch(&snapshot->refs, 1, __ATOMIC_ACQ_REL);
+    op->snapshot = snapshot;
+    op->nextFollower = snapshot->followers;
+    snapshot->followers = op;
+    op->status = ODBXUV_OP_STATUS_IN_PROGRESS;
+    op->fetchStatus = ODBXUV_FETCH_STATUS_RUNNING;
+    con->counters.queriesShared++;
+
+    uv_mutex_unlock(&con->lock);
 
-        MAKE_ODBX_ERR(op, result, {
-            op->error->error = -result;
-            op->fetchStatus = ODBXUV_FETCH_STATUS_ERROR_RESULT;
-        });
+    free(normalized);
+
+    //The followers of an answered query don't wait for it
+    if(snapshot->answered)
+    {
+        op->status = ODBXUV_OP_STATUS_COMPLETED;
+        op->next = con->readyQueue;
+        con->readyQueue = (odbxuv_op_t *)op;
+        uv_async_send(&con->async);
+    }
+
+    return 1;
+}
+
+/**
+ * Runs the query callbacks of the queries attached to a shared query right before its own.
+ * Completes the snapshot when the query failed before it fetched.
+ */
+static void _query_snapshot_answer(odbxuv_op_t *operation)
+{
+    if(operation->type != ODBXUV_HANDLE_TYPE_OP_QUERY) return;
+
+    odbxuv_op_query_t *op = (odbxuv_op_query_t *)operation;
+    odbxuv_snapshot_t *snapshot = op->snapshot;
+
+    if(snapshot == NULL || snapshot->leader != op || snapshot->answered) return;
+
+    snapshot->answered = 1;
+
+    uv_mutex_lock(&op->connection->lock);
+    unsigned char fetching = snapshot->complete || op->fetchStatus == ODBXUV_FETCH_STATUS_RUNNING;
+    odbxuv_op_query_t *follower = snapshot->followers;
+    uv_mutex_unlock(&op->connection->lock);
+
+    if(!fetching)
+    {
+        _query_snapshot_finish(op, ODBXUV_FETCH_STATUS_ERROR_BEFORE);
+    }
+
+    while(follower)
+    {
+        odbxuv_op_query_t *next = follower->nextFollower;
+        follower->status = ODBXUV_OP_STATUS_COMPLETED;
 
-        if(didGetInfo == 0)
+        if(follower->callback)
         {
-            didGetInfo = 1;
-            op->columnCount = odbx_column_count(op->resultHandle);
-            op->affectedCount = odbx_rows_affected(op->resultHandle);
+            follower->callback((odbxuv_op_t *)follower, !fetching && follower->error ? follower->error->error : ODBX_ERR_SUCCESS);
+        }
+
+        follower = next;
+    }
+}
+
+int odbxuv_init_connection(odbxuv_connection_t *connection, uv_loop_t *loop)
+{
+    SET_0_COPY_DATA(connection);
+    connection->loop = loop;
+    connection->type = ODBXUV_HANDLE_TYPE_CONNECTION;
+    connection->workerStatus = ODBXUV_WORKER_IDLE;
+
+    connection->notifyRows = ODBXUV_DEFAULT_NOTIFY_ROWS;
+    connection->notifyInterval = ODBXUV_DEFAULT_NOTIFY_INTERVAL;
+    connection->freeQueryMax = ODBXUV_DEFAULT_FREE_QUERY_MAX;
+    connection->metadataMax = ODBXUV_DEFAULT_METADATA_MAX;
+    uv_mutex_init(&connection->lock);
+    uv_cond_init(&connection->rowsReturned);
+
+    connection->reconnect.baseDelay = ODBXUV_DEFAULT_RECONNECT_DELAY;
+    connection->reconnect.maxDelay = ODBXUV_DEFAULT_RECONNECT_MAX_DELAY;
+    connection->reconnectSeed = (unsigned int)(uv_hrtime() ^ (uintptr_t)connection);
+    connection->reconnectTimer.data = connection;
+    uv_timer_init(connection->loop, &connection->reconnectTimer);
+
+    memset(&connection->async, 0, sizeof(uv_async_t));
+    connection->async.data = connection;
+    uv_async_init(connection->loop, &connection->async, _op_run_callbacks);
+
+    return ODBX_ERR_SUCCESS;
+}
+
+uint64_t odbxuv_memory_used(void)
+{
+    return __atomic_load_n(&_odbxuv_memory_used, __ATOMIC_RELAXED);
+}
+
+void odbxuv_memory_set_limit(uint64_t limit)
+{
+    __atomic_store_n(&_odbxuv_memory_limit, limit, __ATOMIC_RELAXED);
+}
+
+odbxuv_connection_status_e odbxuv_connection_get_status(odbxuv_connection_t *connection)
+{
+    odbxuv_connection_status_e status;
+
+    uv_mutex_lock(&connection->lock);
+    status = connection->status;
+    uv_mutex_unlock(&connection->lock);
+
+    return status;
+}
+
+void odbxuv_connection_counters(odbxuv_connection_t *connection, odbxuv_connection_counters_t *counters)
+{
+    uv_mutex_lock(&connection->lock);
+    *counters = connection->counters;
+    uv_mutex_unlock(&connection->lock);
+
+    //Freeing operations update it without the lock
+    counters->memoryUsed = __atomic_load_n(&connection->counters.memoryUsed, __ATOMIC_RELAXED);
+}
+
+int odbxuv_connect(odbxuv_connection_t *connection, odbxuv_op_connect_t *operation, odbxuv_op_connect_cb callback)
+{
+    assert(odbxuv_connection_get_status(connection) == ODBXUV_CON_STATUS_IDLE || odbxuv_connection_get_status(connection) == ODBXUV_CON_STATUS_DISCONNECTED);
+    _con_set_status(connection, ODBXUV_CON_STATUS_CONNECTING);
+
+    {
+        #define _copys(name) \
+        char *name = NULL; \
+        if (operation->name) \
+        { \
+            name = malloc(strlen( operation->name )+1); \
+            strcpy( name , operation-> name ); \
+        }
+            _copys(host);
+            _copys(port);
+            _copys(backend);
+            _copys(database);
+            _copys(user);
+            _copys(password);
+        #undef _copys
+
+        int method = operation->method;
+
+        SET_0_COPY_DATA(operation);
+
+        #define _copys(name) \
+            operation-> name = name;
+            _copys(host);
+            _copys(port);
+            _copys(backend);
+            _copys(database);
+            _copys(user);
+            _copys(password);
+        #undef _copys
+
+        operation->method = method;
+    }
+
+    //Keep the parameters around to reconnect
+    {
+        odbxuv_credentials_t *credentials = &connection->credentials;
+
+        #define _copys(name) \
+            ODBXUV_FREE_STRING(credentials-> name); \
+            if(operation-> name) \
+            { \
+                credentials-> name = malloc(strlen(operation-> name)+1); \
+                strcpy(credentials-> name, operation-> name); \
+            }
+            _copys(host);
+            _copys(port);
+            _copys(backend);
+            _copys(database);
+            _copys(user);
+            _copys(password);
+        #undef _copys
+
+        credentials->method = operation->method;
+    }
+
+    _init_op(ODBXUV_HANDLE_TYPE_OP_CONNECT, (odbxuv_op_t *)operation, connection, _op_connect, (odbxuv_op_cb)callback);
+
+    _con_add_op(connection, (odbxuv_op_t *)operation);
+
+    con_worker_check(connection);
+
+    return ODBX_ERR_SUCCESS;
+}
+
+int odbxuv_disconnect(odbxuv_connection_t *connection, odbxuv_op_disconnect_t *operation, odbxuv_op_disconnect_cb callback)
+{
+    assert(odbxuv_connection_get_status(connection) == ODBXUV_CON_STATUS_CONNECTED);
+
+    SET_0_COPY_DATA(operation);
+
+    _init_op(ODBXUV_HANDLE_TYPE_OP_DISCONNECT, (odbxuv_op_t *)operation, connection, _op_disconnect, (odbxuv_op_cb)callback);
+
+    _con_add_op(connection, (odbxuv_op_t *)operation);
+    _con_set_status(connection, ODBXUV_CON_STATUS_DISCONNECTING);
+
+    con_worker_check(connection);
+
+    return ODBX_ERR_SUCCESS;
+}
+
+int odbxuv_capabilities(odbxuv_connection_t *connection, odbxuv_op_capabilities_t *operation, int capabilities, odbxuv_op_capabilities_cb callback)
+{
+    assert(_con_is_open(connection) && "The connection is not open");
+
+    memset(operation, 0, sizeof(&operation));
+    _init_op(ODBXUV_HANDLE_TYPE_OP_CAPABILITIES, (odbxuv_op_t *)operation, connection, _op_capabilities, (odbxuv_op_cb)callback);
+
+    operation->capabilities = capabilities;
+
+    _con_add_op(connection, (odbxuv_op_t *)operation);
+
+    con_worker_check(connection);
+
+    return ODBX_ERR_SUCCESS;
+}
+
+int odbxuv_query(odbxuv_connection_t *connection, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, odbxuv_op_query_cb callback)
+{
+    return odbxuv_query_ex(connection, operation, query, flags, NULL, callback);
+}
+
+/**
+ * Queues a query, \p recycled operations keep the buffers left by ::odbxuv_op_reset.
+ */
+static int _query_submit(odbxuv_connection_t *connection, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, const odbxuv_query_config_t *config, odbxuv_op_query_cb callback, unsigned char recycled)
+{
+    assert(_con_is_open(connection) && "The connection is not open");
+
+    char *normalized = NULL;
+    uint32_t hash = 0;
+    unsigned char attach = 0;
+
+    //Statements that change something run every time they are submitted
+    assert((config == NULL || !(config->options & ODBXUV_QUERY_SHARED) || odbxuv_query_classify(query) == ODBXUV_STATEMENT_READ) && "Only reads can be shared");
+
+    if(config != NULL && config->options & ODBXUV_QUERY_SHARED && odbxuv_query_classify(query) == ODBXUV_STATEMENT_READ)
+    {
+        normalized = _query_normalize(query);
+        hash = _hash_bytes(2166136261u, normalized, strlen(normalized));
+
+        uv_mutex_lock(&connection->lock);
+        attach = _con_find_snapshot(connection, normalized, hash, flags) != NULL;
+        uv_mutex_unlock(&connection->lock);
+    }
+
+    //Attached queries cost the database nothing
+    if(!attach && _con_admit(connection) != ODBX_ERR_SUCCESS)
+    {
+        free(normalized);
+        return ODBXUV_ERR_OVERLOAD;
+    }
+
+    size_t queryLength = strlen(query) + 1;
+    int64_t queryGrowth = 0;
+
+    if(recycled)
+    {
+        //Everything has been cleared by odbxuv_op_reset, keep the buffers
+        assert(operation->recycle == ODBXUV_OP_RECYCLE_MAGIC && "Operation was not reset or acquired");
+        assert(operation->type == ODBXUV_HANDLE_TYPE_OP_QUERY && operation->asyncStatus == 0);
+        assert((!operation->persistentAsync || operation->connection == connection) && "Recycled operation belongs to another connection");
+
+        if(operation->queryCapacity < queryLength)
+        {
+            queryGrowth = queryLength - operation->queryCapacity;
+            free(operation->query);
+            operation->query = malloc(queryLength);
+            operation->queryCapacity = queryLength;
+        }
+    }
+    else
+    {
+        SET_0_COPY_DATA(operation);
+        operation->query = malloc(queryLength);
+        operation->queryCapacity = queryLength;
+        queryGrowth = queryLength;
+    }
+
+    _init_op(ODBXUV_HANDLE_TYPE_OP_QUERY, (odbxuv_op_t *)operation, connection, _op_query, (odbxuv_op_cb)callback);
+
+    if(operation->metadataTable != connection->metadata || operation->metadataTable == NULL)
+    {
+        if(operation->metadataTable != NULL) _metadata_table_release(operation->metadataTable);
+        _metadata_table_acquire(operation, connection);
+    }
+
+    _memory_add(operation, queryGrowth);
+
+    operation->flags = flags;
+
+    if(config != NULL)
+    {
+        operation->config = *config;
+        operation->chunkSize = config->chunkSize;
+
+        if(config->chunkBytes && config->chunkSize == 0)
+        {
+            operation->chunkSize = ODBXUV_DEFAULT_CHUNK_SIZE;
+        }
+
+        assert((config->rowHook == NULL || (config->serializer == NULL && config->aggregate == NULL && config->spillThreshold == 0)) && "Rows passed to a row hook are copied into rows");
+        assert((!(config->options & ODBXUV_QUERY_SHARED) || (config->serializer == NULL && config->aggregate == NULL && config->rowHook == NULL && config->spillThreshold == 0
+            && config->selectColumnCount == 0 && config->selectNameCount == 0 && !(config->options & ODBXUV_QUERY_COUNT_ONLY) && !(flags & ODBXUV_QUERY_FETCH_DICTIONARY)))
+            && "Shared queries keep the plain rows of the result");
+
+        if(config->aggregate != NULL)
+        {
+            assert(config->serializer == NULL && "Aggregated rows can't be serialized");
+            odbxuv_aggregate_reset(config->aggregate);
+        }
+
+        if(config->serializer != NULL)
+        {
+            odbxuv_serializer_t *serializer = config->serializer;
+            unsigned int i;
+
+            for(i = 0; i < serializer->bufferCount; i++)
+            {
+                serializer->free[i] = serializer->bufferCount - 1 - i;
+            }
+
+            serializer->freeCount = serializer->bufferCount;
+            serializer->filledStart = 0;
+            serializer->filledCount = 0;
+            serializer->current = serializer->bufferCount;
+            serializer->callback = NULL;
+        }
+    }
+    else
+    {
+        memset(&operation->config, 0, sizeof(odbxuv_query_config_t));
+    }
+
+    memcpy(operation->query, query, queryLength);
+    operation->fetchStatus = ODBXUV_FETCH_STATUS_NONE;
+
+    if(normalized != NULL && _query_share(operation, normalized, hash))
+    {
+        return ODBX_ERR_SUCCESS;
+    }
+
+    _con_add_op(connection, (odbxuv_op_t *)operation);
+
+    con_worker_check(connection);
+
+    return ODBX_ERR_SUCCESS;
+}
+
+int odbxuv_query_ex(odbxuv_connection_t *connection, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, const odbxuv_query_config_t *config, odbxuv_op_query_cb callback)
+{
+    return _query_submit(connection, operation, query, flags, config, callback, 0);
+}
+
+int odbxuv_query_recycled(odbxuv_connection_t *connection, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, const odbxuv_query_config_t *config, odbxuv_op_query_cb callback)
+{
+    return _query_submit(connection, operation, query, flags, config, callback, 1);
+}
+
+/**
+ * Calls the fetch callback for the last time.
+ * \warning The callback may release or free the operation.
+ */
+static void _query_process_finish(odbxuv_op_query_t *op)
+{
+    int status = op->error ? op->error->error : 0;
+    switch(op->fetchStatus)
+    {
+        case ODBXUV_FETCH_STATUS_ERROR_FETCH:
+        case ODBXUV_FETCH_STATUS_ERROR_FINISH:
+        case ODBXUV_FETCH_STATUS_ERROR_RESULT:
+            if(status > 0)
+            {
+                op->error->error = -op->error->error;
+                status = op->error->error;
+            }
+            break;
+        default:
+            break;
+    }
+
+    op->asyncStatus = 3;
+
+    if(op->config.serializer != NULL)
+    {
+        op->config.serializer->callback(op, NULL, 0, status);
+    }
+    else if(op->batchCallback)
+    {
+        op->batchCallback(op, NULL, 0, status);
+    }
+    else
+    {
+        op->cb(op, NULL, status);
+    }
+}
+
+static void _query_process_close(uv_handle_t *handle)
+{
+    odbxuv_op_query_t *op = (odbxuv_op_query_t *)handle->data;
+
+    assert(op->type == ODBXUV_HANDLE_TYPE_OP_QUERY && "Close callback for non query.");
+
+    _query_process_finish(op);
+}
 
-            if(op->columns == NULL && (op->flags & ODBXUV_QUERY_FETCH_NAME || op->flags & ODBXUV_QUERY_FETCH_TYPE))
-            {
-                {
-                    size_t len = sizeof(odbxuv_column_info_t) * op->columnCount;
-                    op->columns = malloc(len);
-                    memset(op->columns, 0, len); //TODO: manually init with 0 if we need it ?
-                }
+/**
+ * Hands \p count rows starting at \p first to the fetch callback.
+ * Returns 1 when a batch callback holds on to them.
+ */
+static int _query_deliver_rows(odbxuv_op_query_t *result, odbxuv_row_t *first, odbxuv_row_t *last, unsigned int count)
+{
+    odbxuv_row_t *row;
 
-                int i;
-                for(i = 0; i < op->columnCount; i++)
-                {
-                    if(op->flags & ODBXUV_QUERY_FETCH_NAME)
-                    {
-                        const char *name = odbx_column_name(op->resultHandle, i);
+    if(result->batchCallback)
+    {
+        result->fetchCallbackStatus = ODBXUV_FETCH_CB_STATUS_CALLED;
 
-                        op->columns[i].name = malloc(strlen(name)+1);
-                        strcpy(op->columns[i].name, name);
-                    }
-                    if(op->flags & ODBXUV_QUERY_FETCH_TYPE)
-                    {
-                        op->columns[i].type = odbx_column_type(op->resultHandle, i);
-                    }
-                }
-            }
+        if(result->batchCallback(result, first, count, 0) == ODBXUV_BATCH_HOLD)
+        {
+            //Rows fetched meanwhile wait in result->row until odbxuv_query_resume
+            result->held = first;
+            result->heldTail = last;
+            result->paused = 1;
+            return 1;
         }
 
-        switch(result)
+        for(row = first; row; row = row->next)
         {
-            case ODBX_RES_ROWS:
-                //fetch & see if there is more
-                while(ODBX_ROW_NEXT == (result = odbx_row_fetch(op->resultHandle)))
-                {
-                    //Find a unused row or create one
-                    odbxuv_row_t **row = &op->row;
+            row->status = ODBXUV_ROW_STATUS_PROCESSED;
+        }
+    }
+    else
+    {
+        for(row = first; row; row = row->next)
+        {
+            result->cb(result, row, 0);
+            result->fetchCallbackStatus = result->fetchCallbackStatus == ODBXUV_FETCH_CB_STATUS_NONE ? ODBXUV_FETCH_CB_STATUS_CALLED : result->fetchCallbackStatus;
+            row->status = ODBXUV_ROW_STATUS_PROCESSED;
+        }
+    }
 
-                    do
-                    {
-                        if(*row == NULL)
-                        {
-                            odbxuv_row_t *newRow = malloc(sizeof(odbxuv_row_t));
-                            memset(newRow, 0, sizeof(odbxuv_row_t));
-                            newRow->status = ODBXUV_ROW_STATUS_NONE;
-                            *row = newRow;
-                            break;
-                        }
+    return 0;
+}
 
-                        if((*row)->status == ODBXUV_ROW_STATUS_PROCESSED)
-                        {
-                            break;
-                        }
+/**
+ * Hands processed rows back to the worker for reuse.
+ */
+static void _query_recycle_rows(odbxuv_op_query_t *result, odbxuv_row_t *first, odbxuv_row_t *last)
+{
+    odbxuv_row_t *row;
+    size_t bytes = 0;
 
-                        row = &(*row)->next;
-                    }
-                    while(1);
+    for(row = first; row; row = row->next)
+    {
+        bytes += row->size;
+    }
 
-                    (*row)->status = ODBXUV_ROW_STATUS_READING;
+    uv_mutex_lock(&result->connection->lock);
+    last->next = result->freeRow;
+    result->freeRow = first;
+    result->bufferedBytes -= bytes;
+    if(result->memoryWaiting)
+    {
+        uv_cond_signal(&result->connection->rowsReturned);
+    }
+    uv_mutex_unlock(&result->connection->lock);
+}
 
-                    int i;
-                    for(i = 0; i < op->columnCount; i++)
-                    {
-                        if(op->flags & ODBXUV_QUERY_FETCH_VALUE)
-                        {
-                            //Lazy init
-                            if((*row)->value == NULL)
-                            {
-                                size_t len = sizeof(char *) * op->columnCount;
-                                (*row)->value = malloc(len);
-                                memset((*row)->value, 0, len);
-                            }
+/**
+ * Delivers the next rows of the spill file once the worker finished.
+ * Returns 1 while rows remain, 0 once the whole file has been replayed.
+ */
+static int _query_spill_replay(odbxuv_op_query_t *result)
+{
+    odbxuv_row_t *last = NULL;
+    unsigned int count = 0;
 
-                            if((*row)->value[i] != NULL)
-                            {
-                                free((*row)->value[i]);
-                            }
+    if(result->spillMap == NULL && result->spillLength > 0)
+    {
+        void *map = mmap(NULL, result->spillLength, PROT_READ, MAP_PRIVATE, result->spillFile, 0);
 
-                            const char *value = odbx_field_value(op->resultHandle, i);
+        if(map == MAP_FAILED)
+        {
+            if(result->error == NULL)
+            {
+                _handle_make_error((odbxuv_handle_t *)result, ODBXUV_ERR_SPILL, 0, strerror(errno));
+            }
 
-                            if(value)
-                            {
-                                (*row)->value[i] = malloc(strlen(value)+1);
-                                strcpy((*row)->value[i], value);
-                            }
-                            else
-                            {
-                                (*row)->value[i] = NULL;
-                            }
-                        }
+            _query_spill_free(result);
+            return 0;
+        }
 
-                        //TODO fetch lengths
-                    }
+        madvise(map, result->spillLength, MADV_SEQUENTIAL);
+        result->spillMap = map;
+    }
+
+    if(result->spillPos >= result->spillLength)
+    {
+        _query_spill_free(result);
+        return 0;
+    }
 
-                    (*row)->status = ODBXUV_ROW_STATUS_READ;
+    if(result->spillRows == NULL)
+    {
+        unsigned int i;
 
-                    //We have inited
-                    if(op->asyncStatus == 1)
-                    {
-                        uv_async_send(&op->async);
-                    }
+        result->spillRowCount = result->connection->notifyRows;
+        result->spillRows = malloc(sizeof(odbxuv_row_t) * result->spillRowCount);
+        memset(result->spillRows, 0, sizeof(odbxuv_row_t) * result->spillRowCount);
 
-                    if(op->fetchStatus == ODBXUV_FETCH_STATUS_CANCELLED) goto escape;
-                }
+        for(i = 0; i < result->spillRowCount; i++)
+        {
+            result->spillRows[i].value = malloc(sizeof(char *) * (result->columnCount ? result->columnCount : 1));
+        }
+    }
 
-                MAKE_ODBX_ERR(op, result, {
-                    op->error->error = -result;
-                    op->fetchStatus = ODBXUV_FETCH_STATUS_ERROR_FETCH;
-                });
+    while(count < result->spillRowCount && result->spillPos < result->spillLength)
+    {
+        odbxuv_row_t *row = &result->spillRows[count];
+        unsigned int i;
 
-                continue;
-                break;
+        for(i = 0; i < result->columnCount; i++)
+        {
+            uint32_t length;
 
-            default: //Assert on this?
-            case ODBX_RES_NOROWS:
-            case ODBX_RES_DONE:
-                goto escape;
-                break;
+            memcpy(&length, result->spillMap + result->spillPos, sizeof(length));
+            result->spillPos += sizeof(length);
+
+            if(length == ODBXUV_SPILL_NULL)
+            {
+                row->value[i] = NULL;
+            }
+            else
+            {
+                row->value[i] = result->spillMap + result->spillPos;
+                result->spillPos += (uint64_t)length + 1;
+            }
         }
-    }
-    while(op->fetchStatus != ODBXUV_FETCH_STATUS_CANCELLED);
 
-    escape:
+        row->status = ODBXUV_ROW_STATUS_PROCESSING;
+        row->next = NULL;
 
-    if(op->resultHandle != NULL)
-    {
-        result = odbx_result_finish(op->resultHandle);
+        if(last != NULL)
+        {
+            last->next = row;
+        }
 
-        MAKE_ODBX_ERR(op, result, {
-            op->error->error = -result;
-            op->fetchStatus = ODBXUV_FETCH_STATUS_ERROR_FINISH;
-        });
+        last = row;
+        count++;
     }
 
-    if(op->asyncStatus == 1)
+    //Go through the loop between batches, the rows are reused for the next one
+    if(!_query_deliver_rows(result, result->spillRows, last, count))
     {
-        uv_async_send(&op->async);
+        uv_async_send(&result->async);
     }
 
-    op->fetchStatus = ODBXUV_FETCH_STATUS_FINISHED;
-
-    return ODBXUV_OP_STATUS_COMPLETED;
+    return 1;
 }
 
-static odbxuv_operation_status_e _op_escape(odbxuv_op_t *req)
+/**
+ * Delivers the next rows of the snapshot of a shared query once it is complete.
+ * Returns 1 while rows remain, 0 once all of them have been delivered.
+ */
+static int _query_snapshot_replay(odbxuv_op_query_t *result)
 {
-    int result;
-    odbxuv_op_escape_t *op = (odbxuv_op_escape_t *)req;
-    assert(op->type == ODBXUV_HANDLE_TYPE_OP_ESCAPE);
+    odbxuv_row_t *last = NULL;
+    unsigned int count = 0;
 
-    unsigned long inlen = strlen(op->string);
-    unsigned long outlen = 2 * (inlen+1);
+    if(result->snapshotRow == NULL) return 0;
 
-    const char *in = op->string;
-    char *out = malloc(outlen + 1);
-    memset(out, 0, outlen + 1);
+    if(result->snapshotRows == NULL)
+    {
+        result->snapshotRowCount = result->connection->notifyRows ? result->connection->notifyRows : 1;
+        result->snapshotRows = malloc(sizeof(odbxuv_row_t) * result->snapshotRowCount);
+        memset(result->snapshotRows, 0, sizeof(odbxuv_row_t) * result->snapshotRowCount);
+    }
 
-    result = odbx_escape(op->connection->handle, in, inlen, out, &outlen);
+    while(count < result->snapshotRowCount && result->snapshotRow != NULL)
+    {
+        odbxuv_row_t *row = &result->snapshotRows[count];
 
-    op->string = out;
+        row->value = result->snapshotRow->value;
+        row->status = ODBXUV_ROW_STATUS_PROCESSING;
+        row->next = NULL;
 
-    free((void *)in);
+        if(last != NULL)
+        {
+            last->next = row;
+        }
 
-    MAKE_ODBX_ERR(op, result, {
+        last = row;
+        count++;
+        result->snapshotRow = result->snapshotRow->next;
+    }
 
-    });
+    //Go through the loop between batches, the rows are reused for the next one
+    if(!_query_deliver_rows(result, result->snapshotRows, last, count))
+    {
+        uv_async_send(&result->async);
+    }
 
-    return 0;
+    return 1;
 }
 
-/**
- * Initialize an operation from the arguments and default values
- */
-static void _init_op(int type, odbxuv_op_t *operation, odbxuv_connection_t *connection, odbxuv_op_fun fun, odbxuv_op_cb callback)
+static odbxuv_row_t *_query_last_row(odbxuv_row_t *row)
 {
-    operation->type = type;
-    operation->status = ODBXUV_OP_STATUS_NOT_STARTED;
-    operation->next = NULL;
-    operation->connection = connection;
-    operation->operationFunction = fun;
-    operation->callback = callback;
-    operation->error = NULL;
+    while(row->next) row = row->next;
+
+    return row;
 }
 
 /**
- * Push an operation to the connection's operation queue
+ * Puts rows the loop took but did not deliver back in front of the rows of the query.
  */
-static void _con_add_op(odbxuv_connection_t *connection, odbxuv_op_t *operation)
+static void _query_unshift_rows(odbxuv_op_query_t *result, odbxuv_row_t *first, odbxuv_row_t *last)
 {
-    assert(connection->status != ODBXUV_CON_STATUS_DISCONNECTING && "Cannot add operations while disconnecting");
+    uv_mutex_lock(&result->connection->lock);
 
-    if(connection->operationQueue == NULL)
+    if(result->row == NULL)
     {
-        connection->operationQueue = operation;
+        result->rowTail = last;
     }
     else
     {
-        odbxuv_op_t *currentOperation = connection->operationQueue;
-        while(currentOperation->next != NULL)
-        {
-            currentOperation = currentOperation->next;
-        }
-        currentOperation->next = operation;
+        last->next = result->row;
     }
+
+    result->row = first;
+    uv_mutex_unlock(&result->connection->lock);
 }
 
-/*
- * API:
+/**
+ * Delivers the rows starting at \p first within the budget of the connection.
+ * Without a budget all rows are delivered at once, otherwise in slices of \p notifyRows rows.
+ * Returns 1 when rows are held by a batch callback or were put back for the next iteration of the loop.
  */
-
-int odbxuv_init_connection(odbxuv_connection_t *connection, uv_loop_t *loop)
+static int _query_deliver_budget(odbxuv_op_query_t *result, odbxuv_row_t *first)
 {
-    SET_0_COPY_DATA(connection);
-    connection->loop = loop;
-    connection->type = ODBXUV_HANDLE_TYPE_CONNECTION;
-    connection->workerStatus = ODBXUV_WORKER_IDLE;
+    odbxuv_connection_t *con = result->connection;
+    unsigned int budget = con->deliverRows;
+    unsigned int slice = budget || con->deliverTime ? (con->notifyRows ? con->notifyRows : 1) : UINT_MAX;
+    uint64_t deadline = con->deliverTime ? uv_hrtime() + (uint64_t)con->deliverTime * 1000 : 0;
 
-    memset(&connection->async, 0, sizeof(uv_async_t));
-    connection->async.data = connection;
-    uv_async_init(connection->loop, &connection->async, _op_run_callbacks);
+    while(first != NULL)
+    {
+        odbxuv_row_t *row = first;
+        odbxuv_row_t *last = NULL;
+        unsigned int count = 0;
+        unsigned int max = budget && budget < slice ? budget : slice;
 
-    return ODBX_ERR_SUCCESS;
+        for(; row && count < max; row = row->next)
+        {
+            row->status = ODBXUV_ROW_STATUS_PROCESSING;
+            last = row;
+            count++;
+        }
+
+        //Cut the slice off, row is the first one of the rest
+        last->next = NULL;
+
+        if(_query_deliver_rows(result, first, last, count))
+        {
+            if(row != NULL) _query_unshift_rows(result, row, _query_last_row(row));
+            return 1;
+        }
+
+        _query_recycle_rows(result, first, last);
+        first = row;
+
+        if(budget)
+        {
+            budget -= count;
+        }
+
+        if(first != NULL && ((con->deliverRows && budget == 0) || (deadline && uv_hrtime() >= deadline)))
+        {
+            //Let the other handles of the loop run first
+            _query_unshift_rows(result, first, _query_last_row(first));
+
+            uv_mutex_lock(&con->lock);
+            con->counters.deliveryYields++;
+            uv_mutex_unlock(&con->lock);
+
+            uv_async_send(&result->async);
+            return 1;
+        }
+    }
+
+    return 0;
 }
 
-int odbxuv_connect(odbxuv_connection_t *connection, odbxuv_op_connect_t *operation, odbxuv_op_connect_cb callback)
+static void _query_process_cb_real(odbxuv_op_query_t *result)
 {
-    assert(connection->status == ODBXUV_CON_STATUS_IDLE || connection->status == ODBXUV_CON_STATUS_DISCONNECTED);
-    connection->status = ODBXUV_CON_STATUS_CONNECTING;
+    odbxuv_connection_t *con = result->connection;
+    odbxuv_fetch_status_e fetchStatus;
+    odbxuv_row_t *first;
+
+    if(result->paused) return;
+
+    //Take all the rows at once, the worker wakes us up again when it adds rows after this
+    uv_mutex_lock(&con->lock);
+    first = result->row;
+    result->row = NULL;
+    result->rowTail = NULL;
+    fetchStatus = result->fetchStatus;
+    uv_mutex_unlock(&con->lock);
 
+    if(result->config.serializer != NULL)
     {
-        #define _copys(name) \
-        char *name = NULL; \
-        if (operation->name) \
-        { \
-            name = malloc(strlen( operation->name )+1); \
-            strcpy( name , operation-> name ); \
+        //The worker hands over its last buffer before it finishes
+        _query_serial_deliver(result);
+    }
+    else if(first != NULL && _query_deliver_budget(result, first))
+    {
+        return;
+    }
+
+    if(fetchStatus == ODBXUV_FETCH_STATUS_RUNNING) return;
+
+    if(result->spilling && _query_spill_replay(result)) return;
+
+    if(result->snapshot != NULL && _query_snapshot_replay(result)) return;
+
+    if(result->asyncStatus == 1)
+    {
+        if(result->persistentAsync)
+        {
+            //The handle stays open for the next query, stop it from keeping the loop alive
+            uv_unref((uv_handle_t *)&result->async);
+            _query_process_finish(result);
         }
-            _copys(host);
-            _copys(port);
-            _copys(backend);
-            _copys(database);
-            _copys(user);
-            _copys(password);
-        #undef _copys
+        else
+        {
+            result->asyncStatus = 2;
 
-        int method = operation->method;
+            //Clean up async
+            uv_close((uv_handle_t *)&result->async, _query_process_close);
+        }
+    }
+}
 
-        SET_0_COPY_DATA(operation);
+static void _query_process_cb(uv_async_t* handle)
+{
+    odbxuv_op_query_t *result = (odbxuv_op_query_t *)handle->data;
 
-        #define _copys(name) \
-            operation-> name = name;
-            _copys(host);
-            _copys(port);
-            _copys(backend);
-            _copys(database);
-            _copys(user);
-            _copys(password);
-        #undef _copys
+    //A wakeup can arrive after a recycled operation finished processing
+    if(result->asyncStatus != 1) return;
+
+    _query_process_cb_real(result);
+}
+
+/**
+ * Sets up the async handle and delivers the rows fetched so far.
+ */
+static int _query_process_start(odbxuv_op_query_t *result)
+{
+    if(result->persistentAsync)
+    {
+        uv_ref((uv_handle_t *)&result->async);
+    }
+    else
+    {
+        memset(&result->async, 0, sizeof(uv_async_t));
+        result->async.data = result;
+        uv_async_init(result->loop ? result->loop : result->connection->loop, &result->async, _query_process_cb);
+    }
+
+    uv_mutex_lock(&result->connection->lock);
+    result->asyncStatus = 1;
+    uv_mutex_unlock(&result->connection->lock);
+
+    _query_process_cb(&result->async);
+
+    return ODBX_ERR_SUCCESS;
+}
+
+int odbxuv_query_process(odbxuv_op_query_t *result, odbxuv_fetch_cb onQueryRow)
+{
+    assert(result->asyncStatus == 0 && "We are already fetching on this handle");
+    result->cb = onQueryRow;
+    result->batchCallback = NULL;
 
-        operation->method = method;
-    }
+    return _query_process_start(result);
+}
 
-    _init_op(ODBXUV_HANDLE_TYPE_OP_CONNECT, (odbxuv_op_t *)operation, connection, _op_connect, (odbxuv_op_cb)callback);
+int odbxuv_query_process_batch(odbxuv_op_query_t *result, odbxuv_fetch_batch_cb onRows)
+{
+    assert(result->asyncStatus == 0 && "We are already fetching on this handle");
+    result->cb = NULL;
+    result->batchCallback = onRows;
 
-    _con_add_op(connection, (odbxuv_op_t *)operation);
+    return _query_process_start(result);
+}
 
-    con_worker_check(connection);
+int odbxuv_query_process_serialized(odbxuv_op_query_t *result, odbxuv_serialized_cb onBuffer)
+{
+    assert(result->asyncStatus == 0 && "We are already fetching on this handle");
+    assert(result->config.serializer != NULL && "The query has no serializer");
+    result->cb = NULL;
+    result->batchCallback = NULL;
+    result->config.serializer->callback = onBuffer;
 
-    return ODBX_ERR_SUCCESS;
+    return _query_process_start(result);
 }
 
-int odbxuv_disconnect(odbxuv_connection_t *connection, odbxuv_op_disconnect_t *operation, odbxuv_op_disconnect_cb callback)
+int odbxuv_query_resume(odbxuv_op_query_t *result)
 {
-    assert(connection->status == ODBXUV_CON_STATUS_CONNECTED);
+    assert(result->paused && "The rows are not held");
 
-    SET_0_COPY_DATA(operation);
+    result->paused = 0;
 
-    _init_op(ODBXUV_HANDLE_TYPE_OP_DISCONNECT, (odbxuv_op_t *)operation, connection, _op_disconnect, (odbxuv_op_cb)callback);
+    if(result->held != NULL)
+    {
+        odbxuv_row_t *row;
+        for(row = result->held; row; row = row->next)
+        {
+            row->status = ODBXUV_ROW_STATUS_PROCESSED;
+        }
 
-    _con_add_op(connection, (odbxuv_op_t *)operation);
-    connection->status = ODBXUV_CON_STATUS_DISCONNECTING;
+        //Replayed rows point into the spill file or the snapshot and stay with the operation
+        if(result->held != result->spillRows && result->held != result->snapshotRows)
+        {
+            _query_recycle_rows(result, result->held, result->heldTail);
+        }
 
-    con_worker_check(connection);
+        result->held = NULL;
+        result->heldTail = NULL;
+    }
+
+    uv_async_send(&result->async);
 
     return ODBX_ERR_SUCCESS;
 }
 
-int odbxuv_capabilities(odbxuv_connection_t *connection, odbxuv_op_capabilities_t *operation, int capabilities, odbxuv_op_capabilities_cb callback)
+void odbxuv_query_hand_over(odbxuv_op_query_t *operation, uv_loop_t *loop)
 {
-    assert(connection->status == ODBXUV_CON_STATUS_CONNECTED);
+    odbxuv_connection_t *connection = operation->connection;
 
-    memset(operation, 0, sizeof(&operation));
-    _init_op(ODBXUV_HANDLE_TYPE_OP_CAPABILITIES, (odbxuv_op_t *)operation, connection, _op_capabilities, (odbxuv_op_cb)callback);
+    assert(!operation->persistentAsync && "Acquired operations belong to the loop of their connection");
+    assert(operation->loop == NULL && operation->asyncStatus == 0 && "Operation was already handed over or is processing");
 
-    operation->capabilities = capabilities;
+    uv_mutex_lock(&connection->lock);
+    operation->loop = loop;
+    connection->remoteQueries++;
+    uv_mutex_unlock(&connection->lock);
+}
 
-    _con_add_op(connection, (odbxuv_op_t *)operation);
+/**
+ * Lets go of the connection of an operation handed to another loop.
+ * The connection may be closed and freed once this returns.
+ */
+static void _query_remote_release(odbxuv_op_query_t *op)
+{
+    odbxuv_connection_t *connection = op->connection;
 
-    con_worker_check(connection);
+    if(op->loop == NULL) return;
 
-    return ODBX_ERR_SUCCESS;
+    op->loop = NULL;
+
+    //Wake up a close waiting for us before it can see the count drop and destroy the handle
+    uv_mutex_lock(&connection->lock);
+    if(--connection->remoteQueries == 0)
+    {
+        uv_async_send(&connection->async);
+    }
+    uv_mutex_unlock(&connection->lock);
 }
 
-int odbxuv_query(odbxuv_connection_t *connection, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, odbxuv_op_query_cb callback)
+odbxuv_op_query_t *odbxuv_op_query_acquire(odbxuv_connection_t *connection)
 {
-    assert(connection->status == ODBXUV_CON_STATUS_CONNECTED);
+    odbxuv_op_query_t *op = connection->freeQuery;
 
-    SET_0_COPY_DATA(operation);
-    _init_op(ODBXUV_HANDLE_TYPE_OP_QUERY, (odbxuv_op_t *)operation, connection, _op_query, (odbxuv_op_cb)callback);
+    if(op != NULL)
+    {
+        connection->freeQuery = (odbxuv_op_query_t *)op->next;
+        connection->freeQueryCount--;
+        op->next = NULL;
+        return op;
+    }
 
-    operation->flags = flags;
+    op = malloc(sizeof(odbxuv_op_query_t));
+    memset(op, 0, sizeof(odbxuv_op_query_t));
+    op->type = ODBXUV_HANDLE_TYPE_OP_QUERY;
+    op->connection = connection;
+    op->recycle = ODBXUV_OP_RECYCLE_MAGIC;
+    op->persistentAsync = 1;
 
-    char *q = malloc(strlen(query) + 1);
-    strcpy(q, query);
-    operation->query = q;
-    operation->fetchStatus = ODBXUV_FETCH_STATUS_NONE;
+    op->async.data = op;
+    uv_async_init(connection->loop, &op->async, _query_process_cb);
+    uv_unref((uv_handle_t *)&op->async);
 
-    _con_add_op(connection, (odbxuv_op_t *)operation);
+    return op;
+}
 
-    con_worker_check(connection);
+typedef struct _odbxuv_closing_data_s
+{
+    odbxuv_connection_t *connection;
+    odbxuv_close_cb cb;
+    odbxuv_error_t *error;
+    int pendingHandles;
+} _odbxuv_closing_data_t;
 
-    return ODBX_ERR_SUCCESS;
-}
+static void _close_connection_release(_odbxuv_closing_data_t *data);
 
-static void _query_process_close(uv_handle_t *handle)
+static void _query_free_pooled(uv_handle_t *handle)
 {
     odbxuv_op_query_t *op = (odbxuv_op_query_t *)handle->data;
+    odbxuv_connection_t *connection = op->connection;
 
-    assert(op->type == ODBXUV_HANDLE_TYPE_OP_QUERY && "Close callback for non query.");
+    op->persistentAsync = 0;
+    odbxuv_free_handle((odbxuv_handle_t *)op);
+    free(op);
 
-    int status = op->error ? op->error->error : 0;
-    switch(op->fetchStatus)
+    //The connection waits for its operations before destroying the lock
+    connection->closingQueries--;
+    if(connection->closing != NULL)
     {
-        case ODBXUV_FETCH_STATUS_ERROR_FETCH:
-        case ODBXUV_FETCH_STATUS_ERROR_FINISH:
-        case ODBXUV_FETCH_STATUS_ERROR_RESULT:
-            if(status > 0)
-            {
-                op->error->error = -op->error->error;
-                status = op->error->error;
-            }
-            break;
-        default:
-            break;
+        _close_connection_release((_odbxuv_closing_data_t *)connection->closing);
     }
-
-    op->asyncStatus = 3;
-    op->cb(op, NULL, status);
 }
 
-static void _query_process_cb_real(odbxuv_op_query_t *result)
+/**
+ * Closes the async handle of a pooled query operation and frees it.
+ */
+static void _query_close_pooled(odbxuv_op_query_t *op)
 {
-    odbxuv_row_t *row = result->row;
+    op->asyncStatus = 2;
+    op->connection->closingQueries++;
 
-    while(row)
+    //A close that already counted the closing operations waits for this one as well
+    if(op->connection->closing != NULL)
     {
-        result->cb(result, row, 0);
-        result->fetchCallbackStatus = result->fetchCallbackStatus == ODBXUV_FETCH_CB_STATUS_NONE ? ODBXUV_FETCH_CB_STATUS_CALLED : result->fetchCallbackStatus;
-        row = row->next;
+        ((_odbxuv_closing_data_t *)op->connection->closing)->pendingHandles++;
     }
 
-    if(result->fetchStatus == ODBXUV_FETCH_STATUS_RUNNING) return;
+    uv_close((uv_handle_t *)&op->async, _query_free_pooled);
+}
 
-    if(result->asyncStatus == 1)
-    {
-        result->asyncStatus = 2;
+void odbxuv_op_query_release(odbxuv_op_query_t *op)
+{
+    odbxuv_connection_t *connection = op->connection;
+
+    assert(op->persistentAsync && "Operation was not acquired with odbxuv_op_query_acquire");
+
+    odbxuv_op_reset((odbxuv_op_t *)op);
 
-        //Clean up async
-        uv_close((uv_handle_t *)&result->async, _query_process_close);
+    if(connection->freeQueryCount >= connection->freeQueryMax)
+    {
+        _query_close_pooled(op);
+        return;
     }
+
+    op->next = (odbxuv_op_t *)connection->freeQuery;
+    connection->freeQuery = op;
+    connection->freeQueryCount++;
 }
 
-static void _query_process_cb(uv_async_t* handle)
+int odbxuv_connection_shares(odbxuv_connection_t *connection, const char *query, odbxuv_query_fetch_e flags)
 {
-    odbxuv_op_query_t *result = (odbxuv_op_query_t *)handle->data;
-    _query_process_cb_real(result);
+    char *normalized = _query_normalize(query);
+    uint32_t hash = _hash_bytes(2166136261u, normalized, strlen(normalized));
+
+    uv_mutex_lock(&connection->lock);
+    int found = _con_find_snapshot(connection, normalized, hash, flags) != NULL;
+    uv_mutex_unlock(&connection->lock);
+
+    free(normalized);
+
+    return found;
 }
 
-int odbxuv_query_process(odbxuv_op_query_t *result, odbxuv_fetch_cb onQueryRow)
+odbxuv_snapshot_t *odbxuv_query_snapshot(odbxuv_op_query_t *operation)
 {
-    assert(result->asyncStatus == 0 && "We are already fetching on this handle");
-    memset(&result->async, 0, sizeof(uv_async_t));
-    result->async.data = result;
-    result->cb = onQueryRow;
-    uv_async_init(result->connection->loop, &result->async, _query_process_cb);
-    result->asyncStatus = 1;
+    odbxuv_snapshot_t *snapshot = operation->snapshot;
 
-    _query_process_cb(&result->async);
+    if(snapshot == NULL) return NULL;
 
-    return ODBX_ERR_SUCCESS;
+    uv_mutex_lock(&operation->connection->lock);
+    unsigned char complete = snapshot->complete;
+    uv_mutex_unlock(&operation->connection->lock);
+
+    if(!complete) return NULL;
+
+    __atomic_add_fetch(&snapshot->refs, 1, __ATOMIC_ACQ_REL);
+
+    return snapshot;
+}
+
+void odbxuv_snapshot_release(odbxuv_snapshot_t *snapshot)
+{
+    if(__atomic_sub_fetch(&snapshot->refs, 1, __ATOMIC_ACQ_REL) != 0) return;
+
+    odbxuv_row_t *row = snapshot->rows;
+
+    while(row)
+    {
+        odbxuv_row_t *next = row->next;
+
+        if(row->value)
+        {
+            unsigned int i;
+            for(i = 0; i < snapshot->columnCount; i++)
+            {
+                free(row->value[i]);
+            }
+
+            free(row->value);
+        }
+
+        free(row);
+        row = next;
+    }
+
+    __atomic_sub_fetch(&_odbxuv_memory_used, snapshot->size, __ATOMIC_RELAXED);
+
+    free(snapshot->query);
+    free(snapshot);
 }
 
 int odbxuv_escape(odbxuv_connection_t *connection, odbxuv_op_escape_t *operation, const char *string, odbxuv_op_escape_cb callback)
 {
-    assert(connection->status == ODBXUV_CON_STATUS_CONNECTED);
+    assert(_con_is_open(connection) && "The connection is not open");
 
     SET_0_COPY_DATA(operation);
     _init_op(ODBXUV_HANDLE_TYPE_OP_ESCAPE, (odbxuv_op_t *)operation, connection, _op_escape, (odbxuv_op_cb)callback);
@@ -695,40 +3784,112 @@ int odbxuv_escape(odbxuv_connection_t *connection, odbxuv_op_escape_t *operation
     return ODBX_ERR_SUCCESS;
 }
 
-typedef struct _odbxuv_closing_data_s
+/**
+ * Finishes the close once the handles of the connection and its closing query operations are closed.
+ */
+static void _close_connection_release(_odbxuv_closing_data_t *data)
 {
-    odbxuv_connection_t *connection;
-    odbxuv_close_cb cb;
-    odbxuv_error_t *error;
-} _odbxuv_closing_data_t;
+    //Wait for the other handles of the connection
+    if(--data->pendingHandles > 0) return;
+
+    data->connection->closing = NULL;
+
+    odbxuv_credentials_t *credentials = &data->connection->credentials;
+    ODBXUV_FREE_STRING(credentials->host);
+    ODBXUV_FREE_STRING(credentials->port);
+    ODBXUV_FREE_STRING(credentials->backend);
+    ODBXUV_FREE_STRING(credentials->database);
+    ODBXUV_FREE_STRING(credentials->user);
+    ODBXUV_FREE_STRING(credentials->password);
+
+    _metadata_free_all(data->connection);
+
+    data->connection->error = data->error;
+    uv_mutex_destroy(&data->connection->lock);
+    uv_cond_destroy(&data->connection->rowsReturned);
+    data->cb((odbxuv_handle_t *)data->connection);
+    free(data);
+}
 
 static void _close_connection_async(uv_handle_t *handle)
 {
     _odbxuv_closing_data_t *data = (_odbxuv_closing_data_t *)handle->data;
     handle->data = NULL;
-    data->connection->error = data->error;
-    data->cb((odbxuv_handle_t *)data->connection);
-    free(data);
+
+    _close_connection_release(data);
 }
 
 static void _close_connection(odbxuv_op_disconnect_t *op, int status)
 {
     odbxuv_close_cb cb = (odbxuv_close_cb)op->data;
     odbxuv_connection_t *connection = op->connection;
+    unsigned char waiting;
+
+    //The callback of the disconnect can run before the worker returned
+    if(connection->workerStatus == ODBXUV_WORKER_RUNNING)
+    {
+        connection->closeOp = op;
+        return;
+    }
+
+    //Operations on other loops still take the lock, the last one wakes us up
+    uv_mutex_lock(&connection->lock);
+    waiting = connection->remoteQueries > 0;
+    uv_mutex_unlock(&connection->lock);
+
+    if(waiting)
+    {
+        connection->closeOp = op;
+        return;
+    }
 
-    assert(connection->workerStatus == ODBXUV_WORKER_IDLE && "Worker did not close after disconnect");
     {
         _odbxuv_closing_data_t *data = malloc(sizeof(_odbxuv_closing_data_t));
         data->connection = connection;
         data->cb = cb;
         data->error = op->error;
+        data->pendingHandles = 2 + connection->closingQueries;
+        connection->closing = data;
         connection->async.data = data;//Worker is not running, we can abuse this
+        connection->reconnectTimer.data = data;
         uv_close((uv_handle_t *)&connection->async, _close_connection_async);
+        uv_close((uv_handle_t *)&connection->reconnectTimer, _close_connection_async);
     }
 
     free(op);
 }
 
+/**
+ * Disconnects and closes the connection, \p op carries the close callback.
+ */
+static void _con_close(odbxuv_connection_t *con, odbxuv_op_disconnect_t *op)
+{
+    if(odbxuv_connection_get_status(con) == ODBXUV_CON_STATUS_RECONNECTING)
+    {
+        uv_timer_stop(&con->reconnectTimer);
+
+        //Let the running reconnect attempt finish first
+        if(con->workerStatus == ODBXUV_WORKER_RUNNING)
+        {
+            con->closeOp = op;
+            return;
+        }
+
+        _con_fail_pending(con, ODBXUV_ERR_NOCONNECTION, "Connection closed while reconnecting");
+        _con_set_status(con, ODBXUV_CON_STATUS_FAILED);
+        _op_run_callbacks_real(con);
+    }
+
+    if(odbxuv_connection_get_status(con) == ODBXUV_CON_STATUS_CONNECTED)
+    {
+        odbxuv_disconnect(con, op, _close_connection);
+    }
+    else
+    {
+        _close_connection(op, 0);
+    }
+}
+
 void odbxuv_close(odbxuv_handle_t* handle, odbxuv_close_cb callback)
 {
     switch(handle->type)
@@ -737,17 +3898,22 @@ void odbxuv_close(odbxuv_handle_t* handle, odbxuv_close_cb callback)
         {
             odbxuv_connection_t *con = (odbxuv_connection_t *)handle;
             odbxuv_op_disconnect_t *op = (odbxuv_op_disconnect_t *)malloc(sizeof(odbxuv_op_disconnect_t));
+            memset(op, 0, sizeof(odbxuv_op_disconnect_t)); //A connection that never connected closes without disconnecting
             op->data = callback;
 
-            if(con->status == ODBXUV_CON_STATUS_CONNECTED)
-            {
-                odbxuv_disconnect(con, op, _close_connection);
-            }
-            else
+            while(con->freeQuery != NULL)
             {
-                op->connection = con;
-                _close_connection(op, 0);
+                odbxuv_op_query_t *query = con->freeQuery;
+                con->freeQuery = (odbxuv_op_query_t *)query->next;
+                _query_close_pooled(query);
             }
+            con->freeQueryCount = 0;
+
+            //Operations released while closing, like the one whose callback closes the connection, are not kept
+            con->freeQueryMax = 0;
+
+            op->connection = con;
+            _con_close(con, op);
         }
         break;
 
@@ -767,18 +3933,184 @@ void odbxuv_free_error(odbxuv_handle_t *operation)
 {
     if(operation->error != NULL)
     {
+        size_t size = _error_size(operation->error);
+        __atomic_sub_fetch(&_odbxuv_memory_used, size, __ATOMIC_RELAXED);
+        if(operation->type == ODBXUV_HANDLE_TYPE_OP_QUERY)
+        {
+            ((odbxuv_op_query_t *)operation)->memoryUsed -= size;
+        }
+
+        free(operation->error->errorString);
         free(operation->error);
         operation->error = NULL;
     }
 }
 
-#define ODBXUV_FREE_STRING(var) \
-    if(var != NULL)             \
-    {                           \
-        free((void *)var);      \
-        var = NULL;             \
+/**
+ * Frees the pending and processed rows of a query.
+ * When \p keepRows is set only the values are freed and the rows are kept for reuse.
+ */
+static void _query_free_rows(odbxuv_op_query_t *query, unsigned char keepRows)
+{
+    odbxuv_row_t *row = query->row;
+    query->row = NULL;
+    query->rowTail = NULL;
+
+    //Free the processed rows along with the pending ones
+    if(row == NULL)
+    {
+        row = query->freeRow;
+    }
+    else
+    {
+        odbxuv_row_t *last = row;
+        while(last->next) last = last->next;
+        last->next = query->freeRow;
+    }
+
+    query->freeRow = keepRows ? row : NULL;
+
+    int64_t bytes = 0;
+
+    while(row)
+    {
+        odbxuv_row_t *next = row->next;
+
+        if(row->user != NULL)
+        {
+            _row_free_user(query, row);
+        }
+
+        //Kept rows are empty afterwards
+        bytes += row->size;
+        row->size = keepRows ? sizeof(odbxuv_row_t) : 0;
+        bytes -= row->size;
+
+        if(row->value)
+        {
+            int i;
+            for(i = 0; i < query->columnCount; i++)
+            {
+                if(row->value[i])
+                {
+                    _row_free_value(query, row, i);
+                }
+            }
+
+            free(row->value);
+            row->value = NULL;
+        }
+
+        if(keepRows)
+        {
+            row->status = ODBXUV_ROW_STATUS_NONE;
+        }
+        else
+        {
+            free(row);
+        }
+
+        row = next;
+    }
+
+    if(bytes != 0)
+    {
+        _memory_add(query, -bytes);
+    }
+}
+
+/**
+ * Drops the reference of the query to its column info.
+ * Column info kept by the connection stays for the next result with the same columns.
+ */
+static void _query_free_columns(odbxuv_op_query_t *query)
+{
+    odbxuv_metadata_t *metadata = (odbxuv_metadata_t *)query->metadata;
+
+    if(metadata == NULL) return;
+
+    query->metadata = NULL;
+    query->columns = NULL;
+
+    if(__atomic_sub_fetch(&metadata->refs, 1, __ATOMIC_ACQ_REL) == 0 && metadata->interned == ODBXUV_METADATA_OWNED)
+    {
+        _memory_add(query, -(int64_t)metadata->size);
+        free(metadata);
+    }
+}
+
+/**
+ * Drops the reference of the query to the snapshot of a shared query.
+ */
+static void _query_snapshot_drop(odbxuv_op_query_t *query)
+{
+    if(query->snapshot == NULL) return;
+
+    odbxuv_snapshot_release(query->snapshot);
+    free(query->snapshotRows);
+
+    query->snapshot = NULL;
+    query->nextFollower = NULL;
+    query->snapshotRow = NULL;
+    query->snapshotRows = NULL;
+    query->snapshotRowCount = 0;
+}
+
+void odbxuv_op_reset(odbxuv_op_t *operation)
+{
+    assert(operation->status != ODBXUV_OP_STATUS_NOT_STARTED && operation->status != ODBXUV_OP_STATUS_IN_PROGRESS && "Can't reset a queued operation");
+
+    odbxuv_free_error((odbxuv_handle_t *)operation);
+
+    if(operation->type != ODBXUV_HANDLE_TYPE_OP_QUERY)
+    {
+        odbxuv_free_handle((odbxuv_handle_t *)operation);
+        return;
     }
 
+    odbxuv_op_query_t *query = (odbxuv_op_query_t *)operation;
+    assert(query->fetchStatus != ODBXUV_FETCH_STATUS_RUNNING && "Can't reset while fetching");
+    assert(query->asyncStatus != 1 && query->asyncStatus != 2 && "Can't reset while processing");
+
+    _query_free_rows(query, 1);
+    _query_dictionary_free(query);
+    _query_free_columns(query);
+    _query_spill_free(query);
+    _query_snapshot_drop(query);
+
+    query->status = ODBXUV_OP_STATUS_NONE;
+    query->next = NULL;
+    query->callback = NULL;
+    query->columnCount = 0;
+    query->affectedCount = 0;
+    query->resultHandle = NULL;
+    query->batch = NULL;
+    query->batchTail = NULL;
+    query->batchCount = 0;
+    query->workerFreeRow = NULL;
+    query->cb = NULL;
+    query->batchCallback = NULL;
+    query->held = NULL;
+    query->heldTail = NULL;
+    query->paused = 0;
+    query->bufferedBytes = 0;
+    query->batchBytes = 0;
+    query->memoryPending = 0;
+    query->memoryExceeded = 0;
+    query->asyncStatus = 0;
+    query->fetchStatus = ODBXUV_FETCH_STATUS_NONE;
+    query->fetchCallbackStatus = ODBXUV_FETCH_CB_STATUS_NONE;
+    query->chunkSize = 0;
+    query->droppedCount = 0;
+    query->rowCount = 0;
+    free(query->columnMask);
+    query->columnMask = NULL;
+    memset(&query->config, 0, sizeof(odbxuv_query_config_t));
+    query->remote = NULL;
+    query->recycle = ODBXUV_OP_RECYCLE_MAGIC;
+    _query_remote_release(query);
+}
+
 void odbxuv_free_handle(odbxuv_handle_t* handle)
 {
     switch(handle->type)
@@ -787,42 +4119,37 @@ void odbxuv_free_handle(odbxuv_handle_t* handle)
         {
             odbxuv_op_query_t *query = (odbxuv_op_query_t *)handle;
             assert(query->fetchStatus != ODBXUV_FETCH_STATUS_RUNNING && "Can't run free while fetching");
+            assert(!query->persistentAsync && "Use odbxuv_op_query_release for acquired operations");
+            if(query->query != NULL)
+            {
+                _memory_add(query, -(int64_t)query->queryCapacity);
+            }
             ODBXUV_FREE_STRING(query->query);
+            query->queryCapacity = 0;
+            query->recycle = 0;
 
-            odbxuv_row_t *row = query->row;
-            query->row = NULL;
+            _query_free_rows(query, 0);
+            _query_dictionary_free(query);
+            _query_free_columns(query);
+            _query_spill_free(query);
+            _query_snapshot_drop(query);
 
-            while(row)
+            if(query->metadataTable != NULL)
             {
-                odbxuv_row_t *next = row->next;
-
-                if(row->value)
-                {
-                    int i;
-                    for(i = 0; i < query->columnCount; i++)
-                    {
-                        if(row->value[i])
-                        {
-                            free(row->value[i]);
-                        }
-                    }
-
-                    free(row->value);
-                }
-
-                free(row);
-                row = next;
+                _metadata_table_release(query->metadataTable);
+                query->metadataTable = NULL;
             }
 
-            if(query->columns)
-            {
-                int i;
-                for(i = 0; i < query->columnCount; i++)
-                {
-                    free(query->columns[i].name);
-                }
-                free(query->columns);
-            }
+            free(query->hookValues);
+            free(query->hookLengths);
+            query->hookValues = NULL;
+            query->hookLengths = NULL;
+            query->hookCapacity = 0;
+            free(query->columnMask);
+            query->columnMask = NULL;
+
+            //Last, the connection may go away after this
+            _query_remote_release(query);
         }
         break;
 
@@ -850,6 +4177,7 @@ void odbxuv_free_handle(odbxuv_handle_t* handle)
         break;
 
         case ODBXUV_HANDLE_TYPE_OP_DISCONNECT:
+        case ODBXUV_HANDLE_TYPE_OP_CAPABILITIES:
             // Nothing to do
             break;
 
@@ -0,0 +1,741 @@
+#include "odbxuv/pool.h"
+#include <assert.h>
+#include <string.h>
+#include <malloc.h>
+
+/**
+ * The interval of the maintenance timer when no keepalive interval is set, in milliseconds
+ * \internal
+ */
+#define ODBXUV_POOL_MAINTAIN_INTERVAL 1000
+
+/**
+ * A query submitted by a pool loop
+ * \internal
+ */
+typedef struct _odbxuv_pool_remote_s
+{
+    struct _odbxuv_pool_remote_s *next;
+    odbxuv_pool_loop_t *poolLoop;
+    odbxuv_op_query_t *operation;
+    odbxuv_query_fetch_e flags;
+    odbxuv_op_query_cb callback;
+    int status;
+    char query[];
+} _odbxuv_pool_remote_t;
+
+static void _pool_maintain(odbxuv_pool_t *pool);
+static void _pool_close_slot(odbxuv_pool_slot_t *slot);
+
+static char *_pool_copy_string(const char *string)
+{
+    if(string == NULL) return NULL;
+
+    char *copy = malloc(strlen(string) + 1);
+    strcpy(copy, string);
+    return copy;
+}
+
+/**
+ * The amount of operations that are pending on the connection of a slot.
+ * A running worker counts as one, it may still be fetching rows for a completed query.
+ */
+static unsigned int _pool_slot_load(odbxuv_pool_slot_t *slot)
+{
+    //The worker completes operations under the lock of the connection
+    uv_mutex_lock(&slot->connection.lock);
+
+    unsigned int load = slot->connection.workerStatus == ODBXUV_WORKER_RUNNING ? 1 : 0;
+    odbxuv_op_t *operation = slot->connection.operationQueue;
+
+    while(operation)
+    {
+        if(operation->status != ODBXUV_OP_STATUS_COMPLETED) load++;
+        operation = operation->next;
+    }
+
+    uv_mutex_unlock(&slot->connection.lock);
+
+    return load;
+}
+
+/**
+ * Finishes closing the pool once every connection and the timer are closed.
+ */
+static void _pool_check_closed(odbxuv_pool_t *pool)
+{
+    if(!pool->closing || pool->openCount > 0 || pool->closingHandles > 0) return;
+
+    uv_mutex_destroy(&pool->remoteLock);
+
+    free(pool->slots);
+    pool->slots = NULL;
+
+    odbxuv_free_handle((odbxuv_handle_t *)&pool->credentials);
+
+    if(pool->keepaliveText != NULL)
+    {
+        free(pool->keepaliveText);
+        pool->keepaliveText = NULL;
+    }
+
+    if(pool->closeCallback)
+    {
+        pool->closeCallback(pool);
+    }
+}
+
+static void _pool_start_done(odbxuv_pool_t *pool, int status)
+{
+    if(pool->startPending == 0) return;
+
+    if(status == ODBX_ERR_SUCCESS || pool->startStatus == ODBXUV_ERR_NOCONNECTION)
+    {
+        pool->startStatus = status;
+    }
+
+    pool->startPending--;
+
+    if(pool->startPending == 0 && pool->startCallback)
+    {
+        pool->startCallback(pool, pool->startStatus);
+    }
+}
+
+static void _pool_on_slot_closed(odbxuv_handle_t *handle)
+{
+    odbxuv_pool_slot_t *slot = (odbxuv_pool_slot_t *)((odbxuv_connection_t *)handle)->data;
+    odbxuv_pool_t *pool = slot->pool;
+
+    odbxuv_free_error(handle);
+
+    slot->status = ODBXUV_POOL_SLOT_FREE;
+    pool->openCount--;
+
+    if(pool->closing)
+    {
+        _pool_check_closed(pool);
+    }
+    else
+    {
+        _pool_maintain(pool);
+    }
+}
+
+static void _pool_close_slot(odbxuv_pool_slot_t *slot)
+{
+    if(slot->status == ODBXUV_POOL_SLOT_READY)
+    {
+        slot->pool->readyCount--;
+    }
+
+    slot->status = ODBXUV_POOL_SLOT_CLOSING;
+    odbxuv_close((odbxuv_handle_t *)&slot->connection, _pool_on_slot_closed);
+}
+
+static void _pool_on_connect(odbxuv_op_connect_t *op, int status)
+{
+    odbxuv_pool_slot_t *slot = (odbxuv_pool_slot_t *)op->connection->data;
+    odbxuv_pool_t *pool = slot->pool;
+
+    odbxuv_free_error((odbxuv_handle_t *)op);
+    odbxuv_free_handle((odbxuv_handle_t *)op);
+    free(op);
+
+    if(status < ODBX_ERR_SUCCESS)
+    {
+        pool->failedAt = uv_now(pool->loop);
+        _pool_close_slot(slot);
+    }
+    else
+    {
+        slot->status = ODBXUV_POOL_SLOT_READY;
+        slot->lastUsed = uv_now(pool->loop);
+        pool->readyCount++;
+
+        if(pool->closing)
+        {
+            _pool_close_slot(slot);
+        }
+    }
+
+    _pool_start_done(pool, status);
+}
+
+/**
+ * Opens a new connection in a free slot.
+ */
+static void _pool_open_slot(odbxuv_pool_t *pool, odbxuv_pool_slot_t *slot)
+{
+    assert(slot->status == ODBXUV_POOL_SLOT_FREE);
+
+    odbxuv_init_connection(&slot->connection, pool->loop);
+    slot->connection.data = slot;
+    slot->connection.stats = pool->stats;
+    slot->connection.slowlog = pool->slowlog;
+    slot->connection.admission = pool->admission;
+    slot->pool = pool;
+    slot->status = ODBXUV_POOL_SLOT_CONNECTING;
+    slot->keepalive = NULL;
+    slot->checkedOut = 0;
+    pool->openCount++;
+
+    odbxuv_op_connect_t *op = malloc(sizeof(odbxuv_op_connect_t));
+    memset(op, 0, sizeof(odbxuv_op_connect_t));
+    op->host = pool->credentials.host;
+    op->port = pool->credentials.port;
+    op->backend = pool->credentials.backend;
+    op->database = pool->credentials.database;
+    op->user = pool->credentials.user;
+    op->password = pool->credentials.password;
+    op->method = pool->credentials.method;
+
+    odbxuv_connect(&slot->connection, op, _pool_on_connect);
+}
+
+static odbxuv_pool_slot_t *_pool_free_slot(odbxuv_pool_t *pool)
+{
+    unsigned int i;
+    for(i = 0; i < pool->maxConnections; i++)
+    {
+        if(pool->slots[i].status == ODBXUV_POOL_SLOT_FREE) return &pool->slots[i];
+    }
+
+    return NULL;
+}
+
+/**
+ * Opens connections until there are \p minConnections connections and \p minIdle idle ones.
+ */
+static void _pool_maintain(odbxuv_pool_t *pool)
+{
+    if(pool->closing) return;
+
+    //Don't hammer a database that just refused a connection
+    if(pool->failedAt && uv_now(pool->loop) - pool->failedAt < ODBXUV_POOL_MAINTAIN_INTERVAL) return;
+
+    unsigned int idle = 0;
+    unsigned int i;
+    for(i = 0; i < pool->maxConnections; i++)
+    {
+        odbxuv_pool_slot_t *slot = &pool->slots[i];
+
+        if(slot->status == ODBXUV_POOL_SLOT_CONNECTING
+            || (slot->status == ODBXUV_POOL_SLOT_READY && !slot->checkedOut && slot->keepalive == NULL && _pool_slot_load(slot) == 0))
+        {
+            idle++;
+        }
+    }
+
+    while(pool->openCount < pool->maxConnections && (pool->openCount < pool->minConnections || idle < pool->minIdle))
+    {
+        _pool_open_slot(pool, _pool_free_slot(pool));
+        idle++;
+    }
+}
+
+static void _pool_keepalive_row(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    if(row) return;
+
+    odbxuv_pool_slot_t *slot = (odbxuv_pool_slot_t *)op->data;
+
+    slot->keepalive = NULL;
+    odbxuv_op_query_release(op);
+
+    if(status < ODBX_ERR_SUCCESS || slot->pool->closing)
+    {
+        _pool_close_slot(slot);
+    }
+}
+
+static void _pool_keepalive_cb(odbxuv_op_query_t *op, int status)
+{
+    if(status < ODBX_ERR_SUCCESS)
+    {
+        odbxuv_pool_slot_t *slot = (odbxuv_pool_slot_t *)op->data;
+
+        //The connection is broken, replace it
+        slot->keepalive = NULL;
+        odbxuv_op_query_release(op);
+        _pool_close_slot(slot);
+        return;
+    }
+
+    odbxuv_query_process(op, _pool_keepalive_row);
+}
+
+static void _pool_timer_cb(uv_timer_t *handle)
+{
+    odbxuv_pool_t *pool = (odbxuv_pool_t *)handle->data;
+    uint64_t now = uv_now(pool->loop);
+
+    if(pool->keepaliveInterval > 0)
+    {
+        unsigned int i;
+        for(i = 0; i < pool->maxConnections; i++)
+        {
+            odbxuv_pool_slot_t *slot = &pool->slots[i];
+
+            if(slot->status != ODBXUV_POOL_SLOT_READY || slot->checkedOut || slot->keepalive != NULL) continue;
+            if(now - slot->lastUsed < pool->keepaliveInterval || _pool_slot_load(slot) > 0) continue;
+
+            slot->lastUsed = now;
+            slot->keepalive = odbxuv_op_query_acquire(&slot->connection);
+            slot->keepalive->data = slot;
+            odbxuv_query_recycled(&slot->connection, slot->keepalive, pool->keepaliveText, 0, NULL, _pool_keepalive_cb);
+        }
+    }
+
+    _pool_maintain(pool);
+}
+
+static void _pool_handle_closed(uv_handle_t *handle)
+{
+    odbxuv_pool_t *pool = (odbxuv_pool_t *)handle->data;
+
+    pool->closingHandles--;
+    _pool_check_closed(pool);
+}
+
+/**
+ * Hands a started query back to the loop that submitted it.
+ * Runs on the loop of the pool.
+ */
+static void _pool_remote_done(_odbxuv_pool_remote_t *remote, int status)
+{
+    odbxuv_pool_loop_t *poolLoop = remote->poolLoop;
+
+    remote->status = status;
+    remote->next = NULL;
+
+    uv_mutex_lock(&poolLoop->lock);
+    if(poolLoop->doneTail != NULL)
+    {
+        poolLoop->doneTail->next = remote;
+    }
+    else
+    {
+        poolLoop->done = remote;
+    }
+    poolLoop->doneTail = remote;
+    uv_mutex_unlock(&poolLoop->lock);
+
+    uv_async_send(&poolLoop->async);
+}
+
+static void _pool_remote_query_cb(odbxuv_op_query_t *op, int status)
+{
+    _pool_remote_done((_odbxuv_pool_remote_t *)op->remote, status);
+}
+
+/**
+ * Starts the queries other loops submitted.
+ * Runs on the loop of the pool.
+ */
+static void _pool_remote_cb(uv_async_t *handle)
+{
+    odbxuv_pool_t *pool = (odbxuv_pool_t *)handle->data;
+    _odbxuv_pool_remote_t *remote;
+
+    uv_mutex_lock(&pool->remoteLock);
+    remote = pool->remoteQueue;
+    pool->remoteQueue = NULL;
+    pool->remoteQueueTail = NULL;
+    uv_mutex_unlock(&pool->remoteLock);
+
+    while(remote)
+    {
+        _odbxuv_pool_remote_t *next = remote->next;
+        odbxuv_op_query_t *op = remote->operation;
+        int result = ODBXUV_ERR_NOCONNECTION;
+
+        if(!pool->closing)
+        {
+            result = odbxuv_pool_query(pool, op, remote->query, remote->flags, _pool_remote_query_cb);
+        }
+
+        if(result == ODBX_ERR_SUCCESS)
+        {
+            //Rows are delivered straight to the submitting loop
+            odbxuv_query_hand_over(op, remote->poolLoop->loop);
+            op->remote = remote;
+        }
+        else
+        {
+            _pool_remote_done(remote, result);
+        }
+
+        remote = next;
+    }
+}
+
+/**
+ * Runs the callbacks of started queries.
+ * Runs on the loop of the pool loop.
+ */
+static void _pool_loop_cb(uv_async_t *handle)
+{
+    odbxuv_pool_loop_t *poolLoop = (odbxuv_pool_loop_t *)handle->data;
+    _odbxuv_pool_remote_t *remote;
+
+    uv_mutex_lock(&poolLoop->lock);
+    remote = poolLoop->done;
+    poolLoop->done = NULL;
+    poolLoop->doneTail = NULL;
+    uv_mutex_unlock(&poolLoop->lock);
+
+    while(remote)
+    {
+        _odbxuv_pool_remote_t *next = remote->next;
+        odbxuv_op_query_t *op = remote->operation;
+        odbxuv_op_query_cb callback = remote->callback;
+        int status = remote->status;
+
+        free(remote);
+        op->remote = NULL;
+
+        if(--poolLoop->pending == 0)
+        {
+            uv_unref((uv_handle_t *)&poolLoop->async);
+        }
+
+        callback(op, status);
+
+        remote = next;
+    }
+}
+
+static void _pool_loop_closed(uv_handle_t *handle)
+{
+    odbxuv_pool_loop_t *poolLoop = (odbxuv_pool_loop_t *)handle->data;
+
+    uv_mutex_destroy(&poolLoop->lock);
+
+    if(poolLoop->closeCallback)
+    {
+        poolLoop->closeCallback(poolLoop);
+    }
+}
+
+/*
+ * API:
+ */
+
+int odbxuv_pool_init(odbxuv_pool_t *pool, uv_loop_t *loop, unsigned int maxConnections)
+{
+    assert(maxConnections > 0);
+
+    void *data = pool->data;
+    memset(pool, 0, sizeof(odbxuv_pool_t));
+    pool->data = data;
+
+    pool->loop = loop;
+    pool->minConnections = 1;
+    pool->maxConnections = maxConnections;
+    pool->credentials.type = ODBXUV_HANDLE_TYPE_OP_CONNECT;
+
+    pool->slots = malloc(sizeof(odbxuv_pool_slot_t) * maxConnections);
+    memset(pool->slots, 0, sizeof(odbxuv_pool_slot_t) * maxConnections);
+
+    pool->timer.data = pool;
+    uv_timer_init(loop, &pool->timer);
+
+    uv_mutex_init(&pool->remoteLock);
+    pool->remoteAsync.data = pool;
+    uv_async_init(loop, &pool->remoteAsync, _pool_remote_cb);
+    uv_unref((uv_handle_t *)&pool->remoteAsync); //The pool loops keep their own loop alive
+
+    return ODBX_ERR_SUCCESS;
+}
+
+int odbxuv_pool_start(odbxuv_pool_t *pool, odbxuv_op_connect_t *credentials, odbxuv_pool_cb callback)
+{
+    assert(pool->openCount == 0 && !pool->closing);
+
+    #define _copys(name) \
+        pool->credentials. name = _pool_copy_string(credentials-> name);
+        _copys(host);
+        _copys(port);
+        _copys(backend);
+        _copys(database);
+        _copys(user);
+        _copys(password);
+    #undef _copys
+    pool->credentials.method = credentials->method;
+
+    pool->keepaliveText = _pool_copy_string(pool->keepaliveQuery ? pool->keepaliveQuery : "SELECT 1");
+
+    if(pool->minConnections > pool->maxConnections)
+    {
+        pool->minConnections = pool->maxConnections;
+    }
+
+    pool->startCallback = callback;
+    pool->startStatus = ODBXUV_ERR_NOCONNECTION;
+    pool->startPending = pool->minConnections;
+
+    //Every connection runs on its own worker, so they all connect at the same time
+    unsigned int i;
+    for(i = 0; i < pool->minConnections; i++)
+    {
+        _pool_open_slot(pool, &pool->slots[i]);
+    }
+
+    {
+        uint64_t interval = pool->keepaliveInterval > 0 && pool->keepaliveInterval < ODBXUV_POOL_MAINTAIN_INTERVAL ? pool->keepaliveInterval : ODBXUV_POOL_MAINTAIN_INTERVAL;
+        uv_timer_start(&pool->timer, _pool_timer_cb, interval, interval);
+        uv_unref((uv_handle_t *)&pool->timer); //The connections keep the loop alive
+    }
+
+    if(pool->startPending == 0 && callback)
+    {
+        callback(pool, ODBX_ERR_SUCCESS);
+    }
+
+    return ODBX_ERR_SUCCESS;
+}
+
+/**
+ * Finds the connected slot with the least pending operations that is not checked out.
+ */
+static odbxuv_pool_slot_t *_pool_least_loaded(odbxuv_pool_t *pool)
+{
+    odbxuv_pool_slot_t *best = NULL;
+    unsigned int bestLoad = 0;
+
+    unsigned int i;
+    for(i = 0; i < pool->maxConnections; i++)
+    {
+        odbxuv_pool_slot_t *slot = &pool->slots[i];
+
+        if(slot->status != ODBXUV_POOL_SLOT_READY || slot->checkedOut) continue;
+
+        unsigned int load = _pool_slot_load(slot) + (slot->keepalive ? 1 : 0);
+
+        if(best == NULL || load < bestLoad)
+        {
+            best = slot;
+            bestLoad = load;
+
+            if(load == 0) break;
+        }
+    }
+
+    if(best != NULL)
+    {
+        best->lastUsed = uv_now(pool->loop);
+    }
+
+    return best;
+}
+
+odbxuv_connection_t *odbxuv_pool_get(odbxuv_pool_t *pool)
+{
+    odbxuv_pool_slot_t *slot = _pool_least_loaded(pool);
+
+    return slot != NULL ? &slot->connection : NULL;
+}
+
+odbxuv_connection_t *odbxuv_pool_checkout(odbxuv_pool_t *pool)
+{
+    odbxuv_pool_slot_t *slot = _pool_least_loaded(pool);
+
+    if(slot == NULL) return NULL;
+
+    slot->checkedOut = 1;
+
+    //The slot no longer counts as idle
+    _pool_maintain(pool);
+
+    return &slot->connection;
+}
+
+void odbxuv_pool_return(odbxuv_pool_t *pool, odbxuv_connection_t *connection)
+{
+    odbxuv_pool_slot_t *slot = (odbxuv_pool_slot_t *)connection->data;
+
+    assert(slot->pool == pool && slot->checkedOut && "Connection was not checked out of this pool");
+
+    slot->checkedOut = 0;
+    slot->lastUsed = uv_now(pool->loop);
+
+    if(pool->closing || odbxuv_connection_get_status(connection) == ODBXUV_CON_STATUS_FAILED)
+    {
+        _pool_close_slot(slot);
+    }
+}
+
+uint64_t odbxuv_pool_latency(odbxuv_pool_t *pool)
+{
+    uint64_t best = UINT64_MAX;
+
+    unsigned int i;
+    for(i = 0; i < pool->maxConnections; i++)
+    {
+        odbxuv_pool_slot_t *slot = &pool->slots[i];
+        odbxuv_connection_counters_t counters;
+
+        if(slot->status != ODBXUV_POOL_SLOT_READY || slot->checkedOut) continue;
+
+        odbxuv_connection_counters(&slot->connection, &counters);
+
+        uint64_t latency = counters.queryLatency * (_pool_slot_load(slot) + 1);
+
+        if(latency < best) best = latency;
+    }
+
+    return best;
+}
+
+int odbxuv_pool_query(odbxuv_pool_t *pool, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, odbxuv_op_query_cb callback)
+{
+    return odbxuv_pool_query_ex(pool, operation, query, flags, NULL, callback);
+}
+
+/**
+ * Finds the connection running a query a shared query would be attached to.
+ */
+static odbxuv_connection_t *_pool_find_shared(odbxuv_pool_t *pool, const char *query, odbxuv_query_fetch_e flags)
+{
+    unsigned int i;
+    for(i = 0; i < pool->maxConnections; i++)
+    {
+        odbxuv_pool_slot_t *slot = &pool->slots[i];
+
+        if(slot->status == ODBXUV_POOL_SLOT_READY && !slot->checkedOut && odbxuv_connection_shares(&slot->connection, query, flags))
+        {
+            slot->lastUsed = uv_now(pool->loop);
+            return &slot->connection;
+        }
+    }
+
+    return NULL;
+}
+
+int odbxuv_pool_query_ex(odbxuv_pool_t *pool, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, const odbxuv_query_config_t *config, odbxuv_op_query_cb callback)
+{
+    odbxuv_connection_t *connection = NULL;
+
+    //Identical shared queries meet on the connection already running one
+    if(config != NULL && config->options & ODBXUV_QUERY_SHARED)
+    {
+        connection = _pool_find_shared(pool, query, flags);
+    }
+
+    if(connection == NULL)
+    {
+        connection = odbxuv_pool_get(pool);
+    }
+
+    if(connection == NULL) return ODBXUV_ERR_NOCONNECTION;
+
+    int result = odbxuv_query_ex(connection, operation, query, flags, config, callback);
+
+    //Keep enough idle connections around for the next query
+    _pool_maintain(pool);
+
+    return result;
+}
+
+void odbxuv_pool_close(odbxuv_pool_t *pool, odbxuv_pool_close_cb callback)
+{
+    assert(!pool->closing && "Pool is already closing");
+
+    uv_mutex_lock(&pool->remoteLock);
+    assert(pool->loopCount == 0 && "Close all pool loops before closing the pool");
+    uv_mutex_unlock(&pool->remoteLock);
+
+    pool->closing = 1;
+    pool->closeCallback = callback;
+    pool->closingHandles = 2;
+
+    uv_timer_stop(&pool->timer);
+    uv_close((uv_handle_t *)&pool->timer, _pool_handle_closed);
+    uv_close((uv_handle_t *)&pool->remoteAsync, _pool_handle_closed);
+
+    unsigned int i;
+    for(i = 0; i < pool->maxConnections; i++)
+    {
+        odbxuv_pool_slot_t *slot = &pool->slots[i];
+
+        //Connecting slots, slots running a keepalive and checked out slots are closed once they report back
+        if(slot->status == ODBXUV_POOL_SLOT_READY && slot->keepalive == NULL && !slot->checkedOut)
+        {
+            _pool_close_slot(slot);
+        }
+    }
+}
+
+int odbxuv_pool_loop_init(odbxuv_pool_loop_t *poolLoop, odbxuv_pool_t *pool, uv_loop_t *loop)
+{
+    void *data = poolLoop->data;
+    memset(poolLoop, 0, sizeof(odbxuv_pool_loop_t));
+    poolLoop->data = data;
+
+    poolLoop->pool = pool;
+    poolLoop->loop = loop;
+
+    uv_mutex_init(&poolLoop->lock);
+    poolLoop->async.data = poolLoop;
+    uv_async_init(loop, &poolLoop->async, _pool_loop_cb);
+    uv_unref((uv_handle_t *)&poolLoop->async); //Referenced while queries are pending
+
+    uv_mutex_lock(&pool->remoteLock);
+    pool->loopCount++;
+    uv_mutex_unlock(&pool->remoteLock);
+
+    return ODBX_ERR_SUCCESS;
+}
+
+int odbxuv_pool_loop_query(odbxuv_pool_loop_t *poolLoop, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, odbxuv_op_query_cb callback)
+{
+    odbxuv_pool_t *pool = poolLoop->pool;
+    size_t queryLength = strlen(query) + 1;
+
+    assert(!operation->persistentAsync && "Acquired operations belong to the loop of their connection");
+
+    _odbxuv_pool_remote_t *remote = malloc(sizeof(_odbxuv_pool_remote_t) + queryLength);
+    remote->next = NULL;
+    remote->poolLoop = poolLoop;
+    remote->operation = operation;
+    remote->flags = flags;
+    remote->callback = callback;
+    remote->status = ODBX_ERR_SUCCESS;
+    memcpy(remote->query, query, queryLength);
+
+    if(poolLoop->pending++ == 0)
+    {
+        uv_ref((uv_handle_t *)&poolLoop->async);
+    }
+
+    uv_mutex_lock(&pool->remoteLock);
+    if(pool->remoteQueueTail != NULL)
+    {
+        pool->remoteQueueTail->next = remote;
+    }
+    else
+    {
+        pool->remoteQueue = remote;
+    }
+    pool->remoteQueueTail = remote;
+    uv_mutex_unlock(&pool->remoteLock);
+
+    uv_async_send(&pool->remoteAsync);
+
+    return ODBX_ERR_SUCCESS;
+}
+
+void odbxuv_pool_loop_close(odbxuv_pool_loop_t *poolLoop, odbxuv_pool_loop_close_cb callback)
+{
+    odbxuv_pool_t *pool = poolLoop->pool;
+
+    assert(poolLoop->pending == 0 && "Pool loop has pending queries");
+
+    uv_mutex_lock(&pool->remoteLock);
+    pool->loopCount--;
+    uv_mutex_unlock(&pool->remoteLock);
+
+    poolLoop->closeCallback = callback;
+    uv_close((uv_handle_t *)&poolLoop->async, _pool_loop_closed);
+}
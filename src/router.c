@@ -0,0 +1,227 @@
+#include "odbxuv/router.h"
+#include <assert.h>
+#include <string.h>
+#include <malloc.h>
+
+odbxuv_router_statement_e odbxuv_router_classify(const char *query)
+{
+    return odbxuv_query_classify(query);
+}
+
+/**
+ * Picks the replica to send a read to or \p NULL when no replica is connected.
+ */
+static odbxuv_pool_t *_router_pick_replica(odbxuv_router_t *router)
+{
+    odbxuv_pool_t *best = NULL;
+    uint64_t bestLatency = UINT64_MAX;
+
+    unsigned int i;
+    for(i = 0; i < router->replicaCount; i++)
+    {
+        //Start at a different replica every time so equal replicas share the load
+        unsigned int index = (router->nextReplica + i) % router->replicaCount;
+        odbxuv_pool_t *replica = router->replicas[index];
+
+        if(replica->readyCount == 0) continue;
+
+        if(router->balance == ODBXUV_ROUTER_ROUND_ROBIN)
+        {
+            best = replica;
+            break;
+        }
+
+        uint64_t latency = odbxuv_pool_latency(replica);
+
+        if(best == NULL || latency < bestLatency)
+        {
+            best = replica;
+            bestLatency = latency;
+        }
+    }
+
+    router->nextReplica = router->replicaCount ? (router->nextReplica + 1) % router->replicaCount : 0;
+
+    return best;
+}
+
+static void _router_pin(odbxuv_router_t *router)
+{
+    if(router->pinInterval > 0)
+    {
+        router->pinnedUntil = uv_now(router->loop) + router->pinInterval;
+    }
+}
+
+/**
+ * Puts the connection of the transaction back into the primary.
+ */
+static void _router_release_transaction(odbxuv_router_t *router)
+{
+    odbxuv_pool_return(router->primary, router->transaction);
+    router->transaction = NULL;
+}
+
+/**
+ * Whether the connection of the transaction is still in the session the transaction started in.
+ */
+static unsigned char _router_transaction_alive(odbxuv_router_t *router)
+{
+    odbxuv_connection_counters_t counters;
+
+    if(odbxuv_connection_get_status(router->transaction) != ODBXUV_CON_STATUS_CONNECTED) return 0;
+
+    odbxuv_connection_counters(router->transaction, &counters);
+
+    return counters.sessions == router->transactionSession;
+}
+
+/**
+ * Runs a statement of the transaction, it fails instead of running after a reconnect.
+ */
+static int _router_transaction_query(odbxuv_router_t *router, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, const odbxuv_query_config_t *config, odbxuv_op_query_cb callback)
+{
+    odbxuv_query_config_t sessionConfig;
+
+    if(config != NULL)
+    {
+        sessionConfig = *config;
+    }
+    else
+    {
+        memset(&sessionConfig, 0, sizeof(odbxuv_query_config_t));
+    }
+
+    sessionConfig.session = router->transactionSession;
+
+    return odbxuv_query_ex(router->transaction, operation, query, flags, &sessionConfig, callback);
+}
+
+/*
+ * API:
+ */
+
+int odbxuv_router_init(odbxuv_router_t *router, odbxuv_pool_t *primary, odbxuv_pool_t **replicas, unsigned int replicaCount)
+{
+    void *data = router->data;
+    memset(router, 0, sizeof(odbxuv_router_t));
+    router->data = data;
+
+    router->loop = primary->loop;
+    router->primary = primary;
+    router->replicaCount = replicaCount;
+
+    if(replicaCount > 0)
+    {
+        unsigned int i;
+        for(i = 0; i < replicaCount; i++)
+        {
+            assert(replicas[i]->loop == primary->loop && "Replicas must run on the loop of the primary");
+        }
+
+        router->replicas = malloc(sizeof(odbxuv_pool_t *) * replicaCount);
+        memcpy(router->replicas, replicas, sizeof(odbxuv_pool_t *) * replicaCount);
+    }
+
+    return ODBX_ERR_SUCCESS;
+}
+
+int odbxuv_router_query(odbxuv_router_t *router, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, odbxuv_op_query_cb callback)
+{
+    return odbxuv_router_query_ex(router, operation, query, flags, NULL, callback);
+}
+
+int odbxuv_router_query_ex(odbxuv_router_t *router, odbxuv_op_query_t *operation, const char *query, odbxuv_query_fetch_e flags, const odbxuv_query_config_t *config, odbxuv_op_query_cb callback)
+{
+    odbxuv_router_statement_e statement = odbxuv_router_classify(query);
+
+    if(router->transaction != NULL || router->transactionLost)
+    {
+        int result = ODBXUV_ERR_NOCONNECTION;
+
+        //Statements of a lost transaction fail until it ends, they must not run in a new session
+        if(router->transaction != NULL && !_router_transaction_alive(router))
+        {
+            _router_release_transaction(router);
+            router->transactionLost = 1;
+        }
+
+        if(router->transaction != NULL)
+        {
+            result = _router_transaction_query(router, operation, query, flags, config, callback);
+        }
+
+        //A rejected COMMIT leaves the transaction open
+        if((result == ODBX_ERR_SUCCESS || router->transactionLost) && statement == ODBXUV_STATEMENT_END)
+        {
+            if(router->transaction != NULL)
+            {
+                _router_release_transaction(router);
+            }
+
+            router->transactionLost = 0;
+            _router_pin(router);
+        }
+
+        return result;
+    }
+
+    if(statement == ODBXUV_STATEMENT_BEGIN)
+    {
+        odbxuv_connection_t *connection = odbxuv_pool_checkout(router->primary);
+        odbxuv_connection_counters_t counters;
+        int result;
+
+        if(connection == NULL) return ODBXUV_ERR_NOCONNECTION;
+
+        odbxuv_connection_counters(connection, &counters);
+        router->transaction = connection;
+        router->transactionSession = counters.sessions;
+
+        result = _router_transaction_query(router, operation, query, flags, config, callback);
+
+        //A rejected BEGIN did not start a transaction
+        if(result != ODBX_ERR_SUCCESS)
+        {
+            _router_release_transaction(router);
+        }
+
+        return result;
+    }
+
+    if(statement == ODBXUV_STATEMENT_READ
+        && !(config != NULL && config->options & ODBXUV_QUERY_PRIMARY)
+        && uv_now(router->loop) >= router->pinnedUntil)
+    {
+        odbxuv_pool_t *replica = _router_pick_replica(router);
+
+        if(replica != NULL && odbxuv_pool_query_ex(replica, operation, query, flags, config, callback) == ODBX_ERR_SUCCESS)
+        {
+            return ODBX_ERR_SUCCESS;
+        }
+    }
+
+    if(statement != ODBXUV_STATEMENT_READ)
+    {
+        _router_pin(router);
+    }
+
+    return odbxuv_pool_query_ex(router->primary, operation, query, flags, config, callback);
+}
+
+void odbxuv_router_free(odbxuv_router_t *router)
+{
+    if(router->transaction != NULL)
+    {
+        _router_release_transaction(router);
+    }
+
+
+    if(router->replicas != NULL)
+    {
+        free(router->replicas);
+        router->replicas = NULL;
+    }
+
+    router->replicaCount = 0;
+}
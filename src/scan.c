@@ -0,0 +1,421 @@
+#include "odbxuv/scan.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+static char *_scan_copy_string(const char *string)
+{
+    if(string == NULL) return NULL;
+
+    char *copy = malloc(strlen(string) + 1);
+    strcpy(copy, string);
+    return copy;
+}
+
+static int64_t _scan_row_key(odbxuv_scan_t *scan, odbxuv_row_t *row)
+{
+    const char *value = row->value != NULL ? row->value[scan->keyColumn] : NULL;
+
+    return value != NULL ? strtoll(value, NULL, 10) : INT64_MIN;
+}
+
+/**
+ * Orders the heap by key and by partition for equal keys
+ */
+static int _scan_before(odbxuv_scan_partition_t *a, odbxuv_scan_partition_t *b)
+{
+    return a->headKey < b->headKey || (a->headKey == b->headKey && a < b);
+}
+
+static void _scan_heap_up(odbxuv_scan_t *scan, unsigned int i)
+{
+    odbxuv_scan_partition_t **heap = scan->heap;
+
+    while(i > 0)
+    {
+        unsigned int parent = (i - 1) / 2;
+
+        if(!_scan_before(heap[i], heap[parent])) break;
+
+        odbxuv_scan_partition_t *swap = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = swap;
+        i = parent;
+    }
+}
+
+static void _scan_heap_down(odbxuv_scan_t *scan, unsigned int i)
+{
+    odbxuv_scan_partition_t **heap = scan->heap;
+
+    for(;;)
+    {
+        unsigned int smallest = i;
+        unsigned int left = 2 * i + 1;
+        unsigned int right = left + 1;
+
+        if(left < scan->heapCount && _scan_before(heap[left], heap[smallest])) smallest = left;
+        if(right < scan->heapCount && _scan_before(heap[right], heap[smallest])) smallest = right;
+
+        if(smallest == i) break;
+
+        odbxuv_scan_partition_t *swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+/**
+ * Hands the held batch of a partition back and lets it deliver the next one.
+ */
+static void _scan_resume(odbxuv_scan_partition_t *partition)
+{
+    partition->head = NULL;
+    partition->held = 0;
+    partition->scan->waiting++;
+
+    //A batch that is still being delivered is not held at all
+    if(!partition->delivering)
+    {
+        odbxuv_query_resume(partition->op);
+    }
+}
+
+/**
+ * Hands back the batches of all partitions once the scan stopped.
+ */
+static void _scan_drop(odbxuv_scan_t *scan)
+{
+    while(scan->heapCount > 0)
+    {
+        _scan_resume(scan->heap[--scan->heapCount]);
+    }
+}
+
+static void _scan_check_finished(odbxuv_scan_t *scan)
+{
+    if(scan->running > 0 || scan->callback == NULL) return;
+
+    odbxuv_scan_cb callback = scan->callback;
+    scan->callback = NULL;
+    callback(scan, NULL, NULL, 0, scan->status);
+}
+
+/**
+ * Delivers rows in key order while every running partition holds a batch.
+ * The partition with the lowest key hands over all rows up to the lowest key of the others at once.
+ */
+static void _scan_merge(odbxuv_scan_t *scan)
+{
+    if(scan->merging) return;
+
+    scan->merging = 1;
+
+    while(scan->waiting == 0 && scan->heapCount > 0 && !scan->stopping)
+    {
+        odbxuv_scan_partition_t *partition = scan->heap[0];
+        int64_t limit = INT64_MAX;
+
+        if(scan->heapCount > 1) limit = scan->heap[1]->headKey;
+        if(scan->heapCount > 2 && scan->heap[2]->headKey < limit) limit = scan->heap[2]->headKey;
+
+        odbxuv_row_t *first = partition->head;
+        odbxuv_row_t *last = first;
+        unsigned int count = 1;
+        int64_t key = 0;
+
+        while(last->next != NULL && (key = _scan_row_key(scan, last->next)) <= limit)
+        {
+            last = last->next;
+            count++;
+        }
+
+        //Cut the run for the callback, the held batch stays linked for the operation
+        odbxuv_row_t *rest = last->next;
+        last->next = NULL;
+
+        scan->rowCount += count;
+        scan->callback(scan, partition->op, first, count, 0);
+
+        last->next = rest;
+
+        if(scan->stopping) break;
+
+        if(rest == NULL)
+        {
+            scan->heap[0] = scan->heap[--scan->heapCount];
+            _scan_heap_down(scan, 0);
+            _scan_resume(partition);
+        }
+        else
+        {
+            partition->head = rest;
+            partition->headKey = key;
+            _scan_heap_down(scan, 0);
+        }
+    }
+
+    scan->merging = 0;
+
+    if(scan->stopping)
+    {
+        _scan_drop(scan);
+    }
+}
+
+static odbxuv_batch_result_e _scan_partition_rows(odbxuv_op_query_t *op, odbxuv_row_t *rows, unsigned int count, int status)
+{
+    odbxuv_scan_partition_t *partition = (odbxuv_scan_partition_t *)op->data;
+    odbxuv_scan_t *scan = partition->scan;
+
+    if(rows != NULL)
+    {
+        if(scan->stopping)
+        {
+            return ODBXUV_BATCH_DONE;
+        }
+
+        if(scan->order == ODBXUV_SCAN_UNORDERED)
+        {
+            scan->rowCount += count;
+            scan->callback(scan, op, rows, count, 0);
+            return ODBXUV_BATCH_DONE;
+        }
+
+        partition->head = rows;
+        partition->headKey = _scan_row_key(scan, rows);
+        partition->held = 1;
+        scan->waiting--;
+        scan->heap[scan->heapCount++] = partition;
+        _scan_heap_up(scan, scan->heapCount - 1);
+
+        partition->delivering = 1;
+        _scan_merge(scan);
+        partition->delivering = 0;
+
+        return partition->held ? ODBXUV_BATCH_HOLD : ODBXUV_BATCH_DONE;
+    }
+
+    if(status < 0)
+    {
+        if(scan->status == 0) scan->status = status;
+        odbxuv_scan_stop(scan);
+    }
+
+    if(scan->order == ODBXUV_SCAN_MERGED)
+    {
+        scan->waiting--;
+    }
+
+    partition->op = NULL;
+    scan->running--;
+    odbxuv_op_query_release(op);
+
+    if(scan->order == ODBXUV_SCAN_MERGED)
+    {
+        _scan_merge(scan);
+    }
+
+    _scan_check_finished(scan);
+
+    return ODBXUV_BATCH_DONE;
+}
+
+static void _scan_partition_queried(odbxuv_op_query_t *op, int status)
+{
+    if(status >= 0)
+    {
+        odbxuv_query_process_batch(op, _scan_partition_rows);
+        return;
+    }
+
+    _scan_partition_rows(op, NULL, 0, op->error ? op->error->error : status);
+}
+
+/**
+ * Queries a partition on \p connection, a partition that is not queued is not running.
+ */
+static int _scan_query_partition(odbxuv_scan_t *scan, unsigned int index, odbxuv_connection_t *connection)
+{
+    odbxuv_scan_partition_t *partition = &scan->partitions[index];
+    const char *order = scan->order == ODBXUV_SCAN_MERGED ? " ORDER BY " : "";
+    const char *orderKey = scan->order == ODBXUV_SCAN_MERGED ? scan->key : "";
+    size_t length = strlen(scan->select) + strlen(scan->key) * 3 + (scan->where ? strlen(scan->where) : 0) + 128;
+    char *query = malloc(length);
+    int written;
+
+    if(scan->partitionBy == ODBXUV_SCAN_RANGE)
+    {
+        uint64_t span = (uint64_t)(scan->max - scan->min);
+        int64_t low = scan->min + (int64_t)(span / scan->partitionCount * index + span % scan->partitionCount * index / scan->partitionCount);
+        int64_t high = scan->min + (int64_t)(span / scan->partitionCount * (index + 1) + span % scan->partitionCount * (index + 1) / scan->partitionCount);
+
+        written = snprintf(query, length, "%s WHERE %s%s%s%s >= %lld AND %s < %lld", scan->select,
+            scan->where ? "(" : "", scan->where ? scan->where : "", scan->where ? ") AND " : "",
+            scan->key, (long long)low, scan->key, (long long)high);
+    }
+    else
+    {
+        written = snprintf(query, length, "%s WHERE %s%s%sMOD(%s, %u) = %u", scan->select,
+            scan->where ? "(" : "", scan->where ? scan->where : "", scan->where ? ") AND " : "",
+            scan->key, scan->partitionCount, index);
+    }
+
+    snprintf(query + written, length - written, "%s%s", order, orderKey);
+
+    partition->scan = scan;
+    partition->op = odbxuv_op_query_acquire(connection);
+    partition->op->data = partition;
+    partition->head = NULL;
+    partition->held = 0;
+    partition->delivering = 0;
+
+    int result = odbxuv_query_recycled(connection, partition->op, query, scan->flags | ODBXUV_QUERY_FETCH_VALUE, &scan->config, _scan_partition_queried);
+
+    free(query);
+
+    if(result < ODBX_ERR_SUCCESS)
+    {
+        odbxuv_op_query_release(partition->op);
+        partition->op = NULL;
+        return result;
+    }
+
+    scan->running++;
+    if(scan->order == ODBXUV_SCAN_MERGED) scan->waiting++;
+
+    return ODBX_ERR_SUCCESS;
+}
+
+/**
+ * Picks a connection per partition of a merged scan.
+ * A held batch waits for the other partitions, so two partitions on one connection
+ * would wait for each other. Returns the amount of connections found.
+ */
+static unsigned int _scan_merged_connections(odbxuv_scan_t *scan, odbxuv_connection_t **connections)
+{
+    odbxuv_pool_t *pool = scan->pool;
+    unsigned int count = 0;
+    unsigned int i;
+
+    for(i = 0; i < pool->maxConnections && count < scan->partitionCount; i++)
+    {
+        if(pool->slots[i].status != ODBXUV_POOL_SLOT_READY || pool->slots[i].checkedOut) continue;
+
+        connections[count++] = &pool->slots[i].connection;
+    }
+
+    return count;
+}
+
+/*
+ * API:
+ */
+
+int odbxuv_scan_init(odbxuv_scan_t *scan, odbxuv_pool_t *pool, const char *select, const char *where, const char *key, unsigned int partitions)
+{
+    assert(partitions > 0 && "A scan needs at least one partition");
+
+    void *data = scan->data;
+    memset(scan, 0, sizeof(odbxuv_scan_t));
+    scan->data = data;
+
+    scan->pool = pool;
+    scan->partitionCount = partitions;
+    scan->flags = ODBXUV_QUERY_FETCH_VALUE;
+    scan->select = _scan_copy_string(select);
+    scan->where = _scan_copy_string(where);
+    scan->key = _scan_copy_string(key);
+    scan->partitions = malloc(sizeof(odbxuv_scan_partition_t) * partitions);
+    scan->heap = malloc(sizeof(odbxuv_scan_partition_t *) * partitions);
+    memset(scan->partitions, 0, sizeof(odbxuv_scan_partition_t) * partitions);
+
+    return 0;
+}
+
+int odbxuv_scan_start(odbxuv_scan_t *scan, odbxuv_scan_cb onRows)
+{
+    odbxuv_connection_t **connections = NULL;
+    int result = ODBX_ERR_SUCCESS;
+    unsigned int i;
+
+    assert(scan->running == 0 && scan->callback == NULL && "The scan is already running");
+    assert((scan->partitionBy != ODBXUV_SCAN_RANGE || scan->max > scan->min) && "The range of the scan is empty");
+
+    if(odbxuv_pool_get(scan->pool) == NULL)
+    {
+        return ODBXUV_ERR_NOCONNECTION;
+    }
+
+    if(scan->order == ODBXUV_SCAN_MERGED)
+    {
+        connections = malloc(sizeof(odbxuv_connection_t *) * scan->partitionCount);
+
+        if(_scan_merged_connections(scan, connections) < scan->partitionCount)
+        {
+            free(connections);
+            return ODBXUV_ERR_NOCONNECTION;
+        }
+    }
+
+    scan->callback = onRows;
+    scan->rowCount = 0;
+    scan->heapCount = 0;
+    scan->stopping = 0;
+    scan->status = 0;
+    scan->running = 0;
+    scan->waiting = 0;
+
+    for(i = 0; i < scan->partitionCount; i++)
+    {
+        result = _scan_query_partition(scan, i, connections != NULL ? connections[i] : odbxuv_pool_get(scan->pool));
+
+        if(result < ODBX_ERR_SUCCESS)
+        {
+            //The rows of the queued partitions are dropped, the callback reports the error
+            scan->status = result;
+            odbxuv_scan_stop(scan);
+            break;
+        }
+    }
+
+    free(connections);
+
+    if(scan->running == 0)
+    {
+        scan->callback = NULL;
+        return result;
+    }
+
+    return ODBX_ERR_SUCCESS;
+}
+
+void odbxuv_scan_stop(odbxuv_scan_t *scan)
+{
+    scan->stopping = 1;
+
+    if(!scan->merging)
+    {
+        _scan_drop(scan);
+    }
+}
+
+void odbxuv_scan_free(odbxuv_scan_t *scan)
+{
+    assert(scan->running == 0 && "Can't free a running scan");
+
+    free(scan->select);
+    free(scan->where);
+    free(scan->key);
+    free(scan->partitions);
+    free(scan->heap);
+
+    scan->select = NULL;
+    scan->where = NULL;
+    scan->key = NULL;
+    scan->partitions = NULL;
+    scan->heap = NULL;
+}
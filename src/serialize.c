@@ -0,0 +1,291 @@
+#include "odbxuv/serialize.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+/**
+ * The longest varint, enough for 64 bits
+ * \internal
+ */
+#define ODBXUV_VARINT_SIZE 10
+
+static size_t _varint_size(uint64_t value)
+{
+    size_t size = 1;
+
+    while(value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+
+    return size;
+}
+
+static unsigned char *_varint_put(unsigned char *out, uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        *out++ = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+
+    *out++ = (unsigned char)value;
+
+    return out;
+}
+
+/**
+ * Reads a varint, returns 0 when it is cut off or too long.
+ */
+static int _varint_get(odbxuv_serial_reader_t *reader, uint64_t *value)
+{
+    uint64_t result = 0;
+    unsigned int shift = 0;
+
+    while(reader->pos < reader->end && shift < ODBXUV_VARINT_SIZE * 7)
+    {
+        unsigned char byte = *reader->pos++;
+
+        result |= (uint64_t)(byte & 0x7F) << shift;
+
+        if(!(byte & 0x80))
+        {
+            *value = result;
+            return 1;
+        }
+
+        shift += 7;
+    }
+
+    return 0;
+}
+
+/*
+ * API:
+ */
+
+int odbxuv_serializer_init(odbxuv_serializer_t *serializer, uv_buf_t *buffers, unsigned int count)
+{
+    assert(count > 0 && "A serializer needs at least one buffer");
+
+    void *data = serializer->data;
+    memset(serializer, 0, sizeof(odbxuv_serializer_t));
+    serializer->data = data;
+
+    serializer->buffers = buffers;
+    serializer->bufferCount = count;
+    serializer->lengths = malloc(sizeof(size_t) * count);
+    serializer->free = malloc(sizeof(unsigned int) * count);
+    serializer->filled = malloc(sizeof(unsigned int) * count);
+    serializer->current = count;
+
+    uv_cond_init(&serializer->available);
+
+    return 0;
+}
+
+void odbxuv_serializer_free(odbxuv_serializer_t *serializer)
+{
+    free(serializer->lengths);
+    free(serializer->free);
+    free(serializer->filled);
+    free(serializer->values);
+    free(serializer->valueLengths);
+    uv_cond_destroy(&serializer->available);
+
+    serializer->lengths = NULL;
+    serializer->free = NULL;
+    serializer->filled = NULL;
+    serializer->values = NULL;
+    serializer->valueLengths = NULL;
+}
+
+size_t odbxuv_serialize_header(unsigned int columnCount, const odbxuv_column_info_t *columns, char *buffer, size_t size)
+{
+    size_t needed = 4 + _varint_size(columnCount);
+    unsigned int i;
+
+    for(i = 0; i < columnCount; i++)
+    {
+        size_t nameLength = columns != NULL && columns[i].name != NULL ? strlen(columns[i].name) : 0;
+        int type = columns != NULL ? columns[i].type : ODBX_TYPE_UNKNOWN;
+
+        needed += _varint_size((unsigned int)type) + _varint_size(nameLength) + nameLength;
+    }
+
+    if(needed > size) return 0;
+
+    unsigned char *out = (unsigned char *)buffer;
+
+    *out++ = 'O';
+    *out++ = 'X';
+    *out++ = 'B';
+    *out++ = ODBXUV_SERIAL_VERSION;
+    out = _varint_put(out, columnCount);
+
+    for(i = 0; i < columnCount; i++)
+    {
+        size_t nameLength = columns != NULL && columns[i].name != NULL ? strlen(columns[i].name) : 0;
+        int type = columns != NULL ? columns[i].type : ODBX_TYPE_UNKNOWN;
+
+        out = _varint_put(out, (unsigned int)type);
+        out = _varint_put(out, nameLength);
+
+        if(nameLength > 0)
+        {
+            memcpy(out, columns[i].name, nameLength);
+            out += nameLength;
+        }
+    }
+
+    return needed;
+}
+
+size_t odbxuv_serialize_values(unsigned int columnCount, const char **values, const unsigned long *lengths, char *buffer, size_t size)
+{
+    size_t bitmapSize = (columnCount + 7) / 8;
+    size_t needed = bitmapSize;
+    unsigned int i;
+
+    if(needed > size) return 0;
+
+    unsigned char *out = (unsigned char *)buffer + bitmapSize;
+    memset(buffer, 0, bitmapSize);
+
+    for(i = 0; i < columnCount; i++)
+    {
+        if(values[i] == NULL)
+        {
+            ((unsigned char *)buffer)[i / 8] |= 1 << (i % 8);
+            continue;
+        }
+
+        size_t length = lengths != NULL ? lengths[i] : strlen(values[i]);
+
+        needed += _varint_size(length) + length;
+        if(needed > size) return 0;
+
+        out = _varint_put(out, length);
+        memcpy(out, values[i], length);
+        out += length;
+    }
+
+    return needed;
+}
+
+size_t odbxuv_serialize_row(unsigned int columnCount, const odbxuv_row_t *row, char *buffer, size_t size)
+{
+    if(row->value != NULL)
+    {
+        return odbxuv_serialize_values(columnCount, (const char **)row->value, NULL, buffer, size);
+    }
+
+    //Values were not fetched, all NULL
+    size_t bitmapSize = (columnCount + 7) / 8;
+
+    if(bitmapSize > size) return 0;
+
+    memset(buffer, 0xFF, bitmapSize);
+
+    return bitmapSize;
+}
+
+int odbxuv_serial_reader_init(odbxuv_serial_reader_t *reader, const char *buffer, size_t length, unsigned int columnCount)
+{
+    memset(reader, 0, sizeof(odbxuv_serial_reader_t));
+    reader->pos = (const unsigned char *)buffer;
+    reader->end = reader->pos + length;
+    reader->columnCount = columnCount;
+
+    if(columnCount != 0) return 0;
+
+    uint64_t count;
+
+    if(length < 4 || memcmp(buffer, "OXB", 3) != 0 || buffer[3] != ODBXUV_SERIAL_VERSION) return -1;
+
+    reader->pos += 4;
+
+    if(!_varint_get(reader, &count) || count > 0xFFFF) return -1;
+
+    reader->columnCount = (unsigned int)count;
+    reader->headerColumns = (unsigned int)count;
+
+    return 0;
+}
+
+int odbxuv_serial_read_column(odbxuv_serial_reader_t *reader, const char **name, size_t *nameLength, int *type)
+{
+    uint64_t columnType;
+    uint64_t length;
+
+    if(reader->headerColumns == 0) return 0;
+
+    if(!_varint_get(reader, &columnType) || !_varint_get(reader, &length) || length > (uint64_t)(reader->end - reader->pos)) return -1;
+
+    *type = (int)columnType;
+    *name = (const char *)reader->pos;
+    *nameLength = (size_t)length;
+
+    reader->pos += length;
+    reader->headerColumns--;
+
+    return 1;
+}
+
+int odbxuv_serial_read_row(odbxuv_serial_reader_t *reader)
+{
+    const char *name;
+    size_t length;
+    int type;
+    int result;
+
+    while((result = odbxuv_serial_read_column(reader, &name, &length, &type)) == 1);
+    if(result < 0) return -1;
+
+    if(reader->nulls != NULL)
+    {
+        const char *value;
+        while((result = odbxuv_serial_read_value(reader, &value, &length)) >= 0);
+        if(reader->column < reader->columnCount) return -1;
+    }
+
+    if(reader->pos == reader->end) return 0;
+
+    size_t bitmapSize = (reader->columnCount + 7) / 8;
+
+    if(bitmapSize > (size_t)(reader->end - reader->pos)) return -1;
+
+    reader->nulls = reader->pos;
+    reader->pos += bitmapSize;
+    reader->column = 0;
+
+    return 1;
+}
+
+int odbxuv_serial_read_value(odbxuv_serial_reader_t *reader, const char **value, size_t *length)
+{
+    uint64_t valueLength;
+
+    if(reader->nulls == NULL || reader->column >= reader->columnCount) return -1;
+
+    unsigned int column = reader->column;
+
+    if(reader->nulls[column / 8] & (1 << (column % 8)))
+    {
+        reader->column++;
+        *value = NULL;
+        *length = 0;
+        return 0;
+    }
+
+    if(!_varint_get(reader, &valueLength) || valueLength > (uint64_t)(reader->end - reader->pos)) return -1;
+
+    reader->column++;
+    *value = (const char *)reader->pos;
+    *length = (size_t)valueLength;
+    reader->pos += valueLength;
+
+    return 1;
+}
@@ -0,0 +1,298 @@
+#include "odbxuv/slowlog.h"
+#include "odbxuv/stats.h"
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <malloc.h>
+
+/**
+ * The size of the buffer records are formatted into before writing
+ * \internal
+ */
+#define ODBXUV_SLOWLOG_BUFFER_SIZE 65536
+
+/**
+ * The longest formatted record, the query plus the other fields
+ * \internal
+ */
+#define ODBXUV_SLOWLOG_LINE_SIZE (ODBXUV_SLOWLOG_TEXT_SIZE + 256)
+
+static void _slowlog_flush(odbxuv_slowlog_t *slowlog);
+
+/**
+ * Takes the oldest record from the ring, returns 0 when it is empty.
+ */
+static int _slowlog_dequeue(odbxuv_slowlog_t *slowlog, odbxuv_slowlog_entry_t *entry)
+{
+    uint64_t pos = __atomic_load_n(&slowlog->dequeuePos, __ATOMIC_RELAXED);
+
+    for(;;)
+    {
+        odbxuv_slowlog_cell_t *cell = &slowlog->cells[pos & slowlog->mask];
+        uint64_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)sequence - (int64_t)(pos + 1);
+
+        if(diff == 0)
+        {
+            if(__atomic_compare_exchange_n(&slowlog->dequeuePos, &pos, pos + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                *entry = cell->entry;
+                __atomic_store_n(&cell->sequence, pos + slowlog->mask + 1, __ATOMIC_RELEASE);
+                return 1;
+            }
+        }
+        else if(diff < 0)
+        {
+            return 0;
+        }
+        else
+        {
+            pos = __atomic_load_n(&slowlog->dequeuePos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * Formats a record as one tab separated line, returns its length.
+ */
+static size_t _slowlog_format(odbxuv_slowlog_entry_t *entry, char *line)
+{
+    struct tm tm;
+    time_t seconds = (time_t)entry->finished.tv_sec;
+    char *text;
+    size_t length;
+
+    gmtime_r(&seconds, &tm);
+    length = strftime(line, 32, "%Y-%m-%dT%H:%M:%S", &tm);
+    length += sprintf(line + length, ".%06dZ\tconnection=%p\texecute_us=%llu\tfetch_us=%llu\trows=%llu\tstatus=%s\t",
+        (int)entry->finished.tv_usec,
+        entry->connection,
+        (unsigned long long)(entry->executeTime / 1000),
+        (unsigned long long)(entry->fetchTime / 1000),
+        (unsigned long long)entry->rows,
+        entry->failed ? "error" : "ok");
+
+    //Keep one record per line
+    for(text = entry->text; *text; text++)
+    {
+        line[length++] = *text == '\n' || *text == '\r' || *text == '\t' ? ' ' : *text;
+    }
+
+    line[length++] = '\n';
+
+    return length;
+}
+
+static void _slowlog_closed(uv_handle_t *handle)
+{
+    odbxuv_slowlog_t *slowlog = (odbxuv_slowlog_t *)handle->data;
+
+    free(slowlog->cells);
+    slowlog->cells = NULL;
+    free(slowlog->buffer);
+    slowlog->buffer = NULL;
+
+    if(slowlog->closeCallback)
+    {
+        slowlog->closeCallback(slowlog);
+    }
+}
+
+static void _slowlog_file_closed(uv_fs_t *req)
+{
+    odbxuv_slowlog_t *slowlog = (odbxuv_slowlog_t *)req->data;
+
+    uv_fs_req_cleanup(req);
+    uv_close((uv_handle_t *)&slowlog->async, _slowlog_closed);
+}
+
+static void _slowlog_written(uv_fs_t *req);
+
+/**
+ * Writes what is left of the buffer.
+ */
+static void _slowlog_write(odbxuv_slowlog_t *slowlog)
+{
+    uv_buf_t buf = uv_buf_init(slowlog->buffer + slowlog->bufferWritten, slowlog->bufferLength - slowlog->bufferWritten);
+
+    slowlog->writing = 1;
+    slowlog->req.data = slowlog;
+    uv_fs_write(slowlog->loop, &slowlog->req, slowlog->file, &buf, 1, -1, _slowlog_written);
+}
+
+static void _slowlog_written(uv_fs_t *req)
+{
+    odbxuv_slowlog_t *slowlog = (odbxuv_slowlog_t *)req->data;
+    ssize_t result = req->result;
+
+    uv_fs_req_cleanup(req);
+    slowlog->writing = 0;
+
+    if(result > 0)
+    {
+        slowlog->bufferWritten += result;
+
+        //A short write, for example on a full disk or after a signal
+        if(slowlog->bufferWritten < slowlog->bufferLength)
+        {
+            _slowlog_write(slowlog);
+            return;
+        }
+    }
+    else
+    {
+        //The records in the buffer are lost, count them like the ones the ring had no room for
+        __atomic_add_fetch(&slowlog->failed, slowlog->bufferRecords, __ATOMIC_RELAXED);
+    }
+
+    slowlog->bufferLength = 0;
+    slowlog->bufferWritten = 0;
+    slowlog->bufferRecords = 0;
+
+    _slowlog_flush(slowlog);
+}
+
+/**
+ * Writes the records in the ring unless a write is running.
+ * Closes the file once the log is closing and everything has been written.
+ */
+static void _slowlog_flush(odbxuv_slowlog_t *slowlog)
+{
+    odbxuv_slowlog_entry_t entry;
+    size_t length = 0;
+    unsigned int records = 0;
+
+    if(slowlog->writing) return;
+
+    while(length + ODBXUV_SLOWLOG_LINE_SIZE <= ODBXUV_SLOWLOG_BUFFER_SIZE && _slowlog_dequeue(slowlog, &entry))
+    {
+        length += _slowlog_format(&entry, slowlog->buffer + length);
+        records++;
+    }
+
+    if(length > 0)
+    {
+        slowlog->bufferLength = length;
+        slowlog->bufferWritten = 0;
+        slowlog->bufferRecords = records;
+        _slowlog_write(slowlog);
+    }
+    else if(slowlog->closing)
+    {
+        slowlog->writing = 1;
+        slowlog->req.data = slowlog;
+        uv_fs_close(slowlog->loop, &slowlog->req, slowlog->file, _slowlog_file_closed);
+    }
+}
+
+static void _slowlog_async(uv_async_t *handle)
+{
+    _slowlog_flush((odbxuv_slowlog_t *)handle->data);
+}
+
+/*
+ * API:
+ */
+
+int odbxuv_slowlog_open(odbxuv_slowlog_t *slowlog, uv_loop_t *loop, const char *path, unsigned int capacity)
+{
+    uv_fs_t req;
+    uint64_t cells = 1;
+    uint64_t i;
+
+    void *data = slowlog->data;
+    memset(slowlog, 0, sizeof(odbxuv_slowlog_t));
+    slowlog->data = data;
+
+    //Opening happens once at startup, no need for a callback
+    int result = uv_fs_open(NULL, &req, path, O_WRONLY | O_CREAT | O_APPEND, 0644, NULL);
+    uv_fs_req_cleanup(&req);
+
+    if(result < 0) return result;
+
+    while(cells < capacity) cells <<= 1;
+
+    slowlog->loop = loop;
+    slowlog->file = result;
+    slowlog->mask = cells - 1;
+    slowlog->cells = malloc(sizeof(odbxuv_slowlog_cell_t) * cells);
+    slowlog->buffer = malloc(ODBXUV_SLOWLOG_BUFFER_SIZE);
+
+    for(i = 0; i < cells; i++)
+    {
+        slowlog->cells[i].sequence = i;
+    }
+
+    slowlog->async.data = slowlog;
+    uv_async_init(loop, &slowlog->async, _slowlog_async);
+    uv_unref((uv_handle_t *)&slowlog->async);
+
+    return 0;
+}
+
+int odbxuv_slowlog_record(odbxuv_slowlog_t *slowlog, const void *connection, const char *query, uint64_t executeTime, uint64_t fetchTime, uint64_t rows, unsigned char failed)
+{
+    if((executeTime + fetchTime) / 1000 < slowlog->threshold) return 0;
+
+    uint64_t pos = __atomic_load_n(&slowlog->enqueuePos, __ATOMIC_RELAXED);
+    odbxuv_slowlog_cell_t *cell;
+
+    for(;;)
+    {
+        cell = &slowlog->cells[pos & slowlog->mask];
+        uint64_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)sequence - (int64_t)pos;
+
+        if(diff == 0)
+        {
+            if(__atomic_compare_exchange_n(&slowlog->enqueuePos, &pos, pos + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+        }
+        else if(diff < 0)
+        {
+            //The writer can't keep up, rather lose the record than block the worker
+            __atomic_add_fetch(&slowlog->dropped, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        else
+        {
+            pos = __atomic_load_n(&slowlog->enqueuePos, __ATOMIC_RELAXED);
+        }
+    }
+
+    odbxuv_slowlog_entry_t *entry = &cell->entry;
+
+    uv_gettimeofday(&entry->finished);
+    entry->connection = connection;
+    entry->executeTime = executeTime;
+    entry->fetchTime = fetchTime;
+    entry->rows = rows;
+    entry->failed = failed;
+
+    if(slowlog->redact)
+    {
+        odbxuv_query_fingerprint(query, entry->text, sizeof(entry->text));
+    }
+    else
+    {
+        strncpy(entry->text, query, sizeof(entry->text) - 1);
+        entry->text[sizeof(entry->text) - 1] = '\0';
+    }
+
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    uv_async_send(&slowlog->async);
+
+    return 1;
+}
+
+void odbxuv_slowlog_close(odbxuv_slowlog_t *slowlog, odbxuv_slowlog_close_cb callback)
+{
+    assert(!slowlog->closing && "Slow query log is already closing");
+
+    slowlog->closing = 1;
+    slowlog->closeCallback = callback;
+
+    _slowlog_flush(slowlog);
+}
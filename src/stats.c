@@ -0,0 +1,443 @@
+#include "odbxuv/stats.h"
+#include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <malloc.h>
+
+#define ODBXUV_FNV_OFFSET 14695981039346656037ULL
+#define ODBXUV_FNV_PRIME 1099511628211ULL
+
+/**
+ * Characters that make up operators like >= or ||
+ * \internal
+ */
+#define ODBXUV_FP_OPERATOR "<>=!|&+-*/%^~:@#"
+
+/**
+ * Output of the query normaliser
+ * \internal
+ */
+typedef struct _odbxuv_fingerprint_s
+{
+    uint64_t hash;
+    char *out;
+    size_t size;
+    size_t length;
+    unsigned char space;
+    char last;
+} _odbxuv_fingerprint_t;
+
+static void _fp_put(_odbxuv_fingerprint_t *fp, char c)
+{
+    if(fp->space)
+    {
+        //One space between tokens, except around parentheses, dots and before commas
+        fp->space = 0;
+        if(fp->length > 0 && fp->last != '(' && fp->last != '.' && c != ')' && c != ',' && c != '.') _fp_put(fp, ' ');
+    }
+
+    fp->last = c;
+
+    fp->hash = (fp->hash ^ (unsigned char)c) * ODBXUV_FNV_PRIME;
+
+    if(fp->out != NULL && fp->length + 1 < fp->size)
+    {
+        fp->out[fp->length] = c;
+    }
+
+    fp->length++;
+}
+
+static void _fp_puts(_odbxuv_fingerprint_t *fp, const char *string)
+{
+    while(*string) _fp_put(fp, *string++);
+}
+
+static int _fp_is_word(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '$';
+}
+
+/**
+ * Skips whitespace and comments, returns the first character after them.
+ */
+static const char *_fp_skip_space(const char *cursor)
+{
+    for(;;)
+    {
+        if(isspace((unsigned char)*cursor))
+        {
+            cursor++;
+        }
+        else if(cursor[0] == '-' && cursor[1] == '-')
+        {
+            while(*cursor && *cursor != '\n') cursor++;
+        }
+        else if(cursor[0] == '/' && cursor[1] == '*')
+        {
+            cursor += 2;
+            while(*cursor && !(cursor[0] == '*' && cursor[1] == '/')) cursor++;
+            if(*cursor) cursor += 2;
+        }
+        else
+        {
+            return cursor;
+        }
+    }
+}
+
+/**
+ * Skips a quoted string starting at \p cursor.
+ */
+static const char *_fp_skip_quoted(const char *cursor)
+{
+    char quote = *cursor++;
+
+    while(*cursor)
+    {
+        if(*cursor == '\\' && cursor[1])
+        {
+            cursor += 2;
+        }
+        else if(*cursor == quote)
+        {
+            //A doubled quote is part of the string
+            if(cursor[1] != quote) return cursor + 1;
+            cursor += 2;
+        }
+        else
+        {
+            cursor++;
+        }
+    }
+
+    return cursor;
+}
+
+/**
+ * Returns the end of the literal at \p cursor or \p NULL when there is none.
+ */
+static const char *_fp_skip_literal(const char *cursor)
+{
+    if(*cursor == '-' || *cursor == '+') cursor = _fp_skip_space(cursor + 1);
+
+    if(*cursor == '\'')
+    {
+        return _fp_skip_quoted(cursor);
+    }
+
+    if(*cursor == '?')
+    {
+        return cursor + 1;
+    }
+
+    if(*cursor == '$' && isdigit((unsigned char)cursor[1]))
+    {
+        cursor++;
+        while(isdigit((unsigned char)*cursor)) cursor++;
+        return cursor;
+    }
+
+    if(isdigit((unsigned char)*cursor) || (*cursor == '.' && isdigit((unsigned char)cursor[1])))
+    {
+        while(isalnum((unsigned char)*cursor) || *cursor == '.' || ((*cursor == '-' || *cursor == '+') && (cursor[-1] == 'e' || cursor[-1] == 'E'))) cursor++;
+        return cursor;
+    }
+
+    if(strncasecmp(cursor, "NULL", 4) == 0 && !_fp_is_word(cursor[4])) return cursor + 4;
+    if(strncasecmp(cursor, "TRUE", 4) == 0 && !_fp_is_word(cursor[4])) return cursor + 4;
+    if(strncasecmp(cursor, "FALSE", 5) == 0 && !_fp_is_word(cursor[5])) return cursor + 5;
+
+    return NULL;
+}
+
+/**
+ * Returns the end of a parenthesised list of literals at \p cursor or \p NULL when it is something else.
+ */
+static const char *_fp_skip_list(const char *cursor)
+{
+    if(*cursor != '(') return NULL;
+
+    cursor = _fp_skip_space(cursor + 1);
+
+    for(;;)
+    {
+        cursor = _fp_skip_literal(cursor);
+        if(cursor == NULL) return NULL;
+
+        cursor = _fp_skip_space(cursor);
+
+        if(*cursor == ')') return cursor + 1;
+        if(*cursor != ',') return NULL;
+
+        cursor = _fp_skip_space(cursor + 1);
+    }
+}
+
+uint64_t odbxuv_query_fingerprint(const char *query, char *normalised, size_t size)
+{
+    _odbxuv_fingerprint_t fp;
+    const char *cursor = query;
+
+    fp.hash = ODBXUV_FNV_OFFSET;
+    fp.out = normalised;
+    fp.size = size;
+    fp.length = 0;
+    fp.space = 0;
+    fp.last = 0;
+
+    while(*(cursor = _fp_skip_space(cursor)))
+    {
+        const char *next;
+        const char *end;
+
+        //Spacing of the query does not matter
+        fp.space = 1;
+
+        if((end = _fp_skip_list(cursor)) != NULL)
+        {
+            _fp_puts(&fp, "(...)");
+
+            //Rows of a multi row VALUES collapse as well
+            for(;;)
+            {
+                next = _fp_skip_space(end);
+                if(*next != ',') break;
+                next = _fp_skip_list(_fp_skip_space(next + 1));
+                if(next == NULL) break;
+                end = next;
+            }
+
+            cursor = end;
+        }
+        else if(*cursor == '"' || *cursor == '`')
+        {
+            //Quoted identifier, keep it
+            end = _fp_skip_quoted(cursor);
+            while(cursor < end) _fp_put(&fp, *cursor++);
+        }
+        else if(_fp_is_word(*cursor) && !isdigit((unsigned char)*cursor) && !(*cursor == '$' && isdigit((unsigned char)cursor[1])))
+        {
+            while(_fp_is_word(*cursor)) _fp_put(&fp, tolower((unsigned char)*cursor++));
+        }
+        else if(*cursor != '-' && *cursor != '+' && (end = _fp_skip_literal(cursor)) != NULL)
+        {
+            _fp_put(&fp, '?');
+            cursor = end;
+        }
+        else if(strchr(ODBXUV_FP_OPERATOR, *cursor))
+        {
+            while(*cursor && strchr(ODBXUV_FP_OPERATOR, *cursor) && !(cursor[0] == '-' && cursor[1] == '-') && !(cursor[0] == '/' && cursor[1] == '*')) _fp_put(&fp, *cursor++);
+        }
+        else
+        {
+            _fp_put(&fp, *cursor++);
+        }
+    }
+
+    if(normalised != NULL && size > 0)
+    {
+        normalised[fp.length < size ? fp.length : size - 1] = '\0';
+    }
+
+    return fp.hash;
+}
+
+/**
+ * The histogram bucket of a call that took \p time nanoseconds
+ */
+static unsigned int _stats_bucket(uint64_t time)
+{
+    uint64_t micros = time / 1000;
+    unsigned int bucket = 0;
+
+    while(micros > 0 && bucket < ODBXUV_STATS_BUCKETS - 1)
+    {
+        micros >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static void _stats_add(odbxuv_stats_entry_t *entry, uint64_t time, uint64_t rows, unsigned char failed)
+{
+    entry->calls++;
+    entry->errors += failed ? 1 : 0;
+    entry->rows += rows;
+    entry->totalTime += time;
+
+    if(time > entry->maxTime) entry->maxTime = time;
+
+    entry->histogram[_stats_bucket(time)]++;
+}
+
+static int _stats_compare(const void *a, const void *b)
+{
+    const odbxuv_stats_entry_t *left = (const odbxuv_stats_entry_t *)a;
+    const odbxuv_stats_entry_t *right = (const odbxuv_stats_entry_t *)b;
+
+    if(left->totalTime == right->totalTime) return 0;
+
+    return left->totalTime > right->totalTime ? -1 : 1;
+}
+
+/*
+ * API:
+ */
+
+int odbxuv_stats_init(odbxuv_stats_t *stats, unsigned int capacity)
+{
+    assert(capacity > 0);
+
+    void *data = stats->data;
+    memset(stats, 0, sizeof(odbxuv_stats_t));
+    stats->data = data;
+
+    stats->capacity = capacity;
+
+    //Keep the table at most half full so probes stay short
+    stats->slots = malloc(sizeof(odbxuv_stats_entry_t *) * capacity * 2);
+    memset(stats->slots, 0, sizeof(odbxuv_stats_entry_t *) * capacity * 2);
+
+    strcpy(stats->overflow.text, "<other>");
+
+    uv_mutex_init(&stats->lock);
+
+    return 0;
+}
+
+void odbxuv_stats_record(odbxuv_stats_t *stats, const char *query, uint64_t time, uint64_t rows, unsigned char failed)
+{
+    char text[ODBXUV_STATS_TEXT_SIZE];
+    uint64_t fingerprint = odbxuv_query_fingerprint(query, text, sizeof(text));
+    unsigned int size = stats->capacity * 2;
+    unsigned int index;
+
+    //0 marks the overflow entry
+    if(fingerprint == 0) fingerprint = 1;
+
+    uv_mutex_lock(&stats->lock);
+
+    for(index = fingerprint % size; stats->slots[index] != NULL; index = (index + 1) % size)
+    {
+        if(stats->slots[index]->fingerprint == fingerprint)
+        {
+            _stats_add(stats->slots[index], time, rows, failed);
+            uv_mutex_unlock(&stats->lock);
+            return;
+        }
+    }
+
+    if(stats->count >= stats->capacity)
+    {
+        _stats_add(&stats->overflow, time, rows, failed);
+        uv_mutex_unlock(&stats->lock);
+        return;
+    }
+
+    odbxuv_stats_entry_t *entry = malloc(sizeof(odbxuv_stats_entry_t));
+    memset(entry, 0, sizeof(odbxuv_stats_entry_t));
+    entry->fingerprint = fingerprint;
+    strcpy(entry->text, text);
+    _stats_add(entry, time, rows, failed);
+
+    stats->slots[index] = entry;
+    stats->count++;
+
+    uv_mutex_unlock(&stats->lock);
+}
+
+unsigned int odbxuv_stats_snapshot(odbxuv_stats_t *stats, odbxuv_stats_entry_t *entries, unsigned int max)
+{
+    unsigned int total = stats->capacity + 1;
+    odbxuv_stats_entry_t *all = malloc(sizeof(odbxuv_stats_entry_t) * total);
+    unsigned int count = 0;
+    unsigned int i;
+
+    uv_mutex_lock(&stats->lock);
+
+    for(i = 0; i < stats->capacity * 2; i++)
+    {
+        if(stats->slots[i] != NULL) all[count++] = *stats->slots[i];
+    }
+
+    if(stats->overflow.calls > 0) all[count++] = stats->overflow;
+
+    uv_mutex_unlock(&stats->lock);
+
+    qsort(all, count, sizeof(odbxuv_stats_entry_t), _stats_compare);
+
+    if(count > max) count = max;
+    memcpy(entries, all, sizeof(odbxuv_stats_entry_t) * count);
+    free(all);
+
+    return count;
+}
+
+void odbxuv_stats_dump(odbxuv_stats_t *stats, FILE *out)
+{
+    unsigned int max = stats->capacity + 1;
+    odbxuv_stats_entry_t *entries = malloc(sizeof(odbxuv_stats_entry_t) * max);
+    unsigned int count = odbxuv_stats_snapshot(stats, entries, max);
+    unsigned int i, j;
+
+    fprintf(out, "fingerprint\tcalls\terrors\trows\ttotal_us\tmean_us\tmax_us\thistogram\tquery\n");
+
+    for(i = 0; i < count; i++)
+    {
+        odbxuv_stats_entry_t *entry = &entries[i];
+
+        fprintf(out, "%016llx\t%llu\t%llu\t%llu\t%llu\t%llu\t%llu\t",
+            (unsigned long long)entry->fingerprint,
+            (unsigned long long)entry->calls,
+            (unsigned long long)entry->errors,
+            (unsigned long long)entry->rows,
+            (unsigned long long)(entry->totalTime / 1000),
+            (unsigned long long)(entry->totalTime / 1000 / entry->calls),
+            (unsigned long long)(entry->maxTime / 1000));
+
+        for(j = 0; j < ODBXUV_STATS_BUCKETS; j++)
+        {
+            fprintf(out, j ? ",%llu" : "%llu", (unsigned long long)entry->histogram[j]);
+        }
+
+        fprintf(out, "\t%s\n", entry->text);
+    }
+
+    free(entries);
+}
+
+void odbxuv_stats_reset(odbxuv_stats_t *stats)
+{
+    unsigned int i;
+
+    uv_mutex_lock(&stats->lock);
+
+    for(i = 0; i < stats->capacity * 2; i++)
+    {
+        if(stats->slots[i] != NULL)
+        {
+            free(stats->slots[i]);
+            stats->slots[i] = NULL;
+        }
+    }
+
+    stats->count = 0;
+    memset(&stats->overflow, 0, sizeof(odbxuv_stats_entry_t));
+    strcpy(stats->overflow.text, "<other>");
+
+    uv_mutex_unlock(&stats->lock);
+}
+
+void odbxuv_stats_free(odbxuv_stats_t *stats)
+{
+    odbxuv_stats_reset(stats);
+
+    free(stats->slots);
+    stats->slots = NULL;
+
+    uv_mutex_destroy(&stats->lock);
+}
@@ -0,0 +1,201 @@
+#include "odbxuv/coro.hpp"
+#include "odbx_fake.h"
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * Tests of the coroutine layer of odbxuv/coro.hpp against the in memory backend of odbx_fake.c.
+ *
+ * Usage: odbxuv_coro
+ */
+
+using namespace odbxuv;
+
+/**
+ * The raw queries filling the queue that did not finish yet
+ */
+static int rawPending = 0;
+
+/**
+ * Set once the test coroutine ran to its end
+ */
+static bool completed = false;
+
+static ConnectOptions fakeOptions()
+{
+    ConnectOptions options;
+    options.backend = "fake";
+    options.host = "";
+    options.port = "";
+    options.database = "test";
+    options.user = "test";
+    options.password = "test";
+    return options;
+}
+
+/**
+ * Reads the rows of \p sql, stops after \p stopAfter batches when it is not 0.
+ * The ids have to follow each other.
+ */
+static Task<long> readRows(Connection &connection, const char *sql, int stopAfter)
+{
+    Query query = co_await connection.query(sql);
+    long rows = 0;
+    int batches = 0;
+
+    while(Result result = co_await query.next())
+    {
+        assert(result.size() > 0);
+
+        for(odbxuv_row_t *row : result)
+        {
+            assert(atol(row->value[0]) == rows + 1);
+            rows++;
+        }
+
+        if(++batches == stopAfter) break;
+    }
+
+    co_return rows;
+}
+
+static void onRawRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    if(row) return;
+
+    odbxuv_free_handle((odbxuv_handle_t *)op);
+    free(op);
+    rawPending--;
+}
+
+static void onRawQuery(odbxuv_op_query_t *op, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+    odbxuv_query_process(op, onRawRow);
+}
+
+/**
+ * Submits a slow query without the coroutine layer, returns whether the connection queued it.
+ */
+static bool submitRaw(Connection &connection)
+{
+    odbxuv_op_query_t *op = (odbxuv_op_query_t *)calloc(1, sizeof(odbxuv_op_query_t));
+
+    if(odbxuv_query(connection.get(), op, "SELECT SLEEP 200", (odbxuv_query_fetch_e)0, onRawQuery) < ODBX_ERR_SUCCESS)
+    {
+        free(op);
+        return false;
+    }
+
+    rawPending++;
+    return true;
+}
+
+static Task<void> run(uv_loop_t *loop)
+{
+    Connection connection(loop);
+    co_await connection.connect(fakeOptions());
+
+    assert(co_await connection.capabilities(ODBX_CAP_BASIC));
+    assert(co_await connection.escape("ab'c") == "ab\\'c");
+
+    //Every row, then the rest of a query dropped after two batches
+    assert(co_await readRows(connection, "SELECT GEN 100000", 0) == 100000);
+    assert(co_await readRows(connection, "SELECT GEN 100000", 2) > 0);
+
+    //A query destroyed before its rows were read
+    {
+        Query unread = co_await connection.query("SELECT GEN 5000");
+        assert(unread.columnCount() == 3);
+    }
+
+    //The queries run on recycled operations
+    assert(connection.get()->freeQueryCount > 0);
+    assert(co_await readRows(connection, "SELECT GEN 10", 0) == 10);
+
+    //A query the connection does not queue resumes right away with the error
+    {
+        int accepted = 0;
+        bool refused = false;
+
+        connection.get()->admission.maxQueued = 1;
+
+        //Once a query runs and another one waits the queue is full
+        while(!refused)
+        {
+            if(submitRaw(connection))
+            {
+                accepted++;
+            }
+            else
+            {
+                refused = accepted >= 2;
+            }
+        }
+
+        try
+        {
+            Query overloaded = co_await connection.query("SELECT GEN 10");
+            assert(false && "The query should have been refused");
+        }
+        catch(const Error &error)
+        {
+            assert(error.code() == ODBXUV_ERR_OVERLOAD);
+        }
+
+        connection.get()->admission.maxQueued = 0;
+
+        while(rawPending > 0)
+        {
+            co_await readRows(connection, "SELECT SLEEP 10", 0);
+        }
+    }
+
+    //A failed query throws and loses the connection, closing it in the destructor
+    {
+        Connection failing(loop);
+        co_await failing.connect(fakeOptions());
+
+        try
+        {
+            co_await readRows(failing, "SELECT FAIL", 0);
+            assert(false && "The query should have failed");
+        }
+        catch(const Error &error)
+        {
+            assert(error.code() < 0 && error.type() < 0);
+            assert(strcmp(error.what(), "Fake backend error") == 0);
+        }
+    }
+
+    //The last query hands its operation back after the batch callback that closes the connection
+    {
+        Query last = co_await connection.query("SELECT GEN 10");
+
+        while(co_await last.next())
+        {
+        }
+    }
+
+    co_await connection.close();
+    assert(connection.get() == nullptr);
+
+    completed = true;
+}
+
+int main(int argc, char **argv)
+{
+    uv_loop_t *loop = uv_default_loop();
+
+    spawn(run(loop));
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(completed);
+    assert(odbxuv_memory_used() == 0);
+    assert(odbx_fake_connections() == 0);
+
+    uv_loop_delete(loop);
+    return 0;
+}
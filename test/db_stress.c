@@ -0,0 +1,605 @@
+#include "odbxuv/db.h"
+#include "odbxuv/cursor.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+#include "uv.h"
+
+/**
+ * Soak test: every loop runs its own thread with a few connections to a local sqlite3 database,
+ * each keeping a mix of queries, inserts, escapes, shared queries and stopped cursors in flight.
+ * A connection is closed and opened again after every round of operations.
+ * The main loop reports the throughput, memory and open handles until the time is up
+ * and fails when memory or handles are left over once everything closed.
+ *
+ * Usage: odbxuv_stress [seconds] [loops] [directory] [database] [backend]
+ */
+
+/**
+ * Connections per loop
+ */
+#define STRESS_CLIENTS 4
+
+/**
+ * Operations a connection keeps in flight
+ */
+#define STRESS_DEPTH 4
+
+/**
+ * Operations of a connection before it is closed and opened again
+ */
+#define STRESS_ROUND 200
+
+/**
+ * Milliseconds between the reports of the main loop
+ */
+#define STRESS_REPORT_INTERVAL 5000
+
+/**
+ * Milliseconds between the checks of a loop for the end of the test
+ */
+#define STRESS_TICK_INTERVAL 100
+
+typedef struct stress_loop_s stress_loop_t;
+
+typedef struct stress_client_s
+{
+    stress_loop_t *owner;
+    odbxuv_connection_t connection;
+
+    /**
+     * Operations in flight, including the connect
+     */
+    unsigned int pending;
+
+    /**
+     * Operations started since connecting
+     */
+    unsigned int issued;
+
+    /**
+     * Whether the last connect succeeded
+     */
+    unsigned char connected;
+} stress_client_t;
+
+struct stress_loop_s
+{
+    uv_thread_t thread;
+    uv_loop_t loop;
+    uv_timer_t tick;
+    stress_client_t clients[STRESS_CLIENTS];
+
+    /**
+     * Clients that did not close for the last time yet
+     */
+    unsigned int openClients;
+    unsigned char stopping;
+
+    /**
+     * Handles of the loop at the last tick and once it stopped
+     */
+    unsigned int handles;
+    unsigned int leftOpen;
+};
+
+typedef struct stress_cursor_s
+{
+    odbxuv_cursor_t cursor;
+    stress_client_t *client;
+} stress_cursor_t;
+
+typedef struct stress_counters_s
+{
+    uint64_t queries;
+    uint64_t rows;
+    uint64_t escapes;
+    uint64_t shared;
+    uint64_t cancels;
+    uint64_t connects;
+    uint64_t closes;
+    uint64_t errors;
+} stress_counters_t;
+
+static stress_counters_t counters;
+static int stopFlag = 0;
+
+static const char *backend = "sqlite3";
+static const char *directory = "/tmp/";
+static const char *database = "odbxuv_stress.db";
+
+static void _client_connect(stress_client_t *client);
+static void _client_issue(stress_client_t *client);
+
+static void _count(uint64_t *counter, uint64_t amount)
+{
+    __atomic_add_fetch(counter, amount, __ATOMIC_RELAXED);
+}
+
+static uint64_t _read(uint64_t *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+static void _count_handle(uv_handle_t *handle, void *data)
+{
+    (*(unsigned int *)data)++;
+}
+
+static void _walk_cb(uv_handle_t *handle, void *data)
+{
+    printf("Still open: %lu %i\n", (unsigned long)handle, handle->type);
+    (*(unsigned int *)data)++;
+}
+
+static void _client_closed(odbxuv_handle_t *handle)
+{
+    stress_client_t *client = (stress_client_t *)handle->data;
+    stress_loop_t *owner = client->owner;
+
+    _count(&counters.closes, 1);
+
+    if(client->connection.error != NULL)
+    {
+        odbxuv_free_error((odbxuv_handle_t *)&client->connection);
+    }
+
+    //A database that can't be opened won't open on the next attempt either
+    if(!owner->stopping && client->connected)
+    {
+        _client_connect(client);
+        return;
+    }
+
+    if(--owner->openClients == 0)
+    {
+        uv_close((uv_handle_t *)&owner->tick, NULL);
+    }
+}
+
+/**
+ * Finishes an operation, closes the connection once its round is done.
+ */
+static void _client_done(stress_client_t *client, int status)
+{
+    client->pending--;
+
+    if(status < ODBX_ERR_SUCCESS)
+    {
+        _count(&counters.errors, 1);
+    }
+
+    _client_issue(client);
+
+    if(client->pending == 0)
+    {
+        odbxuv_close((odbxuv_handle_t *)&client->connection, _client_closed);
+    }
+}
+
+static void onQueryRow(odbxuv_op_query_t *result, odbxuv_row_t *row, int status)
+{
+    if(row)
+    {
+        _count(&counters.rows, 1);
+        return;
+    }
+
+    if(status < ODBX_ERR_SUCCESS)
+    {
+        odbxuv_free_error((odbxuv_handle_t *)result);
+    }
+
+    stress_client_t *client = (stress_client_t *)result->data;
+    odbxuv_free_handle((odbxuv_handle_t *)result);
+    free(result);
+
+    _client_done(client, status);
+}
+
+static void onQuery(odbxuv_op_query_t *req, int status)
+{
+    _count(&counters.queries, 1);
+
+    if(status < ODBX_ERR_SUCCESS)
+    {
+        stress_client_t *client = (stress_client_t *)req->data;
+
+        odbxuv_free_error((odbxuv_handle_t *)req);
+        odbxuv_free_handle((odbxuv_handle_t *)req);
+        free(req);
+
+        _client_done(client, status);
+        return;
+    }
+
+    odbxuv_query_process(req, onQueryRow);
+}
+
+static void _client_query(stress_client_t *client, const char *query, int options)
+{
+    odbxuv_op_query_t *op = (odbxuv_op_query_t *)malloc(sizeof(odbxuv_op_query_t));
+    memset(op, 0, sizeof(odbxuv_op_query_t));
+    op->data = client;
+
+    odbxuv_query_config_t config;
+    memset(&config, 0, sizeof(odbxuv_query_config_t));
+    config.options = options;
+
+    if(odbxuv_query_ex(&client->connection, op, query, ODBXUV_QUERY_FETCH_VALUE | ODBXUV_QUERY_FETCH_NAME, &config, onQuery) < ODBX_ERR_SUCCESS)
+    {
+        free(op);
+        _client_done(client, -1);
+    }
+}
+
+static void onEscape(odbxuv_op_escape_t *req, int status)
+{
+    stress_client_t *client = (stress_client_t *)req->data;
+    char query[256];
+
+    _count(&counters.escapes, 1);
+
+    if(status < ODBX_ERR_SUCCESS)
+    {
+        odbxuv_free_error((odbxuv_handle_t *)req);
+        odbxuv_free_handle((odbxuv_handle_t *)req);
+        free(req);
+
+        _client_done(client, status);
+        return;
+    }
+
+    //The escape finished, the insert takes its place in flight
+    snprintf(query, sizeof(query), "INSERT INTO stress (name, value) VALUES ('%s', %u)", req->string, client->issued);
+    odbxuv_free_handle((odbxuv_handle_t *)req);
+    free(req);
+
+    _client_query(client, query, 0);
+}
+
+static void onCursorRows(odbxuv_cursor_t *cursor, odbxuv_op_query_t *page, odbxuv_row_t *rows, unsigned int count, int status)
+{
+    stress_cursor_t *scan = (stress_cursor_t *)cursor->data;
+
+    if(rows)
+    {
+        _count(&counters.rows, count);
+
+        //Give up after the first page, like a client that went away
+        if(!cursor->stopping)
+        {
+            _count(&counters.cancels, 1);
+            odbxuv_cursor_stop(cursor);
+        }
+
+        return;
+    }
+
+    stress_client_t *client = scan->client;
+    odbxuv_cursor_free(cursor);
+    free(scan);
+
+    _client_done(client, status);
+}
+
+/**
+ * Keeps \p STRESS_DEPTH operations in flight until the round is done.
+ */
+static void _client_issue(stress_client_t *client)
+{
+    while(!client->owner->stopping && client->pending < STRESS_DEPTH && client->issued < STRESS_ROUND)
+    {
+        unsigned int kind = client->issued++ % 5;
+        client->pending++;
+
+        if(client->issued == 1)
+        {
+            _client_query(client, "CREATE TABLE IF NOT EXISTS stress (id INTEGER PRIMARY KEY, name TEXT, value INTEGER)", 0);
+            continue;
+        }
+
+        switch(kind)
+        {
+            case 0:
+            case 1:
+                _client_query(client, "SELECT id, name, value FROM stress ORDER BY id DESC LIMIT 100", 0);
+                break;
+
+            case 2:
+            {
+                odbxuv_op_escape_t *op = (odbxuv_op_escape_t *)malloc(sizeof(odbxuv_op_escape_t));
+                memset(op, 0, sizeof(odbxuv_op_escape_t));
+                op->data = client;
+                odbxuv_escape(&client->connection, op, "it's \"quoted\"", onEscape);
+                break;
+            }
+
+            case 3:
+            {
+                stress_cursor_t *scan = (stress_cursor_t *)malloc(sizeof(stress_cursor_t));
+                memset(scan, 0, sizeof(stress_cursor_t));
+                scan->client = client;
+                scan->cursor.data = scan;
+
+                odbxuv_cursor_init(&scan->cursor, &client->connection, "SELECT id, name, value FROM stress", NULL, "id");
+                scan->cursor.pageSize = 20;
+                odbxuv_cursor_start(&scan->cursor, onCursorRows);
+                break;
+            }
+
+            case 4:
+                _count(&counters.shared, 1);
+                _client_query(client, "SELECT COUNT(*) FROM stress", ODBXUV_QUERY_SHARED);
+                break;
+        }
+    }
+}
+
+static void onConnect(odbxuv_op_connect_t *req, int status)
+{
+    stress_client_t *client = (stress_client_t *)req->data;
+
+    client->connected = status >= ODBX_ERR_SUCCESS;
+
+    if(status < ODBX_ERR_SUCCESS)
+    {
+        printf("Connect status: %i (%i)-> %s\n", req->error->error, req->error->errorType, req->error->errorString);
+        odbxuv_free_error((odbxuv_handle_t *)req);
+    }
+    else
+    {
+        _count(&counters.connects, 1);
+    }
+
+    odbxuv_free_handle((odbxuv_handle_t *)req);
+    free(req);
+
+    if(client->connected)
+    {
+        client->issued = 0;
+        _client_done(client, ODBX_ERR_SUCCESS);
+    }
+    else
+    {
+        client->pending--;
+        _count(&counters.errors, 1);
+        odbxuv_close((odbxuv_handle_t *)&client->connection, _client_closed);
+    }
+}
+
+static void _client_connect(stress_client_t *client)
+{
+    odbxuv_init_connection(&client->connection, &client->owner->loop);
+    client->connection.data = client;
+
+    odbxuv_op_connect_t *op = (odbxuv_op_connect_t *)malloc(sizeof(odbxuv_op_connect_t));
+    memset(op, 0, sizeof(odbxuv_op_connect_t));
+    op->data = client;
+    op->backend = backend;
+    op->host = directory;
+    op->port = "";
+    op->database = database;
+    op->user = "";
+    op->password = "";
+    op->method = ODBX_BIND_SIMPLE;
+
+    client->pending = 1;
+    odbxuv_connect(&client->connection, op, onConnect);
+}
+
+static void _loop_tick(uv_timer_t *handle)
+{
+    stress_loop_t *owner = (stress_loop_t *)handle->data;
+    unsigned int handles = 0;
+
+    uv_walk(&owner->loop, _count_handle, &handles);
+    __atomic_store_n(&owner->handles, handles, __ATOMIC_RELAXED);
+
+    //The clients close once their operations in flight finished
+    if(__atomic_load_n(&stopFlag, __ATOMIC_RELAXED))
+    {
+        owner->stopping = 1;
+    }
+}
+
+static void _loop_run(void *arg)
+{
+    stress_loop_t *owner = (stress_loop_t *)arg;
+    unsigned int i;
+
+    uv_loop_init(&owner->loop);
+
+    owner->tick.data = owner;
+    uv_timer_init(&owner->loop, &owner->tick);
+    uv_timer_start(&owner->tick, _loop_tick, STRESS_TICK_INTERVAL, STRESS_TICK_INTERVAL);
+
+    owner->openClients = STRESS_CLIENTS;
+
+    for(i = 0; i < STRESS_CLIENTS; i++)
+    {
+        owner->clients[i].owner = owner;
+        _client_connect(&owner->clients[i]);
+    }
+
+    uv_run(&owner->loop, UV_RUN_DEFAULT);
+
+    uv_walk(&owner->loop, _walk_cb, &owner->leftOpen);
+    uv_loop_close(&owner->loop);
+}
+
+/**
+ * The resident set size of the process in bytes
+ */
+static uint64_t _rss(void)
+{
+    unsigned long size = 0;
+    unsigned long resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+
+    if(statm == NULL) return 0;
+
+    if(fscanf(statm, "%lu %lu", &size, &resident) != 2)
+    {
+        resident = 0;
+    }
+
+    fclose(statm);
+
+    return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * The bytes allocated with malloc that were not freed
+ */
+static uint64_t _heap(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    return mallinfo2().uordblks;
+#else
+    return (unsigned int)mallinfo().uordblks;
+#endif
+}
+
+typedef struct stress_report_s
+{
+    uv_timer_t timer;
+    stress_loop_t *loops;
+    unsigned int loopCount;
+    uint64_t start;
+    uint64_t deadline;
+    uint64_t lastTime;
+    uint64_t lastQueries;
+
+    /**
+     * The first report is the baseline of the growth, the loops are warmed up by then
+     */
+    unsigned int reports;
+    uint64_t baseRss;
+    uint64_t baseHeap;
+    double firstRate;
+    double lastRate;
+} stress_report_t;
+
+static void _report_tick(uv_timer_t *handle)
+{
+    stress_report_t *report = (stress_report_t *)handle->data;
+    uint64_t now = uv_now(handle->loop);
+    uint64_t queries = _read(&counters.queries) + _read(&counters.escapes);
+    uint64_t rss = _rss();
+    uint64_t heap = _heap();
+    unsigned int handles = 0;
+    unsigned int i;
+
+    for(i = 0; i < report->loopCount; i++)
+    {
+        handles += __atomic_load_n(&report->loops[i].handles, __ATOMIC_RELAXED);
+    }
+
+    double rate = now > report->lastTime ? (double)(queries - report->lastQueries) * 1000.0 / (double)(now - report->lastTime) : 0;
+
+    if(report->reports++ == 0)
+    {
+        report->baseRss = rss;
+        report->baseHeap = heap;
+        report->firstRate = rate;
+    }
+
+    report->lastRate = rate;
+    report->lastTime = now;
+    report->lastQueries = queries;
+
+    printf("[%5lus] %9.1f ops/s rows %llu rss %.1f MiB (%+.1f) heap %.1f MiB (%+.1f) odbxuv %.1f KiB handles %u connects %llu errors %llu\n",
+        (unsigned long)((now - report->start) / 1000), rate, (unsigned long long)_read(&counters.rows),
+        rss / 1048576.0, ((double)rss - (double)report->baseRss) / 1048576.0,
+        heap / 1048576.0, ((double)heap - (double)report->baseHeap) / 1048576.0,
+        odbxuv_memory_used() / 1024.0, handles,
+        (unsigned long long)_read(&counters.connects), (unsigned long long)_read(&counters.errors));
+
+    if(now >= report->deadline)
+    {
+        __atomic_store_n(&stopFlag, 1, __ATOMIC_RELAXED);
+        uv_close((uv_handle_t *)&report->timer, NULL);
+    }
+    else if(report->deadline - now < STRESS_REPORT_INTERVAL)
+    {
+        uv_timer_start(&report->timer, _report_tick, report->deadline - now, STRESS_REPORT_INTERVAL);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int seconds = argc > 1 ? (unsigned int)atoi(argv[1]) : 60;
+    unsigned int loopCount = argc > 2 ? (unsigned int)atoi(argv[2]) : 4;
+    unsigned int leftOpen = 0;
+    unsigned int i;
+    int failed = 0;
+
+    if(argc > 3) directory = argv[3];
+    if(argc > 4) database = argv[4];
+    if(argc > 5) backend = argv[5];
+
+    if(loopCount == 0) loopCount = 1;
+
+    uv_loop_t *loop = uv_default_loop();
+    stress_loop_t *loops = (stress_loop_t *)malloc(sizeof(stress_loop_t) * loopCount);
+    memset(loops, 0, sizeof(stress_loop_t) * loopCount);
+
+    stress_report_t report;
+    memset(&report, 0, sizeof(stress_report_t));
+    report.loops = loops;
+    report.loopCount = loopCount;
+    report.start = uv_now(loop);
+    report.lastTime = report.start;
+    report.deadline = report.start + (uint64_t)seconds * 1000;
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("Stressing %s%s (%s) for %us with %u loops of %u connections\n", directory, database, backend, seconds, loopCount, STRESS_CLIENTS);
+
+    for(i = 0; i < loopCount; i++)
+    {
+        uv_thread_create(&loops[i].thread, _loop_run, &loops[i]);
+    }
+
+    report.timer.data = &report;
+    uv_timer_init(loop, &report.timer);
+    uv_timer_start(&report.timer, _report_tick, seconds * 1000 < STRESS_REPORT_INTERVAL ? seconds * 1000 : STRESS_REPORT_INTERVAL, STRESS_REPORT_INTERVAL);
+
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    for(i = 0; i < loopCount; i++)
+    {
+        uv_thread_join(&loops[i].thread);
+        leftOpen += loops[i].leftOpen;
+    }
+
+    uv_walk(loop, _walk_cb, &leftOpen);
+
+    printf("queries %llu escapes %llu shared %llu cancelled %llu rows %llu connects %llu closes %llu errors %llu\n",
+        (unsigned long long)counters.queries, (unsigned long long)counters.escapes, (unsigned long long)counters.shared,
+        (unsigned long long)counters.cancels, (unsigned long long)counters.rows, (unsigned long long)counters.connects,
+        (unsigned long long)counters.closes, (unsigned long long)counters.errors);
+    printf("throughput %.1f -> %.1f ops/s, rss %+.1f MiB, heap %+.1f MiB since the first report\n",
+        report.firstRate, report.lastRate,
+        ((double)_rss() - (double)report.baseRss) / 1048576.0, ((double)_heap() - (double)report.baseHeap) / 1048576.0);
+
+    if(odbxuv_memory_used() != 0)
+    {
+        printf("Leaked %llu bytes of odbxuv memory\n", (unsigned long long)odbxuv_memory_used());
+        failed = 1;
+    }
+
+    if(leftOpen != 0)
+    {
+        printf("Left %u handles open\n", leftOpen);
+        failed = 1;
+    }
+
+    free(loops);
+    uv_loop_delete(loop);
+
+    return failed;
+}
@@ -0,0 +1,2571 @@
+#include "odbxuv/db.h"
+#include "odbxuv/pool.h"
+#include "odbxuv/router.h"
+#include "odbxuv/cursor.h"
+#include "odbxuv/scan.h"
+#include "odbxuv/aggregate.h"
+#include "odbxuv/stats.h"
+#include "odbxuv/slowlog.h"
+#include "odbxuv/serialize.h"
+#include "odbx_fake.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+#include "uv.h"
+
+/**
+ * Unit tests against the in memory backend of odbx_fake.c, see odbx_fake.h for the queries it answers.
+ * Every test opens its own connection or pool and runs the loop until it closed,
+ * afterwards no memory may be accounted and no handle or backend connection may be left open.
+ *
+ * Usage: odbxuv_units [test]
+ */
+
+typedef struct unit_test_s
+{
+    const char *name;
+    void (*run)(void);
+} unit_test_t;
+
+static uv_loop_t *loop;
+static odbxuv_connection_t connection;
+static odbxuv_connection_counters_t counters;
+
+/**
+ * Called once \p connection is connected
+ */
+static void (*ready)(void);
+
+/**
+ * The rows, errors and finished queries of the running test
+ */
+static long rows;
+static long lastId;
+static int errors;
+static int finished;
+
+static void _walk_cb(uv_handle_t *handle, void *data)
+{
+    printf("Still open: %lu %i\n", (unsigned long)handle, handle->type);
+    (*(unsigned int *)data)++;
+}
+
+static void _fill_credentials(odbxuv_op_connect_t *op)
+{
+    memset(op, 0, sizeof(odbxuv_op_connect_t));
+
+    op->backend = "fake";
+    op->host = "";
+    op->port = "";
+    op->database = "test";
+    op->user = "test";
+    op->password = "test";
+    op->method = ODBX_BIND_SIMPLE;
+}
+
+static void onConnect(odbxuv_op_connect_t *req, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+
+    odbxuv_free_handle((odbxuv_handle_t *)req);
+    free(req);
+
+    ready();
+}
+
+/**
+ * Connects \p connection and calls \p callback once it is connected.
+ */
+static void _unit_open(void (*callback)(void))
+{
+    odbxuv_op_connect_t *op = (odbxuv_op_connect_t *)malloc(sizeof(odbxuv_op_connect_t));
+    _fill_credentials(op);
+
+    rows = 0;
+    lastId = 0;
+    errors = 0;
+    finished = 0;
+    ready = callback;
+
+    odbxuv_init_connection(&connection, loop);
+    odbxuv_connect(&connection, op, onConnect);
+}
+
+static void onClose(odbxuv_handle_t *handle)
+{
+    if(handle->error != NULL)
+    {
+        odbxuv_free_error(handle);
+    }
+}
+
+/**
+ * Keeps the counters of \p connection and closes it.
+ */
+static void _unit_close(void)
+{
+    odbxuv_connection_counters(&connection, &counters);
+    odbxuv_close((odbxuv_handle_t *)&connection, onClose);
+}
+
+/**
+ * Checks that the ids of the rows follow each other.
+ */
+static void _unit_check_row(odbxuv_row_t *row)
+{
+    long id = atol(row->value[0]);
+
+    assert(id == lastId + 1);
+    lastId = id;
+    rows++;
+}
+
+/**
+ * Blocks the loop until the worker fetched \p total rows on \p connection.
+ */
+static void _unit_wait_fetched(uint64_t total)
+{
+    odbxuv_connection_counters_t fetched;
+
+    odbxuv_connection_counters(&connection, &fetched);
+
+    while(fetched.rowsFetched < total)
+    {
+        usleep(1000);
+        odbxuv_connection_counters(&connection, &fetched);
+    }
+}
+
+/**
+ * Submits a query with \p options, returns the result of the submit.
+ */
+static int _unit_query(const char *query, odbxuv_query_fetch_e flags, const odbxuv_query_config_t *config, odbxuv_op_query_cb callback)
+{
+    odbxuv_op_query_t *op = (odbxuv_op_query_t *)malloc(sizeof(odbxuv_op_query_t));
+    memset(op, 0, sizeof(odbxuv_op_query_t));
+
+    int result = odbxuv_query_ex(&connection, op, query, flags, config, callback);
+
+    if(result < ODBX_ERR_SUCCESS)
+    {
+        free(op);
+    }
+
+    return result;
+}
+
+static void _unit_free_query(odbxuv_op_query_t *op)
+{
+    if(op->error != NULL)
+    {
+        odbxuv_free_error((odbxuv_handle_t *)op);
+    }
+
+    odbxuv_free_handle((odbxuv_handle_t *)op);
+    free(op);
+}
+
+/*
+ * Coalesced wakeups: rows arrive in order and in far fewer wakeups than rows.
+ */
+
+static void onWakeupRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    if(row)
+    {
+        _unit_check_row(row);
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS);
+    _unit_free_query(op);
+    _unit_close();
+}
+
+static void onWakeupQuery(odbxuv_op_query_t *op, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+    odbxuv_query_process(op, onWakeupRow);
+}
+
+static void _wakeup_ready(void)
+{
+    assert(_unit_query("SELECT GEN 20000", ODBXUV_QUERY_FETCH_VALUE, NULL, onWakeupQuery) == ODBX_ERR_SUCCESS);
+}
+
+static void _test_wakeups(void)
+{
+    _unit_open(_wakeup_ready);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(rows == 20000);
+    assert(counters.rowsFetched == 20000);
+    assert(counters.queryWakeups >= 1);
+    assert(counters.rowWakeups > 0 && counters.rowWakeups < counters.rowsFetched / 8);
+}
+
+/*
+ * Recycling: a released operation is handed out again and keeps its buffers.
+ */
+
+static odbxuv_op_query_t *recycled;
+static void _recycle_next(void);
+
+static void onRecycleRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    if(row)
+    {
+        _unit_check_row(row);
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS);
+    assert(op->queryCapacity >= strlen("SELECT GEN 100") + 1);
+
+    odbxuv_op_query_release(op);
+    assert(connection.freeQueryCount == 1);
+
+    finished++;
+    lastId = 0;
+    _recycle_next();
+}
+
+static void onRecycleQuery(odbxuv_op_query_t *op, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+    odbxuv_query_process(op, onRecycleRow);
+}
+
+static void _recycle_next(void)
+{
+    if(finished == 3)
+    {
+        _unit_close();
+        return;
+    }
+
+    odbxuv_op_query_t *op = odbxuv_op_query_acquire(&connection);
+
+    //The free list hands out the released operation again
+    if(recycled != NULL)
+    {
+        assert(op == recycled);
+    }
+
+    recycled = op;
+    assert(odbxuv_query_recycled(&connection, op, "SELECT GEN 100", ODBXUV_QUERY_FETCH_VALUE, NULL, onRecycleQuery) == ODBX_ERR_SUCCESS);
+}
+
+static void _test_recycle(void)
+{
+    recycled = NULL;
+
+    _unit_open(_recycle_next);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(finished == 3 && rows == 300);
+}
+
+/*
+ * Pool: the startup connections open at once, idle connections are kept around and checked.
+ */
+
+static odbxuv_pool_t pool;
+static uv_timer_t poolTimer;
+static int poolPhase;
+static uint64_t poolFetched[3];
+static unsigned long poolConnects;
+static odbxuv_connection_t *poolCheckedOut;
+static void _pool_next(void);
+
+static void onPoolRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    if(row) return;
+
+    assert(status == ODBX_ERR_SUCCESS);
+    _unit_free_query(op);
+
+    if(++finished == 2)
+    {
+        _pool_next();
+    }
+}
+
+static void onPoolQuery(odbxuv_op_query_t *op, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+    odbxuv_query_process(op, onPoolRow);
+}
+
+/**
+ * Runs a query on the pool, returns the connection it went to.
+ */
+static odbxuv_connection_t *_pool_query(const char *query)
+{
+    odbxuv_op_query_t *op = (odbxuv_op_query_t *)malloc(sizeof(odbxuv_op_query_t));
+    memset(op, 0, sizeof(odbxuv_op_query_t));
+
+    assert(odbxuv_pool_query(&pool, op, query, ODBXUV_QUERY_FETCH_VALUE, onPoolQuery) == ODBX_ERR_SUCCESS);
+
+    return op->connection;
+}
+
+static void onPoolClose(odbxuv_pool_t *p)
+{
+}
+
+static void onPoolReplaced(uv_timer_t *timer)
+{
+    //The connection that lost the keepalive was closed and opened again
+    if(odbx_fake_connects() == poolConnects || pool.readyCount < 3) return;
+
+    assert(odbx_fake_connects() == poolConnects + 1);
+    assert(odbx_fake_connections() == 3);
+
+    poolPhase++;
+    uv_close((uv_handle_t *)&poolTimer, NULL);
+    odbxuv_pool_close(&pool, onPoolClose);
+}
+
+static void onPoolKeepalive(uv_timer_t *timer)
+{
+    _pool_next();
+}
+
+static void _pool_next(void)
+{
+    odbxuv_connection_counters_t slotCounters;
+    odbxuv_connection_t *first;
+    unsigned int i;
+
+    switch(poolPhase++)
+    {
+        case 0:
+            assert(pool.readyCount == 2 && pool.openCount == 2);
+            assert(odbx_fake_connections() == 2);
+
+            //A busy connection leaves one idle, so the pool opens the third
+            pool.minIdle = 2;
+            first = _pool_query("SELECT SLEEP 100 GEN 1");
+            assert(pool.openCount == 3);
+            assert(_pool_query("SELECT SLEEP 100 GEN 1") != first);
+            break;
+
+        case 1:
+            assert(pool.readyCount == 3);
+
+            poolCheckedOut = odbxuv_pool_checkout(&pool);
+            assert(poolCheckedOut != NULL);
+
+            for(i = 0; i < pool.maxConnections; i++)
+            {
+                odbxuv_connection_counters(&pool.slots[i].connection, &slotCounters);
+                poolFetched[i] = slotCounters.rowsFetched;
+            }
+
+            uv_timer_start(&poolTimer, onPoolKeepalive, 150, 0);
+            break;
+
+        case 2:
+            //Only the idle connections were checked
+            for(i = 0; i < pool.maxConnections; i++)
+            {
+                odbxuv_connection_counters(&pool.slots[i].connection, &slotCounters);
+
+                if(&pool.slots[i].connection == poolCheckedOut)
+                {
+                    assert(slotCounters.rowsFetched == poolFetched[i]);
+                }
+                else
+                {
+                    assert(slotCounters.rowsFetched > poolFetched[i]);
+                }
+            }
+
+            odbxuv_pool_return(&pool, poolCheckedOut);
+
+            //The next keepalive loses its connection
+            poolConnects = odbx_fake_connects();
+            odbx_fake_drop(1);
+            uv_timer_start(&poolTimer, onPoolReplaced, 10, 10);
+            break;
+    }
+}
+
+static void onPoolStart(odbxuv_pool_t *p, int status)
+{
+    if(poolPhase < 0)
+    {
+        //Every startup connection failed
+        assert(status < ODBX_ERR_SUCCESS);
+        assert(pool.readyCount == 0);
+
+        poolPhase++;
+        odbxuv_pool_close(&pool, onPoolClose);
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS);
+    _pool_next();
+}
+
+static void _test_pool(void)
+{
+    odbxuv_op_connect_t op;
+    _fill_credentials(&op);
+
+    poolPhase = -1;
+    finished = 0;
+
+    odbx_fake_fail_connects(2);
+    odbxuv_pool_init(&pool, loop, 2);
+    pool.minConnections = 2;
+    odbxuv_pool_start(&pool, &op, onPoolStart);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(poolPhase == 0);
+
+    odbxuv_pool_init(&pool, loop, 3);
+    pool.minConnections = 2;
+    pool.keepaliveInterval = 20;
+    pool.keepaliveQuery = "SELECT GEN 1";
+    uv_timer_init(loop, &poolTimer);
+
+    odbxuv_pool_start(&pool, &op, onPoolStart);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(poolPhase == 4);
+}
+
+/*
+ * Reconnect: idempotent queries are replayed after the connection was lost, others fail.
+ */
+
+static int replayPhase;
+static void _replay_submit(void);
+
+static void onReplayRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    if(row)
+    {
+        rows++;
+        return;
+    }
+
+    _unit_free_query(op);
+
+    if(++finished < 3) return;
+
+    if(replayPhase == 0)
+    {
+        assert(rows == 30 && errors == 0);
+    }
+    else
+    {
+        assert(rows == 20 && errors == 1);
+    }
+
+    replayPhase++;
+    _replay_submit();
+}
+
+static void onReplayQuery(odbxuv_op_query_t *op, int status)
+{
+    if(status < ODBX_ERR_SUCCESS)
+    {
+        errors++;
+        onReplayRow(op, NULL, status);
+        return;
+    }
+
+    odbxuv_query_process(op, onReplayRow);
+}
+
+static void _replay_submit(void)
+{
+    odbxuv_query_config_t config;
+    int i;
+
+    if(replayPhase == 2)
+    {
+        _unit_close();
+        return;
+    }
+
+    memset(&config, 0, sizeof(odbxuv_query_config_t));
+    config.options = replayPhase == 0 ? ODBXUV_QUERY_IDEMPOTENT : 0;
+
+    rows = 0;
+    errors = 0;
+    finished = 0;
+
+    //The first query finds the connection lost
+    odbx_fake_drop(1);
+
+    for(i = 0; i < 3; i++)
+    {
+        assert(_unit_query("SELECT GEN 10", ODBXUV_QUERY_FETCH_VALUE, &config, onReplayQuery) == ODBX_ERR_SUCCESS);
+    }
+}
+
+static void _replay_ready(void)
+{
+    connection.reconnect.maxAttempts = 3;
+    connection.reconnect.baseDelay = 10;
+
+    _replay_submit();
+}
+
+static void _test_reconnect(void)
+{
+    replayPhase = 0;
+
+    _unit_open(_replay_ready);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(replayPhase == 2);
+}
+
+/*
+ * Pool loops: another thread runs queries on the pool, its own loop gets their callbacks and rows.
+ */
+
+#define UNIT_REMOTE_QUERIES 4
+
+static odbxuv_pool_t emptyPool;
+static odbxuv_pool_loop_t remotePoolLoop;
+static odbxuv_pool_loop_t emptyPoolLoop;
+static uv_loop_t remoteLoop;
+static uv_thread_t remoteThread;
+static uv_thread_t mainThread;
+static uv_async_t remoteDone;
+static odbxuv_connection_t *remoteConnections[UNIT_REMOTE_QUERIES];
+static int remoteStarted;
+static int remoteFinished;
+
+/**
+ * Checks that a callback runs on the thread of the pool loop.
+ */
+static void _remote_check_thread(void)
+{
+    uv_thread_t self = uv_thread_self();
+
+    assert(!uv_thread_equal(&self, &mainThread));
+}
+
+static void onRemoteRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    long received = (long)op->data;
+
+    _remote_check_thread();
+
+    if(row)
+    {
+        assert(atol(row->value[0]) == received + 1);
+        op->data = (void *)(received + 1);
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS && received == 2000);
+    _unit_free_query(op);
+
+    if(++remoteFinished == UNIT_REMOTE_QUERIES)
+    {
+        odbxuv_pool_loop_close(&remotePoolLoop, NULL);
+    }
+}
+
+static void onRemoteQuery(odbxuv_op_query_t *op, int status)
+{
+    _remote_check_thread();
+    assert(status == ODBX_ERR_SUCCESS);
+
+    remoteConnections[remoteStarted++] = op->connection;
+    op->data = (void *)0;
+    odbxuv_query_process(op, onRemoteRow);
+}
+
+static void onEmptyQuery(odbxuv_op_query_t *op, int status)
+{
+    _remote_check_thread();
+
+    //A pool without connections does not start the query
+    assert(status == ODBXUV_ERR_NOCONNECTION && op->error == NULL);
+    free(op);
+
+    odbxuv_pool_loop_close(&emptyPoolLoop, NULL);
+}
+
+/**
+ * Runs on its own thread until both pool loops closed.
+ */
+static void _remote_run(void *arg)
+{
+    odbxuv_op_query_t *op;
+    int i;
+
+    uv_loop_init(&remoteLoop);
+    odbxuv_pool_loop_init(&remotePoolLoop, &pool, &remoteLoop);
+    odbxuv_pool_loop_init(&emptyPoolLoop, &emptyPool, &remoteLoop);
+
+    for(i = 0; i < UNIT_REMOTE_QUERIES; i++)
+    {
+        op = (odbxuv_op_query_t *)malloc(sizeof(odbxuv_op_query_t));
+        memset(op, 0, sizeof(odbxuv_op_query_t));
+        assert(odbxuv_pool_loop_query(&remotePoolLoop, op, "SELECT SLEEP 20 GEN 2000", ODBXUV_QUERY_FETCH_VALUE, onRemoteQuery) == ODBX_ERR_SUCCESS);
+    }
+
+    op = (odbxuv_op_query_t *)malloc(sizeof(odbxuv_op_query_t));
+    memset(op, 0, sizeof(odbxuv_op_query_t));
+    assert(odbxuv_pool_loop_query(&emptyPoolLoop, op, "SELECT GEN 2000", ODBXUV_QUERY_FETCH_VALUE, onEmptyQuery) == ODBX_ERR_SUCCESS);
+
+    uv_run(&remoteLoop, UV_RUN_DEFAULT);
+    assert(uv_loop_close(&remoteLoop) == 0);
+
+    uv_async_send(&remoteDone);
+}
+
+static void onRemoteDone(uv_async_t *handle)
+{
+    int i;
+
+    uv_thread_join(&remoteThread);
+    uv_close((uv_handle_t *)&remoteDone, NULL);
+
+    assert(remoteFinished == UNIT_REMOTE_QUERIES);
+
+    //The queries were spread over the connections
+    for(i = 1; i < UNIT_REMOTE_QUERIES; i++)
+    {
+        if(remoteConnections[i] != remoteConnections[0]) break;
+    }
+
+    assert(i < UNIT_REMOTE_QUERIES);
+
+    odbxuv_pool_close(&pool, onPoolClose);
+    odbxuv_pool_close(&emptyPool, onPoolClose);
+}
+
+static void onRemotePoolStart(odbxuv_pool_t *p, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+
+    uv_async_init(loop, &remoteDone, onRemoteDone);
+    uv_thread_create(&remoteThread, _remote_run, NULL);
+}
+
+static void _test_loops(void)
+{
+    odbxuv_op_connect_t op;
+    _fill_credentials(&op);
+
+    remoteStarted = 0;
+    remoteFinished = 0;
+    memset(remoteConnections, 0, sizeof(remoteConnections));
+    mainThread = uv_thread_self();
+
+    odbxuv_pool_init(&emptyPool, loop, 1);
+
+    odbxuv_pool_init(&pool, loop, 2);
+    pool.minConnections = 2;
+    odbxuv_pool_start(&pool, &op, onRemotePoolStart);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(remoteFinished == UNIT_REMOTE_QUERIES);
+}
+
+/*
+ * Router: reads go to a replica, writes and transactions to the primary, a lost transaction fails.
+ */
+
+static odbxuv_pool_t primary;
+static odbxuv_pool_t replica;
+static odbxuv_router_t router;
+static uv_timer_t routerTimer;
+static int routerPhase;
+static int routerPending;
+static void _router_next(void);
+
+/**
+ * The pool a query was sent to
+ */
+static odbxuv_pool_t *_router_pool_of(odbxuv_op_query_t *op)
+{
+    return ((odbxuv_pool_slot_t *)op->connection->data)->pool;
+}
+
+static void _router_done(odbxuv_op_query_t *op)
+{
+    _unit_free_query(op);
+
+    if(--routerPending == 0)
+    {
+        routerPhase++;
+        _router_next();
+    }
+}
+
+static void onRouterRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    if(row) return;
+
+    assert(status == ODBX_ERR_SUCCESS);
+    _router_done(op);
+}
+
+static void onRouterQuery(odbxuv_op_query_t *op, int status)
+{
+    if(status < ODBX_ERR_SUCCESS)
+    {
+        //Only statements of the lost transaction fail
+        assert(status == ODBXUV_ERR_NOCONNECTION);
+        errors++;
+        _router_done(op);
+        return;
+    }
+
+    odbxuv_query_process(op, onRouterRow);
+}
+
+/**
+ * Routes a query, returns the result of the submit and the queued operation in \p queued.
+ */
+static int _router_submit(const char *query, int options, odbxuv_op_query_t **queued)
+{
+    odbxuv_query_config_t config;
+    memset(&config, 0, sizeof(odbxuv_query_config_t));
+    config.options = options;
+
+    odbxuv_op_query_t *op = (odbxuv_op_query_t *)malloc(sizeof(odbxuv_op_query_t));
+    memset(op, 0, sizeof(odbxuv_op_query_t));
+
+    int result = odbxuv_router_query_ex(&router, op, query, ODBXUV_QUERY_FETCH_VALUE, &config, onRouterQuery);
+
+    if(result != ODBX_ERR_SUCCESS)
+    {
+        free(op);
+        op = NULL;
+    }
+    else
+    {
+        routerPending++;
+    }
+
+    if(queued != NULL) *queued = op;
+    return result;
+}
+
+/**
+ * Routes a query that has to give \p expected, returns the operation when it was queued.
+ */
+static odbxuv_op_query_t *_router_query(const char *query, int options, int expected)
+{
+    odbxuv_op_query_t *op;
+
+    assert(_router_submit(query, options, &op) == expected);
+
+    return op;
+}
+
+static void onRouterTimer(uv_timer_t *timer)
+{
+    //The pin expired
+    assert(_router_pool_of(_router_query("SELECT GEN 3", 0, ODBX_ERR_SUCCESS)) == &replica);
+    assert(_router_pool_of(_router_query("SELECT share FROM quotes GEN 3", 0, ODBX_ERR_SUCCESS)) == &replica);
+}
+
+static void onRouterPoolClose(odbxuv_pool_t *pool)
+{
+}
+
+static void _router_next(void)
+{
+    odbxuv_op_query_t *op;
+    odbxuv_connection_t *connection;
+
+    switch(routerPhase)
+    {
+        case 0:
+            assert(odbxuv_router_classify("SELECT id FROM t") == ODBXUV_STATEMENT_READ);
+            assert(odbxuv_router_classify("UPDATE t SET a = 1") == ODBXUV_STATEMENT_WRITE);
+
+            assert(_router_pool_of(_router_query("SELECT GEN 3", 0, ODBX_ERR_SUCCESS)) == &replica);
+            assert(_router_pool_of(_router_query("INSERT INTO t VALUES (1)", 0, ODBX_ERR_SUCCESS)) == &primary);
+
+            //Reads see the write for a while
+            assert(_router_pool_of(_router_query("SELECT GEN 3", 0, ODBX_ERR_SUCCESS)) == &primary);
+            assert(_router_pool_of(_router_query("SELECT GEN 3", ODBXUV_QUERY_PRIMARY, ODBX_ERR_SUCCESS)) == &primary);
+            break;
+
+        case 1:
+            uv_timer_start(&routerTimer, onRouterTimer, router.pinInterval + 10, 0);
+            break;
+
+        case 2:
+            op = _router_query("BEGIN", 0, ODBX_ERR_SUCCESS);
+            assert(router.transaction == op->connection);
+            assert(((odbxuv_pool_slot_t *)op->connection->data)->checkedOut);
+
+            //The pool no longer hands out the connection of the transaction
+            connection = odbxuv_pool_checkout(&primary);
+            assert(connection != NULL && connection != router.transaction);
+            assert(odbxuv_pool_checkout(&primary) == NULL);
+            odbxuv_pool_return(&primary, connection);
+            assert(odbxuv_pool_get(&primary) == connection);
+
+            assert(_router_query("SELECT GEN 3", 0, ODBX_ERR_SUCCESS)->connection == router.transaction);
+            assert(_router_query("UPDATE t SET a = 1", 0, ODBX_ERR_SUCCESS)->connection == router.transaction);
+
+            connection = router.transaction;
+            assert(_router_query("COMMIT", 0, ODBX_ERR_SUCCESS)->connection == connection);
+            assert(router.transaction == NULL && !((odbxuv_pool_slot_t *)connection->data)->checkedOut);
+            break;
+
+        case 3:
+            op = _router_query("BEGIN", 0, ODBX_ERR_SUCCESS);
+            break;
+
+        case 4:
+            //The first statement loses the connection, after the reconnect neither may run without the BEGIN
+            odbx_fake_drop(1);
+            _router_query("UPDATE t SET a = 1", ODBXUV_QUERY_IDEMPOTENT, ODBX_ERR_SUCCESS);
+
+            //Refused right away once the worker noticed
+            if(_router_submit("UPDATE t SET b = 1", 0, NULL) != ODBX_ERR_SUCCESS)
+            {
+                errors++;
+            }
+            break;
+
+        case 5:
+            assert(errors == 2);
+
+            _router_query("UPDATE t SET c = 1", 0, ODBXUV_ERR_NOCONNECTION);
+            assert(router.transaction == NULL && router.transactionLost);
+
+            _router_query("ROLLBACK", 0, ODBXUV_ERR_NOCONNECTION);
+            assert(!router.transactionLost);
+
+            assert(_router_pool_of(_router_query("INSERT INTO t VALUES (2)", 0, ODBX_ERR_SUCCESS)) == &primary);
+            break;
+
+        default:
+            odbxuv_router_free(&router);
+            uv_close((uv_handle_t *)&routerTimer, NULL);
+            odbxuv_pool_close(&primary, onRouterPoolClose);
+            odbxuv_pool_close(&replica, onRouterPoolClose);
+            break;
+    }
+}
+
+static void onRouterPoolStart(odbxuv_pool_t *pool, int status)
+{
+    unsigned int i;
+
+    assert(status == ODBX_ERR_SUCCESS);
+
+    if(++finished < 2) return;
+
+    for(i = 0; i < primary.maxConnections; i++)
+    {
+        primary.slots[i].connection.reconnect.maxAttempts = 3;
+        primary.slots[i].connection.reconnect.baseDelay = 10;
+    }
+
+    _router_next();
+}
+
+static void _test_router(void)
+{
+    odbxuv_pool_t *replicas[] = { &replica };
+    odbxuv_op_connect_t op;
+    _fill_credentials(&op);
+
+    routerPhase = 0;
+    routerPending = 0;
+    errors = 0;
+    finished = 0;
+
+    odbxuv_pool_init(&primary, loop, 2);
+    primary.minConnections = 2;
+    odbxuv_pool_init(&replica, loop, 1);
+
+    odbxuv_router_init(&router, &primary, replicas, 1);
+    router.pinInterval = 50;
+    uv_timer_init(loop, &routerTimer);
+
+    odbxuv_pool_start(&primary, &op, onRouterPoolStart);
+    odbxuv_pool_start(&replica, &op, onRouterPoolStart);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(routerPhase == 6);
+}
+
+/*
+ * Statistics: the worker records every query under the fingerprint of its normalised text.
+ */
+
+static const char *const statsQueries[] =
+{
+    "SELECT GEN 100 LIMIT 10",
+    "select  GEN 100\n LIMIT 20 -- again",
+    "SELECT COLS2 GEN 5",
+    "SELECT GEN 3 FROM other",
+
+    //The table is full, it counts for the other queries
+    "SELECT GEN 3 FAIL"
+};
+
+static odbxuv_stats_t stats;
+static void _stats_submit(void);
+
+/**
+ * The entry of the normalised query \p text in \p entries.
+ */
+static odbxuv_stats_entry_t *_stats_find(odbxuv_stats_entry_t *entries, unsigned int count, const char *text)
+{
+    unsigned int i;
+    for(i = 0; i < count; i++)
+    {
+        if(strcmp(entries[i].text, text) == 0) return &entries[i];
+    }
+
+    return NULL;
+}
+
+static void onStatsRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    if(row) return;
+
+    assert(status == ODBX_ERR_SUCCESS);
+    _unit_free_query(op);
+    _stats_submit();
+}
+
+static void onStatsQuery(odbxuv_op_query_t *op, int status)
+{
+    if(status < ODBX_ERR_SUCCESS)
+    {
+        errors++;
+        _unit_free_query(op);
+        _unit_close();
+        return;
+    }
+
+    odbxuv_query_process(op, onStatsRow);
+}
+
+static void _stats_submit(void)
+{
+    assert(_unit_query(statsQueries[finished++], ODBXUV_QUERY_FETCH_VALUE, NULL, onStatsQuery) == ODBX_ERR_SUCCESS);
+}
+
+static void _stats_ready(void)
+{
+    connection.stats = &stats;
+    _stats_submit();
+}
+
+static void _test_stats(void)
+{
+    odbxuv_stats_entry_t entries[8];
+    odbxuv_stats_entry_t *entry;
+    char normalised[ODBXUV_STATS_TEXT_SIZE];
+    char line[ODBXUV_STATS_TEXT_SIZE * 2];
+    unsigned int count;
+    unsigned int lines;
+    unsigned int i, j;
+    uint64_t calls;
+    FILE *dump;
+
+    //Literals, lists, spacing, comments and case don't make queries different
+    uint64_t fingerprint = odbxuv_query_fingerprint("SELECT * FROM t WHERE id = 5 AND name = 'x'", normalised, sizeof(normalised));
+    assert(strcmp(normalised, "select * from t where id = ? and name = ?") == 0);
+    assert(odbxuv_query_fingerprint("select *\n  from T /* all */ where ID=7 and name='it''s'", NULL, 0) == fingerprint);
+    assert(odbxuv_query_fingerprint("SELECT * FROM t WHERE id = 5 AND other = 'x'", NULL, 0) != fingerprint);
+
+    fingerprint = odbxuv_query_fingerprint("SELECT a FROM t WHERE id IN (1, 2, 3)", normalised, sizeof(normalised));
+    assert(strcmp(normalised, "select a from t where id in (...)") == 0);
+    assert(odbxuv_query_fingerprint("SELECT a FROM t WHERE id IN ($1)", NULL, 0) == fingerprint);
+
+    odbxuv_query_fingerprint("INSERT INTO t VALUES (1, 'a'), (2, NULL)", normalised, sizeof(normalised));
+    assert(strcmp(normalised, "insert into t values (...)") == 0);
+
+    //A short buffer cuts the text, not the fingerprint
+    assert(odbxuv_query_fingerprint("SELECT a FROM t WHERE id IN (4)", normalised, 8) == fingerprint);
+    assert(strcmp(normalised, "select ") == 0);
+
+    odbxuv_stats_init(&stats, 3);
+
+    _unit_open(_stats_ready);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(finished == 5 && errors == 1);
+    assert(stats.count == 3);
+
+    count = odbxuv_stats_snapshot(&stats, entries, 8);
+    assert(count == 4);
+
+    for(i = 0; i < count; i++)
+    {
+        if(i > 0) assert(entries[i].totalTime <= entries[i - 1].totalTime);
+
+        calls = 0;
+        for(j = 0; j < ODBXUV_STATS_BUCKETS; j++)
+        {
+            calls += entries[i].histogram[j];
+        }
+
+        assert(calls == entries[i].calls);
+        assert(entries[i].maxTime <= entries[i].totalTime);
+    }
+
+    entry = _stats_find(entries, count, "select gen ? limit ?");
+    assert(entry != NULL && entry->calls == 2 && entry->rows == 30 && entry->errors == 0);
+
+    entry = _stats_find(entries, count, "select cols2 gen ?");
+    assert(entry != NULL && entry->calls == 1 && entry->rows == 5);
+
+    entry = _stats_find(entries, count, "<other>");
+    assert(entry != NULL && entry->fingerprint == 0 && entry->calls == 1 && entry->errors == 1);
+
+    //A header and a line per entry
+    dump = tmpfile();
+    odbxuv_stats_dump(&stats, dump);
+    rewind(dump);
+
+    lines = 0;
+    while(fgets(line, sizeof(line), dump) != NULL)
+    {
+        lines++;
+    }
+
+    assert(lines == count + 1);
+    fclose(dump);
+
+    odbxuv_stats_reset(&stats);
+    assert(stats.count == 0 && odbxuv_stats_snapshot(&stats, entries, 8) == 0);
+
+    odbxuv_stats_free(&stats);
+}
+
+/*
+ * Slow query log: slow queries go through the ring to the file, the ring drops what does not fit.
+ */
+
+static const char *const slowlogQueries[] =
+{
+    "SELECT SLEEP 10 GEN 3 WHERE name = 'secret'",
+
+    //Below the threshold
+    "SELECT GEN 3",
+
+    "SELECT FAIL"
+};
+
+static odbxuv_slowlog_t slowlog;
+static void _slowlog_submit(void);
+
+static void onSlowlogClose(odbxuv_slowlog_t *log)
+{
+}
+
+static void onSlowlogRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    if(row) return;
+
+    assert(status == ODBX_ERR_SUCCESS);
+    _unit_free_query(op);
+    _slowlog_submit();
+}
+
+static void onSlowlogQuery(odbxuv_op_query_t *op, int status)
+{
+    if(status < ODBX_ERR_SUCCESS)
+    {
+        errors++;
+        _unit_free_query(op);
+        _unit_close();
+
+        //The worker recorded every query before running its callback
+        odbxuv_slowlog_close(&slowlog, onSlowlogClose);
+        return;
+    }
+
+    odbxuv_query_process(op, onSlowlogRow);
+}
+
+static void _slowlog_submit(void)
+{
+    //The backend fails right away, without waiting
+    if(finished == 2) slowlog.threshold = 0;
+
+    assert(_unit_query(slowlogQueries[finished++], ODBXUV_QUERY_FETCH_VALUE, NULL, onSlowlogQuery) == ODBX_ERR_SUCCESS);
+}
+
+static void _slowlog_ready(void)
+{
+    connection.slowlog = &slowlog;
+    slowlog.redact = 1;
+
+    _slowlog_submit();
+}
+
+static void _test_slowlog(void)
+{
+    char path[] = "/tmp/odbxuv_slowlog_XXXXXX";
+    char line[ODBXUV_SLOWLOG_TEXT_SIZE + 256];
+    char connectionField[64];
+    unsigned int direct = 0;
+    unsigned int lines = 0;
+    int i;
+    FILE *file;
+
+    int fd = mkstemp(path);
+    assert(fd >= 0);
+    close(fd);
+
+    assert(odbxuv_slowlog_open(&slowlog, loop, path, 3) == 0);
+    slowlog.threshold = 5000;
+
+    assert(!odbxuv_slowlog_record(&slowlog, NULL, "SELECT 'fast'", 1000000, 1000000, 0, 0));
+
+    //A ring of four records, nothing writes them before the loop runs
+    for(i = 0; i < 5; i++)
+    {
+        odbxuv_slowlog_record(&slowlog, NULL, "SELECT 'direct'\tFROM\nt", 4000000, 1000000, 7, 0);
+    }
+
+    assert(slowlog.dropped == 1);
+
+    _unit_open(_slowlog_ready);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(finished == 3 && errors == 1);
+    assert(slowlog.dropped == 1 && slowlog.failed == 0);
+
+    //One line per record, the connection's with the literals redacted
+    snprintf(connectionField, sizeof(connectionField), "\tconnection=%p\t", (void *)&connection);
+
+    file = fopen(path, "r");
+    assert(file != NULL);
+
+    while(fgets(line, sizeof(line), file) != NULL)
+    {
+        lines++;
+        assert(strstr(line, "\tstatus=") != NULL && line[strlen(line) - 1] == '\n');
+
+        if(strstr(line, "execute_us=4000\tfetch_us=1000\trows=7\tstatus=ok\tSELECT 'direct' FROM t\n") != NULL)
+        {
+            direct++;
+            continue;
+        }
+
+        assert(strstr(line, connectionField) != NULL);
+        assert(strstr(line, "secret") == NULL);
+        assert(strstr(line, "\tstatus=ok\tselect sleep ? gen ? where name = ?\n") != NULL || strstr(line, "\tstatus=error\tselect fail\n") != NULL);
+    }
+
+    fclose(file);
+    unlink(path);
+
+    assert(direct == 4 && lines == 6);
+}
+
+/*
+ * Serializer: the worker writes the rows into the buffers and they read back the same.
+ */
+
+#define UNIT_SERIAL_BUFFERS 3
+#define UNIT_SERIAL_BUFFER_SIZE 4096
+
+static odbxuv_serializer_t serializer;
+static uv_buf_t serialBuffers[UNIT_SERIAL_BUFFERS];
+static char serialMemory[UNIT_SERIAL_BUFFERS][UNIT_SERIAL_BUFFER_SIZE];
+static unsigned int serialColumns;
+
+static void onSerialBuffer(odbxuv_op_query_t *op, const char *buffer, size_t length, int status)
+{
+    odbxuv_serial_reader_t reader;
+    const char *value;
+    size_t valueLength;
+    int result;
+
+    if(buffer == NULL)
+    {
+        assert(status == ODBX_ERR_SUCCESS && rows == 20000);
+
+        odbxuv_op_query_release(op);
+        _unit_close();
+        return;
+    }
+
+    //The first buffer starts with the columns
+    if(serialColumns == 0)
+    {
+        const char *name;
+        size_t nameLength;
+        int type;
+
+        assert(odbxuv_serial_reader_init(&reader, buffer, length, 0) == ODBX_ERR_SUCCESS);
+        serialColumns = reader.columnCount;
+        assert(serialColumns == 3);
+
+        assert(odbxuv_serial_read_column(&reader, &name, &nameLength, &type) == 1);
+        assert(nameLength == 2 && memcmp(name, "id", 2) == 0 && type == ODBX_TYPE_BIGINT);
+        while(odbxuv_serial_read_column(&reader, &name, &nameLength, &type) == 1);
+    }
+    else
+    {
+        assert(odbxuv_serial_reader_init(&reader, buffer, length, serialColumns) == ODBX_ERR_SUCCESS);
+    }
+
+    while((result = odbxuv_serial_read_row(&reader)) == 1)
+    {
+        assert(odbxuv_serial_read_value(&reader, &value, &valueLength) == 1);
+        assert(strtol(value, NULL, 10) == lastId + 1);
+        lastId++;
+        rows++;
+    }
+
+    assert(result == 0);
+}
+
+static void onSerialQuery(odbxuv_op_query_t *op, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+    odbxuv_query_process_serialized(op, onSerialBuffer);
+}
+
+static void _serial_ready(void)
+{
+    odbxuv_query_config_t config;
+    memset(&config, 0, sizeof(odbxuv_query_config_t));
+    config.serializer = &serializer;
+
+    odbxuv_op_query_t *op = odbxuv_op_query_acquire(&connection);
+    assert(odbxuv_query_recycled(&connection, op, "SELECT GEN 20000", ODBXUV_QUERY_FETCH_VALUE | ODBXUV_QUERY_FETCH_NAME | ODBXUV_QUERY_FETCH_TYPE, &config, onSerialQuery) == ODBX_ERR_SUCCESS);
+}
+
+static void _test_serializer(void)
+{
+    char buffer[64];
+    char *values[3] = { "1", NULL, "x" };
+    odbxuv_row_t row;
+    odbxuv_serial_reader_t reader;
+    const char *value;
+    size_t length;
+    unsigned int i;
+
+    for(i = 0; i < UNIT_SERIAL_BUFFERS; i++)
+    {
+        serialBuffers[i] = uv_buf_init(serialMemory[i], UNIT_SERIAL_BUFFER_SIZE);
+    }
+
+    odbxuv_serializer_init(&serializer, serialBuffers, UNIT_SERIAL_BUFFERS);
+    serialColumns = 0;
+
+    _unit_open(_serial_ready);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    odbxuv_serializer_free(&serializer);
+
+    //Rows held by the loop encode the same, NULL included
+    memset(&row, 0, sizeof(odbxuv_row_t));
+    row.value = values;
+
+    length = odbxuv_serialize_row(3, &row, buffer, sizeof(buffer));
+    assert(length > 0);
+    assert(odbxuv_serial_reader_init(&reader, buffer, length, 3) == ODBX_ERR_SUCCESS);
+    assert(odbxuv_serial_read_row(&reader) == 1);
+    assert(odbxuv_serial_read_value(&reader, &value, &length) == 1 && length == 1 && *value == '1');
+    assert(odbxuv_serial_read_value(&reader, &value, &length) == 0);
+    assert(odbxuv_serial_read_value(&reader, &value, &length) == 1 && length == 1 && *value == 'x');
+    assert(odbxuv_serial_read_row(&reader) == 0);
+}
+
+/*
+ * Spilling: rows beyond the threshold go to a file while the loop is busy and are replayed in order.
+ */
+
+static uv_timer_t delay;
+static odbxuv_op_query_t *delayed;
+
+static void onSpillRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    if(row)
+    {
+        _unit_check_row(row);
+        assert(row->value[1] != NULL && strncmp(row->value[1], "status", 6) == 0);
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS);
+    _unit_free_query(op);
+
+    uv_close((uv_handle_t *)&delay, NULL);
+    _unit_close();
+}
+
+static void onSpillDelay(uv_timer_t *timer)
+{
+    odbxuv_query_process(delayed, onSpillRow);
+}
+
+static void onSpillQuery(odbxuv_op_query_t *op, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+
+    //Let the worker fetch everything before the loop takes any row
+    delayed = op;
+    uv_timer_start(&delay, onSpillDelay, 300, 0);
+}
+
+static void _spill_ready(void)
+{
+    odbxuv_query_config_t config;
+    memset(&config, 0, sizeof(odbxuv_query_config_t));
+    config.spillThreshold = 256 * 1024;
+
+    uv_timer_init(loop, &delay);
+    assert(_unit_query("SELECT GEN 200000", ODBXUV_QUERY_FETCH_VALUE, &config, onSpillQuery) == ODBX_ERR_SUCCESS);
+}
+
+static void _test_spill(void)
+{
+    _unit_open(_spill_ready);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(rows == 200000);
+    assert(counters.rowsSpilled > 0);
+}
+
+/*
+ * Memory limits: a query over the limit of its connection pauses or fails.
+ */
+
+static int memoryPhase;
+static uint64_t memoryPeak;
+static void _memory_submit(void);
+
+static void onMemoryRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    uint64_t used = odbxuv_memory_used();
+    if(used > memoryPeak) memoryPeak = used;
+
+    if(row)
+    {
+        _unit_check_row(row);
+        return;
+    }
+
+    if(memoryPhase == 0)
+    {
+        //Paused below the limit, a batch over it at most
+        assert(status == ODBX_ERR_SUCCESS && rows == 100000);
+        assert(memoryPeak < 2 * connection.memoryLimit);
+    }
+    else
+    {
+        assert(status == ODBXUV_ERR_MEMORY && rows < 100000);
+    }
+
+    _unit_free_query(op);
+
+    memoryPhase++;
+    _memory_submit();
+}
+
+static void onMemoryDelay(uv_timer_t *timer)
+{
+    odbxuv_query_process(delayed, onMemoryRow);
+}
+
+static void onMemoryQuery(odbxuv_op_query_t *op, int status)
+{
+    //Without a delay the worker may exceed the limit before the query callback ran
+    if(memoryPhase == 1 && status == ODBXUV_ERR_MEMORY)
+    {
+        onMemoryRow(op, NULL, status);
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS);
+
+    delayed = op;
+    uv_timer_start(&delay, onMemoryDelay, 200, 0);
+}
+
+static void _memory_submit(void)
+{
+    odbxuv_query_config_t config;
+
+    if(memoryPhase == 2)
+    {
+        uv_close((uv_handle_t *)&delay, NULL);
+        _unit_close();
+        return;
+    }
+
+    memset(&config, 0, sizeof(odbxuv_query_config_t));
+    config.memoryPolicy = memoryPhase == 0 ? ODBXUV_MEMORY_PAUSE : ODBXUV_MEMORY_FAIL;
+
+    rows = 0;
+    lastId = 0;
+    memoryPeak = 0;
+
+    assert(_unit_query("SELECT GEN 100000", ODBXUV_QUERY_FETCH_VALUE | ODBXUV_QUERY_FETCH_NAME, &config, onMemoryQuery) == ODBX_ERR_SUCCESS);
+}
+
+static void _memory_ready(void)
+{
+    connection.memoryLimit = 200000;
+    uv_timer_init(loop, &delay);
+
+    _memory_submit();
+}
+
+static void _test_memory(void)
+{
+    memoryPhase = 0;
+
+    _unit_open(_memory_ready);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(memoryPhase == 2);
+}
+
+/*
+ * Column info: results of the same shape share it, a query may be freed after its connection closed.
+ */
+
+static const odbxuv_metadata_t *metadataFirst;
+static odbxuv_op_query_t *metadataKept;
+static void onMetadataQuery(odbxuv_op_query_t *op, int status);
+
+static void onMetadataRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    if(row) return;
+
+    assert(status == ODBX_ERR_SUCCESS);
+    assert(op->metadata != NULL && op->metadata->interned);
+    assert(strcmp(op->columns[1].name, "status") == 0 && op->columns[1].type == ODBX_TYPE_VARCHAR);
+
+    if(metadataFirst == NULL)
+    {
+        metadataFirst = op->metadata;
+        _unit_free_query(op);
+
+        assert(_unit_query("SELECT GEN 5", ODBXUV_QUERY_FETCH_VALUE | ODBXUV_QUERY_FETCH_NAME | ODBXUV_QUERY_FETCH_TYPE, NULL, onMetadataQuery) == ODBX_ERR_SUCCESS);
+        return;
+    }
+
+    assert(op->metadata == metadataFirst);
+    assert(connection.metadataCount == 1);
+
+    //Keep the query past the connection
+    metadataKept = op;
+    _unit_close();
+}
+
+static void onMetadataQuery(odbxuv_op_query_t *op, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+    odbxuv_query_process(op, onMetadataRow);
+}
+
+static void _metadata_ready(void)
+{
+    assert(_unit_query("SELECT GEN 5", ODBXUV_QUERY_FETCH_VALUE | ODBXUV_QUERY_FETCH_NAME | ODBXUV_QUERY_FETCH_TYPE, NULL, onMetadataQuery) == ODBX_ERR_SUCCESS);
+}
+
+static void _test_metadata(void)
+{
+    metadataFirst = NULL;
+    metadataKept = NULL;
+
+    _unit_open(_metadata_ready);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    //The column info stays with the query until it is freed
+    assert(metadataKept != NULL && strcmp(metadataKept->columns[0].name, "id") == 0);
+    assert(odbxuv_memory_used() > 0);
+    _unit_free_query(metadataKept);
+}
+
+/*
+ * Dictionary encoding: the rows of a query share the values of a column that repeat.
+ */
+
+static const char *dictionaryValues[3];
+
+static void onDictionaryRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    if(row)
+    {
+        long id = atol(row->value[0]);
+        char expected[32];
+
+        snprintf(expected, sizeof(expected), "status%ld", id % 3);
+        assert(strcmp(row->value[1], expected) == 0);
+
+        if(dictionaryValues[id % 3] == NULL)
+        {
+            dictionaryValues[id % 3] = row->value[1];
+        }
+
+        assert(row->value[1] == dictionaryValues[id % 3]);
+
+        _unit_check_row(row);
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS);
+    _unit_free_query(op);
+    _unit_close();
+}
+
+static void onDictionaryQuery(odbxuv_op_query_t *op, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+    odbxuv_query_process(op, onDictionaryRow);
+}
+
+static void _dictionary_ready(void)
+{
+    assert(_unit_query("SELECT GEN 3000", ODBXUV_QUERY_FETCH_VALUE | ODBXUV_QUERY_FETCH_DICTIONARY, NULL, onDictionaryQuery) == ODBX_ERR_SUCCESS);
+}
+
+static void _test_dictionary(void)
+{
+    memset(dictionaryValues, 0, sizeof(dictionaryValues));
+
+    _unit_open(_dictionary_ready);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(rows == 3000);
+}
+
+/*
+ * Chunks: the worker resizes the chunks to the bytes asked for, halving them while the loop lags.
+ */
+
+/**
+ * The width the worker measures for the rows with ids 10000 to 19999:
+ * five digits, "status" and one digit, the id times ten plus ".5", each with its terminating zero
+ */
+#define UNIT_CHUNK_ROW_WIDTH (sizeof(odbxuv_row_t) + 6 + 8 + 9)
+
+static unsigned long chunkSizes[ODBX_FAKE_CHUNKS];
+static int chunkPhase;
+static void _chunks_submit(void);
+
+static void onChunksRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    unsigned int count;
+    unsigned int reached = 0;
+    unsigned int i;
+
+    if(row)
+    {
+        //The loop holds on to the first rows while the worker fetches the others
+        if(chunkPhase == 1 && rows == 0) _unit_wait_fetched(20000);
+
+        _unit_check_row(row);
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS && rows == 10000);
+    _unit_free_query(op);
+
+    count = odbx_fake_chunks(chunkSizes, ODBX_FAKE_CHUNKS);
+    assert(count > 1);
+
+    switch(chunkPhase)
+    {
+        case 0:
+            assert(count == 14);
+
+            for(i = 0; i < count; i++)
+            {
+                assert(chunkSizes[i] == 1UL << i);
+            }
+            break;
+
+        case 1:
+            //Half of the 100 rows that take the bytes
+            assert(chunkSizes[0] == 1000);
+
+            for(i = 1; i < count; i++)
+            {
+                assert(chunkSizes[i] == 50);
+            }
+            break;
+
+        case 2:
+            //The first chunk fills the loop, once it caught up the chunks take the bytes again
+            assert(chunkSizes[0] == 1000);
+
+            for(i = 1; i < count; i++)
+            {
+                assert(chunkSizes[i] <= 100 && chunkSizes[i] <= chunkSizes[i - 1] * 2);
+                reached += chunkSizes[i] == 100;
+            }
+
+            assert(reached > 0);
+            break;
+    }
+
+    chunkPhase++;
+    _chunks_submit();
+}
+
+static void onChunksQuery(odbxuv_op_query_t *op, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+    odbxuv_query_process(op, onChunksRow);
+}
+
+static void _chunks_submit(void)
+{
+    odbxuv_query_config_t config;
+
+    memset(&config, 0, sizeof(odbxuv_query_config_t));
+
+    switch(chunkPhase)
+    {
+        case 0:
+            //Twice the chunk before up to the 8192 rows that take the bytes, the loop holds no more than that
+            config.chunkSize = 1;
+            config.chunkBytes = 8192 * UNIT_CHUNK_ROW_WIDTH;
+            break;
+
+        case 1:
+        case 2:
+            config.chunkSize = 1000;
+            config.chunkBytes = 100 * UNIT_CHUNK_ROW_WIDTH;
+            break;
+
+        default:
+            _unit_close();
+            return;
+    }
+
+    rows = 0;
+    lastId = 9999;
+
+    assert(_unit_query("SELECT GEN 19999 WHERE key >= 10000", ODBXUV_QUERY_FETCH_VALUE, &config, onChunksQuery) == ODBX_ERR_SUCCESS);
+}
+
+static void _chunks_ready(void)
+{
+    //Only the bytes decide
+    connection.notifyInterval = 0;
+    odbx_fake_chunks(chunkSizes, 0);
+
+    _chunks_submit();
+}
+
+static void _test_chunks(void)
+{
+    chunkPhase = 0;
+
+    _unit_open(_chunks_ready);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(chunkPhase == 3);
+}
+
+/*
+ * Cursor: the pages follow each other in key order.
+ */
+
+static odbxuv_cursor_t cursor;
+
+static void onCursorRows(odbxuv_cursor_t *cur, odbxuv_op_query_t *page, odbxuv_row_t *first, unsigned int count, int status)
+{
+    odbxuv_row_t *row;
+    unsigned int delivered = 0;
+
+    if(first)
+    {
+        for(row = first; row != NULL; row = row->next, delivered++)
+        {
+            _unit_check_row(row);
+        }
+
+        assert(delivered == count);
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS);
+    assert(cur->rowCount == 10500 && cur->pageCount == 11);
+
+    odbxuv_cursor_free(cur);
+    _unit_close();
+}
+
+static void _cursor_ready(void)
+{
+    odbxuv_cursor_init(&cursor, &connection, "SELECT GEN 10500 FROM t", NULL, "id");
+    cursor.pageSize = 1000;
+
+    assert(odbxuv_cursor_start(&cursor, onCursorRows) == ODBX_ERR_SUCCESS);
+}
+
+static void _test_cursor(void)
+{
+    _unit_open(_cursor_ready);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(rows == 10500);
+}
+
+/*
+ * Scan: merged partitions deliver their rows in key order, each on its own connection.
+ */
+
+static odbxuv_scan_t scan;
+static int scanPhase;
+static long scanSum;
+static void _scan_next(void);
+
+static void onScanRows(odbxuv_scan_t *s, odbxuv_op_query_t *partition, odbxuv_row_t *first, unsigned int count, int status)
+{
+    odbxuv_row_t *row;
+
+    if(first)
+    {
+        for(row = first; row != NULL; row = row->next)
+        {
+            long id = atol(row->value[0]);
+
+            assert(s->order != ODBXUV_SCAN_MERGED || id > lastId);
+            lastId = id;
+            scanSum += id;
+            rows++;
+        }
+
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS);
+    assert(rows == 50000 && scanSum == 50000L * 50001 / 2);
+
+    odbxuv_scan_free(s);
+
+    scanPhase++;
+    _scan_next();
+}
+
+static void onScanPoolClose(odbxuv_pool_t *p)
+{
+}
+
+static void _scan_next(void)
+{
+    rows = 0;
+    lastId = 0;
+    scanSum = 0;
+
+    if(scanPhase == 3)
+    {
+        //More merged partitions than connections would wait for each other
+        odbxuv_scan_init(&scan, &pool, "SELECT GEN 50000 FROM t", NULL, "id", 5);
+        scan.min = 1;
+        scan.max = 50001;
+        scan.order = ODBXUV_SCAN_MERGED;
+
+        assert(odbxuv_scan_start(&scan, onScanRows) == ODBXUV_ERR_NOCONNECTION);
+        odbxuv_scan_free(&scan);
+
+        odbxuv_pool_close(&pool, onScanPoolClose);
+        return;
+    }
+
+    odbxuv_scan_init(&scan, &pool, "SELECT GEN 50000 FROM t", NULL, "id", 4);
+    scan.min = 1;
+    scan.max = 50001;
+    scan.order = scanPhase == 0 ? ODBXUV_SCAN_UNORDERED : ODBXUV_SCAN_MERGED;
+    scan.partitionBy = scanPhase == 2 ? ODBXUV_SCAN_MODULO : ODBXUV_SCAN_RANGE;
+
+    assert(odbxuv_scan_start(&scan, onScanRows) == ODBX_ERR_SUCCESS);
+}
+
+static void onScanPoolStart(odbxuv_pool_t *p, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+    _scan_next();
+}
+
+static void _test_scan(void)
+{
+    odbxuv_op_connect_t op;
+    _fill_credentials(&op);
+
+    scanPhase = 0;
+
+    odbxuv_pool_init(&pool, loop, 4);
+    pool.minConnections = 4;
+    odbxuv_pool_start(&pool, &op, onScanPoolStart);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(scanPhase == 3);
+}
+
+/*
+ * Aggregation: the worker groups the rows or keeps the top ones.
+ */
+
+static odbxuv_aggregate_t aggregate;
+static int aggregatePhase;
+static long aggregateSum;
+static void _aggregate_submit(void);
+
+static void onAggregateRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    if(row)
+    {
+        if(aggregatePhase == 0)
+        {
+            //status, COUNT(*), SUM(id)
+            long count = atol(row->value[1]);
+            assert(strncmp(row->value[0], "status", 6) == 0 && (count == 333 || count == 334));
+            aggregateSum += atol(row->value[2]);
+        }
+        else if(aggregatePhase == 1)
+        {
+            //The highest ids first
+            assert(atol(row->value[0]) == 1000 - rows);
+        }
+        else
+        {
+            //SUM(id), AVG(id), SUM(val) of the ids from 2^53 + 1 to 2^53 + 4, above the integers a double holds
+            double total = 4 * 90071992547409920.0 + 102;
+            double difference = strtod(row->value[2], NULL) - total;
+            assert(strcmp(row->value[0], "36028797018963978") == 0);
+            assert(strcmp(row->value[1], "9007199254740994.5") == 0);
+            assert(difference < total * 1e-15 && difference > -total * 1e-15);
+        }
+
+        rows++;
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS);
+
+    if(aggregatePhase == 0)
+    {
+        assert(rows == 3 && op->columnCount == 3 && aggregateSum == 1000L * 1001 / 2);
+    }
+    else if(aggregatePhase == 1)
+    {
+        assert(rows == 5 && op->columnCount == 3);
+    }
+    else
+    {
+        assert(rows == 1 && op->columnCount == 3);
+    }
+
+    _unit_free_query(op);
+    odbxuv_aggregate_free(&aggregate);
+
+    aggregatePhase++;
+    _aggregate_submit();
+}
+
+static void onAggregateQuery(odbxuv_op_query_t *op, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+    odbxuv_query_process(op, onAggregateRow);
+}
+
+static void _aggregate_submit(void)
+{
+    static const unsigned int groups[] = { 1 };
+    static const odbxuv_aggregate_column_t functions[] = { { ODBXUV_AGGREGATE_COUNT, ODBXUV_AGGREGATE_ALL }, { ODBXUV_AGGREGATE_SUM, 0 } };
+    static const odbxuv_aggregate_column_t totals[] = { { ODBXUV_AGGREGATE_SUM, 0 }, { ODBXUV_AGGREGATE_AVG, 0 }, { ODBXUV_AGGREGATE_SUM, 2 } };
+    const char *query = "SELECT GEN 1000";
+    odbxuv_query_config_t config;
+
+    if(aggregatePhase == 3)
+    {
+        _unit_close();
+        return;
+    }
+
+    rows = 0;
+    aggregateSum = 0;
+
+    if(aggregatePhase == 0)
+    {
+        odbxuv_aggregate_group_init(&aggregate, groups, 1, functions, 2);
+    }
+    else if(aggregatePhase == 1)
+    {
+        odbxuv_aggregate_top_init(&aggregate, 2, 5, 1);
+    }
+    else
+    {
+        odbxuv_aggregate_group_init(&aggregate, NULL, 0, totals, 3);
+        query = "SELECT GEN 9007199254740996 WHERE key >= 9007199254740993";
+    }
+
+    memset(&config, 0, sizeof(odbxuv_query_config_t));
+    config.aggregate = &aggregate;
+
+    assert(_unit_query(query, ODBXUV_QUERY_FETCH_VALUE, &config, onAggregateQuery) == ODBX_ERR_SUCCESS);
+}
+
+static void _test_aggregate(void)
+{
+    memset(&aggregate, 0, sizeof(odbxuv_aggregate_t));
+    aggregatePhase = 0;
+
+    _unit_open(_aggregate_submit);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(aggregatePhase == 3);
+}
+
+/*
+ * Row hooks: the worker drops and rewrites rows or emits structs of its own instead of their values.
+ */
+
+typedef struct unit_hook_item_s
+{
+    long id;
+    double val;
+} unit_hook_item_t;
+
+static int hookPhase;
+static int hookEmitted;
+static int hookFreed;
+static void _hooks_submit(void);
+
+/**
+ * Keeps the odd ids with another status and without val.
+ */
+static odbxuv_row_hook_e onHookFilter(odbxuv_op_query_t *op, unsigned int columnCount, const char **values, unsigned long *lengths, void **user)
+{
+    if(atol(values[0]) % 2 == 0) return ODBXUV_ROW_DROP;
+
+    values[1] = "odd";
+    lengths[1] = 3;
+    values[2] = NULL;
+
+    return ODBXUV_ROW_COPY;
+}
+
+/**
+ * Emits the ids divisible by 3 as a struct, copies the others.
+ */
+static odbxuv_row_hook_e onHookEmit(odbxuv_op_query_t *op, unsigned int columnCount, const char **values, unsigned long *lengths, void **user)
+{
+    long id = atol(values[0]);
+
+    if(id % 3 != 0) return ODBXUV_ROW_COPY;
+
+    unit_hook_item_t *item = (unit_hook_item_t *)malloc(sizeof(unit_hook_item_t));
+    item->id = id;
+    item->val = atof(values[2]);
+    *user = item;
+
+    return ODBXUV_ROW_EMIT;
+}
+
+/**
+ * Runs on the worker for reused rows and on the loop when the rows are freed.
+ */
+static void onHookFree(odbxuv_op_query_t *op, void *user)
+{
+    free(user);
+    __atomic_add_fetch(&hookFreed, 1, __ATOMIC_RELAXED);
+}
+
+static void onHooksRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    unit_hook_item_t *item;
+    long id;
+
+    if(row)
+    {
+        if(hookPhase == 0)
+        {
+            id = atol(row->value[0]);
+            assert(id % 2 == 1 && id > lastId);
+            assert(strcmp(row->value[1], "odd") == 0 && row->value[2] == NULL);
+            assert(row->user == NULL);
+        }
+        else if((item = (unit_hook_item_t *)row->user) != NULL)
+        {
+            id = item->id;
+            assert(id % 3 == 0 && item->val == id * 10 + 0.5);
+            assert(row->value == NULL || (row->value[0] == NULL && row->value[1] == NULL && row->value[2] == NULL));
+            hookEmitted++;
+        }
+        else
+        {
+            id = atol(row->value[0]);
+            assert(id % 3 != 0 && atof(row->value[2]) == id * 10 + 0.5);
+        }
+
+        assert(id > lastId);
+        lastId = id;
+        rows++;
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS);
+
+    if(hookPhase == 0)
+    {
+        assert(rows == 5000 && op->droppedCount == 5000);
+    }
+    else
+    {
+        assert(rows == 10000 && hookEmitted == 3333 && op->droppedCount == 0);
+    }
+
+    _unit_free_query(op);
+
+    hookPhase++;
+    _hooks_submit();
+}
+
+static void onHooksQuery(odbxuv_op_query_t *op, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+    odbxuv_query_process(op, onHooksRow);
+}
+
+static void _hooks_submit(void)
+{
+    odbxuv_query_config_t config;
+
+    if(hookPhase == 2)
+    {
+        _unit_close();
+        return;
+    }
+
+    memset(&config, 0, sizeof(odbxuv_query_config_t));
+    config.rowHook = hookPhase == 0 ? onHookFilter : onHookEmit;
+    config.rowUserFree = onHookFree;
+
+    rows = 0;
+    lastId = 0;
+
+    assert(_unit_query("SELECT GEN 10000", ODBXUV_QUERY_FETCH_VALUE, &config, onHooksQuery) == ODBX_ERR_SUCCESS);
+}
+
+static void _test_hooks(void)
+{
+    hookPhase = 0;
+    hookEmitted = 0;
+    hookFreed = 0;
+
+    _unit_open(_hooks_submit);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(hookPhase == 2);
+
+    //Every emitted struct was freed, by the worker reusing its row or with the rows of the query
+    assert(__atomic_load_n(&hookFreed, __ATOMIC_RELAXED) == 3333);
+}
+
+/*
+ * Columns: only the selected columns are copied, counting queries deliver no rows.
+ */
+
+static int columnPhase;
+static void _columns_submit(void);
+
+static void onColumnsRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    if(row)
+    {
+        //Counting queries never get here
+        assert(columnPhase == 0);
+
+        assert(row->value[0] == NULL);
+        assert(strncmp(row->value[1], "status", 6) == 0);
+        assert(row->value[2] != NULL && atof(row->value[2]) == (rows + 1) * 10 + 0.5);
+        rows++;
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS);
+
+    switch(columnPhase)
+    {
+        case 0:
+            //The column info is complete
+            assert(rows == 1000 && op->columnCount == 3);
+            assert(strcmp(op->metadata->columns[0].name, "id") == 0);
+            break;
+
+        case 1:
+            assert(rows == 0 && op->rowCount == 5000);
+            break;
+
+        case 2:
+            assert(rows == 0 && op->rowCount == 1000);
+            break;
+    }
+
+    _unit_free_query(op);
+
+    columnPhase++;
+    _columns_submit();
+}
+
+static void onColumnsQuery(odbxuv_op_query_t *op, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+    odbxuv_query_process(op, onColumnsRow);
+}
+
+static void _columns_submit(void)
+{
+    static const unsigned int indexes[] = { 2, 7 };
+    static const char *const names[] = { "status", "missing" };
+    odbxuv_query_config_t config;
+    const char *query;
+
+    memset(&config, 0, sizeof(odbxuv_query_config_t));
+    rows = 0;
+
+    switch(columnPhase)
+    {
+        case 0:
+            //Columns the result does not have are ignored
+            config.selectColumns = indexes;
+            config.selectColumnCount = 2;
+            config.selectNames = names;
+            config.selectNameCount = 2;
+            query = "SELECT GEN 1000";
+            break;
+
+        case 1:
+            config.options = ODBXUV_QUERY_COUNT_ONLY;
+            query = "SELECT GEN 5000";
+            break;
+
+        case 2:
+            config.options = ODBXUV_QUERY_COUNT_ONLY;
+            query = "SELECT GEN 5000 WHERE key > 4000";
+            break;
+
+        default:
+            _unit_close();
+            return;
+    }
+
+    assert(_unit_query(query, ODBXUV_QUERY_FETCH_NAME | ODBXUV_QUERY_FETCH_VALUE, &config, onColumnsQuery) == ODBX_ERR_SUCCESS);
+}
+
+static void _test_columns(void)
+{
+    columnPhase = 0;
+
+    _unit_open(_columns_submit);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(columnPhase == 3);
+
+    //Counted rows are never copied into rows
+    assert(counters.rowsFetched == 1000);
+}
+
+/*
+ * Delivery: the loop hands rows to the fetch callback within a budget and lets the other handles run in between.
+ */
+
+static uv_prepare_t deliveryPrepare;
+static int deliveryPhase;
+static unsigned int deliveredNow;
+static unsigned int deliveryIterations;
+static uint64_t deliveryYields;
+static void _delivery_submit(void);
+
+/**
+ * Runs once per iteration of the loop, before it polls.
+ */
+static void onDeliveryPrepare(uv_prepare_t *handle)
+{
+    deliveredNow = 0;
+    deliveryIterations++;
+}
+
+static void onDeliveryRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    odbxuv_connection_counters_t delivered;
+
+    if(row)
+    {
+        //All rows wait for the loop, the budget alone splits them up
+        if(rows == 0)
+        {
+            _unit_wait_fetched(deliveryPhase == 0 ? 20000 : 22000);
+            deliveryIterations = 0;
+        }
+
+        _unit_check_row(row);
+        deliveredNow++;
+
+        if(deliveryPhase == 0)
+        {
+            assert(deliveredNow <= connection.deliverRows);
+        }
+        else
+        {
+            //A slice takes longer than the time budget, so the loop yields after every one
+            usleep(10);
+            assert(deliveredNow <= connection.notifyRows);
+        }
+
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS);
+    _unit_free_query(op);
+
+    odbxuv_connection_counters(&connection, &delivered);
+
+    if(deliveryPhase == 0)
+    {
+        assert(rows == 20000);
+        assert(delivered.deliveryYields >= 190);
+    }
+    else
+    {
+        assert(rows == 2000);
+        assert(delivered.deliveryYields - deliveryYields >= 6);
+    }
+
+    //The loop went around for every yield
+    assert(deliveryIterations >= delivered.deliveryYields - deliveryYields);
+    deliveryYields = delivered.deliveryYields;
+
+    deliveryPhase++;
+    _delivery_submit();
+}
+
+static void onDeliveryQuery(odbxuv_op_query_t *op, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+    odbxuv_query_process(op, onDeliveryRow);
+}
+
+static void _delivery_submit(void)
+{
+    rows = 0;
+    lastId = 0;
+
+    switch(deliveryPhase)
+    {
+        case 0:
+            connection.deliverRows = 100;
+            assert(_unit_query("SELECT GEN 20000", ODBXUV_QUERY_FETCH_VALUE, NULL, onDeliveryQuery) == ODBX_ERR_SUCCESS);
+            break;
+
+        case 1:
+            connection.deliverRows = 0;
+            connection.deliverTime = 1000;
+            assert(_unit_query("SELECT GEN 2000", ODBXUV_QUERY_FETCH_VALUE, NULL, onDeliveryQuery) == ODBX_ERR_SUCCESS);
+            break;
+
+        default:
+            uv_close((uv_handle_t *)&deliveryPrepare, NULL);
+            _unit_close();
+            break;
+    }
+}
+
+static void _test_delivery(void)
+{
+    deliveryPhase = 0;
+    deliveredNow = 0;
+    deliveryIterations = 0;
+    deliveryYields = 0;
+
+    uv_prepare_init(loop, &deliveryPrepare);
+    uv_prepare_start(&deliveryPrepare, onDeliveryPrepare);
+    uv_unref((uv_handle_t *)&deliveryPrepare);
+
+    _unit_open(_delivery_submit);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(deliveryPhase == 2);
+}
+
+/*
+ * Admission: a full queue rejects queries or sheds the low priority ones.
+ */
+
+static int admissionPhase;
+static int admissionPending;
+static int admissionShed;
+static void _admission_submit(void);
+
+static void _admission_done(odbxuv_op_query_t *op)
+{
+    _unit_free_query(op);
+
+    if(--admissionPending == 0)
+    {
+        admissionPhase++;
+        _admission_submit();
+    }
+}
+
+static void onAdmissionRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    if(row) return;
+
+    assert(status == ODBX_ERR_SUCCESS);
+    _admission_done(op);
+}
+
+static void onAdmissionQuery(odbxuv_op_query_t *op, int status)
+{
+    if(status == ODBXUV_ERR_OVERLOAD)
+    {
+        assert(op->config.options & ODBXUV_QUERY_LOW_PRIORITY);
+        admissionShed++;
+        _admission_done(op);
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS);
+    odbxuv_query_process(op, onAdmissionRow);
+}
+
+/**
+ * Submits a query, returns 0 when it was rejected.
+ */
+static int _admission_query(int lowPriority)
+{
+    odbxuv_query_config_t config;
+    memset(&config, 0, sizeof(odbxuv_query_config_t));
+    config.options = lowPriority ? ODBXUV_QUERY_LOW_PRIORITY : 0;
+
+    int result = _unit_query("SELECT GEN 2000", ODBXUV_QUERY_FETCH_VALUE, &config, onAdmissionQuery);
+    if(result == ODBXUV_ERR_OVERLOAD) return 0;
+
+    assert(result == ODBX_ERR_SUCCESS);
+    admissionPending++;
+    return 1;
+}
+
+static void _admission_submit(void)
+{
+    int rejected = 0;
+    int i;
+
+    switch(admissionPhase)
+    {
+        case 0:
+            connection.admission.maxQueued = 5;
+            connection.admission.policy = ODBXUV_OVERLOAD_REJECT;
+
+            for(i = 0; i < 10; i++)
+            {
+                rejected += !_admission_query(0);
+            }
+
+            //The worker may have taken the first query already
+            assert(rejected >= 4 && rejected <= 5);
+            break;
+
+        case 1:
+            connection.admission.policy = ODBXUV_OVERLOAD_SHED;
+
+            for(i = 0; i < 5; i++)
+            {
+                assert(_admission_query(1));
+            }
+
+            for(i = 0; i < 10; i++)
+            {
+                rejected += !_admission_query(0);
+            }
+
+            assert(rejected >= 4 && rejected <= 6);
+            break;
+
+        default:
+            assert(admissionShed >= 4);
+            _unit_close();
+            break;
+    }
+}
+
+static void _test_admission(void)
+{
+    admissionPhase = 0;
+    admissionPending = 0;
+    admissionShed = 0;
+
+    _unit_open(_admission_submit);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(counters.queriesRejected >= 8);
+    assert(counters.queriesShed == (uint64_t)admissionShed);
+}
+
+/*
+ * Single-flight: identical shared reads run once and are all answered with the same rows.
+ */
+
+#define UNIT_SHARED_QUERIES 8
+
+static long sharedRows[UNIT_SHARED_QUERIES];
+
+static void onSharedRow(odbxuv_op_query_t *op, odbxuv_row_t *row, int status)
+{
+    long index = (long)op->data;
+
+    if(row)
+    {
+        assert(atol(row->value[0]) == sharedRows[index] + 1);
+        sharedRows[index]++;
+        return;
+    }
+
+    assert(status == ODBX_ERR_SUCCESS && sharedRows[index] == 5000);
+    _unit_free_query(op);
+
+    if(++finished == UNIT_SHARED_QUERIES)
+    {
+        _unit_close();
+    }
+}
+
+static void onSharedQuery(odbxuv_op_query_t *op, int status)
+{
+    assert(status == ODBX_ERR_SUCCESS);
+    odbxuv_query_process(op, onSharedRow);
+}
+
+static void _shared_ready(void)
+{
+    odbxuv_query_config_t config;
+    long i;
+
+    memset(&config, 0, sizeof(odbxuv_query_config_t));
+    config.options = ODBXUV_QUERY_SHARED;
+
+    for(i = 0; i < UNIT_SHARED_QUERIES; i++)
+    {
+        odbxuv_op_query_t *op = (odbxuv_op_query_t *)malloc(sizeof(odbxuv_op_query_t));
+        memset(op, 0, sizeof(odbxuv_op_query_t));
+        op->data = (void *)i;
+
+        //Whitespace does not make a query different
+        assert(odbxuv_query_ex(&connection, op, i & 1 ? "SELECT GEN 5000" : "  SELECT\tGEN   5000 ", ODBXUV_QUERY_FETCH_VALUE, &config, onSharedQuery) == ODBX_ERR_SUCCESS);
+    }
+
+    assert(odbxuv_connection_shares(&connection, "SELECT GEN 5000", ODBXUV_QUERY_FETCH_VALUE));
+    assert(!odbxuv_connection_shares(&connection, "SELECT GEN 5000", ODBXUV_QUERY_FETCH_VALUE | ODBXUV_QUERY_FETCH_NAME));
+}
+
+static void _test_shared(void)
+{
+    unsigned long queries = odbx_fake_queries();
+
+    memset(sharedRows, 0, sizeof(sharedRows));
+
+    _unit_open(_shared_ready);
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(counters.queriesShared == UNIT_SHARED_QUERIES - 1);
+    assert(odbx_fake_queries() - queries == 1);
+
+    //Only reads are shared
+    assert(odbxuv_query_classify("SELECT id FROM t") == ODBXUV_STATEMENT_READ);
+    assert(odbxuv_query_classify("/* hint */ WITH a AS (SELECT 1) SELECT * FROM a") == ODBXUV_STATEMENT_READ);
+    assert(odbxuv_query_classify("SELECT id FROM t FOR UPDATE") == ODBXUV_STATEMENT_WRITE);
+    assert(odbxuv_query_classify("SELECT nextval('seq')") == ODBXUV_STATEMENT_WRITE);
+    assert(odbxuv_query_classify("SELECT seq.NEXTVAL FROM dual") == ODBXUV_STATEMENT_WRITE);
+    assert(odbxuv_query_classify("SELECT id FROM t FOR KEY SHARE") == ODBXUV_STATEMENT_WRITE);
+    assert(odbxuv_query_classify("SELECT id FROM t LOCK IN SHARE MODE") == ODBXUV_STATEMENT_WRITE);
+    assert(odbxuv_query_classify("SELECT id INTO copy FROM t") == ODBXUV_STATEMENT_WRITE);
+
+    //The same words naming columns
+    assert(odbxuv_query_classify("SELECT share FROM quotes") == ODBXUV_STATEMENT_READ);
+    assert(odbxuv_query_classify("SELECT q.lock, q.into, nextval FROM quotes q") == ODBXUV_STATEMENT_READ);
+    assert(odbxuv_query_classify("SELECT setval AS into FROM sequences") == ODBXUV_STATEMENT_READ);
+    assert(odbxuv_query_classify("INSERT INTO t VALUES (1)") == ODBXUV_STATEMENT_WRITE);
+    assert(odbxuv_query_classify("BEGIN") == ODBXUV_STATEMENT_BEGIN);
+    assert(odbxuv_query_classify("ROLLBACK TO SAVEPOINT a") == ODBXUV_STATEMENT_WRITE);
+    assert(odbxuv_query_classify("COMMIT") == ODBXUV_STATEMENT_END);
+}
+
+static const unit_test_t tests[] =
+{
+    { "wakeups", _test_wakeups },
+    { "recycle", _test_recycle },
+    { "pool", _test_pool },
+    { "reconnect", _test_reconnect },
+    { "loops", _test_loops },
+    { "router", _test_router },
+    { "stats", _test_stats },
+    { "slowlog", _test_slowlog },
+    { "serializer", _test_serializer },
+    { "spill", _test_spill },
+    { "memory", _test_memory },
+    { "metadata", _test_metadata },
+    { "dictionary", _test_dictionary },
+    { "chunks", _test_chunks },
+    { "cursor", _test_cursor },
+    { "scan", _test_scan },
+    { "aggregate", _test_aggregate },
+    { "hooks", _test_hooks },
+    { "columns", _test_columns },
+    { "delivery", _test_delivery },
+    { "admission", _test_admission },
+    { "shared", _test_shared },
+    { NULL, NULL }
+};
+
+int main(int argc, char **argv)
+{
+    const unit_test_t *test;
+    int ran = 0;
+
+    loop = uv_default_loop();
+
+    for(test = tests; test->name != NULL; test++)
+    {
+        unsigned int leftOpen = 0;
+
+        if(argc > 1 && strcmp(argv[1], test->name) != 0) continue;
+
+        printf("%s\n", test->name);
+        fflush(stdout);
+        memset(&counters, 0, sizeof(odbxuv_connection_counters_t));
+
+        test->run();
+
+        uv_walk(loop, _walk_cb, &leftOpen);
+        assert(leftOpen == 0);
+        assert(odbxuv_memory_used() == 0);
+        assert(odbx_fake_connections() == 0);
+
+        ran++;
+    }
+
+    if(ran == 0)
+    {
+        printf("Unknown test %s\n", argv[1]);
+        return 1;
+    }
+
+    uv_loop_delete(loop);
+    return 0;
+}
@@ -0,0 +1,325 @@
+#include "odbx.h"
+#include "odbx_fake.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * The longest value of a column of a fake row
+ */
+#define FAKE_VALUE_SIZE 32
+
+/**
+ * A connection of the fake backend, used by one worker at a time
+ */
+typedef struct fake_handle_s
+{
+    /**
+     * Set once a query failed, the connection is lost then
+     */
+    int lost;
+
+    /**
+     * Whether the result of the last query was not returned yet
+     */
+    int pending;
+
+    /**
+     * The rows of the last query: the ids up to \p last that match the filter, at most \p limit
+     */
+    long long next;
+    long long last;
+    long long above;
+    long long low;
+    long long high;
+    long long modulo;
+    long long remainder;
+    long long limit;
+    unsigned long columns;
+
+    /**
+     * The rows left in the current chunk, negative when the result is not chunked
+     */
+    long chunkLeft;
+
+    /**
+     * The values of the current row
+     */
+    char values[3][FAKE_VALUE_SIZE];
+} fake_handle_t;
+
+typedef struct fake_result_s
+{
+    fake_handle_t *handle;
+} fake_result_t;
+
+static unsigned int dropQueries = 0;
+static unsigned int failConnects = 0;
+static unsigned long queries = 0;
+static unsigned long connections = 0;
+static unsigned long connects = 0;
+static unsigned long chunks[ODBX_FAKE_CHUNKS];
+static unsigned int chunkCount = 0;
+
+static const char *columnNames[] = { "id", "status", "val" };
+static const int columnTypes[] = { ODBX_TYPE_BIGINT, ODBX_TYPE_VARCHAR, ODBX_TYPE_DOUBLE };
+
+/**
+ * Takes one from \p counter when it is not 0 yet, returns whether it did.
+ */
+static int _fake_take(unsigned int *counter)
+{
+    unsigned int count = __atomic_load_n(counter, __ATOMIC_RELAXED);
+
+    while(count > 0)
+    {
+        if(__atomic_compare_exchange_n(counter, &count, count - 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Reads the number after \p part in \p query or returns \p fallback when \p part is not in it.
+ */
+static long long _fake_number(const char *query, const char *part, long long fallback)
+{
+    const char *found = strstr(query, part);
+
+    return found != NULL ? strtoll(found + strlen(part), NULL, 10) : fallback;
+}
+
+static int _fake_matches(fake_handle_t *handle, long long id)
+{
+    if(id <= handle->above || id < handle->low || id >= handle->high) return 0;
+
+    return handle->modulo == 0 || id % handle->modulo == handle->remainder;
+}
+
+void odbx_fake_drop(unsigned int count)
+{
+    __atomic_store_n(&dropQueries, count, __ATOMIC_RELAXED);
+}
+
+void odbx_fake_fail_connects(unsigned int count)
+{
+    __atomic_store_n(&failConnects, count, __ATOMIC_RELAXED);
+}
+
+unsigned long odbx_fake_queries(void)
+{
+    return __atomic_load_n(&queries, __ATOMIC_RELAXED);
+}
+
+unsigned long odbx_fake_connections(void)
+{
+    return __atomic_load_n(&connections, __ATOMIC_RELAXED);
+}
+
+unsigned long odbx_fake_connects(void)
+{
+    return __atomic_load_n(&connects, __ATOMIC_RELAXED);
+}
+
+unsigned int odbx_fake_chunks(unsigned long *sizes, unsigned int max)
+{
+    unsigned int count = __atomic_exchange_n(&chunkCount, 0, __ATOMIC_RELAXED);
+
+    if(count > ODBX_FAKE_CHUNKS) count = ODBX_FAKE_CHUNKS;
+    if(count > max) count = max;
+
+    memcpy(sizes, chunks, sizeof(unsigned long) * count);
+
+    return count;
+}
+
+int odbx_init(odbx_t **handle, const char *backend, const char *host, const char *port)
+{
+    if(_fake_take(&failConnects))
+    {
+        *handle = NULL;
+        return -ODBX_ERR_BACKEND;
+    }
+
+    fake_handle_t *fake = malloc(sizeof(fake_handle_t));
+    memset(fake, 0, sizeof(fake_handle_t));
+    *handle = (odbx_t *)fake;
+
+    __atomic_add_fetch(&connections, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&connects, 1, __ATOMIC_RELAXED);
+
+    return ODBX_ERR_SUCCESS;
+}
+
+int odbx_bind(odbx_t *handle, const char *database, const char *who, const char *cred, int method)
+{
+    return ODBX_ERR_SUCCESS;
+}
+
+int odbx_unbind(odbx_t *handle)
+{
+    return ODBX_ERR_SUCCESS;
+}
+
+int odbx_finish(odbx_t *handle)
+{
+    if(handle == NULL) return -ODBX_ERR_HANDLE;
+
+    free(handle);
+    __atomic_sub_fetch(&connections, 1, __ATOMIC_RELAXED);
+
+    return ODBX_ERR_SUCCESS;
+}
+
+const char *odbx_error(odbx_t *handle, int error)
+{
+    return error == -ODBX_ERR_BACKEND ? "Fake backend error" : "Fake error";
+}
+
+int odbx_error_type(odbx_t *handle, int error)
+{
+    //Backend errors lose the connection, anything else can be retried
+    return error == -ODBX_ERR_BACKEND ? -1 : 1;
+}
+
+int odbx_capabilities(odbx_t *handle, unsigned int cap)
+{
+    return cap == ODBX_CAP_BASIC ? ODBX_ENABLE : ODBX_DISABLE;
+}
+
+int odbx_escape(odbx_t *handle, const char *from, unsigned long fromlen, char *to, unsigned long *tolen)
+{
+    unsigned long i;
+    unsigned long length = 0;
+
+    for(i = 0; i < fromlen; i++)
+    {
+        if(from[i] == '\'' || from[i] == '"' || from[i] == '\\') to[length++] = '\\';
+        to[length++] = from[i];
+    }
+
+    to[length] = '\0';
+    *tolen = length;
+
+    return ODBX_ERR_SUCCESS;
+}
+
+int odbx_query(odbx_t *handle, const char *query, unsigned long length)
+{
+    fake_handle_t *fake = (fake_handle_t *)handle;
+
+    __atomic_add_fetch(&queries, 1, __ATOMIC_RELAXED);
+
+    if(fake->lost || _fake_take(&dropQueries) || strstr(query, "FAIL") != NULL)
+    {
+        fake->lost = 1;
+        return -ODBX_ERR_BACKEND;
+    }
+
+    long long sleep = _fake_number(query, "SLEEP ", 0);
+    if(sleep > 0) usleep(sleep * 1000);
+
+    fake->pending = 1;
+    fake->last = _fake_number(query, "GEN ", 0);
+    fake->above = _fake_number(query, " > ", 0);
+    fake->low = _fake_number(query, " >= ", 1);
+    fake->next = fake->low > fake->above ? fake->low : fake->above + 1;
+    fake->high = _fake_number(query, " < ", fake->last + 1);
+    fake->limit = _fake_number(query, "LIMIT ", fake->last);
+    fake->columns = strstr(query, "COLS2") != NULL ? 2 : 3;
+    fake->modulo = 0;
+    fake->remainder = 0;
+
+    const char *mod = strstr(query, "MOD(");
+    if(mod != NULL)
+    {
+        fake->modulo = _fake_number(mod, ", ", 1);
+        fake->remainder = _fake_number(mod, ") = ", 0);
+    }
+
+    return ODBX_ERR_SUCCESS;
+}
+
+int odbx_result(odbx_t *handle, odbx_result_t **result, struct timeval *timeout, unsigned long chunk)
+{
+    fake_handle_t *fake = (fake_handle_t *)handle;
+
+    *result = NULL;
+
+    if(!fake->pending) return ODBX_RES_DONE;
+
+    unsigned int index = __atomic_fetch_add(&chunkCount, 1, __ATOMIC_RELAXED);
+    if(index < ODBX_FAKE_CHUNKS) chunks[index] = chunk;
+
+    //The rows run out while fetching, a chunk ending with the last row is followed by an empty one
+    fake->chunkLeft = chunk > 0 ? (long)chunk : -1;
+
+    fake_result_t *fakeResult = malloc(sizeof(fake_result_t));
+    fakeResult->handle = fake;
+    *result = (odbx_result_t *)fakeResult;
+
+    return ODBX_RES_ROWS;
+}
+
+int odbx_result_finish(odbx_result_t *result)
+{
+    free(result);
+    return ODBX_ERR_SUCCESS;
+}
+
+int odbx_row_fetch(odbx_result_t *result)
+{
+    fake_handle_t *fake = ((fake_result_t *)result)->handle;
+
+    if(fake->chunkLeft == 0) return ODBX_ROW_DONE;
+
+    while(fake->next <= fake->last && !_fake_matches(fake, fake->next)) fake->next++;
+
+    if(fake->next > fake->last || fake->limit == 0)
+    {
+        fake->pending = 0;
+        return ODBX_ROW_DONE;
+    }
+
+    long long id = fake->next++;
+
+    if(fake->chunkLeft > 0) fake->chunkLeft--;
+    fake->limit--;
+
+    snprintf(fake->values[0], FAKE_VALUE_SIZE, "%lld", id);
+    snprintf(fake->values[1], FAKE_VALUE_SIZE, "status%lld", id % 3);
+    snprintf(fake->values[2], FAKE_VALUE_SIZE, "%lld.5", id * 10);
+
+    return ODBX_ROW_NEXT;
+}
+
+uint64_t odbx_rows_affected(odbx_result_t *result)
+{
+    return 0;
+}
+
+unsigned long odbx_column_count(odbx_result_t *result)
+{
+    return ((fake_result_t *)result)->handle->columns;
+}
+
+const char *odbx_column_name(odbx_result_t *result, unsigned long pos)
+{
+    return pos < 3 ? columnNames[pos] : NULL;
+}
+
+int odbx_column_type(odbx_result_t *result, unsigned long pos)
+{
+    return pos < 3 ? columnTypes[pos] : ODBX_TYPE_UNKNOWN;
+}
+
+unsigned long odbx_field_length(odbx_result_t *result, unsigned long pos)
+{
+    return strlen(((fake_result_t *)result)->handle->values[pos]);
+}
+
+const char *odbx_field_value(odbx_result_t *result, unsigned long pos)
+{
+    return ((fake_result_t *)result)->handle->values[pos];
+}
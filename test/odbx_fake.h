@@ -0,0 +1,62 @@
+#ifndef ODBX_FAKE_H
+#define ODBX_FAKE_H
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * In memory OpenDBX backend for the unit tests, linked instead of the OpenDBX library.
+ * Queries are not parsed as SQL, the backend looks for the following parts:
+ *
+ *  - <tt>GEN n</tt>: the rows with id 1 up to n, without it the result has no rows.
+ *    The columns are id (BIGINT), status (VARCHAR, "status" and the id modulo 3) and val (DOUBLE, the id times 10 plus 0.5)
+ *  - <tt>COLS2</tt>: only the id and status columns
+ *  - <tt>key > k</tt>, <tt>key >= a AND key < b</tt> and <tt>MOD(key, n) = i</tt>: only the ids that match
+ *  - <tt>LIMIT n</tt>: at most n rows
+ *  - <tt>SLEEP ms</tt>: the query takes ms milliseconds
+ *  - <tt>FAIL</tt>: the query fails and the connection is lost
+ */
+
+/**
+ * The amount of chunk sizes ::odbx_fake_chunks keeps
+ */
+#define ODBX_FAKE_CHUNKS 256
+
+/**
+ * Lets the next \p count queries fail as if the connection to the database was lost.
+ */
+void odbx_fake_drop(unsigned int count);
+
+/**
+ * Lets the next \p count connection attempts fail.
+ */
+void odbx_fake_fail_connects(unsigned int count);
+
+/**
+ * The amount of queries the backend received.
+ */
+unsigned long odbx_fake_queries(void);
+
+/**
+ * The amount of connections that are open.
+ */
+unsigned long odbx_fake_connections(void);
+
+/**
+ * The amount of connections the backend opened so far.
+ */
+unsigned long odbx_fake_connects(void);
+
+/**
+ * Copies the chunk sizes the results were fetched with since the last call into \p sizes, oldest first.
+ * Returns how many it copied, at most \p max and ::ODBX_FAKE_CHUNKS.
+ */
+unsigned int odbx_fake_chunks(unsigned long *sizes, unsigned int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,286 @@
+#include "odbxuv/coro.hpp"
+#include "odbxuv/rowmap.hpp"
+#include "odbx_fake.h"
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+/**
+ * Tests of the row mapping of odbxuv/rowmap.hpp against the in memory backend of odbx_fake.c.
+ *
+ * Usage: odbxuv_rowmap
+ */
+
+using namespace odbxuv;
+
+/**
+ * The columns of "SELECT GEN n" by name, in another order than the result has them
+ */
+struct Item
+{
+    std::optional<double> val;
+    long long id;
+    std::string status;
+};
+
+template<>
+struct odbxuv::RowDescriptor<Item>
+{
+    static constexpr auto fields = std::make_tuple(field("val", &Item::val), field("id", &Item::id), field("status", &Item::status));
+};
+
+/**
+ * The columns of "SELECT GEN n" by position
+ */
+struct Positional
+{
+    long long id;
+    std::string_view status;
+    double val;
+};
+
+template<>
+struct odbxuv::RowDescriptor<Positional>
+{
+    static constexpr auto fields = std::make_tuple(field("id", &Positional::id), field("status", &Positional::status), field("val", &Positional::val));
+};
+
+/**
+ * A field that can't hold the text of its column
+ */
+struct Mismatch
+{
+    int status;
+};
+
+template<>
+struct odbxuv::RowDescriptor<Mismatch>
+{
+    static constexpr auto fields = std::make_tuple(field("status", &Mismatch::status));
+};
+
+/**
+ * A field that isn't nullable
+ */
+struct Required
+{
+    long long id;
+    double val;
+};
+
+template<>
+struct odbxuv::RowDescriptor<Required>
+{
+    static constexpr auto fields = std::make_tuple(field("id", &Required::id), field("val", &Required::val));
+};
+
+/**
+ * Set once the test coroutine ran to its end
+ */
+static bool completed = false;
+
+static const int byName = ODBXUV_QUERY_FETCH_NAME | ODBXUV_QUERY_FETCH_TYPE | ODBXUV_QUERY_FETCH_VALUE;
+
+static ConnectOptions fakeOptions()
+{
+    ConnectOptions options;
+    options.backend = "fake";
+    options.host = "";
+    options.port = "";
+    options.database = "test";
+    options.user = "test";
+    options.password = "test";
+    return options;
+}
+
+/**
+ * Whether \p call throws a ::odbxuv::MappingError
+ */
+template<typename F>
+static bool throwsMapping(F &&call)
+{
+    try
+    {
+        call();
+    }
+    catch(const MappingError &)
+    {
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Reads every row of \p query, so the connection can run the next one
+ */
+static Task<void> drain(Query &query)
+{
+    //GCC 12 never runs the body when the loop awaits through the parameter itself
+    Query &rest = query;
+
+    while(co_await rest.next())
+    {
+    }
+}
+
+static odbxuv_row_hook_e emitHook(odbxuv_op_query_t *op, unsigned int columnCount, const char **values, unsigned long *lengths, void **user)
+{
+    return ODBXUV_ROW_EMIT;
+}
+
+static Task<void> run(uv_loop_t *loop)
+{
+    Connection connection(loop);
+    co_await connection.connect(fakeOptions());
+
+    //By name, every row of every batch
+    RowMapper<Item> items;
+    const odbxuv_metadata_t *metadata;
+    {
+        Query query = co_await connection.query("SELECT GEN 1000", byName);
+        long long rows = 0;
+
+        while(Result result = co_await query.next())
+        {
+            for(odbxuv_row_t *row : result)
+            {
+                if(!items.bound()) items.bind(query.get());
+
+                Item item = items.decode(row);
+                assert(item.id == ++rows);
+                assert(item.status == "status" + std::to_string(item.id % 3));
+                assert(item.val && *item.val == item.id * 10 + 0.5);
+            }
+        }
+
+        assert(rows == 1000);
+        metadata = query.get()->metadata;
+        assert(metadata != nullptr && metadata->interned);
+    }
+
+    //Rebinding to the interned column info of the connection, then to other columns
+    {
+        Query query = co_await connection.query("SELECT GEN 10", byName);
+        Result result = co_await query.next();
+
+        assert(query.get()->metadata == metadata);
+        items.bind(query.get());
+        assert(items.bound() && items.decode(*result.begin()).id == 1);
+        co_await drain(query);
+
+        Query other = co_await connection.query("SELECT COLS2 GEN 10", byName);
+        co_await other.next();
+
+        assert(throwsMapping([&] { items.bind(other.get()); }));
+        assert(!items.bound());
+        co_await drain(other);
+    }
+
+    //By position without column names
+    {
+        RowMapper<Positional> positional;
+        Query query = co_await connection.query("SELECT GEN 10", ODBXUV_QUERY_FETCH_VALUE);
+        Result result = co_await query.next();
+
+        positional.bind(query.get());
+        Positional first = positional.decode(*result.begin());
+        assert(first.id == 1 && first.status == "status1" && first.val == 10.5);
+        co_await drain(query);
+
+        Query narrow = co_await connection.query("SELECT COLS2 GEN 10", ODBXUV_QUERY_FETCH_VALUE);
+        co_await narrow.next();
+
+        assert(throwsMapping([&] { positional.bind(narrow.get()); }));
+        co_await drain(narrow);
+    }
+
+    //A type mismatch is found by binding with column types, by decoding without them
+    {
+        RowMapper<Mismatch> mismatch;
+        Query typed = co_await connection.query("SELECT GEN 10", byName);
+        co_await typed.next();
+
+        assert(throwsMapping([&] { mismatch.bind(typed.get()); }));
+        co_await drain(typed);
+
+        Query untyped = co_await connection.query("SELECT GEN 10", ODBXUV_QUERY_FETCH_NAME | ODBXUV_QUERY_FETCH_VALUE);
+        Result result = co_await untyped.next();
+
+        mismatch.bind(untyped.get());
+        assert(throwsMapping([&] { mismatch.decode(*result.begin()); }));
+        co_await drain(untyped);
+    }
+
+    //Columns left out are NULL, empty for optionals and an error otherwise
+    {
+        static const char *const names[] = {"id", "status"};
+        odbxuv_query_config_t config;
+
+        memset(&config, 0, sizeof(config));
+        config.selectNames = names;
+        config.selectNameCount = 2;
+
+        Query query = co_await connection.query("SELECT GEN 10", byName, &config);
+        Result result = co_await query.next();
+
+        items.bind(query.get());
+        Item item = items.decode(*result.begin());
+        assert(item.id == 1 && item.status == "status1" && !item.val);
+
+        RowMapper<Required> required;
+        required.bind(query.get());
+        assert(throwsMapping([&] { required.decode(*result.begin()); }));
+        co_await drain(query);
+    }
+
+    //Results without values
+    {
+        odbxuv_query_config_t config;
+
+        Query unfetched = co_await connection.query("SELECT GEN 10", ODBXUV_QUERY_FETCH_NAME | ODBXUV_QUERY_FETCH_TYPE);
+        co_await unfetched.next();
+
+        assert(throwsMapping([&] { items.bind(unfetched.get()); }));
+        assert(!items.bound());
+        co_await drain(unfetched);
+
+        memset(&config, 0, sizeof(config));
+        config.options = ODBXUV_QUERY_COUNT_ONLY;
+
+        Query counted = co_await connection.query("SELECT GEN 10", byName, &config);
+        co_await drain(counted);
+
+        assert(counted.get()->rowCount == 10);
+        assert(throwsMapping([&] { items.bind(counted.get()); }));
+
+        memset(&config, 0, sizeof(config));
+        config.rowHook = emitHook;
+
+        Query emitted = co_await connection.query("SELECT GEN 10", byName, &config);
+        Result result = co_await emitted.next();
+
+        items.bind(emitted.get());
+        assert(throwsMapping([&] { items.decode(*result.begin()); }));
+        co_await drain(emitted);
+    }
+
+    co_await connection.close();
+    completed = true;
+}
+
+int main(int argc, char **argv)
+{
+    uv_loop_t *loop = uv_default_loop();
+
+    spawn(run(loop));
+    uv_run(loop, UV_RUN_DEFAULT);
+
+    assert(completed);
+    assert(odbxuv_memory_used() == 0);
+    assert(odbx_fake_connections() == 0);
+
+    uv_loop_delete(loop);
+    return 0;
+}